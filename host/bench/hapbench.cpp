@@ -0,0 +1,1117 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  hapbench - a scripted HomeKit controller for benchmarking HomeSpan from Linux
+//
+//  Pairs with a HomeSpan device (pair-setup, or a pairing saved by an earlier run), then opens a number of
+//  connections that each run pair-verify and a series of workloads concurrently (GET /accessories,
+//  GET /characteristics, PUT /characteristics, and Event Notifications), and reports the count, mean, p50, p99,
+//  and maximum latency and the throughput of each.
+//
+//  With --spawn, hapbench starts the device itself (normally the hapbench_server sketch) with an empty NVS
+//  directory, and afterwards reports the server's peak memory use along with HomeSpan's own request statistics,
+//  including the heap used by each type of request (this needs a sketch that calls homeSpan.enableStats()).
+//
+//  Run "hapbench --help" for options.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <algorithm>
+
+#include <sodium.h>
+#include <mbedtls/bignum.h>
+#include <mbedtls/sha512.h>
+#include <mbedtls/md.h>
+#include <mbedtls/hkdf.h>
+
+typedef std::vector<uint8_t> bytes_t;
+
+static void fatal(const char *format, ...){
+  va_list args;
+  va_start(args,format);
+  fprintf(stderr,"\n*** ERROR:  ");
+  vfprintf(stderr,format,args);
+  fprintf(stderr,"\n\n");
+  va_end(args);
+  exit(1);
+}
+
+static uint64_t now(){
+  return(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+///////////////////////////////
+//    TLV8 (HAP Chapter 14)  //
+///////////////////////////////
+
+enum {
+  kTLVType_Method=0x00,
+  kTLVType_Identifier=0x01,
+  kTLVType_Salt=0x02,
+  kTLVType_PublicKey=0x03,
+  kTLVType_Proof=0x04,
+  kTLVType_EncryptedData=0x05,
+  kTLVType_State=0x06,
+  kTLVType_Error=0x07,
+  kTLVType_Signature=0x0A
+};
+
+typedef std::map<uint8_t,bytes_t> tlv_t;
+
+static void tlvAdd(bytes_t &out, uint8_t tag, const void *data, size_t len){
+  const uint8_t *p=(const uint8_t *)data;
+  do {                                                  // values longer than 255 bytes are split into consecutive fragments
+    size_t n=std::min(len,(size_t)255);
+    out.push_back(tag);
+    out.push_back(n);
+    out.insert(out.end(),p,p+n);
+    p+=n;
+    len-=n;
+  } while(len);
+}
+
+static void tlvAdd(bytes_t &out, uint8_t tag, const bytes_t &data){
+  tlvAdd(out,tag,data.data(),data.size());
+}
+
+static void tlvAdd(bytes_t &out, uint8_t tag, uint8_t val){
+  tlvAdd(out,tag,&val,1);
+}
+
+static tlv_t tlvParse(const bytes_t &in){
+  tlv_t tlv;
+  int lastTag=-1;
+  size_t lastLen=0;
+  for(size_t i=0;i+2<=in.size() && i+2+in[i+1]<=in.size();i+=2+in[i+1]){
+    uint8_t tag=in[i];
+    if(tag!=lastTag || lastLen!=255)                    // not a continuation fragment
+      tlv[tag].clear();
+    tlv[tag].insert(tlv[tag].end(),in.begin()+i+2,in.begin()+i+2+in[i+1]);
+    lastTag=tag;
+    lastLen=in[i+1];
+  }
+  return(tlv);
+}
+
+///////////////////////////////
+//        Cryptography       //
+///////////////////////////////
+
+static bytes_t sha512(const bytes_t &data){
+  bytes_t hash(64);
+  mbedtls_sha512_ret(data.data(),data.size(),hash.data(),0);
+  return(hash);
+}
+
+static bytes_t hkdf(const uint8_t *key, size_t keyLen, const char *salt, const char *info){
+  bytes_t out(32);
+  mbedtls_hkdf(mbedtls_md_info_from_type(MBEDTLS_MD_SHA512),(const uint8_t *)salt,strlen(salt),key,keyLen,(const uint8_t *)info,strlen(info),out.data(),out.size());
+  return(out);
+}
+
+static void makeNonce(uint8_t *nonce, const char *label){          // nonces used for pairing are 4 zero bytes followed by an 8-character label
+  memset(nonce,0,4);
+  memcpy(nonce+4,label,8);
+}
+
+static void makeNonce(uint8_t *nonce, uint64_t count){             // nonces used for sessions are 4 zero bytes followed by a 64-bit little-endian counter
+  memset(nonce,0,4);
+  for(int i=0;i<8;i++)
+    nonce[4+i]=count>>(8*i);
+}
+
+static bytes_t encrypt(const bytes_t &key, const uint8_t *nonce, const bytes_t &plain){
+  bytes_t out(plain.size()+16);
+  unsigned long long len;
+  crypto_aead_chacha20poly1305_ietf_encrypt(out.data(),&len,plain.data(),plain.size(),NULL,0,NULL,nonce,key.data());
+  return(out);
+}
+
+static bool decrypt(const bytes_t &key, const uint8_t *nonce, const bytes_t &cipher, bytes_t &plain){
+  if(cipher.size()<16)
+    return(false);
+  plain.resize(cipher.size()-16);
+  unsigned long long len;
+  return(crypto_aead_chacha20poly1305_ietf_decrypt(plain.data(),&len,NULL,cipher.data(),cipher.size(),NULL,0,nonce,key.data())==0);
+}
+
+static void append(bytes_t &out, const void *data, size_t len){
+  out.insert(out.end(),(const uint8_t *)data,(const uint8_t *)data+len);
+}
+
+static void append(bytes_t &out, const bytes_t &data){
+  out.insert(out.end(),data.begin(),data.end());
+}
+
+// SRP-6a client (3072-bit group, SHA-512, g=5), mirroring the server-side calculations in src/SRP.cpp
+
+class SRPClient {
+
+  mbedtls_mpi N, g, k, a, A, B, s, x, u, S, t1, t2, t3, rr;
+
+  static bytes_t write(const mbedtls_mpi *m, size_t len=0){      // len=0 writes the minimum number of bytes (no padding)
+    bytes_t out(len?len:mbedtls_mpi_size(m));
+    mbedtls_mpi_write_binary(m,out.data(),out.size());
+    return(out);
+  }
+
+  public:
+
+  bytes_t K;                                            // shared secret (64 bytes)
+  bytes_t M1;                                           // client proof
+  bytes_t M2;                                           // expected server proof
+
+  SRPClient(){
+    for(auto m : {&N,&g,&k,&a,&A,&B,&s,&x,&u,&S,&t1,&t2,&t3,&rr})
+      mbedtls_mpi_init(m);
+    mbedtls_mpi_read_string(&N,16,"FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+               "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+               "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+               "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+               "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+               "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+               "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+               "3995497CEA956AE515D2261898FA051015728E5A8AAAC42DAD33170D04507A33"
+               "A85521ABDF1CBA64ECFB850458DBEF0A8AEA71575D060C7DB3970F85A6E1E4C7"
+               "ABF5AE8CDB0933D71E8C94E04A25619DCEE3D2261AD2EE6BF12FFA06D98A0864"
+               "D87602733EC86A64521F2B18177B200CBBE117577A615D6C770988C0BAD946E2"
+               "08E24FA074E5AB3143DB5BFCE0FD108E4B82D120A93AD2CAFFFFFFFFFFFFFFFF");
+    mbedtls_mpi_lset(&g,5);
+
+    bytes_t buf=write(&N,384);                          // k = H( N | PAD(g) )
+    append(buf,write(&g,384));
+    bytes_t hash=sha512(buf);
+    mbedtls_mpi_read_binary(&k,hash.data(),hash.size());
+  }
+
+  ~SRPClient(){
+    for(auto m : {&N,&g,&k,&a,&A,&B,&s,&x,&u,&S,&t1,&t2,&t3,&rr})
+      mbedtls_mpi_free(m);
+  }
+
+  bytes_t publicKey(){                                  // creates private key a and returns A = g^a % N
+    uint8_t priv[32];
+    randombytes_buf(priv,sizeof(priv));
+    mbedtls_mpi_read_binary(&a,priv,sizeof(priv));
+    mbedtls_mpi_exp_mod(&A,&g,&a,&N,&rr);
+    return(write(&A,384));
+  }
+
+  void computeProof(const char *setupCode, const bytes_t &salt, const bytes_t &serverKey){
+    mbedtls_mpi_read_binary(&s,salt.data(),salt.size());
+    mbedtls_mpi_read_binary(&B,serverKey.data(),serverKey.size());
+
+    char icp[32];                                       // x = H( s | H( I | ":" | P ) )
+    snprintf(icp,sizeof(icp),"Pair-Setup:%.3s-%.2s-%.3s",setupCode,setupCode+3,setupCode+5);
+    bytes_t buf=write(&s,16);
+    append(buf,sha512(bytes_t(icp,icp+strlen(icp))));
+    bytes_t hash=sha512(buf);
+    mbedtls_mpi_read_binary(&x,hash.data(),hash.size());
+
+    buf=write(&A,384);                                  // u = H( PAD(A) | PAD(B) )
+    append(buf,write(&B,384));
+    hash=sha512(buf);
+    mbedtls_mpi_read_binary(&u,hash.data(),hash.size());
+
+    mbedtls_mpi_exp_mod(&t1,&g,&x,&N,&rr);              // S = ( B - k*g^x ) ^ ( a + u*x ) % N
+    mbedtls_mpi_mul_mpi(&t2,&k,&t1);
+    mbedtls_mpi_sub_mpi(&t3,&B,&t2);
+    mbedtls_mpi_mod_mpi(&t1,&t3,&N);
+    mbedtls_mpi_mul_mpi(&t2,&u,&x);
+    mbedtls_mpi_add_mpi(&t3,&a,&t2);
+    mbedtls_mpi_exp_mod(&S,&t1,&t3,&N,&rr);
+    K=sha512(write(&S,384));                            // K = H( S )
+
+    bytes_t hN=sha512(write(&N,384));                   // M1 = H( H(N) xor H(g) | H(I) | s | A | B | K )
+    bytes_t hg=sha512(bytes_t(1,5));
+    for(int i=0;i<64;i++)
+      hg[i]^=hN[i];
+    buf=hg;
+    append(buf,sha512(bytes_t({'P','a','i','r','-','S','e','t','u','p'})));
+    append(buf,write(&s,16));
+    append(buf,write(&A));
+    append(buf,write(&B));
+    append(buf,K);
+    M1=sha512(buf);
+
+    buf=write(&A,384);                                  // M2 = H( PAD(A) | M1 | K )
+    append(buf,M1);
+    append(buf,K);
+    M2=sha512(buf);
+  }
+};
+
+///////////////////////////////
+//       HAP Connection      //
+///////////////////////////////
+
+struct Message {
+  bool event=false;                                     // true for EVENT/1.0 messages, false for HTTP/1.1 responses
+  int status=0;
+  std::string body;
+};
+
+class Connection {
+
+  int fd=-1;
+  bool encrypted=false;
+  bytes_t writeKey, readKey;
+  uint64_t writeCount=0, readCount=0;
+  bytes_t received;                                     // bytes received but not yet decrypted (encrypted sessions only)
+  std::string plain;                                    // plaintext received but not yet returned as a Message
+
+  bool parseMessage(Message &msg){
+    size_t end=plain.find("\r\n\r\n");
+    if(end==std::string::npos)
+      return(false);
+    size_t len=0;
+    size_t p=plain.find("Content-Length: ");
+    if(p!=std::string::npos && p<end)
+      len=atoi(plain.c_str()+p+16);
+    if(plain.size()<end+4+len)
+      return(false);
+    msg.event=plain.compare(0,6,"EVENT/")==0;
+    size_t sp=plain.find(' ');
+    msg.status=(sp!=std::string::npos && sp<end)?atoi(plain.c_str()+sp+1):0;
+    msg.body=plain.substr(end+4,len);
+    plain.erase(0,end+4+len);
+    return(true);
+  }
+
+  public:
+
+  std::string error;                                    // description of the last error
+
+  ~Connection(){close();}
+
+  bool open(const char *host, uint16_t port){
+    close();
+    struct addrinfo hints={}, *res;
+    hints.ai_family=AF_INET;
+    hints.ai_socktype=SOCK_STREAM;
+    char service[8];
+    sprintf(service,"%u",port);
+    if(getaddrinfo(host,service,&hints,&res)){
+      error="can't resolve host";
+      return(false);
+    }
+    fd=socket(AF_INET,SOCK_STREAM,0);
+    int ok=(fd>=0 && connect(fd,res->ai_addr,res->ai_addrlen)==0);
+    freeaddrinfo(res);
+    if(!ok){
+      error=std::string("can't connect: ")+strerror(errno);
+      close();
+      return(false);
+    }
+    int on=1;
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+    return(true);
+  }
+
+  void close(){
+    if(fd>=0)
+      ::close(fd);
+    fd=-1;
+    encrypted=false;
+    writeCount=readCount=0;
+    received.clear();
+    plain.clear();
+  }
+
+  void startSession(const bytes_t &wKey, const bytes_t &rKey){
+    writeKey=wKey;
+    readKey=rKey;
+    writeCount=readCount=0;
+    encrypted=true;
+  }
+
+  bool send(const std::string &request){
+    bytes_t out;
+    if(!encrypted){
+      out.assign(request.begin(),request.end());
+    } else {
+      for(size_t i=0;i<request.size();i+=1024){         // split into frames of at most 1024 bytes, each with a 2-byte length as AAD
+        size_t n=std::min(request.size()-i,(size_t)1024);
+        uint8_t aad[2]={(uint8_t)(n&0xFF),(uint8_t)(n>>8)};
+        uint8_t nonce[12];
+        makeNonce(nonce,writeCount++);
+        bytes_t frame(n+16);
+        unsigned long long len;
+        crypto_aead_chacha20poly1305_ietf_encrypt(frame.data(),&len,(const uint8_t *)request.data()+i,n,aad,2,NULL,nonce,writeKey.data());
+        append(out,aad,2);
+        append(out,frame);
+      }
+    }
+    for(size_t sent=0;sent<out.size();){
+      ssize_t n=::send(fd,out.data()+sent,out.size()-sent,MSG_NOSIGNAL);
+      if(n<=0){
+        error="connection closed while sending";
+        return(false);
+      }
+      sent+=n;
+    }
+    return(true);
+  }
+
+  bool request(const char *method, const std::string &path, const char *contentType=NULL, const std::string &body=""){
+    std::string req=std::string(method)+" "+path+" HTTP/1.1\r\nHost: hapbench\r\n";
+    if(contentType)
+      req+=std::string("Content-Type: ")+contentType+"\r\nContent-Length: "+std::to_string(body.size())+"\r\n";
+    return(send(req+"\r\n"+body));
+  }
+
+  bool receive(Message &msg, int timeoutMs=10000){
+    uint64_t deadline=now()+timeoutMs*1000ULL;
+    while(!parseMessage(msg)){
+      int wait=(int)((deadline-std::min(deadline,now()))/1000);
+      struct pollfd pfd={fd,POLLIN,0};
+      if(wait<=0 || poll(&pfd,1,wait)<=0){
+        error="timed out waiting for response";
+        return(false);
+      }
+      uint8_t buf[4096];
+      ssize_t n=recv(fd,buf,sizeof(buf),0);
+      if(n<=0){
+        error="connection closed by device";
+        return(false);
+      }
+      if(!encrypted){
+        plain.append((char *)buf,n);
+        continue;
+      }
+      append(received,buf,n);
+      while(received.size()>=2){
+        size_t len=received[0]+received[1]*256;
+        if(received.size()<2+len+16)
+          break;
+        uint8_t nonce[12];
+        makeNonce(nonce,readCount++);
+        std::string frame(len,'\0');
+        unsigned long long outLen;
+        if(crypto_aead_chacha20poly1305_ietf_decrypt((uint8_t *)&frame[0],&outLen,NULL,received.data()+2,len+16,received.data(),2,nonce,readKey.data())){
+          error="can't decrypt frame";
+          return(false);
+        }
+        plain+=frame;
+        received.erase(received.begin(),received.begin()+2+len+16);
+      }
+    }
+    return(true);
+  }
+
+  bool tlvExchange(const char *path, const bytes_t &tlvOut, tlv_t &tlvIn, int expectedState){
+    Message msg;
+    if(!request("POST",path,"application/pairing+tlv8",std::string(tlvOut.begin(),tlvOut.end())) || !receive(msg))
+      return(false);
+    if(msg.status!=200){
+      error="HTTP status "+std::to_string(msg.status);
+      return(false);
+    }
+    tlvIn=tlvParse(bytes_t(msg.body.begin(),msg.body.end()));
+    if(tlvIn.count(kTLVType_Error)){
+      error="pairing error "+std::to_string(tlvIn[kTLVType_Error].empty()?0:tlvIn[kTLVType_Error][0])+" at M"+std::to_string(expectedState);
+      return(false);
+    }
+    if(!tlvIn.count(kTLVType_State) || tlvIn[kTLVType_State].empty() || tlvIn[kTLVType_State][0]!=expectedState){
+      error="unexpected pairing state (expected M"+std::to_string(expectedState)+")";
+      return(false);
+    }
+    return(true);
+  }
+};
+
+///////////////////////////////
+//          Pairing          //
+///////////////////////////////
+
+struct Pairing {
+  std::string id;                                       // controller's pairing ID (36-character UUID)
+  uint8_t ltpk[32];                                     // controller's long-term Ed25519 public key
+  uint8_t ltsk[64];                                     // controller's long-term Ed25519 secret key
+  std::string accessoryID;                              // accessory's pairing ID, and long-term public key (saved by pair-setup)
+  uint8_t accessoryLTPK[32];
+  bool paired=false;
+
+  void create(){
+    uint8_t uuid[16];
+    randombytes_buf(uuid,sizeof(uuid));
+    char buf[37];
+    sprintf(buf,"%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",uuid[0],uuid[1],uuid[2],uuid[3],uuid[4],uuid[5],uuid[6],uuid[7],
+            uuid[8],uuid[9],uuid[10],uuid[11],uuid[12],uuid[13],uuid[14],uuid[15]);
+    id=buf;
+    crypto_sign_keypair(ltpk,ltsk);
+  }
+
+  static std::string hex(const uint8_t *p, size_t n){
+    std::string s;
+    char buf[3];
+    for(size_t i=0;i<n;i++){
+      sprintf(buf,"%02X",p[i]);
+      s+=buf;
+    }
+    return(s);
+  }
+
+  static bool unhex(const char *s, uint8_t *p, size_t n){
+    if(strlen(s)<2*n)
+      return(false);
+    for(size_t i=0;i<n;i++)
+      if(sscanf(s+2*i,"%2hhx",p+i)!=1)
+        return(false);
+    return(true);
+  }
+
+  bool load(const char *file){                          // file format: one line each for id, ltsk (which includes ltpk), accessoryID, accessoryLTPK
+    FILE *f=fopen(file,"r");
+    if(!f)
+      return(false);
+    char line[4][256];
+    bool ok=true;
+    for(int i=0;i<4 && ok;i++)
+      ok=(fscanf(f,"%255s",line[i])==1);
+    fclose(f);
+    if(!ok || !unhex(line[1],ltsk,64) || !unhex(line[3],accessoryLTPK,32))
+      return(false);
+    id=line[0];
+    memcpy(ltpk,ltsk+32,32);
+    accessoryID=line[2];
+    paired=true;
+    return(true);
+  }
+
+  void save(const char *file){
+    FILE *f=fopen(file,"w");
+    if(!f)
+      fatal("Can't write pairing file %s",file);
+    fprintf(f,"%s\n%s\n%s\n%s\n",id.c_str(),hex(ltsk,64).c_str(),accessoryID.c_str(),hex(accessoryLTPK,32).c_str());
+    fclose(f);
+  }
+};
+
+static bool pairSetup(Connection &con, const char *setupCode, Pairing &pairing){
+
+  SRPClient srp;
+  tlv_t in;
+  bytes_t out;
+
+  tlvAdd(out,kTLVType_State,1);                         // M1: SRP Start Request
+  tlvAdd(out,kTLVType_Method,0);
+  if(!con.tlvExchange("/pair-setup",out,in,2))
+    return(false);
+
+  out.clear();                                          // M3: SRP Verify Request
+  tlvAdd(out,kTLVType_State,3);
+  tlvAdd(out,kTLVType_PublicKey,srp.publicKey());
+  srp.computeProof(setupCode,in[kTLVType_Salt],in[kTLVType_PublicKey]);
+  tlvAdd(out,kTLVType_Proof,srp.M1);
+  if(!con.tlvExchange("/pair-setup",out,in,4))
+    return(false);
+  if(in[kTLVType_Proof]!=srp.M2){
+    con.error="accessory's SRP proof is invalid";
+    return(false);
+  }
+
+  pairing.create();                                     // M5: Exchange Request
+
+  bytes_t info=hkdf(srp.K.data(),64,"Pair-Setup-Controller-Sign-Salt","Pair-Setup-Controller-Sign-Info");
+  append(info,pairing.id.data(),pairing.id.size());
+  append(info,pairing.ltpk,32);
+  uint8_t sig[64];
+  crypto_sign_detached(sig,NULL,info.data(),info.size(),pairing.ltsk);
+
+  bytes_t sub;
+  tlvAdd(sub,kTLVType_Identifier,pairing.id.data(),pairing.id.size());
+  tlvAdd(sub,kTLVType_PublicKey,pairing.ltpk,32);
+  tlvAdd(sub,kTLVType_Signature,sig,64);
+
+  bytes_t sessionKey=hkdf(srp.K.data(),64,"Pair-Setup-Encrypt-Salt","Pair-Setup-Encrypt-Info");
+  uint8_t nonce[12];
+  makeNonce(nonce,"PS-Msg05");
+  out.clear();
+  tlvAdd(out,kTLVType_State,5);
+  tlvAdd(out,kTLVType_EncryptedData,encrypt(sessionKey,nonce,sub));
+  if(!con.tlvExchange("/pair-setup",out,in,6))
+    return(false);
+
+  makeNonce(nonce,"PS-Msg06");                          // M6: Exchange Response - verify accessory's signature
+  if(!decrypt(sessionKey,nonce,in[kTLVType_EncryptedData],sub)){
+    con.error="can't decrypt pair-setup M6";
+    return(false);
+  }
+  tlv_t acc=tlvParse(sub);
+  if(acc[kTLVType_PublicKey].size()!=32 || acc[kTLVType_Signature].size()!=64){
+    con.error="bad pair-setup M6";
+    return(false);
+  }
+  pairing.accessoryID.assign(acc[kTLVType_Identifier].begin(),acc[kTLVType_Identifier].end());
+  memcpy(pairing.accessoryLTPK,acc[kTLVType_PublicKey].data(),32);
+
+  info=hkdf(srp.K.data(),64,"Pair-Setup-Accessory-Sign-Salt","Pair-Setup-Accessory-Sign-Info");
+  append(info,acc[kTLVType_Identifier]);
+  append(info,pairing.accessoryLTPK,32);
+  if(crypto_sign_verify_detached(acc[kTLVType_Signature].data(),info.data(),info.size(),pairing.accessoryLTPK)){
+    con.error="accessory's pair-setup signature is invalid";
+    return(false);
+  }
+
+  pairing.paired=true;
+  return(true);
+}
+
+static bool pairVerify(Connection &con, const Pairing &pairing){
+
+  uint8_t pk[32], sk[32];
+  crypto_box_keypair(pk,sk);
+
+  tlv_t in;
+  bytes_t out;
+  tlvAdd(out,kTLVType_State,1);                         // M1: Verify Start Request
+  tlvAdd(out,kTLVType_PublicKey,pk,32);
+  if(!con.tlvExchange("/pair-verify",out,in,2))
+    return(false);
+
+  bytes_t accPK=in[kTLVType_PublicKey];                 // M2: Verify Start Response - verify accessory's signature
+  uint8_t shared[32];
+  if(accPK.size()!=32 || crypto_scalarmult_curve25519(shared,sk,accPK.data())){
+    con.error="bad pair-verify M2";
+    return(false);
+  }
+  bytes_t sessionKey=hkdf(shared,32,"Pair-Verify-Encrypt-Salt","Pair-Verify-Encrypt-Info");
+  uint8_t nonce[12];
+  makeNonce(nonce,"PV-Msg02");
+  bytes_t sub;
+  if(!decrypt(sessionKey,nonce,in[kTLVType_EncryptedData],sub)){
+    con.error="can't decrypt pair-verify M2";
+    return(false);
+  }
+  tlv_t acc=tlvParse(sub);
+  bytes_t info=accPK;
+  append(info,acc[kTLVType_Identifier]);
+  append(info,pk,32);
+  if(acc[kTLVType_Signature].size()!=64 || crypto_sign_verify_detached(acc[kTLVType_Signature].data(),info.data(),info.size(),pairing.accessoryLTPK)){
+    con.error="accessory's pair-verify signature is invalid";
+    return(false);
+  }
+
+  info.assign(pk,pk+32);                                // M3: Verify Finish Request
+  append(info,pairing.id.data(),pairing.id.size());
+  append(info,accPK);
+  uint8_t sig[64];
+  crypto_sign_detached(sig,NULL,info.data(),info.size(),pairing.ltsk);
+  sub.clear();
+  tlvAdd(sub,kTLVType_Identifier,pairing.id.data(),pairing.id.size());
+  tlvAdd(sub,kTLVType_Signature,sig,64);
+  makeNonce(nonce,"PV-Msg03");
+  out.clear();
+  tlvAdd(out,kTLVType_State,3);
+  tlvAdd(out,kTLVType_EncryptedData,encrypt(sessionKey,nonce,sub));
+  if(!con.tlvExchange("/pair-verify",out,in,4))
+    return(false);
+
+  con.startSession(hkdf(shared,32,"Control-Salt","Control-Write-Encryption-Key"),hkdf(shared,32,"Control-Salt","Control-Read-Encryption-Key"));
+  return(true);
+}
+
+///////////////////////////////
+//         Statistics        //
+///////////////////////////////
+
+struct Stats {
+  const char *name;
+  std::mutex mutex;
+  std::vector<uint32_t> latency;                        // in microseconds
+  uint64_t startTime=0, endTime=0;
+  int errors=0;
+
+  Stats(const char *name) : name{name} {}
+
+  void add(uint32_t t){
+    std::lock_guard<std::mutex> lock(mutex);
+    latency.push_back(t);
+  }
+
+  void fail(const std::string &error){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!errors++)
+      fprintf(stderr,"%s: %s\n",name,error.c_str());
+  }
+
+  uint32_t percentile(int p){
+    size_t i=(latency.size()*p+99)/100;                 // nearest-rank method
+    return(latency[i?i-1:0]);
+  }
+
+  void print(){
+    if(latency.empty() && !errors)
+      return;
+    std::sort(latency.begin(),latency.end());
+    uint64_t total=0;
+    for(auto t : latency)
+      total+=t;
+    double elapsed=(endTime-startTime)/1.0e6;
+    if(latency.empty())
+      printf("%-22s  %8d  %10s  %10s  %10s  %10s  %10s  %6d\n",name,0,"-","-","-","-","-",errors);
+    else
+      printf("%-22s  %8zu  %10u  %10u  %10u  %10u  %10.1f  %6d\n",name,latency.size(),(uint32_t)(total/latency.size()),percentile(50),percentile(99),latency.back(),
+             elapsed>0?latency.size()/elapsed:0,errors);
+  }
+};
+
+static void printHeader(){
+  char d[]="------------------------------";
+  printf("%-22s  %8s  %10s  %10s  %10s  %10s  %10s  %6s\n","Workload","Count","Mean (us)","p50 (us)","p99 (us)","Max (us)","Req/sec","Errors");
+  printf("%.22s  %.8s  %.10s  %.10s  %.10s  %.10s  %.10s  %.6s\n",d,d,d,d,d,d,d,d);
+}
+
+// Runs fn(i) for each connection i in its own thread, all starting together, and records the elapsed time in stats
+
+template <class F> void runConcurrently(int nConnections, Stats &stats, F fn){
+  std::vector<std::thread> threads;
+  stats.startTime=now();
+  for(int i=0;i<nConnections;i++)
+    threads.emplace_back(fn,i);
+  for(auto &t : threads)
+    t.join();
+  stats.endTime=now();
+}
+
+///////////////////////////////
+//         Spawned Device    //
+///////////////////////////////
+
+struct Device {
+  pid_t pid=-1;
+  int toDevice=-1;                                      // device's stdin
+  std::string nvsDir;
+  std::thread reader;
+  std::mutex mutex;
+  std::string output;                                   // everything the device has written to stdout
+  bool verbose=false;
+
+  void start(const char *path, uint16_t port, int nAccessories, bool multiCore){
+    char dir[]="/tmp/hapbench-XXXXXX";
+    if(!mkdtemp(dir))
+      fatal("Can't create temporary NVS directory");
+    nvsDir=dir;
+
+    int in[2], out[2];
+    if(pipe(in) || pipe(out))
+      fatal("Can't create pipes");
+
+    pid=fork();
+    if(pid<0)
+      fatal("Can't fork");
+
+    if(pid==0){
+      dup2(in[0],STDIN_FILENO);
+      dup2(out[1],STDOUT_FILENO);
+      ::close(in[1]);
+      ::close(out[0]);
+      setenv("HOMESPAN_PORT",std::to_string(port).c_str(),1);
+      setenv("HOMESPAN_NVS_DIR",nvsDir.c_str(),1);
+      setenv("HAPBENCH_ACCESSORIES",std::to_string(nAccessories).c_str(),1);
+      if(multiCore)
+        setenv("HAPBENCH_MULTICORE","1",1);
+      execl(path,path,(char *)NULL);
+      fprintf(stderr,"\n*** ERROR:  Can't run %s: %s\n\n",path,strerror(errno));
+      _exit(1);
+    }
+
+    ::close(in[0]);
+    ::close(out[1]);
+    toDevice=in[1];
+    int fromDevice=out[0];
+    reader=std::thread([this,fromDevice](){
+      char buf[4096];
+      ssize_t n;
+      while((n=read(fromDevice,buf,sizeof(buf)))>0){
+        std::lock_guard<std::mutex> lock(mutex);
+        output.append(buf,n);
+        if(verbose)
+          fwrite(buf,1,n,stderr);
+      }
+      ::close(fromDevice);
+    });
+  }
+
+  std::string command(const char *cmd, const char *endMarker, int timeoutMs=5000){   // sends a CLI command and returns its output (up to endMarker)
+    size_t start;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      start=output.size();
+    }
+    std::string line=std::string(cmd)+"\n";
+    if(write(toDevice,line.data(),line.size())!=(ssize_t)line.size())
+      return("");
+    for(int t=0;t<timeoutMs;t+=10){
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t end=output.find(endMarker,start);
+        if(end!=std::string::npos)
+          return(output.substr(start,end+strlen(endMarker)-start));
+      }
+      usleep(10000);
+    }
+    return("");
+  }
+
+  long peakMemory(){                                    // returns peak resident memory (VmHWM) of the device in kB
+    FILE *f=fopen(("/proc/"+std::to_string(pid)+"/status").c_str(),"r");
+    if(!f)
+      return(-1);
+    char line[256];
+    long kb=-1;
+    while(fgets(line,sizeof(line),f))
+      if(sscanf(line,"VmHWM: %ld",&kb)==1)
+        break;
+    fclose(f);
+    return(kb);
+  }
+
+  void stop(){
+    if(pid<=0)
+      return;
+    kill(pid,SIGTERM);
+    waitpid(pid,NULL,0);
+    ::close(toDevice);
+    reader.join();
+    pid=-1;
+
+    if(DIR *dir=opendir(nvsDir.c_str())){
+      while(struct dirent *e=readdir(dir))
+        if(e->d_name[0]!='.')
+          unlink((nvsDir+"/"+e->d_name).c_str());
+      closedir(dir);
+    }
+    rmdir(nvsDir.c_str());
+  }
+};
+
+///////////////////////////////
+//           Main            //
+///////////////////////////////
+
+struct Target {
+  uint32_t aid;
+  int iid;                                              // iid of On Characteristic
+};
+
+static void usage(){
+  printf("Usage: hapbench [options]\n\n"
+         "  -H, --host HOST         device address (default 127.0.0.1)\n"
+         "  -p, --port PORT         device port (default 8080)\n"
+         "  -s, --code CODE         8-digit setup code (default 46637726)\n"
+         "  -c, --connections N     number of concurrent connections (default 4, at most the device's connection limit)\n"
+         "  -n, --requests N        requests per connection in each workload (default 100)\n"
+         "  -v, --verifies N        pair-verify handshakes per connection (default 5)\n"
+         "  -f, --pairing FILE      load the controller pairing from FILE if it exists, else pair and save it to FILE\n"
+         "  -S, --spawn PATH        run the device sketch at PATH (e.g. hapbench_server) with empty NVS, and report\n"
+         "                          its peak memory and HomeSpan's request statistics afterwards\n"
+         "  -a, --accessories N     number of Accessories created by a spawned hapbench_server (default 8)\n"
+         "  -m, --multicore         run a spawned hapbench_server with HAP I/O in a separate task\n"
+         "  -V, --verbose           copy a spawned device's output to stderr\n"
+         "  -h, --help              show this help\n");
+}
+
+int main(int argc, char *argv[]){
+
+  const char *host="127.0.0.1";
+  uint16_t port=8080;
+  std::string setupCode="46637726";
+  int nConnections=4;
+  int nRequests=100;
+  int nVerifies=5;
+  const char *pairingFile=NULL;
+  const char *spawnPath=NULL;
+  int nAccessories=8;
+  bool multiCore=false;
+  bool verbose=false;
+
+  static struct option options[]={
+    {"host",required_argument,NULL,'H'}, {"port",required_argument,NULL,'p'}, {"code",required_argument,NULL,'s'},
+    {"connections",required_argument,NULL,'c'}, {"requests",required_argument,NULL,'n'}, {"verifies",required_argument,NULL,'v'},
+    {"pairing",required_argument,NULL,'f'}, {"spawn",required_argument,NULL,'S'}, {"accessories",required_argument,NULL,'a'},
+    {"multicore",no_argument,NULL,'m'}, {"verbose",no_argument,NULL,'V'}, {"help",no_argument,NULL,'h'}, {NULL,0,NULL,0}
+  };
+
+  int opt;
+  while((opt=getopt_long(argc,argv,"H:p:s:c:n:v:f:S:a:mVh",options,NULL))!=-1){
+    switch(opt){
+      case 'H': host=optarg; break;
+      case 'p': port=atoi(optarg); break;
+      case 's': setupCode=optarg; break;
+      case 'c': nConnections=atoi(optarg); break;
+      case 'n': nRequests=atoi(optarg); break;
+      case 'v': nVerifies=atoi(optarg); break;
+      case 'f': pairingFile=optarg; break;
+      case 'S': spawnPath=optarg; break;
+      case 'a': nAccessories=atoi(optarg); break;
+      case 'm': multiCore=true; break;
+      case 'V': verbose=true; break;
+      case 'h': usage(); return(0);
+      default: usage(); return(1);
+    }
+  }
+
+  setupCode.erase(std::remove(setupCode.begin(),setupCode.end(),'-'),setupCode.end());
+  if(setupCode.size()!=8)
+    fatal("Setup code must have 8 digits");
+  if(nConnections<1 || nRequests<1 || nVerifies<1)
+    fatal("Connections, requests, and verifies must be at least 1");
+
+  if(sodium_init()<0)
+    fatal("Can't initialize libsodium");
+
+  Device device;
+  device.verbose=verbose;
+  if(spawnPath){
+    device.start(spawnPath,port,nAccessories,multiCore);
+    Connection probe;
+    int t;
+    for(t=0;t<100 && !probe.open(host,port);t++)         // wait up to 10 seconds for device to start listening
+      usleep(100000);
+    if(t==100){
+      device.stop();
+      fatal("Device did not start listening on port %u",port);
+    }
+  }
+
+  // Pairing
+
+  Pairing pairing;
+  Stats setupStats("POST /pair-setup");
+
+  if(!(pairingFile && pairing.load(pairingFile))){
+    Connection con;
+    uint64_t start=now();
+    setupStats.startTime=start;
+    if(!con.open(host,port) || !pairSetup(con,setupCode.c_str(),pairing)){
+      device.stop();
+      fatal("Pair-setup failed (%s).  If the device is already paired, use --pairing with the file saved when it was paired, or unpair it first",con.error.c_str());
+    }
+    setupStats.endTime=now();
+    setupStats.add(setupStats.endTime-start);
+    if(pairingFile)
+      pairing.save(pairingFile);
+  }
+
+  // Pair-verify on every connection (repeated nVerifies times, keeping the last session open for the workloads that follow)
+
+  std::vector<Connection> cons(nConnections);
+  Stats verifyStats("POST /pair-verify");
+
+  runConcurrently(nConnections,verifyStats,[&](int i){
+    for(int n=0;n<nVerifies;n++){
+      uint64_t start=now();
+      if(!cons[i].open(host,port) || !pairVerify(cons[i],pairing)){
+        verifyStats.fail(cons[i].error);
+        cons[i].close();
+        return;
+      }
+      verifyStats.add(now()-start);
+      if(n<nVerifies-1)
+        cons[i].close();
+    }
+  });
+
+  if(verifyStats.errors){
+    device.stop();
+    fatal("Pair-verify failed on %d connection(s)",verifyStats.errors);
+  }
+
+  // Find the On Characteristic of every Accessory that has one (these are the targets of GET, PUT, and Events)
+
+  std::vector<Target> targets;
+  Message msg;
+  if(!cons[0].request("GET","/accessories") || !cons[0].receive(msg) || msg.status!=200){
+    device.stop();
+    fatal("Can't read Accessory database (%s)",cons[0].error.c_str());
+  }
+  for(size_t a=msg.body.find("{\"aid\":");a!=std::string::npos;){
+    size_t next=msg.body.find("{\"aid\":",a+1);
+    uint32_t aid=strtoul(msg.body.c_str()+a+7,NULL,10);
+    size_t c=msg.body.find("\"type\":\"25\"",a);                 // On Characteristic
+    if(c!=std::string::npos && c<next){
+      size_t iid=msg.body.rfind("{\"iid\":",c);
+      targets.push_back({aid,atoi(msg.body.c_str()+iid+7)});
+    }
+    a=next;
+  }
+
+  printf("\nhapbench: %d connection(s), %d request(s) per connection per workload, %d Accessories with an On Characteristic\n\n",nConnections,nRequests,(int)targets.size());
+
+  // Workloads
+
+  Stats accStats("GET /accessories");
+  Stats getStats("GET /characteristics");
+  Stats putStats("PUT /characteristics");
+  Stats eventStats("EVENT");
+
+  runConcurrently(nConnections,accStats,[&](int i){
+    Message msg;
+    for(int n=0;n<nRequests;n++){
+      uint64_t start=now();
+      if(!cons[i].request("GET","/accessories") || !cons[i].receive(msg) || msg.status!=200){
+        accStats.fail(cons[i].error.empty()?"status "+std::to_string(msg.status):cons[i].error);
+        return;
+      }
+      accStats.add(now()-start);
+    }
+  });
+
+  if(!targets.empty()){
+    runConcurrently(nConnections,getStats,[&](int i){
+      Target &t=targets[i%targets.size()];
+      std::string path="/characteristics?id="+std::to_string(t.aid)+"."+std::to_string(t.iid)+","+std::to_string(t.aid)+"."+std::to_string(t.iid+1);
+      Message msg;
+      for(int n=0;n<nRequests;n++){
+        uint64_t start=now();
+        if(!cons[i].request("GET",path) || !cons[i].receive(msg) || (msg.status!=200 && msg.status!=207)){
+          getStats.fail(cons[i].error.empty()?"status "+std::to_string(msg.status):cons[i].error);
+          return;
+        }
+        getStats.add(now()-start);
+      }
+    });
+
+    runConcurrently(nConnections,putStats,[&](int i){
+      Target &t=targets[i%targets.size()];
+      Message msg;
+      for(int n=0;n<nRequests;n++){
+        std::string body="{\"characteristics\":[{\"aid\":"+std::to_string(t.aid)+",\"iid\":"+std::to_string(t.iid)+",\"value\":"+(n%2?"false":"true")+"}]}";
+        uint64_t start=now();
+        if(!cons[i].request("PUT","/characteristics","application/hap+json",body) || !cons[i].receive(msg) || (msg.status!=204 && msg.status!=207)){
+          putStats.fail(cons[i].error.empty()?"status "+std::to_string(msg.status):cons[i].error);
+          return;
+        }
+        putStats.add(now()-start);
+      }
+    });
+  }
+
+  // Events: connection 0 writes to the first target, and every other connection (subscribed to it) times how long
+  // each Event Notification takes to arrive after the write was sent
+
+  if(!targets.empty() && nConnections>1){
+    Target &t=targets[0];
+    std::string id="{\"aid\":"+std::to_string(t.aid)+",\"iid\":"+std::to_string(t.iid);
+    std::atomic<uint64_t> sentTime{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    int received=0;
+    int round=0;
+    std::atomic<int> ready{0};                          // subscribers that have tried to subscribe
+    std::atomic<int> subscribed{0};                     // subscribers that are still receiving events
+
+    runConcurrently(nConnections,eventStats,[&](int i){
+      Message msg;
+      if(i>0){
+        if(!cons[i].request("PUT","/characteristics","application/hap+json","{\"characteristics\":["+id+",\"ev\":true}]}") || !cons[i].receive(msg) || msg.status!=204){
+          eventStats.fail("can't subscribe: "+(cons[i].error.empty()?"status "+std::to_string(msg.status):cons[i].error));
+          ready++;
+          return;
+        }
+        subscribed++;
+        ready++;
+        for(int n=0;n<nRequests;n++){
+          bool ok=cons[i].receive(msg) && msg.event;
+          if(ok)
+            eventStats.add(now()-sentTime);
+          else
+            eventStats.fail(cons[i].error.empty()?"expected an Event Notification":cons[i].error);
+          std::lock_guard<std::mutex> lock(mutex);
+          received++;
+          if(!ok)
+            subscribed--;
+          cv.notify_all();
+          if(!ok)
+            return;
+        }
+        return;
+      }
+
+      while(ready<nConnections-1)                       // writer waits for every subscription before starting
+        usleep(1000);
+      for(int n=0;n<nRequests;n++){
+        std::string body="{\"characteristics\":["+id+",\"value\":"+(n%2?"false":"true")+"}]}";
+        sentTime=now();
+        if(!cons[0].request("PUT","/characteristics","application/hap+json",body) || !cons[0].receive(msg)){
+          eventStats.fail(cons[0].error);
+          return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);      // wait for every subscriber to receive (or fail to receive) this round's event
+        round+=subscribed;
+        if(!cv.wait_for(lock,std::chrono::seconds(10),[&]{return(received>=round);}))
+          return;
+      }
+    });
+  }
+
+  printHeader();
+  for(Stats *s : {&setupStats,&verifyStats,&accStats,&getStats,&putStats,&eventStats})
+    s->print();
+
+  if(spawnPath){
+    for(auto &c : cons)
+      c.close();
+    printf("\nDevice peak resident memory (VmHWM): %ld kB\n",device.peakMemory());
+    std::string stats=device.command("P","*** End Statistics ***");
+    printf("%s\n",stats.empty()?"\nNo request statistics from device (does the sketch call homeSpan.enableStats()?)":stats.c_str());
+    device.stop();
+  }
+
+  int errors=0;
+  for(Stats *s : {&setupStats,&verifyStats,&accStats,&getStats,&putStats,&eventStats})
+    errors+=s->errors;
+  return(errors?1:0);
+}
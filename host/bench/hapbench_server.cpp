@@ -0,0 +1,95 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Sketch run by hapbench (see hapbench.cpp): a Bridge with a number of dimmable LightBulb Accessories, with request
+//  statistics enabled so that hapbench can collect HomeSpan's own latency and heap figures with the 'P' command.
+//
+//  Environment:  HAPBENCH_ACCESSORIES  number of LightBulb Accessories (default 8)
+//                HAPBENCH_MULTICORE    if set, runs HAP network I/O and encryption in a separate task
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HomeSpan.h"
+
+struct BenchLight : Service::LightBulb {
+
+  SpanCharacteristic *power;
+  SpanCharacteristic *level;
+
+  BenchLight() : Service::LightBulb(){
+    power=new Characteristic::On();
+    level=new Characteristic::Brightness(50);
+  }
+
+  boolean update(){
+    return(true);
+  }
+};
+
+static void addAccessory(const char *name){
+  new SpanAccessory();
+    new Service::AccessoryInformation();
+      new Characteristic::Name(name);
+      new Characteristic::Manufacturer("HomeSpan");
+      new Characteristic::SerialNumber("HAPBENCH");
+      new Characteristic::Model("hapbench");
+      new Characteristic::FirmwareRevision("1.0");
+      new Characteristic::Identify();
+}
+
+void setup(){
+
+  Serial.begin(115200);
+
+  const char *env=getenv("HAPBENCH_ACCESSORIES");
+  int nAccessories=env?atoi(env):8;
+
+  homeSpan.setLogLevel(0);
+  homeSpan.setMaxConnections(14);                           // the most allowed by CONFIG_LWIP_MAX_SOCKETS
+  homeSpan.enableStats();
+  if(getenv("HAPBENCH_MULTICORE"))
+    homeSpan.enableMultiCore();
+
+  homeSpan.begin(Category::Bridges,"HAP Bench");
+
+  addAccessory("HAP Bench");
+    new Service::HAPProtocolInformation();
+      new Characteristic::Version("1.1.0");
+
+  for(int i=0;i<nAccessories;i++){
+    char *name=(char *)malloc(24);                          // Characteristic::Name keeps the pointer, not a copy, so the name must persist
+    sprintf(name,"Light %d",i+1);
+    addAccessory(name);
+      new BenchLight();
+  }
+}
+
+void loop(){
+  homeSpan.poll();
+}
@@ -0,0 +1,342 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host (Linux/POSIX) stand-in for the subset of the Arduino-ESP32 core, FreeRTOS, and ESP-IDF system APIs used by
+//  HomeSpan, so that the library, its extras, and example sketches can be compiled, unit-tested, and benchmarked on
+//  a development machine.  See host/README.md.
+//
+//  Interrupts are emulated by running each interrupt handler while holding a single global lock, which is also
+//  what portENTER_CRITICAL() acquires, so critical sections exclude interrupts just as they do on the ESP32.
+//  Pins, timers, and peripheral registers are simulated in HostSim.cpp.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include <vector>                 // pulled in (indirectly) by the Arduino-ESP32 core, which HomeSpan relies on
+#include <functional>
+
+#include <soc/soc.h>
+#include <soc/gpio_reg.h>
+#include <esp_intr_alloc.h>
+
+#ifndef HOMESPAN_HOST
+#define HOMESPAN_HOST 1
+#endif
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT         0x01
+#define OUTPUT        0x02
+#define PULLUP        0x04
+#define INPUT_PULLUP  0x05
+#define PULLDOWN      0x08
+#define INPUT_PULLDOWN 0x09
+
+#define RISING  0x01
+#define FALLING 0x02
+#define CHANGE  0x03
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define ARDUINO_VARIANT "host"
+
+// Arduino core functions
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+uint16_t analogRead(uint8_t pin);
+#define digitalPinToInterrupt(p) (p)
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void attachInterruptArg(uint8_t pin, void (*isr)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+
+long random(long max);
+long random(long min, long max);
+
+// Arduino String (subset)
+
+class String {
+  std::string s;
+
+  public:
+    String(){}
+    String(const char *c) : s(c?c:"") {}
+    String(const std::string &str) : s(str) {}
+    explicit String(char c) : s(1,c) {}
+    explicit String(int n, unsigned char base=10);
+    explicit String(unsigned int n, unsigned char base=10);
+    explicit String(long n, unsigned char base=10);
+    explicit String(unsigned long n, unsigned char base=10);
+    explicit String(double n, unsigned int decimalPlaces=2);
+
+    const char *c_str() const {return(s.c_str());}
+    unsigned int length() const {return(s.length());}
+    char charAt(unsigned int i) const {return(i<s.length()?s[i]:0);}
+    char operator[](unsigned int i) const {return(charAt(i));}
+    String substring(unsigned int from) const {return(from<s.length()?String(s.substr(from)):String());}
+    String substring(unsigned int from, unsigned int to) const {return(from<to && from<s.length()?String(s.substr(from,to-from)):String());}
+    int indexOf(char c, unsigned int from=0) const {size_t n=s.find(c,from);return(n==std::string::npos?-1:(int)n);}
+    int indexOf(const String &str, unsigned int from=0) const {size_t n=s.find(str.s,from);return(n==std::string::npos?-1:(int)n);}
+    long toInt() const {return(atol(s.c_str()));}
+    float toFloat() const {return(atof(s.c_str()));}
+    void toUpperCase(){for(auto &c : s) c=toupper(c);}
+    void toLowerCase(){for(auto &c : s) c=tolower(c);}
+    void trim();
+
+    String &operator+=(const String &str){s+=str.s;return(*this);}
+    String &operator+=(const char *c){s+=c;return(*this);}
+    String &operator+=(char c){s+=c;return(*this);}
+    String &operator+=(int n){return(*this+=String(n));}
+    String &operator+=(unsigned int n){return(*this+=String(n));}
+    String &operator+=(long n){return(*this+=String(n));}
+    String &operator+=(unsigned long n){return(*this+=String(n));}
+    bool concat(const String &str){s+=str.s;return(true);}
+
+    friend String operator+(const String &a, const String &b){return(String(a.s+b.s));}
+    friend String operator+(const String &a, const char *b){return(String(a.s+b));}
+    friend String operator+(const char *a, const String &b){return(String(a+b.s));}
+    friend String operator+(const String &a, char b){return(String(a.s+b));}
+    bool operator==(const String &str) const {return(s==str.s);}
+    bool operator==(const char *c) const {return(s==c);}
+    bool operator!=(const String &str) const {return(s!=str.s);}
+    bool operator!=(const char *c) const {return(s!=c);}
+    bool equals(const String &str) const {return(s==str.s);}
+};
+
+// Print, Printable, and Stream
+
+class Print;
+
+class Printable {
+  public:
+    virtual ~Printable(){}
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+  size_t printNumber(unsigned long long n, uint8_t base);
+  size_t printFloat(double n, uint8_t digits);
+
+  public:
+    virtual ~Print(){}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str){return(str?write((const uint8_t *)str,strlen(str)):0);}
+    size_t write(const char *buffer, size_t size){return(write((const uint8_t *)buffer,size));}
+    virtual int availableForWrite(){return(0);}
+    virtual void flush(){}
+
+    size_t printf(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+
+    size_t print(const String &s){return(write(s.c_str(),s.length()));}
+    size_t print(const char *s){return(write(s));}
+    size_t print(char c){return(write((uint8_t)c));}
+    size_t print(unsigned char n, int base=DEC){return(print((unsigned long)n,base));}
+    size_t print(int n, int base=DEC){return(print((long)n,base));}
+    size_t print(unsigned int n, int base=DEC){return(print((unsigned long)n,base));}
+    size_t print(long n, int base=DEC);
+    size_t print(unsigned long n, int base=DEC){return(printNumber(n,base));}
+    size_t print(long long n, int base=DEC);
+    size_t print(unsigned long long n, int base=DEC){return(printNumber(n,base));}
+    size_t print(double n, int digits=2){return(printFloat(n,digits));}
+    size_t print(const Printable &x){return(x.printTo(*this));}
+
+    size_t println(){return(write("\r\n"));}
+    template <class T> size_t println(const T &x){size_t n=print(x);return(n+println());}
+    template <class T> size_t println(const T &x, int fmt){size_t n=print(x,fmt);return(n+println());}
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek(){return(-1);}
+    size_t readBytes(char *buffer, size_t length);
+};
+
+// Serial port (reads from stdin without blocking, writes to stdout)
+
+class HardwareSerial : public Stream {
+  int peeked=-1;                                      // byte read ahead by available() (-1 if none)
+  bool eof=false;                                     // true once stdin has been closed
+
+  public:
+    void begin(unsigned long baud){}
+    void end(){}
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int availableForWrite() override {return(4096);}
+    void flush() override;
+    operator bool() const {return(true);}
+};
+
+extern HardwareSerial Serial;
+
+// IP addresses (stored, as on the ESP32, with the first octet in the lowest byte)
+
+class IPAddress : public Printable {
+  union {
+    uint8_t bytes[4];
+    uint32_t dword;
+  } address;
+
+  public:
+    IPAddress(){address.dword=0;}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d){address.bytes[0]=a;address.bytes[1]=b;address.bytes[2]=c;address.bytes[3]=d;}
+    IPAddress(uint32_t a){address.dword=a;}
+    operator uint32_t() const {return(address.dword);}
+    uint8_t operator[](int i) const {return(address.bytes[i]);}
+    uint8_t &operator[](int i){return(address.bytes[i]);}
+    bool operator==(const IPAddress &a) const {return(address.dword==a.address.dword);}
+    String toString() const;
+    size_t printTo(Print &p) const override;
+};
+
+// ESP32 system functions
+
+class EspClass {
+  public:
+    void restart();                                   // re-executes the current program with the same arguments (after flushing Serial)
+    uint32_t getHeapSize();
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+    const char *getChipModel(){return("host");}
+    uint8_t getChipCores(){return(2);}
+    uint32_t getCpuFreqMHz(){return(240);}
+};
+
+extern EspClass ESP;
+
+typedef int esp_err_t;
+#define ESP_OK    0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM        0x101
+#define ESP_ERR_INVALID_ARG   0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_FOUND     0x105
+
+uint32_t esp_random();
+const char *esp_get_idf_version();
+uint32_t esp_get_free_heap_size();
+uint32_t esp_get_minimum_free_heap_size();
+
+#define MALLOC_CAP_8BIT     (1<<2)
+#define MALLOC_CAP_DEFAULT  (1<<12)
+#define MALLOC_CAP_INTERNAL (1<<11)
+
+void *heap_caps_malloc(size_t size, uint32_t caps);
+void heap_caps_free(void *ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+// lwIP configuration visible to sketches
+
+#define CONFIG_LWIP_MAX_SOCKETS 16
+#define LWIP_SOCKET_OFFSET 0
+
+// FreeRTOS (tasks are threads; one tick is one millisecond)
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void *);
+typedef struct hostTask *TaskHandle_t;
+typedef struct hostSemaphore *SemaphoreHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  1
+#define pdFAIL  0
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *arg, UBaseType_t priority, TaskHandle_t *handle);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+void vTaskDelay(TickType_t ticks);
+void vTaskDelete(TaskHandle_t handle);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t handle);     // stack usage is not measured on the host - always returns the stack depth requested when the task was created (8192 for the main task)
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+#define portYIELD_FROM_ISR() yield()
+
+typedef struct {
+  uint32_t owner;
+  uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0,0}
+
+void hostEnterCritical();               // acquires global lock shared by all critical sections and emulated interrupt handlers
+void hostExitCritical();
+
+#define portENTER_CRITICAL(mux)     hostEnterCritical()
+#define portEXIT_CRITICAL(mux)      hostExitCritical()
+#define portENTER_CRITICAL_ISR(mux) hostEnterCritical()
+#define portEXIT_CRITICAL_ISR(mux)  hostExitCritical()
@@ -0,0 +1,77 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host stand-in for the Arduino-ESP32 ArduinoOTA library.  Handlers are stored but OTA updates are never received.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <Arduino.h>
+#include <MD5Builder.h>         // included by the Arduino-ESP32 ArduinoOTA.h (through Update.h)
+#include <functional>
+
+#define U_FLASH 0
+#define U_SPIFFS 100
+
+typedef enum {
+  OTA_AUTH_ERROR,
+  OTA_BEGIN_ERROR,
+  OTA_CONNECT_ERROR,
+  OTA_RECEIVE_ERROR,
+  OTA_END_ERROR
+} ota_error_t;
+
+class ArduinoOTAClass {
+  public:
+    typedef std::function<void(void)> THandlerFunction;
+    typedef std::function<void(ota_error_t)> THandlerFunction_Error;
+    typedef std::function<void(unsigned int, unsigned int)> THandlerFunction_Progress;
+
+    ArduinoOTAClass &setHostname(const char *hostname){return(*this);}
+    ArduinoOTAClass &setPassword(const char *password){return(*this);}
+    ArduinoOTAClass &setPasswordHash(const char *password){return(*this);}
+    ArduinoOTAClass &setRebootOnSuccess(bool reboot){return(*this);}
+    ArduinoOTAClass &onStart(THandlerFunction fn){startCallback=fn;return(*this);}
+    ArduinoOTAClass &onEnd(THandlerFunction fn){endCallback=fn;return(*this);}
+    ArduinoOTAClass &onError(THandlerFunction_Error fn){errorCallback=fn;return(*this);}
+    ArduinoOTAClass &onProgress(THandlerFunction_Progress fn){progressCallback=fn;return(*this);}
+    void begin(){}
+    void end(){}
+    void handle(){}
+    int getCommand(){return(U_FLASH);}
+
+  private:
+    THandlerFunction startCallback;
+    THandlerFunction endCallback;
+    THandlerFunction_Error errorCallback;
+    THandlerFunction_Progress progressCallback;
+};
+
+extern ArduinoOTAClass ArduinoOTA;
@@ -0,0 +1,77 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Controls and inspects the simulated ESP32 peripherals used by the host build.
+//
+//  Time:  by default the host clock follows real time and a background thread raises timer-group alarms, runs
+//         esp_timer callbacks, and steps RMT transmissions as they come due.  Tests can instead call useManualClock(),
+//         after which time only moves when advance() is called (or delay() is called, which advances the clock by
+//         the same amount), and every event that comes due is handled synchronously, in time order, by advance().
+//
+//  Pins:  setPin() drives an input pin and calls any interrupt handler attached to it.  Pins configured as
+//         INPUT_PULLUP read HIGH until driven.
+//
+//  RMT:   each RMT channel reads pulses from simulated RMT memory (see RMT_CHANNEL_MEM) just as the ESP32 does,
+//         including threshold and end-of-transmission interrupts and wrap-around, and appends each pulse it
+//         transmits to a log that can be read with rmtOutput().
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+
+namespace HostSim {
+
+void useManualClock(boolean manual=true);     // switches between manual and real-time clocks (time continues from its current value)
+void advance(uint64_t us);                    // advances manual clock by us microseconds, handling every event that comes due
+uint64_t now();                               // returns current time (in microseconds since program started)
+
+void setPin(uint8_t pin, uint8_t level);      // drives input pin to level, calling attached interrupt handler if level changes
+int getPin(uint8_t pin);                      // returns level of pin (as set by digitalWrite() or setPin())
+
+uint32_t ledcDuty(int speedMode, int channel);         // returns duty last set and updated for LEDC channel
+uint32_t ledcFreq(int speedMode, int timer);           // returns frequency configured for LEDC timer (0 if not configured)
+uint8_t ledcResolution(int speedMode, int timer);      // returns duty resolution configured for LEDC timer (0 if not configured)
+
+struct rmtPulse_t {
+  uint8_t level;                              // output level during pulse
+  uint32_t duration;                          // duration, in microseconds (ticks times tick length)
+};
+
+std::vector<rmtPulse_t> rmtOutput(int channel);          // returns pulses transmitted on RMT channel since last cleared
+void clearRmtOutput(int channel);
+boolean rmtBusy(int channel);                            // returns true if RMT channel is transmitting
+uint32_t gpioOutputEnabled();                            // returns mask of pins (0-31) whose output is enabled
+
+void useMemoryNvs();                          // discards all NVS data and keeps NVS in memory only from now on (no files are read or written)
+void failNvsCommits(boolean fail);            // when true, nvs_commit() fails and leaves changes pending
+
+}
@@ -0,0 +1,130 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host stand-in for the Arduino-ESP32 WiFi library.  The station is always connected (to the host's network),
+//  WiFiServer listens on a non-blocking TCP socket on all interfaces, and WiFiClient wraps a connected socket.
+//  Setting the environment variable HOMESPAN_PORT overrides the port of every WiFiServer created with port 80,
+//  so that sketches can be run without root privileges (the port logged by the ESPmDNS stand-in is overridden to match).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <Arduino.h>
+#include <memory>
+
+typedef enum {
+  WL_IDLE_STATUS=0,
+  WL_NO_SSID_AVAIL=1,
+  WL_SCAN_COMPLETED=2,
+  WL_CONNECTED=3,
+  WL_CONNECT_FAILED=4,
+  WL_CONNECTION_LOST=5,
+  WL_DISCONNECTED=6
+} wl_status_t;
+
+typedef enum {WIFI_OFF=0, WIFI_STA=1, WIFI_AP=2, WIFI_AP_STA=3} wifi_mode_t;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED  (-2)
+
+class WiFiClient : public Stream {
+  std::shared_ptr<int> sock;                          // connected socket, shared by copies and closed when the last copy is destroyed (or on stop())
+
+  public:
+    WiFiClient(){}
+    WiFiClient(int fd);
+
+    int fd() const;
+    uint8_t connected();
+    operator bool(){return(connected());}
+    bool operator==(const WiFiClient &c) const {return(fd()==c.fd());}
+    bool operator!=(const WiFiClient &c) const {return(fd()!=c.fd());}
+
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size);
+    int peek() override;
+    size_t write(uint8_t c) override {return(write(&c,1));}
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Print::write;
+    void flush() override {}
+    void stop();
+    int setNoDelay(bool nodelay);
+    IPAddress remoteIP() const;
+    uint16_t remotePort() const;
+    IPAddress localIP() const;
+};
+
+class WiFiServer {
+  uint16_t port;
+  int sockfd=-1;
+
+  public:
+    WiFiServer(uint16_t port=80);
+    ~WiFiServer(){end();}
+    void begin(uint16_t port=0);
+    void end();
+    WiFiClient available();                           // returns newly-accepted client, if any, without waiting
+    void setNoDelay(bool nodelay){}
+    operator bool(){return(sockfd>=0);}
+};
+
+class WiFiClass {
+  wifi_mode_t wifiMode=WIFI_STA;
+
+  public:
+    wl_status_t status(){return(WL_CONNECTED);}
+    wl_status_t begin(const char *ssid, const char *passphrase=NULL, int32_t channel=0, const uint8_t *bssid=NULL, bool connect=true){return(WL_CONNECTED);}
+    bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1=(uint32_t)0, IPAddress dns2=(uint32_t)0){return(true);}
+    bool disconnect(bool wifioff=false, bool eraseap=false){return(true);}
+    bool mode(wifi_mode_t m){wifiMode=m;return(true);}
+    wifi_mode_t getMode(){return(wifiMode);}
+    bool setAutoReconnect(bool autoReconnect){return(true);}
+    bool softAP(const char *ssid, const char *passphrase=NULL, int channel=1, int ssid_hidden=0, int max_connection=4){return(true);}
+    bool softAPdisconnect(bool wifioff=false){return(true);}
+    IPAddress softAPIP(){return(IPAddress(192,168,4,1));}
+
+    int16_t scanNetworks(bool async=false){return(1);}
+    int16_t scanComplete(){return(1);}
+    void scanDelete(){}
+    String SSID(uint8_t i){return("HomeSpanHost");}
+    String SSID(){return("HomeSpanHost");}
+    int32_t RSSI(){return(-40);}
+
+    IPAddress localIP();                              // address of the interface used to reach other hosts (127.0.0.1 if none)
+    IPAddress gatewayIP(){return((uint32_t)0);}
+    IPAddress subnetMask(){return(IPAddress(255,255,255,0));}
+    IPAddress dnsIP(uint8_t i=0){return((uint32_t)0);}
+    uint8_t *BSSID();
+    int32_t channel(){return(1);}
+    String macAddress(){return("02:00:00:00:00:01");}
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,82 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host stand-in for the ESP-IDF (v3.x) timer group driver.  Counters run from the host clock (see HostSim.h)
+//  and alarm interrupts are raised by HostSim when a counter reaches its alarm value.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <esp_intr_alloc.h>
+
+typedef int esp_err_t;
+
+typedef enum {TIMER_GROUP_0=0, TIMER_GROUP_1=1, TIMER_GROUP_MAX} timer_group_t;
+typedef enum {TIMER_0=0, TIMER_1=1, TIMER_MAX} timer_idx_t;
+typedef enum {TIMER_PAUSE=0, TIMER_START=1} timer_start_t;
+typedef enum {TIMER_ALARM_DIS=0, TIMER_ALARM_EN=1} timer_alarm_t;
+typedef enum {TIMER_INTR_LEVEL=0} timer_intr_mode_t;
+typedef enum {TIMER_COUNT_DOWN=0, TIMER_COUNT_UP=1} timer_count_dir_t;
+typedef enum {TIMER_AUTORELOAD_DIS=0, TIMER_AUTORELOAD_EN=1} timer_autoreload_t;
+
+typedef struct {
+  timer_alarm_t alarm_en;
+  timer_start_t counter_en;
+  timer_intr_mode_t intr_type;
+  timer_count_dir_t counter_dir;
+  timer_autoreload_t auto_reload;
+  uint32_t divider;                 // counter ticks at 80 MHz / divider
+} timer_config_t;
+
+typedef intr_handle_t timer_isr_handle_t;
+
+esp_err_t timer_init(timer_group_t group, timer_idx_t idx, const timer_config_t *config);
+esp_err_t timer_isr_register(timer_group_t group, timer_idx_t idx, void (*fn)(void *), void *arg, int flags, timer_isr_handle_t *handle);
+esp_err_t timer_enable_intr(timer_group_t group, timer_idx_t idx);
+esp_err_t timer_disable_intr(timer_group_t group, timer_idx_t idx);
+esp_err_t timer_set_counter_value(timer_group_t group, timer_idx_t idx, uint64_t val);
+esp_err_t timer_get_counter_value(timer_group_t group, timer_idx_t idx, uint64_t *val);
+esp_err_t timer_set_alarm_value(timer_group_t group, timer_idx_t idx, uint64_t val);
+esp_err_t timer_set_alarm(timer_group_t group, timer_idx_t idx, timer_alarm_t alarm);
+esp_err_t timer_start(timer_group_t group, timer_idx_t idx);
+esp_err_t timer_pause(timer_group_t group, timer_idx_t idx);
+
+typedef struct {
+  struct {
+    uint32_t t0:1;
+    uint32_t t1:1;
+    uint32_t wdt:1;
+    uint32_t reserved3:29;
+  } int_clr_timers;                 // writes are accepted and ignored (HostSim clears the interrupt before calling the handler)
+} timg_dev_t;
+
+extern timg_dev_t TIMERG0;
+extern timg_dev_t TIMERG1;
@@ -0,0 +1,65 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host stand-in for ESP32 soc/rmt_reg.h (only the registers used by HomeSpan).  RMT memory is simulated in
+//  HostSim.cpp, so RMT_CHANNEL_MEM() points into host memory rather than to the ESP32 address.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <soc/soc.h>
+
+#define RMT_CHnCONF0_REG(n)   (DR_REG_RMT_BASE+0x0020+(n)*8)
+#define RMT_CHnCONF1_REG(n)   (DR_REG_RMT_BASE+0x0024+(n)*8)
+
+#define RMT_DIV_CNT_CH0       0x000000FF
+#define RMT_DIV_CNT_CH0_V     0xFF
+#define RMT_DIV_CNT_CH0_S     0
+
+#define RMT_INT_RAW_REG       (DR_REG_RMT_BASE+0x00A0)
+#define RMT_INT_ST_REG        (DR_REG_RMT_BASE+0x00A4)
+#define RMT_INT_ENA_REG       (DR_REG_RMT_BASE+0x00A8)
+#define RMT_INT_CLR_REG       (DR_REG_RMT_BASE+0x00AC)
+
+#define RMT_CH0_TX_END_INT_ENA_S          0
+#define RMT_CH0_TX_END_INT_ST_S           0
+#define RMT_CH0_TX_THR_EVENT_INT_ENA_S    24
+#define RMT_CH0_TX_THR_EVENT_INT_ST_S     24
+
+#define RMT_CH0_TX_LIM_REG    (DR_REG_RMT_BASE+0x00D0)
+#define RMT_TX_LIM_CH0        0x000001FF
+#define RMT_TX_LIM_CH0_V      0x1FF
+#define RMT_TX_LIM_CH0_S      0
+
+#define RMT_APB_CONF_REG      (DR_REG_RMT_BASE+0x00F0)
+
+extern uint32_t hostRmtMem[8*64];
+
+#define RMT_CHANNEL_MEM(i)    (hostRmtMem+64*(i))
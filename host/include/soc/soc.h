@@ -0,0 +1,53 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host stand-in for ESP32 soc/soc.h.  Peripheral registers are not memory-mapped on the host - reads and writes
+//  are routed to the register file simulated in HostSim.cpp, using the same addresses as the ESP32.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+
+#define DR_REG_DPORT_BASE 0x3ff00000
+#define DR_REG_GPIO_BASE  0x3ff44000
+#define DR_REG_RMT_BASE   0x3ff56000
+
+#define ETS_RMT_INTR_SOURCE 47
+
+uint32_t hostRegRead(uint32_t addr);
+void hostRegWrite(uint32_t addr, uint32_t val);
+
+#define REG_READ(r)             hostRegRead((uint32_t)(r))
+#define REG_WRITE(r,v)          hostRegWrite((uint32_t)(r),(uint32_t)(v))
+#define REG_SET_BIT(r,b)        REG_WRITE((r),REG_READ(r)|(b))
+#define REG_CLR_BIT(r,b)        REG_WRITE((r),REG_READ(r)&~(b))
+#define REG_GET_FIELD(r,f)      ((REG_READ(r)>>(f##_S))&(f##_V))
+#define REG_SET_FIELD(r,f,v)    REG_WRITE((r),(REG_READ(r)&~((f##_V)<<(f##_S)))|(((uint32_t)(v)&(f##_V))<<(f##_S)))
@@ -0,0 +1,404 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host implementations of the Arduino core, ESP32 system, and FreeRTOS functions declared in Arduino.h
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <unistd.h>
+#include <poll.h>
+#include <malloc.h>
+#include <sys/random.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <Arduino.h>
+#include <HostSim.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+////////////////////////////////
+//       Time & Random        //
+////////////////////////////////
+
+unsigned long millis(){
+  return(HostSim::now()/1000);
+}
+
+unsigned long micros(){
+  return(HostSim::now());
+}
+
+void delayMicroseconds(uint32_t us){
+  uint64_t start=HostSim::now();
+  HostSim::advance(us);                                       // only moves time if using the manual clock
+  while(HostSim::now()-start<us)
+    std::this_thread::sleep_for(std::chrono::microseconds(us-(HostSim::now()-start)));
+}
+
+void delay(uint32_t ms){
+  delayMicroseconds(ms*1000);
+}
+
+void yield(){
+  std::this_thread::yield();
+}
+
+uint32_t esp_random(){
+  uint32_t r;
+  if(getrandom(&r,sizeof(r),0)==sizeof(r))
+    return(r);
+  static std::random_device rd;
+  return(rd());
+}
+
+long random(long max){
+  return(max>0?esp_random()%max:0);
+}
+
+long random(long min, long max){
+  return(max>min?min+random(max-min):min);
+}
+
+////////////////////////////////
+//          String            //
+////////////////////////////////
+
+static std::string toBase(unsigned long long n, unsigned char base){
+  if(base<2 || base>36)
+    base=10;
+  std::string s;
+  do {
+    int d=n%base;
+    s.insert(s.begin(),(char)(d<10?'0'+d:'a'+d-10));
+    n/=base;
+  } while(n);
+  return(s);
+}
+
+String::String(int n, unsigned char base) : String((long)n,base) {}
+String::String(unsigned int n, unsigned char base) : String((unsigned long)n,base) {}
+String::String(unsigned long n, unsigned char base) : s(toBase(n,base)) {}
+
+String::String(long n, unsigned char base){
+  if(n<0 && base==10)
+    s="-"+toBase(-(unsigned long long)n,base);
+  else
+    s=toBase((unsigned long)n,base);
+}
+
+String::String(double n, unsigned int decimalPlaces){
+  char buf[64];
+  snprintf(buf,sizeof(buf),"%.*f",decimalPlaces,n);
+  s=buf;
+}
+
+void String::trim(){
+  size_t first=s.find_first_not_of(" \t\r\n\f\v");
+  if(first==std::string::npos){
+    s.clear();
+    return;
+  }
+  s=s.substr(first,s.find_last_not_of(" \t\r\n\f\v")-first+1);
+}
+
+////////////////////////////////
+//      Print & Stream        //
+////////////////////////////////
+
+size_t Print::write(const uint8_t *buffer, size_t size){
+  size_t n=0;
+  while(size--)
+    n+=write(*buffer++);
+  return(n);
+}
+
+size_t Print::printf(const char *format, ...){
+  va_list args;
+  va_start(args,format);
+  char *buf=NULL;
+  int len=vasprintf(&buf,format,args);
+  va_end(args);
+  if(len<0)
+    return(0);
+  size_t n=write((const uint8_t *)buf,len);
+  free(buf);
+  return(n);
+}
+
+size_t Print::printNumber(unsigned long long n, uint8_t base){
+  return(write(toBase(n,base).c_str()));
+}
+
+size_t Print::printFloat(double n, uint8_t digits){
+  return(print(String(n,(unsigned int)digits)));
+}
+
+size_t Print::print(long n, int base){
+  return(print((long long)n,base));
+}
+
+size_t Print::print(long long n, int base){
+  if(n<0 && base==10)
+    return(write((uint8_t)'-')+printNumber(-(unsigned long long)n,base));
+  return(printNumber((unsigned long long)n,base));
+}
+
+size_t Stream::readBytes(char *buffer, size_t length){
+  size_t n=0;
+  unsigned long start=millis();
+  while(n<length && millis()-start<1000){                     // same 1-second default timeout as Arduino
+    if(available())
+      buffer[n++]=read();
+    else
+      delay(1);
+  }
+  return(n);
+}
+
+////////////////////////////////
+//          Serial            //
+////////////////////////////////
+
+int HardwareSerial::available(){
+  if(peeked>=0)
+    return(1);
+  if(eof)
+    return(0);
+
+  struct pollfd pfd={STDIN_FILENO,POLLIN,0};
+  if(poll(&pfd,1,0)<=0 || !(pfd.revents&(POLLIN|POLLHUP)))
+    return(0);
+
+  uint8_t c;
+  if(::read(STDIN_FILENO,&c,1)!=1){
+    eof=true;
+    return(0);
+  }
+  peeked=c;
+  return(1);
+}
+
+int HardwareSerial::read(){
+  if(!available())
+    return(-1);
+  int c=peeked;
+  peeked=-1;
+  return(c);
+}
+
+int HardwareSerial::peek(){
+  return(available()?peeked:-1);
+}
+
+size_t HardwareSerial::write(uint8_t c){
+  return(fwrite(&c,1,1,stdout));
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size){
+  return(fwrite(buffer,1,size,stdout));
+}
+
+void HardwareSerial::flush(){
+  fflush(stdout);
+}
+
+////////////////////////////////
+//         IPAddress          //
+////////////////////////////////
+
+String IPAddress::toString() const {
+  char buf[16];
+  snprintf(buf,sizeof(buf),"%u.%u.%u.%u",address.bytes[0],address.bytes[1],address.bytes[2],address.bytes[3]);
+  return(String(buf));
+}
+
+size_t IPAddress::printTo(Print &p) const {
+  return(p.print(toString()));
+}
+
+////////////////////////////////
+//     ESP32 System & Heap    //
+////////////////////////////////
+
+// The host has no fixed heap, so a notional 4 MB heap is reported, from which the bytes currently allocated with
+// malloc() are subtracted.  This keeps free-heap figures (and the minimum reached) meaningful for comparing runs.
+
+static const uint32_t HEAP_SIZE=4*1024*1024;
+static std::atomic<uint32_t> minFreeHeap{HEAP_SIZE};
+
+static uint32_t freeHeap(){
+  uint32_t used=0;
+#if defined(__GLIBC__) && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=33))
+  used=mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+  used=mallinfo().uordblks;
+#endif
+  uint32_t free=used<HEAP_SIZE?HEAP_SIZE-used:0;
+  uint32_t min=minFreeHeap;
+  while(free<min && !minFreeHeap.compare_exchange_weak(min,free));
+  return(free);
+}
+
+void EspClass::restart(){
+  Serial.flush();
+  char path[256];
+  ssize_t len=readlink("/proc/self/exe",path,sizeof(path)-1);
+  if(len>0){
+    path[len]='\0';
+    FILE *f=fopen("/proc/self/cmdline","r");                  // recover original arguments
+    static char cmdline[4096];
+    size_t n=f?fread(cmdline,1,sizeof(cmdline)-1,f):0;
+    if(f)
+      fclose(f);
+    cmdline[n]='\0';
+    std::vector<char *> argv;
+    for(size_t i=0;i<n;i+=strlen(cmdline+i)+1)
+      argv.push_back(cmdline+i);
+    argv.push_back(NULL);
+    execv(path,argv.data());
+  }
+  exit(0);
+}
+
+uint32_t EspClass::getHeapSize(){return(HEAP_SIZE);}
+uint32_t EspClass::getFreeHeap(){return(freeHeap());}
+uint32_t EspClass::getMinFreeHeap(){freeHeap();return(minFreeHeap);}
+uint32_t EspClass::getMaxAllocHeap(){return(freeHeap());}
+
+uint32_t esp_get_free_heap_size(){return(freeHeap());}
+uint32_t esp_get_minimum_free_heap_size(){freeHeap();return(minFreeHeap);}
+
+const char *esp_get_idf_version(){
+  return("host");
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps){return(malloc(size));}
+void heap_caps_free(void *ptr){free(ptr);}
+size_t heap_caps_get_free_size(uint32_t caps){return(freeHeap());}
+size_t heap_caps_get_largest_free_block(uint32_t caps){return(freeHeap());}
+size_t heap_caps_get_minimum_free_size(uint32_t caps){freeHeap();return(minFreeHeap);}
+
+////////////////////////////////
+//     FreeRTOS Tasks         //
+////////////////////////////////
+
+struct hostTask {
+  uint32_t stackDepth;
+};
+
+static hostTask mainTask={8192};
+static thread_local hostTask *currentTask=&mainTask;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core){
+  hostTask *task=new hostTask{stackDepth};
+  if(handle)
+    *handle=task;
+  std::thread([fn,arg,task](){
+    currentTask=task;
+    fn(arg);
+  }).detach();
+  return(pdPASS);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *arg, UBaseType_t priority, TaskHandle_t *handle){
+  return(xTaskCreatePinnedToCore(fn,name,stackDepth,arg,priority,handle,tskNO_AFFINITY));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(){
+  return(currentTask);
+}
+
+void vTaskDelay(TickType_t ticks){
+  delay(ticks*portTICK_PERIOD_MS);
+}
+
+void vTaskDelete(TaskHandle_t handle){
+  if(handle==NULL || handle==currentTask){                    // a task deleting itself never returns
+    while(1)
+      std::this_thread::sleep_for(std::chrono::hours(1));
+  }
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t handle){
+  return((handle?handle:currentTask)->stackDepth);
+}
+
+////////////////////////////////
+//   FreeRTOS Semaphores      //
+////////////////////////////////
+
+struct hostSemaphore {
+  std::mutex mutex;
+  std::condition_variable cv;
+  int count;
+};
+
+SemaphoreHandle_t xSemaphoreCreateBinary(){
+  return(new hostSemaphore{{},{},0});
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(){
+  return(new hostSemaphore{{},{},1});
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks){
+  std::unique_lock<std::mutex> lock(sem->mutex);
+  if(ticks==portMAX_DELAY)
+    sem->cv.wait(lock,[sem]{return(sem->count>0);});
+  else if(!sem->cv.wait_for(lock,std::chrono::milliseconds(ticks*portTICK_PERIOD_MS),[sem]{return(sem->count>0);}))
+    return(pdFALSE);
+  sem->count--;
+  return(pdTRUE);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem){
+  std::lock_guard<std::mutex> lock(sem->mutex);
+  if(sem->count>0)
+    return(pdFALSE);
+  sem->count++;
+  sem->cv.notify_one();
+  return(pdTRUE);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken){
+  if(woken)
+    *woken=pdFALSE;
+  return(xSemaphoreGive(sem));
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem){
+  delete sem;
+}
@@ -0,0 +1,714 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Simulated ESP32 clock, pins, timer groups, esp_timers, LEDC, and RMT peripheral for the host build (see HostSim.h)
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <map>
+
+#include <Arduino.h>
+#include <HostSim.h>
+#include <driver/timer.h>
+#include <driver/ledc.h>
+#include <driver/gpio.h>
+#include <esp_timer.h>
+#include <soc/rmt_reg.h>
+
+using namespace std::chrono;
+
+////////////////////////////////
+//   Interrupt Lock & Clock   //
+////////////////////////////////
+
+// State shared with the interrupt thread is allocated on first use (so it is available to constructors of
+// static objects in other files) and never freed (so the thread can safely keep running while static objects
+// are destroyed at program exit).
+
+static std::recursive_mutex &hostIsrLock(){
+  static std::recursive_mutex *m=new std::recursive_mutex;
+  return(*m);
+}
+
+#define isrLock hostIsrLock()
+
+void hostEnterCritical(){isrLock.lock();}
+void hostExitCritical(){isrLock.unlock();}
+
+static std::atomic<boolean> manualClock{false};
+static std::atomic<uint64_t> manualTime{0};
+static std::atomic<int64_t> realOffset{0};          // added to elapsed real time (so time is continuous after leaving manual mode)
+
+static uint64_t realTime(){
+  static const steady_clock::time_point startTime=steady_clock::now();
+  return(duration_cast<microseconds>(steady_clock::now()-startTime).count()+realOffset);
+}
+
+uint64_t HostSim::now(){
+  return(manualClock?manualTime.load():realTime());
+}
+
+////////////////////////////////
+//       Timer Groups         //
+////////////////////////////////
+
+struct tgTimer_t {
+  boolean running=false;
+  uint32_t divider=2;
+  uint64_t counterBase=0;               // counter value at time baseTime
+  uint64_t baseTime=0;
+  boolean alarmEnabled=false;
+  uint64_t alarm=0;
+  boolean autoReload=false;
+  boolean intrEnabled=false;
+  void (*isr)(void *)=NULL;
+  void *arg=NULL;
+};
+
+static tgTimer_t tgTimers[TIMER_GROUP_MAX][TIMER_MAX];
+
+timg_dev_t TIMERG0;
+timg_dev_t TIMERG1;
+
+static uint64_t tgCounter(tgTimer_t *t, uint64_t time){
+  if(!t->running || time<t->baseTime)
+    return(t->counterBase);
+  return(t->counterBase+(time-t->baseTime)*80/t->divider);         // timers are clocked by 80 MHz APB clock
+}
+
+static void tgRebase(tgTimer_t *t){
+  uint64_t time=HostSim::now();
+  t->counterBase=tgCounter(t,time);
+  t->baseTime=time;
+}
+
+static uint64_t tgDue(tgTimer_t *t){
+  if(!t->running || !t->alarmEnabled || !t->intrEnabled || !t->isr)
+    return(UINT64_MAX);
+  if(t->counterBase>=t->alarm)
+    return(t->baseTime);
+  return(t->baseTime+((t->alarm-t->counterBase)*t->divider+79)/80);
+}
+
+esp_err_t timer_init(timer_group_t group, timer_idx_t idx, const timer_config_t *config){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  tgTimer_t *t=&tgTimers[group][idx];
+  tgRebase(t);
+  t->divider=config->divider<2?2:config->divider;
+  t->alarmEnabled=config->alarm_en;
+  t->autoReload=config->auto_reload;
+  t->running=config->counter_en;
+  return(ESP_OK);
+}
+
+esp_err_t timer_isr_register(timer_group_t group, timer_idx_t idx, void (*fn)(void *), void *arg, int flags, timer_isr_handle_t *handle){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  tgTimers[group][idx].isr=fn;
+  tgTimers[group][idx].arg=arg;
+  return(ESP_OK);
+}
+
+esp_err_t timer_enable_intr(timer_group_t group, timer_idx_t idx){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  tgTimers[group][idx].intrEnabled=true;
+  return(ESP_OK);
+}
+
+esp_err_t timer_disable_intr(timer_group_t group, timer_idx_t idx){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  tgTimers[group][idx].intrEnabled=false;
+  return(ESP_OK);
+}
+
+esp_err_t timer_set_counter_value(timer_group_t group, timer_idx_t idx, uint64_t val){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  tgTimer_t *t=&tgTimers[group][idx];
+  t->counterBase=val;
+  t->baseTime=HostSim::now();
+  return(ESP_OK);
+}
+
+esp_err_t timer_get_counter_value(timer_group_t group, timer_idx_t idx, uint64_t *val){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  *val=tgCounter(&tgTimers[group][idx],HostSim::now());
+  return(ESP_OK);
+}
+
+esp_err_t timer_set_alarm_value(timer_group_t group, timer_idx_t idx, uint64_t val){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  tgTimers[group][idx].alarm=val;
+  return(ESP_OK);
+}
+
+esp_err_t timer_set_alarm(timer_group_t group, timer_idx_t idx, timer_alarm_t alarm){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  tgTimers[group][idx].alarmEnabled=(alarm==TIMER_ALARM_EN);
+  return(ESP_OK);
+}
+
+esp_err_t timer_start(timer_group_t group, timer_idx_t idx){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  tgTimer_t *t=&tgTimers[group][idx];
+  tgRebase(t);
+  t->running=true;
+  return(ESP_OK);
+}
+
+esp_err_t timer_pause(timer_group_t group, timer_idx_t idx){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  tgTimer_t *t=&tgTimers[group][idx];
+  tgRebase(t);
+  t->running=false;
+  return(ESP_OK);
+}
+
+static void tgFire(tgTimer_t *t){
+  t->alarmEnabled=false;                // as on the ESP32, the alarm is disabled when it fires and must be re-enabled
+  if(t->autoReload){
+    t->counterBase=0;
+    t->baseTime=HostSim::now();
+  }
+  t->isr(t->arg);
+}
+
+////////////////////////////////
+//        esp_timers          //
+////////////////////////////////
+
+struct esp_timer {
+  esp_timer_cb_t callback;
+  void *arg;
+  boolean active=false;
+  uint64_t due;
+  uint64_t period;                      // 0 if one-shot
+};
+
+static std::vector<esp_timer *> &hostEspTimers(){
+  static std::vector<esp_timer *> *v=new std::vector<esp_timer *>;
+  return(*v);
+}
+
+#define espTimers hostEspTimers()
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  esp_timer *t=new esp_timer;
+  t->callback=args->callback;
+  t->arg=args->arg;
+  espTimers.push_back(t);
+  *handle=t;
+  return(ESP_OK);
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t t, uint64_t timeout_us){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  if(t->active)
+    return(ESP_ERR_INVALID_STATE);
+  t->due=HostSim::now()+timeout_us;
+  t->period=0;
+  t->active=true;
+  return(ESP_OK);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t t, uint64_t period_us){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  if(t->active)
+    return(ESP_ERR_INVALID_STATE);
+  t->due=HostSim::now()+period_us;
+  t->period=period_us;
+  t->active=true;
+  return(ESP_OK);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t t){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  if(!t->active)
+    return(ESP_ERR_INVALID_STATE);
+  t->active=false;
+  return(ESP_OK);
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t t){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  if(t->active)
+    return(ESP_ERR_INVALID_STATE);
+  espTimers.erase(std::find(espTimers.begin(),espTimers.end(),t));
+  delete t;
+  return(ESP_OK);
+}
+
+int64_t esp_timer_get_time(){
+  return(HostSim::now());
+}
+
+static void espTimerFire(esp_timer *t){
+  if(t->period)
+    t->due+=t->period;
+  else
+    t->active=false;
+  t->callback(t->arg);
+}
+
+////////////////////////////////
+//           Pins             //
+////////////////////////////////
+
+static const int NUM_PINS=40;
+
+struct pin_t {
+  uint8_t mode=0;
+  uint8_t level=LOW;
+  int intrMode=0;
+  void (*isr)(void)=NULL;
+  void (*isrArg)(void *)=NULL;
+  void *arg=NULL;
+};
+
+static pin_t pins[NUM_PINS];
+
+void pinMode(uint8_t pin, uint8_t mode){
+  if(pin>=NUM_PINS)
+    return;
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  pins[pin].mode=mode;
+  if((mode&INPUT) && (mode&PULLUP))
+    pins[pin].level=HIGH;
+  else if((mode&INPUT) && (mode&PULLDOWN))
+    pins[pin].level=LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val){
+  if(pin<NUM_PINS)
+    pins[pin].level=val?HIGH:LOW;
+}
+
+int digitalRead(uint8_t pin){
+  return(pin<NUM_PINS?pins[pin].level:LOW);
+}
+
+int gpio_get_level(gpio_num_t gpio_num){
+  return(gpio_num>=0 && gpio_num<NUM_PINS?pins[gpio_num].level:LOW);
+}
+
+uint16_t analogRead(uint8_t pin){
+  return(digitalRead(pin)?4095:0);
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode){
+  if(pin>=NUM_PINS)
+    return;
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  pins[pin].isr=isr;
+  pins[pin].isrArg=NULL;
+  pins[pin].intrMode=mode;
+}
+
+void attachInterruptArg(uint8_t pin, void (*isr)(void *), void *arg, int mode){
+  if(pin>=NUM_PINS)
+    return;
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  pins[pin].isr=NULL;
+  pins[pin].isrArg=isr;
+  pins[pin].arg=arg;
+  pins[pin].intrMode=mode;
+}
+
+void detachInterrupt(uint8_t pin){
+  if(pin>=NUM_PINS)
+    return;
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  pins[pin].isr=NULL;
+  pins[pin].isrArg=NULL;
+  pins[pin].intrMode=0;
+}
+
+void HostSim::setPin(uint8_t pin, uint8_t level){
+  if(pin>=NUM_PINS)
+    return;
+
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  pin_t *p=pins+pin;
+  level=level?HIGH:LOW;
+  if(p->level==level)
+    return;
+
+  p->level=level;
+  boolean fire=(p->intrMode==CHANGE) || (p->intrMode==RISING && level) || (p->intrMode==FALLING && !level);
+  if(!fire)
+    return;
+  if(p->isr)
+    p->isr();
+  else if(p->isrArg)
+    p->isrArg(p->arg);
+}
+
+int HostSim::getPin(uint8_t pin){
+  return(digitalRead(pin));
+}
+
+////////////////////////////////
+//           LEDC             //
+////////////////////////////////
+
+static uint32_t ledcPendingDuty[LEDC_SPEED_MODE_MAX][LEDC_CHANNEL_MAX];
+static uint32_t ledcDutyValue[LEDC_SPEED_MODE_MAX][LEDC_CHANNEL_MAX];
+static uint32_t ledcTimerFreq[LEDC_SPEED_MODE_MAX][LEDC_TIMER_MAX];
+static uint8_t ledcTimerRes[LEDC_SPEED_MODE_MAX][LEDC_TIMER_MAX];
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *config){
+  if(config->speed_mode>=LEDC_SPEED_MODE_MAX || config->timer_num>=LEDC_TIMER_MAX)
+    return(ESP_ERR_INVALID_ARG);
+  ledcTimerFreq[config->speed_mode][config->timer_num]=config->freq_hz;
+  ledcTimerRes[config->speed_mode][config->timer_num]=config->duty_resolution;
+  return(ESP_OK);
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *config){
+  if(config->speed_mode>=LEDC_SPEED_MODE_MAX || config->channel>=LEDC_CHANNEL_MAX)
+    return(ESP_ERR_INVALID_ARG);
+  ledcPendingDuty[config->speed_mode][config->channel]=config->duty;
+  ledcDutyValue[config->speed_mode][config->channel]=config->duty;
+  return(ESP_OK);
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty){
+  if(mode>=LEDC_SPEED_MODE_MAX || channel>=LEDC_CHANNEL_MAX)
+    return(ESP_ERR_INVALID_ARG);
+  ledcPendingDuty[mode][channel]=duty;
+  return(ESP_OK);
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel){
+  if(mode>=LEDC_SPEED_MODE_MAX || channel>=LEDC_CHANNEL_MAX)
+    return(ESP_ERR_INVALID_ARG);
+  ledcDutyValue[mode][channel]=ledcPendingDuty[mode][channel];
+  return(ESP_OK);
+}
+
+uint32_t ledc_get_duty(ledc_mode_t mode, ledc_channel_t channel){
+  return(ledcDutyValue[mode][channel]);
+}
+
+uint32_t HostSim::ledcDuty(int speedMode, int channel){
+  return(ledcDutyValue[speedMode][channel]);
+}
+
+uint32_t HostSim::ledcFreq(int speedMode, int timer){
+  return(ledcTimerFreq[speedMode][timer]);
+}
+
+uint8_t HostSim::ledcResolution(int speedMode, int timer){
+  return(ledcTimerRes[speedMode][timer]);
+}
+
+////////////////////////////////
+//     Registers & RMT        //
+////////////////////////////////
+
+static const int RMT_CHANNELS=8;
+
+uint32_t hostRmtMem[8*64];
+
+static std::map<uint32_t,uint32_t> &hostRegs(){
+  static std::map<uint32_t,uint32_t> *m=new std::map<uint32_t,uint32_t>;
+  return(*m);
+}
+
+#define regs hostRegs()
+static uint32_t rmtIntRaw=0;
+static uint32_t gpioEnable=0;
+static intr_handler_t rmtIsr=NULL;
+static void *rmtIsrArg=NULL;
+
+struct rmtChannel_t {
+  boolean active=false;
+  boolean endPending=false;             // first entry read at start of transmission is an end-marker
+  int word=0;                           // index of word in channel memory being transmitted
+  int half=0;                           // entry (0=lower 16 bits, 1=upper 16 bits) of word being transmitted
+  uint32_t sent=0;                      // number of words transmitted since start (for threshold events)
+  uint64_t due=UINT64_MAX;              // time current entry completes
+  std::vector<HostSim::rmtPulse_t> output;
+};
+
+static rmtChannel_t rmtChannels[RMT_CHANNELS];
+
+static uint32_t regGet(uint32_t addr){
+  auto r=regs.find(addr);
+  return(r==regs.end()?0:r->second);
+}
+
+static int rmtMemWords(int ch){
+  int nBlocks=(regGet(RMT_CHnCONF0_REG(ch))>>24)&0x0F;
+  if(nBlocks==0 || ch+nBlocks>RMT_CHANNELS)
+    nBlocks=1;
+  return(nBlocks*64);
+}
+
+static uint16_t rmtEntry(int ch, rmtChannel_t *c){
+  uint32_t w=hostRmtMem[ch*64+c->word];
+  return(c->half?(w>>16):(w&0xFFFF));
+}
+
+static uint64_t rmtDuration(int ch, uint16_t entry){
+  uint32_t div=regGet(RMT_CHnCONF0_REG(ch))&0xFF;
+  if(div==0)
+    div=256;
+  uint64_t ticks=(uint64_t)(entry&0x7FFF)*div;
+  if(regGet(RMT_CHnCONF1_REG(ch))&(1<<17))          // REF_ALWAYS_ON: 80 MHz APB clock, else 1 MHz REF_TICK
+    return((ticks+79)/80);
+  return(ticks);
+}
+
+static void rmtStart(int ch){
+  rmtChannel_t *c=rmtChannels+ch;
+  if(regGet(RMT_CHnCONF1_REG(ch))&(1<<3))           // MEM_RD_RST: start reading from beginning of channel memory
+    c->word=0;
+  c->half=0;
+  c->sent=0;
+  c->active=true;
+
+  uint16_t entry=rmtEntry(ch,c);
+  c->endPending=((entry&0x7FFF)==0);
+  c->due=HostSim::now()+(c->endPending?0:rmtDuration(ch,entry));
+}
+
+static void rmtInterrupt(){
+  if((rmtIntRaw&regGet(RMT_INT_ENA_REG)) && rmtIsr)
+    rmtIsr(rmtIsrArg);
+}
+
+static void rmtFire(int ch){
+  rmtChannel_t *c=rmtChannels+ch;
+
+  if(c->endPending){
+    c->active=false;
+    c->due=UINT64_MAX;
+    rmtIntRaw|=1<<(RMT_CH0_TX_END_INT_ST_S+3*ch);
+    rmtInterrupt();
+    return;
+  }
+
+  uint16_t entry=rmtEntry(ch,c);
+  c->output.push_back({(uint8_t)(entry>>15),(uint32_t)rmtDuration(ch,entry)});
+
+  if(++c->half==2){
+    c->half=0;
+    c->sent++;
+    if(++c->word==rmtMemWords(ch))                   // wrap around to start of channel memory
+      c->word=0;
+    uint32_t lim=regGet(RMT_CH0_TX_LIM_REG+4*ch)&RMT_TX_LIM_CH0_V;
+    if(lim && c->sent%lim==0)
+      rmtIntRaw|=1<<(RMT_CH0_TX_THR_EVENT_INT_ST_S+ch);
+  }
+
+  entry=rmtEntry(ch,c);
+  if((entry&0x7FFF)==0){                             // end-marker
+    c->active=false;
+    c->due=UINT64_MAX;
+    rmtIntRaw|=1<<(RMT_CH0_TX_END_INT_ST_S+3*ch);
+  } else {
+    c->due+=rmtDuration(ch,entry);
+  }
+
+  rmtInterrupt();
+}
+
+uint32_t hostRegRead(uint32_t addr){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  switch(addr){
+    case RMT_INT_RAW_REG:
+      return(rmtIntRaw);
+    case RMT_INT_ST_REG:
+      return(rmtIntRaw&regGet(RMT_INT_ENA_REG));
+    case GPIO_ENABLE_W1TS_REG:
+    case GPIO_ENABLE_W1TC_REG:
+      return(gpioEnable);
+  }
+  return(regGet(addr));
+}
+
+void hostRegWrite(uint32_t addr, uint32_t val){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  switch(addr){
+    case RMT_INT_CLR_REG:
+      rmtIntRaw&=~val;
+      return;
+    case RMT_INT_RAW_REG:
+    case RMT_INT_ST_REG:
+      return;
+    case GPIO_ENABLE_W1TS_REG:
+      gpioEnable|=val;
+      return;
+    case GPIO_ENABLE_W1TC_REG:
+      gpioEnable&=~val;
+      return;
+  }
+
+  regs[addr]=val;
+
+  for(int ch=0;ch<RMT_CHANNELS;ch++){
+    if(addr==RMT_CHnCONF1_REG(ch) && (val&1)){        // TX_START
+      rmtStart(ch);
+      return;
+    }
+  }
+}
+
+int esp_intr_alloc(int source, int flags, intr_handler_t handler, void *arg, intr_handle_t *handle){
+  if(source!=ETS_RMT_INTR_SOURCE)
+    return(ESP_ERR_NOT_FOUND);
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  rmtIsr=handler;
+  rmtIsrArg=arg;
+  return(ESP_OK);
+}
+
+std::vector<HostSim::rmtPulse_t> HostSim::rmtOutput(int channel){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  return(rmtChannels[channel].output);
+}
+
+void HostSim::clearRmtOutput(int channel){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  rmtChannels[channel].output.clear();
+}
+
+boolean HostSim::rmtBusy(int channel){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  return(rmtChannels[channel].active);
+}
+
+uint32_t HostSim::gpioOutputEnabled(){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  return(gpioEnable);
+}
+
+////////////////////////////////
+//       Event Handling       //
+////////////////////////////////
+
+// Finds the earliest pending event and, if it is due by time t, handles it.  Returns false if no event is due.
+// Call with isrLock held.
+
+static boolean fireNext(uint64_t t, uint64_t *next=NULL){
+
+  uint64_t due=UINT64_MAX;
+  tgTimer_t *tg=NULL;
+  esp_timer *et=NULL;
+  int rmt=-1;
+
+  for(int g=0;g<TIMER_GROUP_MAX;g++){
+    for(int i=0;i<TIMER_MAX;i++){
+      uint64_t d=tgDue(&tgTimers[g][i]);
+      if(d<due){
+        due=d;
+        tg=&tgTimers[g][i];
+      }
+    }
+  }
+
+  for(auto e : espTimers){
+    if(e->active && e->due<due){
+      due=e->due;
+      tg=NULL;
+      et=e;
+    }
+  }
+
+  for(int ch=0;ch<RMT_CHANNELS;ch++){
+    if(rmtChannels[ch].active && rmtChannels[ch].due<due){
+      due=rmtChannels[ch].due;
+      tg=NULL;
+      et=NULL;
+      rmt=ch;
+    }
+  }
+
+  if(next)
+    *next=due;
+
+  if(due>t)
+    return(false);
+
+  if(manualClock && due>manualTime)
+    manualTime=due;
+
+  if(rmt>=0)
+    rmtFire(rmt);
+  else if(et)
+    espTimerFire(et);
+  else
+    tgFire(tg);
+
+  return(true);
+}
+
+static void interruptThread(){
+
+  while(1){
+    uint64_t next=UINT64_MAX;
+
+    if(!manualClock){
+      std::lock_guard<std::recursive_mutex> lock(isrLock);
+      while(!manualClock && fireNext(realTime(),&next));
+    }
+
+    uint64_t t=HostSim::now();
+    uint64_t wait=(next>t)?next-t:0;
+    std::this_thread::sleep_for(microseconds(wait<1000?wait:1000));     // wake at least every millisecond to pick up newly-scheduled events
+  }
+}
+
+static struct startInterruptThread {
+  startInterruptThread(){std::thread(interruptThread).detach();}
+} startInterruptThread;
+
+void HostSim::useManualClock(boolean manual){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  if(manual && !manualClock){
+    manualTime=realTime();
+    manualClock=true;
+  } else if(!manual && manualClock){
+    realOffset+=manualTime-realTime();
+    manualClock=false;
+  }
+}
+
+void HostSim::advance(uint64_t us){
+  std::lock_guard<std::recursive_mutex> lock(isrLock);
+  if(!manualClock)
+    return;
+  uint64_t target=manualTime+us;
+  while(fireNext(target));
+  manualTime=target;
+}
@@ -0,0 +1,285 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host implementations of WiFi, ESPmDNS, ArduinoOTA, and esp_ota_ops (see WiFi.h, ESPmDNS.h, and ArduinoOTA.h)
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <WiFi.h>
+#include <ESPmDNS.h>
+#include <ArduinoOTA.h>
+#include <esp_ota_ops.h>
+#include <lwip/sockets.h>
+
+WiFiClass WiFi;
+MDNSResponder MDNS;
+ArduinoOTAClass ArduinoOTA;
+
+// Returns port, or the port given by HOMESPAN_PORT if port is 80 (so the port advertised by mDNS matches the port used)
+
+static uint16_t hostPort(uint16_t port){
+  const char *env=getenv("HOMESPAN_PORT");
+  if(port==80 && env && atoi(env)>0)
+    return(atoi(env));
+  return(port);
+}
+
+////////////////////////////////
+//        WiFiClient          //
+////////////////////////////////
+
+// HAPClient initializes its client with WiFiClient(0).  On the ESP32 lwIP sockets are numbered from LWIP_SOCKET_OFFSET, so
+// such a client is simply not connected; on the host descriptors 0-2 are stdin, stdout, and stderr, so they are never adopted.
+
+WiFiClient::WiFiClient(int fd){
+  if(fd>STDERR_FILENO)
+    sock.reset(new int(fd),[](int *s){if(*s>=0) close(*s);delete s;});
+}
+
+int WiFiClient::fd() const {
+  return(sock?*sock:-1);
+}
+
+uint8_t WiFiClient::connected(){
+  if(fd()<0)
+    return(false);
+
+  struct pollfd pfd={fd(),POLLIN,0};
+  if(poll(&pfd,1,0)<=0)
+    return(true);
+  if(pfd.revents&(POLLERR|POLLNVAL))
+    return(false);
+
+  char c;                                                     // readable with no data pending means peer has closed
+  return(recv(fd(),&c,1,MSG_PEEK|MSG_DONTWAIT)>0);
+}
+
+int WiFiClient::available(){
+  int n=0;
+  if(fd()<0 || ioctl(fd(),FIONREAD,&n)<0)
+    return(0);
+  return(n);
+}
+
+int WiFiClient::read(){
+  uint8_t c;
+  return(read(&c,1)==1?c:-1);
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size){
+  if(fd()<0)
+    return(-1);
+  ssize_t n=recv(fd(),buf,size,MSG_DONTWAIT);
+  return(n<0?-1:n);
+}
+
+int WiFiClient::peek(){
+  uint8_t c;
+  if(fd()<0 || recv(fd(),&c,1,MSG_PEEK|MSG_DONTWAIT)!=1)
+    return(-1);
+  return(c);
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size){
+  size_t sent=0;
+  while(fd()>=0 && sent<size){
+    ssize_t n=send(fd(),buf+sent,size-sent,MSG_NOSIGNAL);
+    if(n<0 && errno==EINTR)
+      continue;
+    if(n<=0)
+      break;
+    sent+=n;
+  }
+  return(sent);
+}
+
+void WiFiClient::stop(){
+  if(sock && *sock>=0){
+    close(*sock);
+    *sock=-1;
+  }
+  sock.reset();
+}
+
+int WiFiClient::setNoDelay(bool nodelay){
+  int flag=nodelay;
+  return(fd()>=0?setsockopt(fd(),IPPROTO_TCP,TCP_NODELAY,&flag,sizeof(flag)):-1);
+}
+
+IPAddress WiFiClient::remoteIP() const {
+  struct sockaddr_in addr;
+  socklen_t len=sizeof(addr);
+  if(fd()<0 || getpeername(fd(),(struct sockaddr *)&addr,&len)<0 || addr.sin_family!=AF_INET)
+    return(IPAddress());
+  return(IPAddress(addr.sin_addr.s_addr));
+}
+
+uint16_t WiFiClient::remotePort() const {
+  struct sockaddr_in addr;
+  socklen_t len=sizeof(addr);
+  if(fd()<0 || getpeername(fd(),(struct sockaddr *)&addr,&len)<0 || addr.sin_family!=AF_INET)
+    return(0);
+  return(ntohs(addr.sin_port));
+}
+
+IPAddress WiFiClient::localIP() const {
+  struct sockaddr_in addr;
+  socklen_t len=sizeof(addr);
+  if(fd()<0 || getsockname(fd(),(struct sockaddr *)&addr,&len)<0 || addr.sin_family!=AF_INET)
+    return(IPAddress());
+  return(IPAddress(addr.sin_addr.s_addr));
+}
+
+////////////////////////////////
+//        WiFiServer          //
+////////////////////////////////
+
+WiFiServer::WiFiServer(uint16_t port){
+  this->port=hostPort(port);
+}
+
+void WiFiServer::begin(uint16_t port){
+  if(port)
+    this->port=hostPort(port);
+  end();
+
+  sockfd=socket(AF_INET,SOCK_STREAM,0);
+  if(sockfd<0)
+    return;
+
+  int on=1;
+  setsockopt(sockfd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+  fcntl(sockfd,F_SETFL,fcntl(sockfd,F_GETFL)|O_NONBLOCK);
+
+  struct sockaddr_in addr={};
+  addr.sin_family=AF_INET;
+  addr.sin_addr.s_addr=htonl(INADDR_ANY);
+  addr.sin_port=htons(this->port);
+
+  if(bind(sockfd,(struct sockaddr *)&addr,sizeof(addr))<0 || listen(sockfd,CONFIG_LWIP_MAX_SOCKETS)<0){
+    Serial.printf("\n*** ERROR:  Can't listen on port %d: %s\n\n",this->port,strerror(errno));
+    close(sockfd);
+    sockfd=-1;
+  }
+}
+
+void WiFiServer::end(){
+  if(sockfd>=0)
+    close(sockfd);
+  sockfd=-1;
+}
+
+WiFiClient WiFiServer::available(){
+  if(sockfd<0)
+    return(WiFiClient());
+  int fd=accept(sockfd,NULL,NULL);
+  if(fd<0)
+    return(WiFiClient());
+  return(WiFiClient(fd));
+}
+
+////////////////////////////////
+//         WiFiClass          //
+////////////////////////////////
+
+IPAddress WiFiClass::localIP(){
+  int fd=socket(AF_INET,SOCK_DGRAM,0);                        // "connecting" a UDP socket sends nothing but selects the outgoing interface
+  if(fd<0)
+    return(IPAddress(127,0,0,1));
+
+  struct sockaddr_in addr={};
+  addr.sin_family=AF_INET;
+  addr.sin_addr.s_addr=inet_addr("192.0.2.1");
+  addr.sin_port=htons(9);
+  socklen_t len=sizeof(addr);
+
+  IPAddress ip(127,0,0,1);
+  if(connect(fd,(struct sockaddr *)&addr,sizeof(addr))==0 && getsockname(fd,(struct sockaddr *)&addr,&len)==0)
+    ip=IPAddress(addr.sin_addr.s_addr);
+  close(fd);
+  return(ip);
+}
+
+uint8_t *WiFiClass::BSSID(){
+  static uint8_t bssid[6]={0x02,0x00,0x00,0x00,0x00,0x02};
+  return(bssid);
+}
+
+////////////////////////////////
+//          ESPmDNS           //
+////////////////////////////////
+
+static bool mdnsLog(){
+  return(getenv("HOMESPAN_MDNS_LOG")!=NULL);
+}
+
+bool MDNSResponder::begin(const char *hostName){
+  if(mdnsLog())
+    Serial.printf("[mDNS] host name: %s\n",hostName);
+  return(true);
+}
+
+void MDNSResponder::end(){
+}
+
+void MDNSResponder::setInstanceName(const char *name){
+  if(mdnsLog())
+    Serial.printf("[mDNS] instance name: %s\n",name);
+}
+
+bool MDNSResponder::addService(const char *service, const char *proto, uint16_t port){
+  if(mdnsLog())
+    Serial.printf("[mDNS] service: %s.%s port %d\n",service,proto,hostPort(port));
+  return(true);
+}
+
+esp_err_t mdns_service_txt_item_set(const char *service, const char *proto, const char *key, const char *value){
+  if(mdnsLog())
+    Serial.printf("[mDNS] %s.%s TXT %s=%s\n",service,proto,key,value);
+  return(ESP_OK);
+}
+
+////////////////////////////////
+//        esp_ota_ops         //
+////////////////////////////////
+
+const esp_partition_t *esp_ota_get_running_partition(){
+  static const esp_partition_t running={0,0x10,0x10000,0x140000,"app0",false};
+  return(&running);
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from){
+  return(NULL);
+}
@@ -0,0 +1,69 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Entry point for sketches built for the host: initializes libsodium, makes sure HomeSpan finds WiFi credentials
+//  in NVS (so it starts its HAP server instead of waiting for credentials to be typed in with the 'W' command),
+//  and then calls the sketch's setup() once and loop() forever, as the Arduino-ESP32 core does.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <sodium.h>
+#include <nvs.h>
+
+#include "HomeSpan.h"
+
+void setup();
+void loop();
+
+int main(int argc, char *argv[]){
+
+  setvbuf(stdout,NULL,_IOLBF,0);                                    // Serial output appears line by line, even when redirected
+
+  if(sodium_init()<0){
+    Serial.print("\n*** ERROR:  Can't initialize libsodium\n\n");
+    return(1);
+  }
+
+  nvs_handle wifiNVS;
+  size_t len;
+  nvs_open("WIFI",NVS_READWRITE,&wifiNVS);
+  if(nvs_get_blob(wifiNVS,"WIFIDATA",NULL,&len)){                   // no WiFi credentials saved - store placeholders (the host is always connected)
+    auto wifiData=homeSpan.network.wifiData;
+    strcpy(wifiData.ssid,"HomeSpanHost");
+    nvs_set_blob(wifiNVS,"WIFIDATA",&wifiData,sizeof(wifiData));
+    nvs_commit(wifiNVS);
+  }
+  nvs_close(wifiNVS);
+
+  setup();
+  while(1){
+    loop();
+    yield();
+  }
+}
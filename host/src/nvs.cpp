@@ -0,0 +1,295 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Host implementation of NVS (see nvs.h).  Each namespace is held in memory as the set of values last committed
+//  plus a working copy that nvs_set_*() and nvs_erase_*() modify (and that nvs_get_*() reads, as on the ESP32).
+//  nvs_commit() writes the working copy to a temporary file and renames it over the namespace's file, so a program
+//  stopped part-way through a commit leaves the previous contents intact.
+//
+//  File format (per entry):  type (1 byte), key length (1 byte), key, value length (4 bytes), value
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <string>
+
+#include <nvs_flash.h>
+#include <HostSim.h>
+
+enum {TYPE_U8=1, TYPE_STR=2, TYPE_BLOB=3};
+
+struct nvsValue_t {
+  uint8_t type;
+  std::vector<uint8_t> data;
+};
+
+typedef std::map<std::string,nvsValue_t> nvsMap_t;
+
+struct nvsNamespace_t {
+  std::string name;
+  nvsMap_t working;
+  nvsMap_t committed;
+};
+
+static std::mutex nvsMutex;
+static std::map<std::string,nvsNamespace_t> namespaces;                   // std::map never moves its elements, so handles can point into it
+static std::vector<std::pair<nvsNamespace_t *,nvs_open_mode>> handles;      // handle n refers to handles[n-1]
+static bool memoryOnly=false;
+static bool failCommits=false;
+
+static const size_t MAX_KEY_LEN=15;
+
+static std::string nvsDir(){
+  const char *env=getenv("HOMESPAN_NVS_DIR");
+  return(env?env:"homespan-nvs");
+}
+
+static std::string nvsFile(const std::string &name){
+  return(nvsDir()+"/"+name+".nvs");
+}
+
+static void loadNamespace(nvsNamespace_t *ns){
+  ns->committed.clear();
+  FILE *f=memoryOnly?NULL:fopen(nvsFile(ns->name).c_str(),"rb");
+  if(f){
+    uint8_t hdr[2];
+    while(fread(hdr,1,2,f)==2){
+      std::string key(hdr[1],'\0');
+      uint32_t len;
+      if(fread(&key[0],1,hdr[1],f)!=hdr[1] || fread(&len,sizeof(len),1,f)!=1)
+        break;
+      nvsValue_t v{hdr[0],std::vector<uint8_t>(len)};
+      if(len && fread(v.data.data(),1,len,f)!=len)
+        break;
+      ns->committed[key]=v;
+    }
+    fclose(f);
+  }
+  ns->working=ns->committed;
+}
+
+static bool saveNamespace(nvsNamespace_t *ns){
+  if(memoryOnly)
+    return(true);
+
+  mkdir(nvsDir().c_str(),0755);
+  std::string tmp=nvsFile(ns->name)+".tmp";
+  FILE *f=fopen(tmp.c_str(),"wb");
+  if(!f)
+    return(false);
+
+  bool ok=true;
+  for(auto &kv : ns->working){
+    uint8_t hdr[2]={kv.second.type,(uint8_t)kv.first.length()};
+    uint32_t len=kv.second.data.size();
+    ok=ok && fwrite(hdr,1,2,f)==2 && fwrite(kv.first.data(),1,hdr[1],f)==hdr[1] && fwrite(&len,sizeof(len),1,f)==1 && (!len || fwrite(kv.second.data.data(),1,len,f)==len);
+  }
+  ok=(fflush(f)==0) && ok;
+  fsync(fileno(f));
+  ok=(fclose(f)==0) && ok;
+
+  if(!ok || rename(tmp.c_str(),nvsFile(ns->name).c_str())!=0){
+    unlink(tmp.c_str());
+    return(false);
+  }
+  return(true);
+}
+
+static nvsNamespace_t *getNamespace(nvs_handle handle, bool write=false){
+  if(handle==0 || handle>handles.size())
+    return(NULL);
+  if(write && handles[handle-1].second==NVS_READONLY)
+    return(NULL);
+  return(handles[handle-1].first);
+}
+
+static esp_err_t getValue(nvs_handle handle, const char *key, uint8_t type, nvsValue_t **value){
+  nvsNamespace_t *ns=getNamespace(handle);
+  if(!ns)
+    return(ESP_ERR_NVS_INVALID_HANDLE);
+  if(strlen(key)>MAX_KEY_LEN)
+    return(ESP_ERR_NVS_KEY_TOO_LONG);
+  auto v=ns->working.find(key);
+  if(v==ns->working.end() || v->second.type!=type)                  // as on the ESP32, values are looked up by key and type
+    return(ESP_ERR_NVS_NOT_FOUND);
+  *value=&v->second;
+  return(ESP_OK);
+}
+
+static esp_err_t setValue(nvs_handle handle, const char *key, uint8_t type, const void *data, size_t len){
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  nvsNamespace_t *ns=getNamespace(handle);
+  if(!ns)
+    return(ESP_ERR_NVS_INVALID_HANDLE);
+  if(!getNamespace(handle,true))
+    return(ESP_ERR_NVS_READ_ONLY);
+  if(strlen(key)>MAX_KEY_LEN)
+    return(ESP_ERR_NVS_KEY_TOO_LONG);
+  ns->working[key]={type,std::vector<uint8_t>((const uint8_t *)data,(const uint8_t *)data+len)};
+  return(ESP_OK);
+}
+
+static esp_err_t getVariable(nvs_handle handle, const char *key, uint8_t type, void *out, size_t *length){
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  nvsValue_t *v;
+  esp_err_t err=getValue(handle,key,type,&v);
+  if(err)
+    return(err);
+  if(!out){                                                  // caller is asking for length only
+    *length=v->data.size();
+    return(ESP_OK);
+  }
+  if(*length<v->data.size()){
+    *length=v->data.size();
+    return(ESP_ERR_NVS_INVALID_LENGTH);
+  }
+  memcpy(out,v->data.data(),v->data.size());
+  *length=v->data.size();
+  return(ESP_OK);
+}
+
+esp_err_t nvs_flash_init(){
+  return(ESP_OK);
+}
+
+esp_err_t nvs_flash_erase(){
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  for(auto &ns : namespaces){
+    ns.second.working.clear();
+    ns.second.committed.clear();
+  }
+  if(memoryOnly)
+    return(ESP_OK);
+
+  DIR *dir=opendir(nvsDir().c_str());
+  if(!dir)
+    return(ESP_OK);
+  while(struct dirent *e=readdir(dir)){
+    std::string name=e->d_name;
+    if(name.size()>4 && name.compare(name.size()-4,4,".nvs")==0)
+      unlink((nvsDir()+"/"+name).c_str());
+  }
+  closedir(dir);
+  return(ESP_OK);
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode mode, nvs_handle *handle){
+  if(strlen(name)>MAX_KEY_LEN)
+    return(ESP_ERR_NVS_INVALID_NAME);
+
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  bool found=namespaces.count(name);
+  nvsNamespace_t *ns=&namespaces[name];
+  if(!found){
+    ns->name=name;
+    loadNamespace(ns);
+  }
+  handles.push_back({ns,mode});
+  *handle=handles.size();
+  return(ESP_OK);
+}
+
+void nvs_close(nvs_handle handle){
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out, size_t *length){
+  return(getVariable(handle,key,TYPE_BLOB,out,length));
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length){
+  return(setValue(handle,key,TYPE_BLOB,value,length));
+}
+
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *out, size_t *length){
+  return(getVariable(handle,key,TYPE_STR,out,length));
+}
+
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value){
+  return(setValue(handle,key,TYPE_STR,value,strlen(value)+1));           // length includes terminating null, as on the ESP32
+}
+
+esp_err_t nvs_get_u8(nvs_handle handle, const char *key, uint8_t *out){
+  size_t len=1;
+  return(getVariable(handle,key,TYPE_U8,out,&len));
+}
+
+esp_err_t nvs_set_u8(nvs_handle handle, const char *key, uint8_t value){
+  return(setValue(handle,key,TYPE_U8,&value,1));
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key){
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  nvsNamespace_t *ns=getNamespace(handle);
+  if(!ns)
+    return(ESP_ERR_NVS_INVALID_HANDLE);
+  if(!getNamespace(handle,true))
+    return(ESP_ERR_NVS_READ_ONLY);
+  return(ns->working.erase(key)?ESP_OK:ESP_ERR_NVS_NOT_FOUND);
+}
+
+esp_err_t nvs_erase_all(nvs_handle handle){
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  nvsNamespace_t *ns=getNamespace(handle);
+  if(!ns)
+    return(ESP_ERR_NVS_INVALID_HANDLE);
+  if(!getNamespace(handle,true))
+    return(ESP_ERR_NVS_READ_ONLY);
+  ns->working.clear();
+  return(ESP_OK);
+}
+
+esp_err_t nvs_commit(nvs_handle handle){
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  nvsNamespace_t *ns=getNamespace(handle);
+  if(!ns)
+    return(ESP_ERR_NVS_INVALID_HANDLE);
+  if(failCommits || !saveNamespace(ns))
+    return(ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+  ns->committed=ns->working;
+  return(ESP_OK);
+}
+
+void HostSim::useMemoryNvs(){
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  memoryOnly=true;
+  for(auto &ns : namespaces){
+    ns.second.working.clear();
+    ns.second.committed.clear();
+  }
+}
+
+void HostSim::failNvsCommits(boolean fail){
+  std::lock_guard<std::mutex> lock(nvsMutex);
+  failCommits=fail;
+}
@@ -0,0 +1,93 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Minimal unit-test framework for the host build.  Each test file defines its tests with TEST(name){...}, checks
+//  conditions with CHECK(), CHECK_EQ(), and CHECK_NEAR() (which report the failure and continue), and ends with
+//  HOSTTEST_MAIN.  The executable runs every test in file order and exits non-zero if any check failed, so that
+//  each file can be registered with ctest.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+#include <sstream>
+
+namespace HostTest {
+
+struct test_t {
+  const char *name;
+  void (*fn)();
+};
+
+inline std::vector<test_t> &tests(){
+  static std::vector<test_t> t;
+  return(t);
+}
+
+inline int &failures(){
+  static int n=0;
+  return(n);
+}
+
+struct Registrar {
+  Registrar(const char *name, void (*fn)()){tests().push_back({name,fn});}
+};
+
+template <class A, class B> void checkEq(const A &a, const B &b, const char *exprA, const char *exprB, const char *file, int line){
+  if(a==b)
+    return;
+  std::ostringstream sa, sb;
+  sa << +a;
+  sb << +b;
+  printf("  %s:%d: CHECK_EQ(%s, %s) failed: %s != %s\n",file,line,exprA,exprB,sa.str().c_str(),sb.str().c_str());
+  failures()++;
+}
+
+inline int runAll(){
+  for(auto &t : tests()){
+    int before=failures();
+    printf("[ RUN  ] %s\n",t.name);
+    t.fn();
+    printf("[ %s ] %s\n",failures()==before?" OK ":"FAIL",t.name);
+  }
+  printf("\n%d test(s), %d failed check(s)\n",(int)tests().size(),failures());
+  return(failures()?1:0);
+}
+
+}
+
+#define TEST(name) static void name(); static HostTest::Registrar name##_registrar(#name,name); static void name()
+
+#define CHECK(cond) do { if(!(cond)){ printf("  %s:%d: CHECK(%s) failed\n",__FILE__,__LINE__,#cond); HostTest::failures()++; } } while(0)
+#define CHECK_EQ(a,b) HostTest::checkEq((a),(b),#a,#b,__FILE__,__LINE__)
+#define CHECK_NEAR(a,b,tol) do { double _a=(a), _b=(b); if(fabs(_a-_b)>(tol)){ printf("  %s:%d: CHECK_NEAR(%s, %s, %s) failed: %g vs %g\n",__FILE__,__LINE__,#a,#b,#tol,_a,_b); HostTest::failures()++; } } while(0)
+
+#define HOSTTEST_MAIN int main(){return(HostTest::runAll());}
@@ -0,0 +1,139 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of Backoff (Utils.h), the jittered exponential backoff policy Span::checkConnect() uses between WiFi
+//  connection attempts
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HostTest.h"
+#include <Utils.h>
+
+TEST(doubling){
+  Backoff b(1000,32000,0);
+  uint32_t expect[]={1000,2000,4000,8000,16000,32000,32000,32000};
+  for(int i=0;i<8;i++){
+    CHECK_EQ(b.attempts(),(uint32_t)i);
+    CHECK_EQ(b.atMax(),i>=5);
+    CHECK_EQ(b.next(12345),expect[i]);                // r has no effect without jitter
+  }
+  CHECK_EQ(b.attempts(),8u);
+
+  b.config(1000,5000,0);                              // maximum that is not a power-of-two multiple of the minimum
+  CHECK_EQ(b.next(0),1000u);
+  CHECK_EQ(b.next(0),2000u);
+  CHECK_EQ(b.next(0),4000u);
+  CHECK_EQ(b.next(0),5000u);
+  CHECK_EQ(b.next(0),5000u);
+
+  b.config(1,0xF0000000,0);                           // doubling near the top of the range does not overflow
+  uint32_t prev=0;
+  for(int i=0;i<40;i++){
+    uint32_t d=b.next(0);
+    CHECK(d>=prev && d<=0xF0000000);
+    prev=d;
+  }
+  CHECK_EQ(prev,0xF0000000u);
+}
+
+TEST(reset){
+  Backoff b(500,60000,20);
+  for(int i=0;i<10;i++)
+    b.next(i);
+  CHECK(b.atMax());
+  b.reset();
+  CHECK_EQ(b.attempts(),0u);
+  CHECK(!b.atMax());
+  CHECK_EQ(b.next(0),500u);
+  CHECK_EQ(b.next(0),1000u);
+
+  b.config(2000,8000,0);                              // re-configuring also resets
+  CHECK_EQ(b.attempts(),0u);
+  CHECK_EQ(b.next(0),2000u);
+}
+
+TEST(jitterBounds){
+  Backoff b(1000,32000,25);
+  uint32_t base=1000;
+  for(int i=0;i<8;i++){
+    uint32_t span=base/4;
+    uint32_t lo=base-span<1000?1000:base-span;
+    for(uint32_t r : {0u,1u,span-1,span,span+1,0x7FFFFFFFu,0xFFFFFFFFu}){
+      b.config(1000,32000,25);
+      for(int k=0;k<i;k++)
+        b.next(0);
+      uint32_t d=b.next(r);
+      CHECK(d>=lo && d<=base);
+      if(r<=span)
+        CHECK_EQ(d,(base-r<1000?1000:base-r));       // shortened by exactly r (up to the jitter span)
+    }
+    base=base*2>32000?32000:base*2;
+  }
+}
+
+TEST(jitterFloor){
+  Backoff b(1000,8000,100);                           // full jitter could shorten a delay to zero...
+  for(uint32_t r=0;r<=1000;r++){
+    b.reset();
+    CHECK_EQ(b.next(r),1000u);                        // ...but never below the minimum
+  }
+  b.reset();
+  b.next(0);
+  CHECK_EQ(b.next(2000),1000u);
+  CHECK_EQ(b.next(1000),3000u);
+}
+
+TEST(config){
+  Backoff b(0,0,200);                                 // minimum of at least 1 ms, maximum of at least the minimum, jitter of at most 100%
+  for(int i=0;i<5;i++)
+    CHECK_EQ(b.next(0xFFFFFFFF),1u);
+  CHECK(b.atMax());
+
+  b.config(5000,1000,0);
+  CHECK_EQ(b.next(0),5000u);
+  CHECK_EQ(b.next(0),5000u);
+  CHECK(b.atMax());
+}
+
+TEST(hardwareRandom){
+  Backoff b(1000,16000,50);
+  const int N=20000;
+  double sum=0;
+  for(int i=0;i<N;i++){
+    b.reset();
+    for(int k=0;k<4;k++)
+      b.next();
+    uint32_t d=b.next();                              // base delay of 16000, shortened by up to 8000
+    CHECK(d>=8000 && d<=16000);
+    sum+=d;
+  }
+  CHECK_NEAR(sum/N,12000,200);                        // spread evenly across the jitter span
+}
+
+HOSTTEST_MAIN
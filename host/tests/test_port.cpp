@@ -0,0 +1,221 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of the host port itself: simulated clock, timers, pins, NVS, and sockets
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "HostTest.h"
+#include <HostSim.h>
+#include <driver/timer.h>
+#include <esp_timer.h>
+#include <nvs_flash.h>
+#include <WiFi.h>
+#include <lwip/sockets.h>
+
+TEST(manualClock){
+  HostSim::useManualClock();
+  HostSim::advance(1000-HostSim::now()%1000);          // start on a millisecond boundary (the clock is frozen at an arbitrary real time)
+  uint32_t t0=millis();
+  delay(250);
+  CHECK_EQ(millis()-t0,250u);
+  HostSim::advance(1500);
+  CHECK_EQ(millis()-t0,251u);
+}
+
+static int tgCount=0;
+static void tgIsr(void *arg){
+  tgCount++;
+  TIMERG0.int_clr_timers.t0=1;
+  timer_set_alarm(TIMER_GROUP_0,TIMER_0,TIMER_ALARM_EN);
+}
+
+TEST(timerGroupAlarm){
+  HostSim::useManualClock();
+  timer_config_t conf={};
+  conf.divider=80;                                   // 1 tick per microsecond
+  conf.counter_en=TIMER_PAUSE;
+  conf.alarm_en=TIMER_ALARM_EN;
+  conf.auto_reload=TIMER_AUTORELOAD_EN;
+  timer_init(TIMER_GROUP_0,TIMER_0,&conf);
+  timer_set_counter_value(TIMER_GROUP_0,TIMER_0,0);
+  timer_set_alarm_value(TIMER_GROUP_0,TIMER_0,1000);
+  timer_isr_register(TIMER_GROUP_0,TIMER_0,tgIsr,NULL,0,NULL);
+  timer_enable_intr(TIMER_GROUP_0,TIMER_0);
+  timer_start(TIMER_GROUP_0,TIMER_0);
+
+  HostSim::advance(999);
+  CHECK_EQ(tgCount,0);
+  HostSim::advance(1);
+  CHECK_EQ(tgCount,1);
+  HostSim::advance(10000);
+  CHECK_EQ(tgCount,11);
+  timer_pause(TIMER_GROUP_0,TIMER_0);
+  HostSim::advance(10000);
+  CHECK_EQ(tgCount,11);
+}
+
+static std::vector<uint64_t> espTimes;
+static void espCallback(void *arg){
+  espTimes.push_back(HostSim::now());
+}
+
+TEST(espTimerPeriodic){
+  HostSim::useManualClock();
+  esp_timer_create_args_t args={espCallback,NULL,ESP_TIMER_TASK,"test"};
+  esp_timer_handle_t t;
+  esp_timer_create(&args,&t);
+  uint64_t start=HostSim::now();
+  esp_timer_start_periodic(t,300);
+  HostSim::advance(1000);
+  esp_timer_stop(t);
+  HostSim::advance(1000);
+  CHECK_EQ(espTimes.size(),3u);
+  for(int i=0;i<(int)espTimes.size();i++)
+    CHECK_EQ(espTimes[i]-start,300u*(i+1));
+  CHECK_EQ(esp_timer_delete(t),ESP_OK);
+}
+
+static int pinEdges=0;
+static void pinIsr(){
+  pinEdges++;
+}
+
+TEST(pinInterrupts){
+  pinMode(4,INPUT_PULLUP);
+  CHECK_EQ(digitalRead(4),HIGH);
+  attachInterrupt(4,pinIsr,FALLING);
+  HostSim::setPin(4,LOW);
+  HostSim::setPin(4,LOW);                           // no change - no interrupt
+  HostSim::setPin(4,HIGH);
+  HostSim::setPin(4,LOW);
+  CHECK_EQ(pinEdges,2);
+  detachInterrupt(4);
+  HostSim::setPin(4,HIGH);
+  HostSim::setPin(4,LOW);
+  CHECK_EQ(pinEdges,2);
+}
+
+TEST(nvsFile){
+  char dir[]="/tmp/homespan-nvs-XXXXXX";
+  CHECK(mkdtemp(dir)!=NULL);
+  setenv("HOMESPAN_NVS_DIR",dir,1);
+
+  nvs_handle h;
+  CHECK_EQ(nvs_open("TEST",NVS_READWRITE,&h),ESP_OK);
+  CHECK_EQ(nvs_set_str(h,"NAME","HomeSpan"),ESP_OK);
+  std::string file=std::string(dir)+"/TEST.nvs";
+  struct stat st;
+  CHECK(stat(file.c_str(),&st)!=0);                 // nothing written until committed
+  CHECK_EQ(nvs_commit(h),ESP_OK);
+  CHECK(stat(file.c_str(),&st)==0 && st.st_size>0);
+
+  nvs_flash_erase();
+  CHECK(stat(file.c_str(),&st)!=0);
+  rmdir(dir);
+}
+
+TEST(nvsMemory){
+  HostSim::useMemoryNvs();
+  nvs_handle h;
+  nvs_open("TEST",NVS_READWRITE,&h);
+
+  uint8_t blob[5]={1,2,3,4,5};
+  CHECK_EQ(nvs_set_blob(h,"BLOB",blob,sizeof(blob)),ESP_OK);
+  size_t len=0;
+  CHECK_EQ(nvs_get_blob(h,"BLOB",NULL,&len),ESP_OK);
+  CHECK_EQ(len,5u);
+  uint8_t out[5]={};
+  len=4;
+  CHECK_EQ(nvs_get_blob(h,"BLOB",out,&len),ESP_ERR_NVS_INVALID_LENGTH);
+  len=5;
+  CHECK_EQ(nvs_get_blob(h,"BLOB",out,&len),ESP_OK);
+  CHECK(!memcmp(out,blob,5));
+  CHECK_EQ(nvs_get_str(h,"BLOB",NULL,&len),ESP_ERR_NVS_NOT_FOUND);     // values are typed
+
+  nvs_set_str(h,"STR","abc");
+  CHECK_EQ(nvs_get_str(h,"STR",NULL,&len),ESP_OK);
+  CHECK_EQ(len,4u);                                 // includes terminating null
+
+  CHECK_EQ(nvs_set_u8(h,"ThisKeyIsTooLong",1),ESP_ERR_NVS_KEY_TOO_LONG);
+
+  HostSim::failNvsCommits(true);
+  CHECK(nvs_commit(h)!=ESP_OK);
+  HostSim::failNvsCommits(false);
+  CHECK_EQ(nvs_commit(h),ESP_OK);
+  CHECK_EQ(nvs_erase_key(h,"STR"),ESP_OK);
+  CHECK_EQ(nvs_erase_key(h,"STR"),ESP_ERR_NVS_NOT_FOUND);
+}
+
+TEST(sockets){
+  HostSim::useManualClock(false);
+  uint16_t port=40000+getpid()%20000;
+  WiFiServer server(port);
+  server.begin();
+  CHECK(server);
+
+  int fd=socket(AF_INET,SOCK_STREAM,0);
+  struct sockaddr_in addr={};
+  addr.sin_family=AF_INET;
+  addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+  addr.sin_port=htons(port);
+  CHECK_EQ(connect(fd,(struct sockaddr *)&addr,sizeof(addr)),0);
+
+  WiFiClient client;
+  for(int i=0;i<100 && !(client=server.available());i++)
+    delay(10);
+  CHECK(client.connected());
+  CHECK(client.remoteIP()==IPAddress(127,0,0,1));
+
+  CHECK_EQ(send(fd,"ping",4,0),4);
+  for(int i=0;i<100 && client.available()<4;i++)
+    delay(10);
+  CHECK_EQ(client.available(),4);
+  uint8_t buf[8];
+  CHECK_EQ(client.read(buf,sizeof(buf)),4);
+  CHECK(!memcmp(buf,"ping",4));
+
+  client.print("pong");
+  CHECK_EQ(recv(fd,buf,sizeof(buf),0),4);
+  CHECK(!memcmp(buf,"pong",4));
+
+  close(fd);
+  for(int i=0;i<100 && client.connected();i++)
+    delay(10);
+  CHECK(!client.connected());
+
+  WiFiClient unused=0;                                  // as HAPClient initializes its client: not connected, and does not adopt stdin
+  CHECK(!unused);
+  CHECK_EQ(unused.fd(),-1);
+}
+
+HOSTTEST_MAIN
@@ -0,0 +1,228 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of PushButton (Utils.h): debouncing and Single/Double/Long press classification from synthetic edge
+//  sequences.  Edges are driven with HostSim::setPin() on the manual clock, so the interrupt handler timestamps
+//  each one exactly when it occurs, and the classifier is checked both when polled every millisecond and when
+//  polled only long after the edges (as from a slow loop()).
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HostTest.h"
+#include <HostSim.h>
+#include <Utils.h>
+
+static const uint16_t SINGLE_TIME=5;                  // the times SpanButton uses by default
+static const uint16_t LONG_TIME=2000;
+static const uint16_t DOUBLE_TIME=200;
+
+struct event_t {
+  int type;                                           // PushButton::SINGLE, DOUBLE, or LONG
+  uint32_t time;                                      // time (in ms since start of test) it was triggered
+};
+
+static uint32_t t0;                                   // millis() at start of test
+
+// Starts a test on a millisecond boundary, with a new button on pin (released)
+
+static void begin(PushButton &b, uint8_t pin){
+  HostSim::useManualClock();
+  HostSim::advance(1000-HostSim::now()%1000);
+  HostSim::setPin(pin,HIGH);
+  b.init(pin);
+  b.reset();
+  t0=millis();
+}
+
+// Drives pin at time t (in ms since start of test), where t may include fractions of a millisecond
+
+static void drive(uint8_t pin, uint8_t level, double t){
+  uint64_t due=(uint64_t)t0*1000+(uint64_t)(t*1000);
+  if(due>HostSim::now())
+    HostSim::advance(due-HostSim::now());
+  HostSim::setPin(pin,level);
+}
+
+// Polls button every millisecond until time t, returning events triggered
+
+static std::vector<event_t> poll(PushButton &b, uint32_t t){
+  std::vector<event_t> events;
+  while(millis()-t0<t){
+    HostSim::advance(1000);
+    if(b.triggered(SINGLE_TIME,LONG_TIME,DOUBLE_TIME))
+      events.push_back({b.type(),(uint32_t)(millis()-t0)});
+  }
+  return(events);
+}
+
+// Polls button once, after advancing to time t, returning every event triggered
+
+static std::vector<event_t> pollOnce(PushButton &b, uint32_t t){
+  std::vector<event_t> events;
+  HostSim::advance(((uint64_t)t0+t-millis())*1000);
+  while(b.triggered(SINGLE_TIME,LONG_TIME,DOUBLE_TIME))
+    events.push_back({b.type(),(uint32_t)(millis()-t0)});
+  return(events);
+}
+
+TEST(singlePress){
+  PushButton b;
+  begin(b,4);
+  drive(4,LOW,0);
+  drive(4,HIGH,100);
+  auto events=poll(b,1000);
+  CHECK_EQ(events.size(),1u);
+  CHECK_EQ(events[0].type,PushButton::SINGLE);
+  CHECK_EQ(events[0].time,206u);                      // as soon as a second press can no longer start a Double Press
+}
+
+TEST(doublePress){
+  PushButton b;
+  begin(b,4);
+  drive(4,LOW,0);
+  drive(4,HIGH,50);
+  drive(4,LOW,150);
+  auto events=poll(b,300);
+  drive(4,HIGH,300);
+  auto after=poll(b,1000);
+  CHECK_EQ(events.size(),1u);
+  CHECK_EQ(events[0].type,PushButton::DOUBLE);
+  CHECK_EQ(events[0].time,156u);                      // as soon as second press has been held for singleTime
+  CHECK_EQ(after.size(),0u);
+}
+
+TEST(longPress){
+  PushButton b;
+  begin(b,4);
+  drive(4,LOW,0);
+  auto events=poll(b,4500);
+  drive(4,HIGH,4500);
+  auto after=poll(b,5000);
+  CHECK_EQ(events.size(),2u);                         // repeats every longTime while held
+  CHECK_EQ(events[0].type,PushButton::LONG);
+  CHECK_EQ(events[0].time,2001u);
+  CHECK_EQ(events[1].type,PushButton::LONG);
+  CHECK_EQ(events[1].time,4002u);
+  CHECK_EQ(after.size(),0u);                          // no Single Press on release
+}
+
+TEST(bounces){
+  PushButton b;
+  begin(b,4);
+  drive(4,LOW,0);                                     // contacts bounce on press...
+  drive(4,HIGH,0.4);
+  drive(4,LOW,1.1);
+  drive(4,HIGH,2.5);
+  drive(4,LOW,4);
+  drive(4,HIGH,100);                                  // ...and on release
+  drive(4,LOW,101);
+  drive(4,HIGH,102.5);
+  auto events=poll(b,1000);
+  CHECK_EQ(events.size(),1u);
+  CHECK_EQ(events[0].type,PushButton::SINGLE);
+  CHECK_EQ(events[0].time,210u);                      // press and release are timed from the last bounce of each
+
+  drive(4,LOW,1000);                                  // glitch shorter than the debounce time is ignored
+  drive(4,HIGH,1003);
+  events=poll(b,2000);
+  CHECK_EQ(events.size(),0u);
+}
+
+TEST(slowLoop){
+  PushButton b;
+  begin(b,4);
+  drive(4,LOW,0);                                     // a Double Press, entirely between two calls to triggered()
+  drive(4,HIGH,50);
+  drive(4,LOW,150);
+  drive(4,HIGH,210);
+  auto events=pollOnce(b,1000);
+  CHECK_EQ(events.size(),1u);
+  CHECK_EQ(events[0].type,PushButton::DOUBLE);
+
+  drive(4,LOW,1000);                                  // two Single Presses, too far apart to be a Double Press
+  drive(4,HIGH,1100);
+  drive(4,LOW,1400);
+  drive(4,HIGH,1500);
+  events=pollOnce(b,3000);
+  CHECK_EQ(events.size(),2u);
+  CHECK(events.size()==2 && events[0].type==PushButton::SINGLE && events[1].type==PushButton::SINGLE);
+
+  drive(4,LOW,3000);                                  // a Long Press, released before the next call
+  drive(4,HIGH,5500);
+  events=pollOnce(b,6000);
+  CHECK_EQ(events.size(),1u);
+  CHECK(events.size()==1 && events[0].type==PushButton::LONG);
+}
+
+TEST(queueOverflow){
+  PushButton b;
+  begin(b,4);
+  for(int i=0;i<40;i++)                               // far more edges than the queue holds
+    drive(4,i%2?HIGH:LOW,i*0.2);
+  drive(4,LOW,10);
+  auto events=poll(b,3000);
+  CHECK(events.size()>=1);
+  for(auto &e : events)
+    CHECK_EQ(e.type,PushButton::LONG);                // button re-synchronizes with its state rather than inventing presses
+  drive(4,HIGH,3000);
+  events=poll(b,4000);
+  CHECK_EQ(events.size(),0u);
+}
+
+TEST(primed){
+  PushButton b;
+  begin(b,4);
+  drive(4,LOW,0);
+  poll(b,3);
+  CHECK(!b.primed());                                 // not yet held for singleTime
+  poll(b,10);
+  CHECK(b.primed());
+  CHECK(!b.primed());                                 // only once per press
+  drive(4,HIGH,100);
+  auto events=poll(b,1000);
+  CHECK_EQ(events.size(),1u);
+  CHECK_EQ(events[0].type,PushButton::SINGLE);
+
+  drive(4,LOW,1000);
+  poll(b,1010);
+  CHECK(b.primed());                                  // primed again by the next press
+}
+
+TEST(resetDiscardsEdges){
+  PushButton b;
+  begin(b,4);
+  drive(4,LOW,0);
+  drive(4,HIGH,100);
+  HostSim::advance(10000);
+  b.reset();
+  auto events=poll(b,1000);
+  CHECK_EQ(events.size(),0u);
+}
+
+HOSTTEST_MAIN
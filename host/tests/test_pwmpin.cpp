@@ -0,0 +1,401 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of PwmPin: easing curves and fades (driven by the manual clock, with the duty read back from the simulated
+//  LEDC channel), resolution solving, timer sharing, and gamma tables.  Ends with a comparison of the fixed-point and
+//  batch HSVtoRGB() conversions against the floating-point one, for accuracy and speed.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+
+#include "HostTest.h"
+#include <HostSim.h>
+#include <PwmPin.h>
+
+static const uint8_t CURVES[]={PwmPin::LINEAR,PwmPin::EASE_IN,PwmPin::EASE_OUT,PwmPin::EASE_IN_OUT};
+
+TEST(easeEndpoints){
+  for(uint8_t c : CURVES){
+    CHECK_EQ(PwmPin::ease(0,c),0.0f);
+    CHECK_EQ(PwmPin::ease(1,c),1.0f);
+    CHECK_EQ(PwmPin::ease(-0.5,c),0.0f);             // clamped outside 0-1
+    CHECK_EQ(PwmPin::ease(1.5,c),1.0f);
+  }
+  CHECK_NEAR(PwmPin::ease(0.5,PwmPin::LINEAR),0.5,1e-6);
+  CHECK_NEAR(PwmPin::ease(0.5,PwmPin::EASE_IN),0.25,1e-6);
+  CHECK_NEAR(PwmPin::ease(0.5,PwmPin::EASE_OUT),0.75,1e-6);
+  CHECK_NEAR(PwmPin::ease(0.5,PwmPin::EASE_IN_OUT),0.5,1e-6);
+}
+
+TEST(easeShape){
+  const int N=1000;
+  for(uint8_t c : CURVES){
+    float prev=0;
+    for(int i=1;i<=N;i++){
+      float t=(float)i/N;
+      float f=PwmPin::ease(t,c);
+      CHECK(f>=prev);                                 // never moves backwards
+      CHECK(f-prev<=3.0/N);                           // and never jumps (steepest slope of any curve is 3)
+      prev=f;
+    }
+  }
+  for(int i=0;i<=N;i++){
+    float t=(float)i/N;
+    CHECK_NEAR(PwmPin::ease(t,PwmPin::EASE_OUT),1-PwmPin::ease(1-t,PwmPin::EASE_IN),1e-5);        // mirror images
+    CHECK_NEAR(PwmPin::ease(t,PwmPin::EASE_IN_OUT),1-PwmPin::ease(1-t,PwmPin::EASE_IN_OUT),1e-5);  // symmetric about the midpoint
+    CHECK(PwmPin::ease(t,PwmPin::EASE_IN)<=t+1e-6);
+    CHECK(PwmPin::ease(t,PwmPin::EASE_OUT)>=t-1e-6);
+  }
+}
+
+// Duty for a fade from 0 to 1023 (level 100 at 10 bits) at time t of duration d, as fadeStep() computes it
+
+static uint32_t expected(int t, int d, uint8_t curve){
+  return(lroundf(1023*PwmPin::ease((float)t/d,curve)));
+}
+
+TEST(fadeCurves){
+  HostSim::useManualClock();
+  PwmPin pwm(0,16);
+  CHECK_EQ(pwm.getResolution(),10);
+
+  for(uint8_t c : CURVES){
+    pwm.set(0,0);
+    CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,0),0u);
+    pwm.fade(100,200,c);
+    CHECK(pwm.isFading());
+    for(int t=10;t<200;t+=10){
+      HostSim::advance(10000);
+      CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,0),expected(t,200,c));
+      CHECK(pwm.isFading());
+    }
+    HostSim::advance(10000);
+    CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,0),1023u);
+    CHECK(!pwm.isFading());
+    HostSim::advance(100000);                         // timer is stopped - nothing changes afterwards
+    CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,0),1023u);
+  }
+}
+
+TEST(fadeDown){
+  HostSim::useManualClock();
+  PwmPin pwm(9,17);                                   // low-speed channel
+  pwm.set(0,100);
+  pwm.fade(0,100);
+  HostSim::advance(30000);
+  CHECK_EQ(HostSim::ledcDuty(LEDC_LOW_SPEED_MODE,1),716u);       // 1023-round(1023*0.3)
+  HostSim::advance(70000);
+  CHECK_EQ(HostSim::ledcDuty(LEDC_LOW_SPEED_MODE,1),0u);
+  CHECK(!pwm.isFading());
+}
+
+TEST(fadeImmediate){
+  HostSim::useManualClock();
+  PwmPin pwm(1,18);
+  pwm.set(0,0);
+  pwm.fade(50,0);                                     // zero duration sets level right away
+  CHECK(!pwm.isFading());
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,1),512u);
+  pwm.fade(50,1000);                                  // already at level - nothing to fade
+  CHECK(!pwm.isFading());
+  pwm.fade(200,0);                                    // levels above 100 are capped
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,1),1023u);
+}
+
+TEST(setCancelsFade){
+  HostSim::useManualClock();
+  PwmPin pwm(2,19);
+  pwm.set(0,0);
+  pwm.fade(100,100);
+  HostSim::advance(30000);
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,2),307u);
+  pwm.set(0,20);
+  CHECK(!pwm.isFading());
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,2),205u);
+  HostSim::advance(200000);                           // fade does not resume
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,2),205u);
+}
+
+TEST(retargetFade){
+  HostSim::useManualClock();
+  PwmPin pwm(3,21);
+  pwm.set(0,0);
+  pwm.fade(100,100);
+  HostSim::advance(50000);
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,3),512u);
+  pwm.fade(0,200);                                    // new fade starts from the current duty, not from either end of the old one
+  CHECK(pwm.isFading());
+  HostSim::advance(100000);
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,3),256u);
+  HostSim::advance(100000);
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,3),0u);
+  CHECK(!pwm.isFading());
+}
+
+TEST(destroyWhileFading){
+  HostSim::useManualClock();
+  {
+    PwmPin pwm(4,22);
+    pwm.set(0,0);
+    pwm.fade(100,1000);
+    HostSim::advance(20000);
+  }
+  uint32_t duty=HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,4);
+  HostSim::advance(100000);                           // timer was deleted along with the pin
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,4),duty);
+}
+
+TEST(solveResolution){
+  CHECK_EQ(PwmPin::solveResolution(5000,10),10);
+  CHECK_EQ(PwmPin::solveResolution(5000,0),13);      // highest possible
+  CHECK_EQ(PwmPin::solveResolution(5000,16),13);     // reduced to highest possible
+  CHECK_EQ(PwmPin::solveResolution(5000,1),4);       // raised until divider fits in 10 bits
+  CHECK_EQ(PwmPin::solveResolution(20000,12),11);
+  CHECK_EQ(PwmPin::solveResolution(1000,0),16);
+  CHECK_EQ(PwmPin::solveResolution(50,8),11);
+  CHECK_EQ(PwmPin::solveResolution(2,0),16);
+  CHECK_EQ(PwmPin::solveResolution(40000000,0),1);
+  CHECK_EQ(PwmPin::solveResolution(1,0),0);          // too slow even at 16 bits
+  CHECK_EQ(PwmPin::solveResolution(40000001,0),0);   // too fast even at 1 bit
+  CHECK_EQ(PwmPin::solveResolution(0,10),0);
+  CHECK_EQ(PwmPin::solveResolution(5000,17),0);
+
+  for(double f=2;f<=40000000;f*=1.37){               // whenever a resolution is returned, the divider it needs is in range
+    uint32_t freq=f;
+    for(int res=0;res<=16;res++){
+      uint8_t r=PwmPin::solveResolution(freq,res);
+      CHECK(r<=16);
+      if(r==0)
+        continue;
+      double divider=80000000.0/((double)freq*(1<<r));
+      CHECK(divider>=1 && divider<1024);
+      if(res && (double)freq*(1<<res)<=80000000 && (double)freq*(1<<res)*1024>80000000)
+        CHECK_EQ(r,res);                              // requested resolution is kept whenever it is possible
+    }
+  }
+}
+
+TEST(timerSharing){
+  PwmPin a(0,16,5000,10);
+  PwmPin b(1,17,5000,10);                             // same frequency and resolution - shares a's timer
+  CHECK_EQ(PwmPin::allocTimer(LEDC_HIGH_SPEED_MODE,5000,10),0);
+  CHECK_EQ(HostSim::ledcFreq(LEDC_HIGH_SPEED_MODE,0),5000u);
+  CHECK_EQ(HostSim::ledcResolution(LEDC_HIGH_SPEED_MODE,0),10);
+  CHECK_EQ(PwmPin::allocTimer(LEDC_HIGH_SPEED_MODE,5000,8),1);
+
+  PwmPin c(2,18,5000,8);                              // same frequency but different resolution - needs a timer of its own
+  PwmPin d(3,19,1000,0);
+  PwmPin e(4,21,50,0);
+  CHECK_EQ(HostSim::ledcFreq(LEDC_HIGH_SPEED_MODE,1),5000u);
+  CHECK_EQ(HostSim::ledcResolution(LEDC_HIGH_SPEED_MODE,1),8);
+  CHECK_EQ(HostSim::ledcFreq(LEDC_HIGH_SPEED_MODE,2),1000u);
+  CHECK_EQ(HostSim::ledcResolution(LEDC_HIGH_SPEED_MODE,2),16);
+  CHECK_EQ(HostSim::ledcFreq(LEDC_HIGH_SPEED_MODE,3),50u);
+  CHECK_EQ(d.getResolution(),16);
+  CHECK_EQ(PwmPin::allocTimer(LEDC_HIGH_SPEED_MODE,2000,10),-1);
+  CHECK_EQ(PwmPin::allocTimer(LEDC_HIGH_SPEED_MODE,1000,16),2);
+
+  {
+    PwmPin f(5,22,2000,10);                           // all four High-Speed timers are taken
+    CHECK_EQ(f.getFreq(),0u);
+    CHECK_EQ(f.getResolution(),0);
+    f.set(0,50);                                      // ignored
+    CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,5),0u);
+
+    PwmPin g(13,23,2000,10);                          // but Low-Speed channels have timers of their own
+    CHECK_EQ(g.getFreq(),2000u);
+    CHECK_EQ(HostSim::ledcFreq(LEDC_LOW_SPEED_MODE,0),2000u);
+  }
+
+  CHECK_EQ(PwmPin::allocTimer(LEDC_LOW_SPEED_MODE,2000,10),0);
+  {
+    PwmPin h(6,25,1000,16);                           // shares d's timer
+    CHECK_EQ(PwmPin::allocTimer(LEDC_HIGH_SPEED_MODE,2000,10),-1);
+  }
+  CHECK_EQ(PwmPin::allocTimer(LEDC_HIGH_SPEED_MODE,1000,16),2);       // still used by d
+}
+
+TEST(timerRelease){
+  CHECK_EQ(PwmPin::allocTimer(LEDC_HIGH_SPEED_MODE,2000,10),0);       // every pin of the last test has been destroyed
+  PwmPin a(0,16,2000,10);
+  CHECK_EQ(HostSim::ledcFreq(LEDC_HIGH_SPEED_MODE,0),2000u);          // freed timer is reconfigured
+  CHECK_EQ(PwmPin::allocTimer(LEDC_HIGH_SPEED_MODE,5000,10),1);
+}
+
+TEST(gammaTable){
+  uint16_t lut[101];
+
+  PwmPin::gammaTable(lut,1.0,1023);
+  for(int i=0;i<=100;i++)
+    CHECK_EQ(lut[i],(uint16_t)lround(i*1023/100.0));
+
+  for(float gamma : {0.45f,1.0f,2.2f,3.0f}){
+    for(uint32_t maxDuty : {255u,1023u,65535u}){
+      PwmPin::gammaTable(lut,gamma,maxDuty);
+      CHECK_EQ(lut[0],0);
+      CHECK_EQ(lut[100],maxDuty);
+      for(int i=1;i<=100;i++){
+        CHECK(lut[i]>=lut[i-1]);
+        uint32_t linear=lround(i*maxDuty/100.0);
+        CHECK(gamma>1?lut[i]<=linear:lut[i]>=linear);
+      }
+    }
+  }
+
+  PwmPin::gammaTable(lut,2.2,1023);
+  CHECK_EQ(lut[50],223);
+
+  PwmPin pwm(0,16);
+  pwm.setGamma(2.2);
+  pwm.set(0,50);
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,0),223u);
+  pwm.setGamma(0);                                    // invalid gamma reverts to linear
+  pwm.set(0,50);
+  CHECK_EQ(HostSim::ledcDuty(LEDC_HIGH_SPEED_MODE,0),512u);
+}
+
+// Converts with the floating-point HSVtoRGB(), scaling H/S/V and R/G/B the same way as the fixed-point version
+
+static void floatRGB(uint16_t h, uint8_t s, uint8_t v, uint8_t *rgb){
+  float r, g, b;
+  PwmPin::HSVtoRGB((float)h,s/100.0f,v/100.0f,&r,&g,&b);
+  rgb[0]=lroundf(r*255);
+  rgb[1]=lroundf(g*255);
+  rgb[2]=lroundf(b*255);
+}
+
+TEST(hsvAccuracy){
+  int maxErr=0;
+  long nErr=0;
+  for(int h=0;h<360;h++){
+    for(int s=0;s<=100;s++){
+      for(int v=0;v<=100;v++){
+        uint8_t expect[3], rgb[3];
+        floatRGB(h,s,v,expect);
+        PwmPin::HSVtoRGB(h,s,v,rgb,rgb+1,rgb+2);
+        for(int i=0;i<3;i++){
+          int err=abs(rgb[i]-expect[i]);
+          if(err>maxErr)
+            maxErr=err;
+          if(err)
+            nErr++;
+        }
+      }
+    }
+  }
+  printf("  fixed-point vs float over %d conversions: max error %d, %.2f%% of components differ\n",360*101*101,maxErr,100.0*nErr/(3*360*101*101));
+  CHECK(maxErr<=1);
+
+  uint8_t rgb[3];
+  PwmPin::HSVtoRGB(0,100,100,rgb,rgb+1,rgb+2);        // primaries and secondaries are exact
+  CHECK(rgb[0]==255 && rgb[1]==0 && rgb[2]==0);
+  PwmPin::HSVtoRGB(120,100,100,rgb,rgb+1,rgb+2);
+  CHECK(rgb[0]==0 && rgb[1]==255 && rgb[2]==0);
+  PwmPin::HSVtoRGB(300,100,100,rgb,rgb+1,rgb+2);
+  CHECK(rgb[0]==255 && rgb[1]==0 && rgb[2]==255);
+  PwmPin::HSVtoRGB(200,0,50,rgb,rgb+1,rgb+2);         // grey, regardless of hue
+  CHECK(rgb[0]==128 && rgb[1]==128 && rgb[2]==128);
+
+  uint8_t wrapped[3];
+  PwmPin::HSVtoRGB(360+45,100,100,wrapped,wrapped+1,wrapped+2);      // hue wraps around
+  PwmPin::HSVtoRGB(45,100,100,rgb,rgb+1,rgb+2);
+  CHECK(!memcmp(rgb,wrapped,3));
+  PwmPin::HSVtoRGB(45,250,250,wrapped,wrapped+1,wrapped+2);          // saturation and brightness are capped at 100
+  CHECK(!memcmp(rgb,wrapped,3));
+}
+
+// Fills hsv with n pixels of a rainbow, as an addressable strip would show
+
+static void rainbow(uint16_t *hsv, int n){
+  for(int i=0;i<n;i++){
+    hsv[3*i]=i*360/n;
+    hsv[3*i+1]=50+i%51;
+    hsv[3*i+2]=100-i%71;
+  }
+}
+
+TEST(hsvBatch){
+  const int n=1000;
+  std::vector<uint16_t> hsv(3*n);
+  std::vector<uint8_t> rgb(3*n+1,0xAA);
+  rainbow(hsv.data(),n);
+
+  PwmPin::HSVtoRGB(hsv.data(),rgb.data(),n);
+  for(int i=0;i<n;i++){
+    uint8_t expect[3];
+    PwmPin::HSVtoRGB(hsv[3*i],hsv[3*i+1],hsv[3*i+2],expect,expect+1,expect+2);
+    CHECK(!memcmp(rgb.data()+3*i,expect,3));
+  }
+  CHECK_EQ(rgb[3*n],0xAA);                            // writes exactly n packed triplets
+
+  PwmPin::HSVtoRGB(hsv.data(),rgb.data(),0);          // nothing to convert
+}
+
+TEST(hsvBenchmark){
+  const int n=300;                                    // a typical strip
+  const int frames=5000;
+  std::vector<uint16_t> hsv(3*n);
+  std::vector<uint8_t> rgb(3*n);
+  rainbow(hsv.data(),n);
+  uint32_t sum=0;
+
+  auto t0=std::chrono::steady_clock::now();
+  for(int f=0;f<frames;f++){
+    for(int i=0;i<n;i++){
+      float r, g, b;
+      PwmPin::HSVtoRGB((float)((hsv[3*i]+f)%360),hsv[3*i+1]/100.0f,hsv[3*i+2]/100.0f,&r,&g,&b);
+      rgb[3*i]=r*255;
+      rgb[3*i+1]=g*255;
+      rgb[3*i+2]=b*255;
+    }
+    sum+=rgb[f%(3*n)];
+  }
+  auto t1=std::chrono::steady_clock::now();
+  for(int f=0;f<frames;f++){
+    for(int i=0;i<n;i++)
+      PwmPin::HSVtoRGB((hsv[3*i]+f)%360,hsv[3*i+1],hsv[3*i+2],&rgb[3*i],&rgb[3*i+1],&rgb[3*i+2]);
+    sum+=rgb[f%(3*n)];
+  }
+  auto t2=std::chrono::steady_clock::now();
+  for(int f=0;f<frames;f++){
+    hsv[3*(f%n)]=(hsv[3*(f%n)]+1)%360;                // change one pixel per frame so the work cannot be hoisted
+    PwmPin::HSVtoRGB(hsv.data(),rgb.data(),n);
+    sum+=rgb[f%(3*n)];
+  }
+  auto t3=std::chrono::steady_clock::now();
+
+  double pixels=(double)n*frames;
+  printf("  float: %6.2f ns/pixel   fixed-point: %6.2f ns/pixel   batch: %6.2f ns/pixel   (checksum %u)\n",
+    std::chrono::duration<double,std::nano>(t1-t0).count()/pixels,
+    std::chrono::duration<double,std::nano>(t2-t1).count()/pixels,
+    std::chrono::duration<double,std::nano>(t3-t2).count()/pixels,sum);
+}
+
+HOSTTEST_MAIN
@@ -0,0 +1,138 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of SpanQueue (Utils.h), the lock-free single-producer/single-consumer queue that connects the HAP I/O task
+//  to poll() in multi-core mode.  The producer and consumer run on separate std::threads, as the two tasks do on the
+//  host build.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <thread>
+
+#include "HostTest.h"
+#include <Utils.h>
+
+TEST(fullAndEmpty){
+  SpanQueue<int> q(3);
+  int item;
+
+  CHECK(!q.pop(item));
+  CHECK(q.push(1));
+  CHECK(q.push(2));
+  CHECK(q.push(3));
+  CHECK(!q.push(4));                                    // full
+
+  CHECK(q.pop(item));
+  CHECK_EQ(item,1);
+  CHECK(q.push(4));                                     // space freed by pop is re-used (wrapping around)
+  CHECK(!q.push(5));
+
+  for(int i=2;i<=4;i++){
+    CHECK(q.pop(item));
+    CHECK_EQ(item,i);
+  }
+  CHECK(!q.pop(item));
+}
+
+struct Message {                                        // larger than a word, so a torn copy would be detected
+  uint32_t seq;
+  uint32_t check;
+  uint8_t body[24];
+};
+
+TEST(producerConsumer){
+  const uint32_t count=2000000;
+  SpanQueue<Message> q(16);
+  std::atomic<uint32_t> fullCount{0};
+
+  std::thread producer([&](){
+    Message m;
+    for(uint32_t i=0;i<count;i++){
+      m.seq=i;
+      m.check=~i;
+      memset(m.body,i&0xFF,sizeof(m.body));
+      while(!q.push(m)){
+        fullCount++;
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t expected=0, errors=0, emptyCount=0;
+  Message m;
+  while(expected<count){
+    if(!q.pop(m)){
+      emptyCount++;
+      std::this_thread::yield();
+      continue;
+    }
+    if(m.seq!=expected || m.check!=~expected || m.body[0]!=(expected&0xFF) || m.body[sizeof(m.body)-1]!=(expected&0xFF))
+      errors++;
+    expected=m.seq+1;
+  }
+  producer.join();
+
+  CHECK_EQ(errors,0u);                                  // every message arrived once, in order, and intact
+  CHECK(!q.pop(m));
+  printf("  %u messages (producer found queue full %u times, consumer found it empty %u times)\n",count,(uint32_t)fullCount,emptyCount);
+}
+
+TEST(pointers){                                         // HomeSpan passes ownership of buffers through the queue, as here
+  SpanQueue<std::string *> q(4);
+  std::atomic<bool> done{false};
+  size_t received=0;
+
+  std::thread consumer([&](){
+    std::string *s;
+    for(;;){
+      bool finished=done;                               // checked before popping, so nothing pushed before done was set is missed
+      if(q.pop(s)){
+        received+=s->size();
+        delete s;
+      } else if(finished){
+        break;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  size_t sent=0;
+  for(int i=0;i<100000;i++){
+    std::string *s=new std::string(i%64,'x');
+    sent+=s->size();
+    while(!q.push(s))
+      std::this_thread::yield();
+  }
+  done=true;
+  consumer.join();
+  CHECK_EQ(received,sent);
+}
+
+HOSTTEST_MAIN
@@ -0,0 +1,344 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of RFControl (extras/RFControl.h) against the host's simulated RMT peripheral, which transmits from RMT
+//  memory, raises threshold and end-of-transmission interrupts, and records every pulse it sends.  Most tests use
+//  the manual clock, so each transmission is stepped exactly by HostSim::advance().
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HostTest.h"
+#include <HostSim.h>
+#include <RFControl.h>
+#include <soc/rmt_reg.h>
+#include <soc/gpio_reg.h>
+
+typedef std::vector<HostSim::rmtPulse_t> pulses_t;
+
+static pulses_t pulses(std::initializer_list<std::pair<int,int>> list, int cycles=1){     // expected output: list of {level,microseconds}, repeated
+  pulses_t p;
+  for(int c=0;c<cycles;c++)
+    for(auto &x : list)
+      p.push_back({(uint8_t)x.first,(uint32_t)x.second});
+  return(p);
+}
+
+static bool same(const pulses_t &a, const pulses_t &b){
+  if(a.size()!=b.size()){
+    printf("  output has %d pulses, expected %d\n",(int)a.size(),(int)b.size());
+    return(false);
+  }
+  for(size_t i=0;i<a.size();i++){
+    if(a[i].level!=b[i].level || a[i].duration!=b[i].duration){
+      printf("  pulse %d is {%d,%u}, expected {%d,%u}\n",(int)i,a[i].level,a[i].duration,b[i].level,b[i].duration);
+      return(false);
+    }
+  }
+  return(true);
+}
+
+static void finish(RFControl &rf){                      // steps manual clock until transmitter is idle
+  for(int i=0;i<100000 && rf.busy();i++)
+    HostSim::advance(1000);
+}
+
+static std::vector<int> completed;                      // args of completion callbacks, in order called
+
+static void onDone(void *arg){
+  completed.push_back((int)(intptr_t)arg);
+}
+
+TEST(shortTrain){
+  HostSim::useManualClock();
+  RFControl rf(17);
+  int ch=rf.getChannel();
+  CHECK_EQ(ch,0);
+  HostSim::clearRmtOutput(ch);
+  completed.clear();
+
+  RFControl::clear();
+  rf.add(100,200);
+  rf.add(300,400);
+  rf.phase(50,HIGH);                                    // odd number of phases
+  CHECK(rf.startAsync(3,2,onDone,(void *)1));           // 3 cycles, 2 microseconds per tick
+  CHECK(rf.busy());
+  CHECK(HostSim::gpioOutputEnabled()&(1<<17));
+
+  HostSim::advance(100);
+  CHECK(rf.busy());                                     // startAsync() returned long before transmission finished
+  finish(rf);
+
+  CHECK(same(HostSim::rmtOutput(ch),pulses({{1,200},{0,400},{1,600},{0,800},{1,100}},3)));
+  CHECK(completed==std::vector<int>({1}));
+  CHECK(!(HostSim::gpioOutputEnabled()&(1<<17)));       // output disabled when done
+}
+
+TEST(longTrain){                                        // more pulses than fit in RMT memory, so halves are refilled as they are sent
+  HostSim::useManualClock();
+  for(int nBlocks : {1,2}){
+    RFControl rf(18,nBlocks);
+    int ch=rf.getChannel();
+    HostSim::clearRmtOutput(ch);
+
+    RFControl::clear();
+    pulses_t expected;
+    for(int i=1;i<=300;i++){                            // 300 words, against 64 or 128 words of memory
+      rf.add(i,1000-i);
+      expected.push_back({1,(uint32_t)i});
+      expected.push_back({0,(uint32_t)(1000-i)});
+    }
+    pulses_t twice=expected;
+    twice.insert(twice.end(),expected.begin(),expected.end());
+
+    CHECK(rf.startAsync(2));
+    finish(rf);
+    CHECK(same(HostSim::rmtOutput(ch),twice));
+  }
+}
+
+TEST(queue){
+  HostSim::useManualClock();
+  RFControl rf(19);
+  int ch=rf.getChannel();
+  HostSim::clearRmtOutput(ch);
+  completed.clear();
+
+  pulses_t expected;
+  int queued=0;
+  for(int i=1;i<=20;i++){                               // more than the queue holds
+    RFControl::clear();
+    rf.add(10*i,5);
+    if(!rf.startAsync(1,1,onDone,(void *)(intptr_t)i))
+      break;
+    expected.push_back({1,(uint32_t)(10*i)});
+    expected.push_back({0,5});
+    queued++;
+  }
+  CHECK_EQ(queued,8);                                   // QUEUE_SIZE
+
+  RFControl::clear();
+  rf.add(1000,1000);
+  CHECK(!rf.startAsync(1));                             // still full
+
+  finish(rf);
+  CHECK(same(HostSim::rmtOutput(ch),expected));         // trains sent back-to-back, in order
+  CHECK_EQ((int)completed.size(),8);
+  for(int i=0;i<(int)completed.size();i++)
+    CHECK_EQ(completed[i],i+1);
+
+  CHECK(rf.startAsync(1));                              // room again once transmissions have completed
+  finish(rf);
+
+  RFControl::clear();                                   // nothing to transmit
+  CHECK(rf.startAsync(0));
+  CHECK(!rf.busy());
+}
+
+TEST(blockingStart){                                    // start() waits for transmission to finish, with the clock running in real time
+  HostSim::useManualClock(false);
+  RFControl rf(21);
+  int ch=rf.getChannel();
+  HostSim::clearRmtOutput(ch);
+
+  RFControl::clear();
+  rf.add(500,500);
+  uint32_t t0=micros();
+  rf.start(4);
+  uint32_t elapsed=micros()-t0;
+  CHECK(!rf.busy());
+  CHECK(elapsed>=4000);
+  CHECK(same(HostSim::rmtOutput(ch),pulses({{1,500},{0,500}},4)));
+}
+
+TEST(encodeProtocol){
+  HostSim::useManualClock();
+  RFControl rf(22);
+  int ch=rf.getChannel();
+  HostSim::clearRmtOutput(ch);
+
+  RFCode code;
+  CHECK(code.encode(1,0xA,4,2));                        // protocol 1 (350 us): 1={3,1}, 0={1,3}, sync={1,31}; 2 cycles
+  CHECK(rf.startAsync(code));
+  finish(rf);
+  CHECK(same(HostSim::rmtOutput(ch),pulses({{1,1050},{0,350},{1,350},{0,1050},{1,1050},{0,350},{1,350},{0,1050},{1,350},{0,10850}},2)));
+
+  HostSim::clearRmtOutput(ch);                          // compiled code can be sent again, unchanged
+  CHECK(rf.startAsync(code));
+  finish(rf);
+  CHECK_EQ((int)HostSim::rmtOutput(ch).size(),20);
+
+  HostSim::clearRmtOutput(ch);                          // inverted protocol 6 (HT6P20B, 450 us): 1={2,1}, 0={1,2}, sync={23,1}, each LOW then HIGH
+  CHECK(code.encode(6,0x2,2,1));
+  CHECK(rf.startAsync(code));
+  finish(rf);
+  CHECK(same(HostSim::rmtOutput(ch),pulses({{0,900},{1,450},{0,450},{1,900},{0,10350},{1,450}})));
+
+  HostSim::clearRmtOutput(ch);                          // 64-bit codes use every bit
+  CHECK(code.encode(1,0x8000000000000001ULL,64,1));
+  CHECK(rf.startAsync(code));
+  finish(rf);
+  pulses_t out=HostSim::rmtOutput(ch);
+  CHECK_EQ((int)out.size(),130);
+  CHECK(out.size()==130 && out[0].duration==1050 && out[2].duration==350 && out[126].duration==1050 && out[129].duration==10850);
+}
+
+TEST(encodeErrors){
+  RFCode code;
+  CHECK(!code.encode(0,1,8));                           // protocol numbers are 1-6
+  CHECK(!code.encode(RFProtocolCount+1,1,8));
+
+  RFProtocol slow={2000,{1,31},{1,3},{3,1},false};      // sync of 62000 us does not fit in a 15-bit RMT entry
+  CHECK(!code.encode(slow,1,8));
+
+  RFProtocol custom={100,{2,40},{1,2},{2,1},false};     // protocols need not come from the table
+  CHECK(code.encode(custom,1,1));
+}
+
+TEST(runLength){
+  RFCode code;
+  CHECK(code.encode(1,0,24));                           // 24 identical 0 bits and a sync pulse make just two runs
+  int runSize=code.size()/2;
+  CHECK_EQ(code.size(),2*runSize);
+  CHECK(code.encode(1,0xAAAAAA,24));                    // but alternating bits make 25
+  CHECK_EQ(code.size(),25*runSize);
+
+  RFControl::clear();                                   // runs are limited to 65535 repetitions
+  for(int i=0;i<70000;i++)
+    RFControl::add(10,10);
+  CHECK(code.capture(1));
+  CHECK_EQ(code.size(),2*runSize);
+
+  code.clear();
+  CHECK_EQ(code.size(),0);
+}
+
+TEST(capture){                                          // a code captured from add() and phase() is sent exactly as startAsync() sends them
+  HostSim::useManualClock();
+  RFControl rf(23);
+  int ch=rf.getChannel();
+
+  RFControl::clear();
+  for(int i=0;i<100;i++)
+    rf.add(200,i%3?200:600);
+  rf.phase(700,HIGH);
+
+  HostSim::clearRmtOutput(ch);
+  CHECK(rf.startAsync(3,2));
+  finish(rf);
+  pulses_t direct=HostSim::rmtOutput(ch);
+
+  RFCode code;
+  CHECK(code.capture(3,2));
+  CHECK(code.size()<100*8);
+  RFControl::clear();                                   // code is independent of the buffer it was captured from
+  rf.add(1,1);
+
+  HostSim::clearRmtOutput(ch);
+  CHECK(rf.startAsync(code));
+  finish(rf);
+  CHECK(same(HostSim::rmtOutput(ch),direct));
+  CHECK_EQ((int)direct.size(),201*3);
+}
+
+TEST(channelAllocation){
+  RFControl *rf[9];
+  for(int i=0;i<8;i++){                                 // one transmitter per channel...
+    rf[i]=new RFControl(10+i);
+    CHECK_EQ(rf[i]->getChannel(),i);
+    CHECK_EQ((int)(REG_READ(GPIO_FUNC0_OUT_SEL_CFG_REG+4*(10+i))&0x1FF),87+i);     // pin routed to its channel's RMT output signal
+  }
+  rf[8]=new RFControl(18);                              // ...and no more
+  CHECK_EQ(rf[8]->getChannel(),-1);
+  RFControl::clear();
+  RFControl::add(10,10);
+  CHECK(!rf[8]->startAsync(1));
+  delete rf[8];
+
+  delete rf[3];                                         // a freed channel is re-used
+  rf[3]=new RFControl(13);
+  CHECK_EQ(rf[3]->getChannel(),3);
+  for(int i=0;i<8;i++)
+    delete rf[i];
+
+  RFControl a(10,3);                                    // channel 0 with blocks 0-2
+  CHECK_EQ(a.getChannel(),0);
+  CHECK_EQ((int)((REG_READ(RMT_CHnCONF0_REG(0))>>24)&0x0F),3);
+  RFControl b(11);                                      // blocks 1 and 2 are taken, so next free channel is 3
+  CHECK_EQ(b.getChannel(),3);
+  RFControl c(12,4);                                    // channel n can only use blocks n and above: 4-7
+  CHECK_EQ(c.getChannel(),4);
+  RFControl d(13,2);                                    // no two contiguous blocks left
+  CHECK_EQ(d.getChannel(),-1);
+
+  RFControl e(14,0), f(15,9);                           // 1-8 blocks
+  CHECK_EQ(e.getChannel(),-1);
+  CHECK_EQ(f.getChannel(),-1);
+}
+
+TEST(concurrentChannels){                               // transmitters on separate channels send at the same time
+  HostSim::useManualClock();
+  RFControl ir(25), rf433(26,2), other(27);
+  RFControl *all[]={&ir,&rf433,&other};
+  for(auto t : all)
+    HostSim::clearRmtOutput(t->getChannel());
+
+  RFControl::clear();
+  for(int i=0;i<40;i++)
+    RFControl::add(13,13);                              // 38 kHz-like burst
+  CHECK(ir.startAsync(5));
+
+  RFCode code;
+  CHECK(code.encode(1,0xABCDE,20,3));
+  CHECK(rf433.startAsync(code));
+
+  RFControl::clear();
+  for(int i=0;i<300;i++)                                // longer than its RMT memory, so it is refilled while the others run
+    RFControl::add(7,3);
+  CHECK(other.startAsync(2));
+
+  HostSim::advance(100);
+  CHECK(ir.busy() && rf433.busy() && other.busy());
+  CHECK(HostSim::rmtBusy(ir.getChannel()) && HostSim::rmtBusy(rf433.getChannel()) && HostSim::rmtBusy(other.getChannel()));
+
+  uint64_t t0=HostSim::now();
+  for(int i=0;i<100000 && (ir.busy() || rf433.busy() || other.busy());i++)
+    HostSim::advance(100);
+  uint64_t elapsed=HostSim::now()-t0;
+
+  CHECK(same(HostSim::rmtOutput(ir.getChannel()),pulses({{1,13},{0,13}},40*5)));
+  CHECK(same(HostSim::rmtOutput(other.getChannel()),pulses({{1,7},{0,3}},300*2)));
+  CHECK_EQ((int)HostSim::rmtOutput(rf433.getChannel()).size(),(20+1)*2*3);
+
+  uint64_t rfTime=0;                                    // the three ran in parallel: total time is that of the longest
+  for(auto &p : HostSim::rmtOutput(rf433.getChannel()))
+    rfTime+=p.duration;
+  CHECK(elapsed<rfTime+1000);
+}
+
+HOSTTEST_MAIN
@@ -0,0 +1,203 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of SpanTimer (Utils.h), the pool of software timers multiplexed onto one Alarm Timer, and of Blinker, which
+//  uses it.  The scheduling core is tested by calling SpanTimer::service() directly with a fake time while the
+//  manual clock is frozen (so the Alarm Timer never fires), and the whole pool, including its interrupt handler,
+//  by advancing the manual clock.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "HostTest.h"
+#include <HostSim.h>
+#include <Utils.h>
+#include <driver/timer.h>
+
+// A callback that logs the time (as given to service()) of each call, and returns a fixed period until it has
+// been called a given number of times
+
+struct probe_t {
+  uint32_t period;                                    // delay (in microseconds) returned by callback
+  int limit;                                          // number of calls after which callback returns 0 (0=never)
+  std::vector<uint64_t> calls;                        // time of each call
+};
+
+static uint64_t serviceTime;                          // time passed to service() (or current time, when driven by the Alarm Timer)
+
+static uint32_t probe(void *arg){
+  probe_t *p=(probe_t *)arg;
+  p->calls.push_back(serviceTime);
+  return((p->limit && (int)p->calls.size()>=p->limit)?0:p->period);
+}
+
+// Time of the pool (the counter of the Alarm Timer)
+
+static uint64_t poolTime(){
+  uint64_t t;
+  timer_get_counter_value(TIMER_GROUP_0,TIMER_0,&t);
+  return(t);
+}
+
+static uint64_t service(uint64_t t){
+  serviceTime=t;
+  return(SpanTimer::service(t));
+}
+
+TEST(pool){
+  HostSim::useManualClock();
+  probe_t p={1000,0};
+  std::vector<int> ids;
+  for(int i=0;i<16;i++)
+    ids.push_back(SpanTimer::add(probe,&p));
+  for(int i=0;i<16;i++)
+    CHECK_EQ(ids[i],i);
+  CHECK_EQ(SpanTimer::add(probe,&p),-1);              // pool is exhausted
+  SpanTimer::remove(5);
+  CHECK_EQ(SpanTimer::add(probe,&p),5);               // freed timer is re-used
+  SpanTimer::start(16,100);                           // invalid ids are ignored
+  SpanTimer::start(-1,100);
+  SpanTimer::remove(99);
+  for(int id : ids)
+    SpanTimer::remove(id);
+  CHECK_EQ(SpanTimer::add(probe,&p),0);
+  SpanTimer::remove(0);
+  SpanTimer::start(0,100);                            // removed timers cannot be started
+  CHECK_EQ(service(UINT64_MAX-1),UINT64_MAX);
+  CHECK_EQ(p.calls.size(),0u);
+}
+
+TEST(schedule){
+  HostSim::useManualClock();                          // frozen: only service() moves time
+  probe_t a={1000,0}, b={700,3};
+  int ida=SpanTimer::add(probe,&a);
+  int idb=SpanTimer::add(probe,&b);
+  CHECK_EQ(service(poolTime()),UINT64_MAX);           // nothing running
+  uint64_t t0=poolTime();
+  SpanTimer::start(ida,1000);
+  SpanTimer::start(idb,300);
+
+  CHECK_EQ(service(t0+299),t0+300);                   // returns earliest expiration
+  CHECK_EQ(a.calls.size()+b.calls.size(),0u);
+  CHECK_EQ(service(t0+300),t0+1000);
+  CHECK_EQ(b.calls.size(),1u);
+  CHECK_EQ(service(t0+1000),t0+1700);                 // a and b are both due at 1000 (b at 300+700)
+  CHECK_EQ(a.calls.size(),1u);
+  CHECK_EQ(b.calls.size(),2u);
+  CHECK_EQ(service(t0+1700),t0+2000);                 // b stops itself after 3 calls
+  CHECK_EQ(b.calls.size(),3u);
+
+  CHECK_EQ(service(t0+2450),t0+3000);                 // serviced late, but next expiration is not delayed (no drift)
+  CHECK_EQ(a.calls.size(),2u);
+  CHECK_EQ(service(t0+7500),t0+8500);                 // fell behind by several periods - missed expirations are skipped, not run in a burst
+  CHECK_EQ(a.calls.size(),3u);
+
+  SpanTimer::stop(ida);
+  CHECK_EQ(service(t0+100000),UINT64_MAX);
+  CHECK_EQ(a.calls.size(),3u);
+
+  SpanTimer::start(idb,500);                          // re-started timers are due relative to when they are started
+  CHECK_EQ(service(t0),t0+500);
+  SpanTimer::remove(ida);
+  SpanTimer::remove(idb);
+  CHECK_EQ(service(UINT64_MAX-1),UINT64_MAX);
+}
+
+TEST(alarmDriven){
+  HostSim::useManualClock();
+  const int N=10;
+  probe_t p[N];
+  int id[N];
+  for(int i=0;i<N;i++){
+    p[i]={(uint32_t)(1000+i*370),0};
+    id[i]=SpanTimer::add([](void *arg){serviceTime=HostSim::now();return(probe(arg));},p+i);
+  }
+  uint64_t start=HostSim::now();
+  for(int i=0;i<N;i++)
+    SpanTimer::start(id[i],p[i].period);
+
+  HostSim::advance(100000);
+  for(int i=0;i<N;i++){
+    CHECK_EQ(p[i].calls.size(),100000/p[i].period);
+    for(int k=0;k<(int)p[i].calls.size();k++){
+      uint64_t due=start+(uint64_t)p[i].period*(k+1);
+      CHECK(p[i].calls[k]>=due && p[i].calls[k]<=due+20);      // late only when another timer was due within MIN_DELAY (20 us) of the alarm, and never drifts
+    }
+  }
+
+  for(int i=0;i<N;i++)
+    SpanTimer::remove(id[i]);
+  size_t n=p[0].calls.size();
+  HostSim::advance(10000);
+  CHECK_EQ(p[0].calls.size(),n);
+}
+
+TEST(blinker){
+  HostSim::useManualClock();
+  Blinker b(12);
+  CHECK_EQ(HostSim::getPin(12),LOW);
+  b.start(100,0.3,2,500);                             // 2 blinks of 30 ms on / 70 ms off, then another 500 ms off
+  uint64_t t0=HostSim::now();
+  auto at=[t0](uint32_t ms){HostSim::advance(t0+ms*1000-HostSim::now());return(HostSim::getPin(12));};
+
+  for(int cycle=0;cycle<3;cycle++){
+    uint32_t c=cycle*700;
+    CHECK_EQ(at(c+15),HIGH);
+    CHECK_EQ(at(c+65),LOW);
+    CHECK_EQ(at(c+115),HIGH);
+    CHECK_EQ(at(c+165),LOW);
+    CHECK_EQ(at(c+400),LOW);
+    CHECK_EQ(at(c+690),LOW);
+  }
+
+  b.stop();
+  int level=at(2115);
+  CHECK_EQ(at(2165),level);
+  b.on();
+  CHECK_EQ(at(3000),HIGH);
+  b.off();
+  CHECK_EQ(at(4000),LOW);
+}
+
+TEST(manyBlinkers){
+  HostSim::useManualClock();                          // more Blinkers than the ESP32 has Alarm Timers, all running at once
+  const int N=8;
+  Blinker b[N];
+  for(int i=0;i<N;i++){
+    b[i].init(13+i,i%4);
+    b[i].start(20*(i+1));
+  }
+  uint64_t t0=HostSim::now();
+  for(uint32_t ms=5;ms<1000;ms+=10){
+    HostSim::advance(t0+ms*1000-HostSim::now());
+    for(int i=0;i<N;i++)
+      CHECK_EQ(HostSim::getPin(13+i),(ms%(20*(i+1)))<10*(i+1)?HIGH:LOW);
+  }
+}
+
+HOSTTEST_MAIN
@@ -0,0 +1,288 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of SpanStore (Storage.h), HomeSpan's write-coalescing store for Controller and configuration data: debounced
+//  and coalesced writes, urgent changes, ordering across a reset part-way through a flush, retrying failed writes,
+//  and persistence through NVSBackend and the host's file-backed NVS.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <unistd.h>
+#include <map>
+#include <string>
+
+#include "HostTest.h"
+#include <HostSim.h>
+#include <nvs_flash.h>
+#include <Storage.h>
+
+// StorageBackend that keeps staged and committed blobs in memory and logs every call.  After powerOff() every call
+// fails, so that committed shows exactly what would have survived a reset at that point.
+
+struct LogBackend : StorageBackend {
+  std::map<std::string,std::string> staged, committed;
+  std::vector<std::string> log;                         // "set KEY" or "commit" for every successful call
+  int callsLeft=-1;                                     // calls that succeed before power is lost (-1=never lost)
+
+  bool alive(){
+    if(callsLeft==0)
+      return(false);
+    if(callsLeft>0)
+      callsLeft--;
+    return(true);
+  }
+
+  int get(const char *key, void *data, size_t len) override {
+    auto it=committed.find(key);
+    if(it==committed.end() || it->second.size()!=len)
+      return(0);
+    memcpy(data,it->second.data(),len);
+    return(1);
+  }
+
+  int set(const char *key, const void *data, size_t len) override {
+    if(!alive())
+      return(0);
+    staged[key]=std::string((const char *)data,len);
+    log.push_back(std::string("set ")+key);
+    return(1);
+  }
+
+  int erase(const char *key) override {
+    if(!alive())
+      return(0);
+    staged.erase(key);
+    return(1);
+  }
+
+  int commit() override {
+    if(!alive())
+      return(0);
+    for(auto &s : staged)
+      committed[s.first]=s.second;
+    staged.clear();
+    log.push_back("commit");
+    return(1);
+  }
+
+  std::string value(const char *key){
+    return(committed.count(key)?committed[key]:"");
+  }
+};
+
+struct Record {
+  char text[8];
+  void set(const char *s){strncpy(text,s,sizeof(text));}
+};
+
+TEST(debounce){
+  HostSim::useManualClock();
+  LogBackend backend;
+  SpanStore store;
+  store.begin(&backend,1000);
+
+  Record a={"a0"}, b={"b0"}, c={"c0"};
+  CHECK_EQ(store.add("A",&a,sizeof(a)),0);              // nothing stored yet
+  store.add("B",&b,sizeof(b));
+  store.add("C",&c,sizeof(c));
+
+  store.poll();
+  CHECK(backend.log.empty());                           // nothing to write
+
+  a.set("a1");
+  store.mark(&a);
+  HostSim::advance(600000);
+  store.poll();
+  CHECK(backend.log.empty());                           // still within debounce window
+
+  a.set("a2");                                          // further changes restart the window and are coalesced
+  store.mark(&a);
+  b.set("b1");
+  store.mark(&b);
+  HostSim::advance(600000);
+  store.poll();
+  CHECK(backend.log.empty());
+
+  HostSim::advance(400000);
+  store.poll();
+  CHECK_EQ(backend.log.size(),3u);                      // A and B written once each (C unchanged), in one commit
+  CHECK(backend.log==std::vector<std::string>({"set A","set B","commit"}));
+  CHECK(backend.value("A")==std::string((char *)&a,sizeof(a)));
+  CHECK(backend.value("B")==std::string((char *)&b,sizeof(b)));
+  CHECK(backend.value("C").empty());
+
+  backend.log.clear();                                  // nothing more is written until something changes
+  HostSim::advance(5000000);
+  store.poll();
+  CHECK(backend.log.empty());
+
+  Record other;                                         // marking memory that was never added is ignored
+  store.mark(&other);
+  HostSim::advance(2000000);
+  store.poll();
+  CHECK(backend.log.empty());
+
+  Record loaded;                                        // add() loads a stored record of the right size...
+  SpanStore store2;
+  store2.begin(&backend,1000);
+  CHECK_EQ(store2.add("A",&loaded,sizeof(loaded)),1);
+  CHECK(!strcmp(loaded.text,"a2"));
+  char wrongSize[4];                                    // ...but not one whose size has changed
+  CHECK_EQ(store2.add("B",wrongSize,sizeof(wrongSize)),0);
+}
+
+TEST(urgent){
+  HostSim::useManualClock();
+  LogBackend backend;
+  SpanStore store;
+  store.begin(&backend,1000);
+
+  Record a={"a0"}, b={"b0"};
+  store.add("A",&a,sizeof(a));
+  store.add("B",&b,sizeof(b));
+
+  a.set("a1");
+  store.mark(&a);                                       // ordinary change...
+  b.set("b1");
+  store.mark(&b,true);                                  // ...then an urgent one, which is written at the next poll without waiting
+  store.poll();
+  CHECK(backend.log==std::vector<std::string>({"set B","commit"}));
+
+  HostSim::advance(1000000);                            // ordinary change follows once the debounce time has elapsed
+  store.poll();
+  CHECK(backend.log==std::vector<std::string>({"set B","commit","set A","commit"}));
+
+  backend.log.clear();                                  // flush() also commits urgent changes ahead of all others
+  a.set("a2");
+  store.mark(&a);
+  b.set("b2");
+  store.mark(&b,true);
+  store.flush();
+  CHECK(backend.log==std::vector<std::string>({"set B","commit","set A","commit"}));
+}
+
+TEST(resetDuringFlush){
+  HostSim::useManualClock();
+  Record a={"a0"}, b={"b0"};
+
+  for(int calls=0;calls<=4;calls++){                    // lose power after each possible number of backend calls
+    LogBackend backend;
+    SpanStore store;
+    store.begin(&backend,1000);
+    store.add("A",&a,sizeof(a));
+    store.add("B",&b,sizeof(b));
+
+    a.set("a1");
+    store.mark(&a);
+    b.set("b1");
+    store.mark(&b,true);
+    backend.callsLeft=calls;
+    store.flush();
+
+    bool savedA=!backend.value("A").empty();
+    bool savedB=!backend.value("B").empty();
+    CHECK(!savedA || savedB);                           // the ordinary change is never saved without the urgent one
+    CHECK_EQ(savedB,calls>=2);
+    CHECK_EQ(savedA,calls>=4);
+  }
+}
+
+TEST(retryFailures){
+  HostSim::useManualClock();
+  LogBackend backend;
+  SpanStore store;
+  store.begin(&backend,1000);
+
+  Record a={"a0"};
+  store.add("A",&a,sizeof(a));
+  a.set("a1");
+  store.mark(&a);
+
+  backend.callsLeft=0;                                  // every write fails...
+  store.flush();
+  CHECK(backend.value("A").empty());
+
+  backend.callsLeft=-1;                                 // ...so the change stays pending, and is retried once the debounce time has elapsed
+  store.poll();
+  CHECK(backend.value("A").empty());
+  HostSim::advance(1000000);
+  store.poll();
+  CHECK(!strcmp(backend.value("A").c_str(),"a1"));
+
+  backend.log.clear();
+  HostSim::advance(1000000);
+  store.poll();
+  CHECK(backend.log.empty());                           // and is not written again once saved
+}
+
+TEST(nvsBackend){
+  HostSim::useManualClock();
+  char dir[]="/tmp/homespan-store-XXXXXX";
+  CHECK(mkdtemp(dir)!=NULL);
+  setenv("HOMESPAN_NVS_DIR",dir,1);
+
+  nvs_handle h;
+  CHECK_EQ(nvs_open("STORE",NVS_READWRITE,&h),ESP_OK);
+  NVSBackend backend(h);
+  SpanStore store;
+  store.begin(&backend,1000);
+
+  Record a={"a0"};
+  CHECK_EQ(store.add("A",&a,sizeof(a)),0);
+  a.set("a1");
+  store.mark(&a);
+
+  HostSim::failNvsCommits(true);                        // a failed nvs_commit() leaves the change pending...
+  store.flush();
+  Record check;
+  CHECK_EQ(backend.get("A",&check,sizeof(check)),1);    // (staged, though not committed)
+  HostSim::failNvsCommits(false);
+  std::string file=std::string(dir)+"/STORE.nvs";
+  CHECK(access(file.c_str(),F_OK)!=0);
+
+  HostSim::advance(1000000);                            // ...and it is committed, to a file, once retried
+  store.poll();
+  CHECK(access(file.c_str(),F_OK)==0);
+
+  SpanStore store2;                                     // a new store over the same namespace loads the saved record
+  store2.begin(&backend,1000);
+  Record loaded;
+  CHECK_EQ(store2.add("A",&loaded,sizeof(loaded)),1);
+  CHECK(!strcmp(loaded.text,"a1"));
+
+  CHECK_EQ(backend.erase("A"),1);
+  CHECK_EQ(backend.erase("A"),1);                       // erasing a missing key is not an error
+  CHECK_EQ(backend.commit(),1);
+  CHECK_EQ(backend.get("A",&loaded,sizeof(loaded)),0);
+
+  nvs_flash_erase();
+  rmdir(dir);
+}
+
+HOSTTEST_MAIN
@@ -0,0 +1,267 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Tests of the TLV8 container (TLV.h): tag lookup, fragmentation, zero-copy unpacking, the streaming writer, and
+//  error handling.  Ends with a benchmark of pack() and unpack() against the template TLV.h replaced
+//  (TLVBaseline.h), using the Pair-Setup messages HomeSpan handles most.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+
+#include "HostTest.h"
+#include <HAPConstants.h>
+#include <TLV.h>
+#include "TLVBaseline.h"
+
+// Creates the same records HAPClient::init() creates for tlv8
+
+template <class T> void createRecords(T &tlv){
+  tlv.create(kTLVType_State,1,"STATE");
+  tlv.create(kTLVType_PublicKey,384,"PUBKEY");
+  tlv.create(kTLVType_Method,1,"METHOD");
+  tlv.create(kTLVType_Salt,16,"SALT");
+  tlv.create(kTLVType_Error,1,"ERROR");
+  tlv.create(kTLVType_Proof,64,"PROOF");
+  tlv.create(kTLVType_EncryptedData,1024,"ENC.DATA");
+  tlv.create(kTLVType_Signature,64,"SIGNATURE");
+  tlv.create(kTLVType_Identifier,64,"IDENTIFIER");
+  tlv.create(kTLVType_Permissions,1,"PERMISSION");
+}
+
+static void fill(uint8_t *buf, int len, int seed){
+  for(int i=0;i<len;i++)
+    buf[i]=(uint8_t)(i*7+seed);
+}
+
+// Fills tlv with a Pair-Setup M3 request: State, a 384-byte PublicKey (split into two fragments when packed), and Proof
+
+template <class T> void makeM3(T &tlv){
+  tlv.clear();
+  tlv.val(kTLVType_State,3);
+  fill(tlv.buf(kTLVType_PublicKey,384),384,1);
+  fill(tlv.buf(kTLVType_Proof,64),64,2);
+}
+
+TEST(lookup){
+  TLV<kTLVType,10> tlv;
+  createRecords(tlv);
+
+  CHECK_EQ(tlv.val(kTLVType_State),-1);                 // created but not set
+  CHECK_EQ(tlv.len(kTLVType_State),0);
+  CHECK_EQ(tlv.len(kTLVType_Flags),-1);                 // never created
+  CHECK(tlv.buf(kTLVType_Flags)==NULL);
+  CHECK_EQ(tlv.val(kTLVType_Flags,1),-1);
+
+  CHECK_EQ(tlv.val(kTLVType_State,5),5);
+  CHECK_EQ(tlv.val(kTLVType_State),5);
+  CHECK_EQ(tlv.len(kTLVType_State),1);
+
+  CHECK(tlv.buf(kTLVType_Salt,17)==NULL);               // longer than maxLen
+  uint8_t *salt=tlv.buf(kTLVType_Salt,16);
+  CHECK(salt!=NULL);
+  CHECK(tlv.buf(kTLVType_Salt)==salt);
+  CHECK_EQ(tlv.len(kTLVType_Salt),16);
+
+  tlv.clear();
+  CHECK_EQ(tlv.len(kTLVType_State),0);
+  CHECK_EQ(tlv.val(kTLVType_State),-1);
+
+  TLV<kTLVType,2> small;                                // more records than reserved
+  CHECK_EQ(small.create(kTLVType_State,1,"STATE"),1);
+  CHECK_EQ(small.create(kTLVType_Error,1,"ERROR"),1);
+  CHECK_EQ(small.create(kTLVType_Proof,64,"PROOF"),0);
+}
+
+TEST(packFragments){
+  TLV<kTLVType,10> tlv;
+  createRecords(tlv);
+  makeM3(tlv);
+
+  int n=tlv.pack(NULL);
+  CHECK_EQ(n,3+(2+255)+(2+129)+(2+64));
+  uint8_t buf[1024];
+  CHECK_EQ(tlv.pack(buf),n);
+
+  CHECK_EQ(buf[0],kTLVType_State);                      // records are packed in the order they were created
+  CHECK_EQ(buf[1],1);
+  CHECK_EQ(buf[2],3);
+  CHECK_EQ(buf[3],kTLVType_PublicKey);                  // first fragment
+  CHECK_EQ(buf[4],255);
+  CHECK_EQ(buf[3+2+255],kTLVType_PublicKey);            // second fragment
+  CHECK_EQ(buf[3+2+255+1],129);
+  CHECK_EQ(buf[3+257+131],kTLVType_Proof);
+
+  TLVBaseline<kTLVType,10> base;                        // identical to the template TLV.h replaced
+  createRecords(base);
+  makeM3(base);
+  uint8_t baseBuf[1024];
+  CHECK_EQ(base.pack(baseBuf),n);
+  CHECK(!memcmp(buf,baseBuf,n));
+}
+
+TEST(unpackViews){
+  TLV<kTLVType,10> out, in;
+  createRecords(out);
+  createRecords(in);
+  makeM3(out);
+
+  uint8_t buf[1024];
+  int n=out.pack(buf);
+  CHECK_EQ(in.unpack(buf,n),1);
+
+  CHECK_EQ(in.val(kTLVType_State),3);
+  CHECK_EQ(in.len(kTLVType_PublicKey),384);
+  CHECK(!memcmp(in.buf(kTLVType_PublicKey),out.buf(kTLVType_PublicKey),384));
+  CHECK_EQ(in.len(kTLVType_Proof),64);
+  CHECK(!memcmp(in.buf(kTLVType_Proof),out.buf(kTLVType_Proof),64));
+  CHECK_EQ(in.len(kTLVType_Salt),0);
+
+  CHECK(in.buf(kTLVType_Proof)==buf+3+257+131+2);       // non-fragmented VALUE is a view into the unpacked buffer...
+  CHECK(in.buf(kTLVType_PublicKey)<buf || in.buf(kTLVType_PublicKey)>=buf+n);    // ...but a fragmented one is assembled in the arena
+
+  uint8_t *proof=in.buf(kTLVType_Proof,64);             // writing to a record takes it back into the arena, leaving buf untouched
+  CHECK(proof!=buf+3+257+131+2);
+  memset(proof,0,64);
+  CHECK_EQ(buf[3+257+131+2],out.buf(kTLVType_Proof)[0]);
+
+  uint8_t rebuf[1024];                                  // repacking the unpacked records reproduces the original
+  in.buf(kTLVType_Proof,64);
+  memcpy(in.buf(kTLVType_Proof),out.buf(kTLVType_Proof),64);
+  CHECK_EQ(in.pack(rebuf),n);
+  CHECK(!memcmp(rebuf,buf,n));
+
+  uint8_t empty[]={kTLVType_State,1,6,kTLVType_Error,0};       // zero-length records are allowed
+  CHECK_EQ(in.unpack(empty,sizeof(empty)),1);
+  CHECK_EQ(in.val(kTLVType_State),6);
+  CHECK_EQ(in.len(kTLVType_Error),0);
+}
+
+TEST(unpackErrors){
+  TLV<kTLVType,10> tlv;
+  createRecords(tlv);
+
+  uint8_t unknown[]={kTLVType_State,1,2,kTLVType_Flags,1,0};
+  CHECK_EQ(tlv.unpack(unknown,sizeof(unknown)),0);
+  CHECK_EQ(tlv.len(kTLVType_State),0);                  // records are cleared on failure
+
+  uint8_t tooLong[2+17]={kTLVType_Salt,17};
+  CHECK_EQ(tlv.unpack(tooLong,sizeof(tooLong)),0);
+
+  uint8_t truncated[]={kTLVType_State,1,2,kTLVType_Proof,64,1,2,3};
+  CHECK_EQ(tlv.unpack(truncated,sizeof(truncated)),0);
+  CHECK_EQ(tlv.len(kTLVType_State),0);
+
+  uint8_t missingLen[]={kTLVType_State};
+  CHECK_EQ(tlv.unpack(missingLen,sizeof(missingLen)),0);
+
+  uint8_t repeated[2+255+2+255]={kTLVType_PublicKey,255};       // fragments may not add up to more than maxLen (384)
+  repeated[2+255]=kTLVType_PublicKey;
+  repeated[2+255+1]=255;
+  CHECK_EQ(tlv.unpack(repeated,sizeof(repeated)),0);
+}
+
+TEST(streamingWriter){
+  TLV<kTLVType,10> tlv;
+  createRecords(tlv);
+  makeM3(tlv);
+
+  uint8_t full[1024];
+  int n=tlv.pack(full);
+
+  int failures=0;
+  for(int chunk : {1,2,3,100,255,257,n}){               // concatenating chunks of any size reproduces pack()
+    uint8_t buf[1024];
+    int total=0;
+    for(int offset=0;offset<n;offset+=chunk)
+      total+=tlv.pack(buf+offset,offset,chunk);
+    if(total!=n || memcmp(buf,full,n))
+      failures++;
+  }
+  CHECK_EQ(failures,0);
+
+  uint8_t buf[8];
+  CHECK_EQ(tlv.pack(buf,n-3,8),3);                      // partial final chunk
+  CHECK(!memcmp(buf,full+n-3,3));
+  CHECK_EQ(tlv.pack(buf,n,8),0);                        // past the end
+}
+
+// Benchmark: reports the time per pack() and unpack() of a Pair-Setup M3 request (State, PublicKey, Proof) and the
+// M5 request that follows it (State, 154-byte EncryptedData), for TLV.h and for the template it replaced.  The two
+// are checked to produce identical results, but the times are only reported, since they depend on the host.
+
+template <class T> void bench(const char *name, int iterations){
+  T out, in;
+  createRecords(out);
+  createRecords(in);
+
+  uint8_t m3[1024], m5[1024];
+  makeM3(out);
+  int n3=out.pack(m3);
+  out.clear();
+  out.val(kTLVType_State,5);
+  fill(out.buf(kTLVType_EncryptedData,154),154,3);
+  int n5=out.pack(m5);
+
+  uint8_t buf[1024];
+  uint32_t sum=0;
+  auto t0=std::chrono::steady_clock::now();
+  for(int i=0;i<iterations;i++){
+    in.unpack(m3,n3);
+    sum+=in.val(kTLVType_State)+in.buf(kTLVType_PublicKey)[i%384]+in.len(kTLVType_Proof);
+    in.unpack(m5,n5);
+    sum+=in.val(kTLVType_State)+in.len(kTLVType_EncryptedData);
+  }
+  auto t1=std::chrono::steady_clock::now();
+  for(int i=0;i<iterations;i++){
+    makeM3(out);
+    sum+=out.pack(buf);
+    out.clear();
+    out.val(kTLVType_State,5);
+    out.buf(kTLVType_EncryptedData,154);
+    sum+=out.pack(buf)+buf[i%n5];
+  }
+  auto t2=std::chrono::steady_clock::now();
+
+  double unpackNs=std::chrono::duration<double,std::nano>(t1-t0).count()/(2*iterations);
+  double packNs=std::chrono::duration<double,std::nano>(t2-t1).count()/(2*iterations);
+  printf("  %-12s unpack: %7.1f ns/message   pack: %7.1f ns/message   (checksum %u)\n",name,unpackNs,packNs,sum);
+
+  in.unpack(m3,n3);
+  CHECK_EQ(in.pack(buf),n3);
+  CHECK(!memcmp(buf,m3,n3));
+}
+
+TEST(benchmark){
+  const int iterations=200000;
+  bench<TLVBaseline<kTLVType,10>>("TLVBaseline",iterations);
+  bench<TLV<kTLVType,10>>("TLV",iterations);
+}
+
+HOSTTEST_MAIN
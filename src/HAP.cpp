@@ -106,15 +106,28 @@ void HAPClient::init(){
     nvs_commit(hapNVS);                                               // commit to NVS
   }
 
-  if(!nvs_get_blob(hapNVS,"CONTROLLERS",NULL,&len)){                 // if found long-term Controller Pairings data from NVS
+  store.begin(new NVSBackend(hapNVS),homeSpan.storageDelay);       // Controller and configuration data are saved through write-coalescing store
+
+  int nFound=0;
+  char key[16];
+  
+  for(int i=0;i<MAX_CONTROLLERS;i++){                                // each Controller slot is stored as a separate record so only changed slots are re-written
+    sprintf(key,"CTRL%02d",i);
+    nFound+=store.add(key,controllers+i,sizeof(Controller));
+  }
+
+  if(!nvs_get_blob(hapNVS,"CONTROLLERS",NULL,&len)){                 // if found long-term Controller Pairings data from NVS saved as a single record (prior versions)
+    Serial.print("Migrating storage for Paired Controllers data...\n\n");
     nvs_get_blob(hapNVS,"CONTROLLERS",controllers,&len);             // retrieve data
-  } else {
+    for(int i=0;i<MAX_CONTROLLERS;i++)
+      store.mark(controllers+i);
+    store.flush();                                                    // save all slots as separate records...
+    nvs_erase_key(hapNVS,"CONTROLLERS");                              // ...before erasing prior record, so a reset mid-migration simply repeats the migration
+    nvs_commit(hapNVS);
+  } else if(!nFound){
     Serial.print("Initializing storage for Paired Controllers data...\n\n");               
     
-    HAPClient::removeControllers();                                             // clear all Controller data
-        
-    nvs_set_blob(hapNVS,"CONTROLLERS",controllers,sizeof(controllers));      // update data
-    nvs_commit(hapNVS);                                                      // commit to NVS
+    HAPClient::removeControllers();                                   // clear all Controller data (unallocated slots need not be saved)
   }
 
   Serial.print("Accessory ID:      ");
@@ -142,45 +155,32 @@ void HAPClient::init(){
   tlv8.create(kTLVType_Identifier,64,"IDENTIFIER");
   tlv8.create(kTLVType_Permissions,1,"PERMISSION");
 
-  if(!nvs_get_blob(hapNVS,"HAPHASH",NULL,&len)){                 // if found HAP HASH structure
-    nvs_get_blob(hapNVS,"HAPHASH",&homeSpan.hapConfig,&len);     // retrieve data    
-  } else {
+  if(!store.add("HAPHASH",&homeSpan.hapConfig,sizeof(homeSpan.hapConfig))){     // if HAP HASH structure not found
     Serial.print("Resetting Accessory Configuration number...\n");
-    nvs_set_blob(hapNVS,"HAPHASH",&homeSpan.hapConfig,sizeof(homeSpan.hapConfig));     // update data
-    nvs_commit(hapNVS);                                                                // commit to NVS
+    store.mark(&homeSpan.hapConfig);                                               // save data
   }
 
+  store.add("WIFICACHE",&homeSpan.network.wifiCache,sizeof(homeSpan.network.wifiCache));      // details of last WiFi connection (if any) for fast reconnect
+
   Serial.print("\n");
 
   uint8_t tHash[48];
-  TempBuffer <char> tBuf(homeSpan.sprintfAttributes(NULL)+1);
-  homeSpan.sprintfAttributes(tBuf.buf);  
-  mbedtls_sha512_ret((uint8_t *)tBuf.buf,tBuf.len(),tHash,1);     // create SHA-384 hash of JSON (can be any hash - just looking for a unique key)
+  homeSpan.hashAttributes(tHash);                             // create hash of structure of HAP database (can be any hash - just looking for a unique key)
 
   if(memcmp(tHash,homeSpan.hapConfig.hashCode,48)){           // if hash code of current HAP database does not match stored hash code
     memcpy(homeSpan.hapConfig.hashCode,tHash,48);             // update stored hash code
-    homeSpan.hapConfig.configNumber++;                        // increment configuration number
-    if(homeSpan.hapConfig.configNumber==65536)                // reached max value
-      homeSpan.hapConfig.configNumber=1;                      // reset to 1
-                   
-    Serial.print("Accessory configuration has changed.  Updating configuration number to ");
-    Serial.print(homeSpan.hapConfig.configNumber);
-    Serial.print("\n\n");
-    nvs_set_blob(hapNVS,"HAPHASH",&homeSpan.hapConfig,sizeof(homeSpan.hapConfig));     // update data
-    nvs_commit(hapNVS);                                                                // commit to NVS
+    homeSpan.updateConfigNumber();                            // increment and save configuration number
   } else {
     Serial.print("Accessory configuration number: ");
     Serial.print(homeSpan.hapConfig.configNumber);
     Serial.print("\n\n");    
   }
 
-  for(int i=0;i<homeSpan.Accessories.size();i++){                             // identify all services with over-ridden loop() methods
-    for(int j=0;j<homeSpan.Accessories[i]->Services.size();j++){
-      SpanService *s=homeSpan.Accessories[i]->Services[j];      
-      if((void(*)())(s->*(&SpanService::loop)) != (void(*)())(&SpanService::loop))    // save pointers to services in Loops vector
-        homeSpan.Loops.push_back(s);
-    }
-  }
+  for(int i=0;i<homeSpan.Accessories.size();i++)              // identify all services with over-ridden loop() methods
+    homeSpan.addLoops(homeSpan.Accessories[i]);
+
+  homeSpan.nPublished=homeSpan.Accessories.size();             // all Accessories created before start-up are now published
+  homeSpan.configLogMark=homeSpan.configLog.length();
 
 }
 
@@ -188,6 +188,16 @@ void HAPClient::init(){
 
 void HAPClient::processRequest(){
 
+  int nBytes=readRequest(httpBuf);
+
+  if(nBytes)
+    parseRequest(nBytes);
+}
+
+//////////////////////////////////////
+
+int HAPClient::readRequest(uint8_t *buf){
+
   int nBytes;
   
   if(cPair){                           // expecting encrypted message
@@ -195,11 +205,11 @@ void HAPClient::processRequest(){
     LOG2(client.remoteIP());
     LOG2(" #### <<<<\n");
 
-    nBytes=receiveEncrypted();           // decrypt and return number of bytes       
+    nBytes=receiveEncrypted(buf);        // decrypt and return number of bytes       
         
     if(!nBytes){                        // decryption failed (error message already printed in function)
       badRequestError();              
-      return;          
+      return(0);
     }
         
   } else {                                            // expecting plaintext message  
@@ -207,16 +217,30 @@ void HAPClient::processRequest(){
     LOG2(client.remoteIP());
     LOG2(" <<<<<<<<<\n");
     
-    nBytes=client.read(httpBuf,MAX_HTTP+1);   // read all available bytes up to maximum allowed+1
+    uint32_t tRead=micros();
+    nBytes=client.read(buf,MAX_HTTP+1);       // read all available bytes up to maximum allowed+1
+    homeSpan.trace(Tracer::READ,slot,tRead);
        
     if(nBytes>MAX_HTTP){                              // exceeded maximum number of bytes allowed
       badRequestError();
       Serial.print("\n*** ERROR:  Exceeded maximum HTTP message length\n\n");
-      return;
+      return(0);
     }
         
   } // encrypted/plaintext
+
+  if(nBytes<0)                          // read failed
+    nBytes=0;
+    
+  bytesIn+=nBytes;
+  return(nBytes);
+}
+
+//////////////////////////////////////
+
+void HAPClient::parseRequest(int nBytes){
       
+  uint32_t tParse=micros();
   httpBuf[nBytes]='\0';         // add null character to enable string functions
       
   char *body=(char *)httpBuf;   // char pointer to start of HTTP Body
@@ -240,6 +264,8 @@ void HAPClient::processRequest(){
     return;        
   }
 
+  homeSpan.trace(Tracer::PARSE,slot,tParse);
+
   LOG2(body);
   LOG2("\n------------ END BODY! ------------\n");
 
@@ -254,9 +280,10 @@ void HAPClient::processRequest(){
     if(!strncmp(body,"POST /pair-setup ",17) &&                              // POST PAIR-SETUP
        strstr(body,"Content-Type: application/pairing+tlv8") &&              // check that content is TLV8
        tlv8.unpack(content,cLen)){                                          // read TLV content
-       if(homeSpan.logLevel>1) tlv8.print();                                                        // print TLV records in form "TAG(INT) LENGTH(INT) VALUES(HEX)"
+       if(LOG_ON(2)) tlv8.print(*homeSpan.logOut);                                                        // print TLV records in form "TAG(INT) LENGTH(INT) VALUES(HEX)"
       LOG2("------------ END TLVS! ------------\n");
                
+      reqType=RequestStats::PAIR_SETUP;
       postPairSetupURL();                   // process URL
       return;
     }
@@ -264,9 +291,10 @@ void HAPClient::processRequest(){
     if(!strncmp(body,"POST /pair-verify ",18) &&                             // POST PAIR-VERIFY
        strstr(body,"Content-Type: application/pairing+tlv8") &&              // check that content is TLV8
        tlv8.unpack(content,cLen)){                                          // read TLV content
-       if(homeSpan.logLevel>1) tlv8.print();                                                        // print TLV records in form "TAG(INT) LENGTH(INT) VALUES(HEX)"
+       if(LOG_ON(2)) tlv8.print(*homeSpan.logOut);                                                        // print TLV records in form "TAG(INT) LENGTH(INT) VALUES(HEX)"
       LOG2("------------ END TLVS! ------------\n");
                
+      reqType=RequestStats::PAIR_VERIFY;
       postPairVerifyURL();                  // process URL    
       return;
     }
@@ -274,9 +302,10 @@ void HAPClient::processRequest(){
     if(!strncmp(body,"POST /pairings ",15) &&                                // POST PAIRINGS
        strstr(body,"Content-Type: application/pairing+tlv8") &&              // check that content is TLV8
        tlv8.unpack(content,cLen)){                                          // read TLV content
-       if(homeSpan.logLevel>1) tlv8.print();                                                        // print TLV records in form "TAG(INT) LENGTH(INT) VALUES(HEX)"
+       if(LOG_ON(2)) tlv8.print(*homeSpan.logOut);                                                        // print TLV records in form "TAG(INT) LENGTH(INT) VALUES(HEX)"
       LOG2("------------ END TLVS! ------------\n");
                
+      reqType=RequestStats::PAIRINGS;
       postPairingsURL();                  // process URL    
       return;
     }
@@ -284,9 +313,10 @@ void HAPClient::processRequest(){
     if(!strncmp(body,"POST /pairings ",15) &&                                // POST PAIRINGS
        strstr(body,"Content-Type: application/pairing+tlv8") &&              // check that content is TLV8
        tlv8.unpack(content,cLen)){                                          // read TLV content
-       if(homeSpan.logLevel>1) tlv8.print();                                                        // print TLV records in form "TAG(INT) LENGTH(INT) VALUES(HEX)"
+       if(LOG_ON(2)) tlv8.print(*homeSpan.logOut);                                                        // print TLV records in form "TAG(INT) LENGTH(INT) VALUES(HEX)"
       LOG2("------------ END TLVS! ------------\n");
                
+      reqType=RequestStats::PAIRINGS;
       postPairingsURL();                  // process URL    
       return;
     }
@@ -312,6 +342,7 @@ void HAPClient::processRequest(){
       LOG2((char *)content);                                         // print JSON
       LOG2("\n------------ END JSON! ------------\n");
                
+      reqType=RequestStats::PUT_CHARACTERISTICS;
       putCharacteristicsURL((char *)content);                           // process URL
       return;
     }
@@ -323,6 +354,7 @@ void HAPClient::processRequest(){
       LOG2((char *)content);                                         // print JSON
       LOG2("\n------------ END JSON! ------------\n");
                
+      reqType=RequestStats::PUT_PREPARE;
       putPrepareURL((char *)content);                           // process URL
       return;
     }
@@ -336,11 +368,13 @@ void HAPClient::processRequest(){
   if(!strncmp(body,"GET ",4)){                       // this is a GET request
                     
     if(!strncmp(body,"GET /accessories ",17)){       // GET ACCESSORIES
+      reqType=RequestStats::ACCESSORIES;
       getAccessoriesURL();
       return;
     }
 
     if(!strncmp(body,"GET /characteristics?",21)){   // GET CHARACTERISTICS
+      reqType=RequestStats::GET_CHARACTERISTICS;
       getCharacteristicsURL(body+21);
       return;
     }
@@ -354,7 +388,34 @@ void HAPClient::processRequest(){
   badRequestError();
   Serial.print("\n*** ERROR:  Unknown or malformed HTTP request\n\n");
                         
-} // processHAP
+} // parseRequest
+
+//////////////////////////////////////
+
+void HAPClient::reset(){
+
+  cPair=NULL;                             // reset pointer to verified ID
+  freeKeys();                             // free any session keys left from prior connection
+  homeSpan.clearNotify(slot);             // clear all notification requests for this connection
+  pairStatus=pairState_M1;                // reset starting PAIR STATE (which may be needed if Accessory failed in middle of pair-setup)
+  deferred=false;                         // any deferred response was meant for prior connection
+}
+
+//////////////////////////////////////
+
+void HAPClient::allocKeys(){
+
+  if(!keys)
+    keys=new SessionKeys;
+}
+
+//////////////////////////////////////
+
+void HAPClient::freeKeys(){
+
+  delete keys;
+  keys=NULL;
+}
 
 //////////////////////////////////////
 
@@ -365,11 +426,11 @@ int HAPClient::notFoundError(){
   LOG2(client.remoteIP());
   LOG2(" >>>>>>>>>>\n");
   LOG2(s);
-  client.print(s);
+  writePlain(s,strlen(s));
   LOG2("------------ SENT! --------------\n");
   
   delay(1);
-  client.stop();
+  closeClient();
 
   return(-1);
 }
@@ -383,11 +444,34 @@ int HAPClient::badRequestError(){
   LOG2(client.remoteIP());
   LOG2(" >>>>>>>>>>\n");
   LOG2(s);
-  client.print(s);
+  writePlain(s,strlen(s));
   LOG2("------------ SENT! --------------\n");
   
   delay(1);
-  client.stop();
+  closeClient();
+
+  return(-1);
+}
+
+//////////////////////////////////////
+
+int HAPClient::resourceError(){
+
+  char jsonBuf[32];
+  sprintf(jsonBuf,"{\"status\":%d}",(int)StatusCode::OutOfResources);
+  int nBytes=strlen(jsonBuf);
+
+  char body[128];
+  sprintf(body,"HTTP/1.1 400 Bad Request\r\nContent-Type: application/hap+json\r\nContent-Length: %d\r\n\r\n",nBytes);
+
+  LOG2("\n>>>>>>>>>> ");
+  LOG2(client.remoteIP());
+  LOG2(" >>>>>>>>>>\n");
+  LOG2(body);
+  LOG2(jsonBuf);
+  LOG2("\n");
+
+  sendEncrypted(body,(uint8_t *)jsonBuf,nBytes);
 
   return(-1);
 }
@@ -401,11 +485,11 @@ int HAPClient::unauthorizedError(){
   LOG2(client.remoteIP());
   LOG2(" >>>>>>>>>>\n");
   LOG2(s);
-  client.print(s);
+  writePlain(s,strlen(s));
   LOG2("------------ SENT! --------------\n");
   
   delay(1);
-  client.stop();
+  closeClient();
 
   return(-1);
 }
@@ -529,7 +613,8 @@ int HAPClient::postPairSetupURL(){
       // Note the SALT and INFO text fields used by HKDF to create this Session Key are NOT the same as those for creating iosDeviceX.
       // The iosDeviceX HKDF calculations are separate and will be performed further below with the SALT and INFO as specified in the HAP docs.
 
-      hkdf.create(sessionKey, srp.sharedSecret,64,"Pair-Setup-Encrypt-Salt","Pair-Setup-Encrypt-Info");       // create SessionKey
+      allocKeys();
+      hkdf.create(keys->sessionKey, srp.sharedSecret,64,"Pair-Setup-Encrypt-Salt","Pair-Setup-Encrypt-Info");       // create SessionKey
 
       uint8_t decrypted[1024];                    // temporary storage for decrypted data
       unsigned long long decryptedLen;            // length (in bytes) of decrypted data
@@ -537,7 +622,7 @@ int HAPClient::postPairSetupURL(){
       if(crypto_aead_chacha20poly1305_ietf_decrypt(                                  // use SessionKey to decrypt encryptedData TLV with padded nonce="PS-Msg05"
         decrypted, &decryptedLen, NULL,
         tlv8.buf(kTLVType_EncryptedData), tlv8.len(kTLVType_EncryptedData), NULL, 0,
-        (unsigned char *)"\x00\x00\x00\x00PS-Msg05", sessionKey)==-1){
+        (unsigned char *)"\x00\x00\x00\x00PS-Msg05", keys->sessionKey)==-1){
           
         Serial.print("\n*** ERROR: Exchange-Request Authentication Failed\n\n");
         tlv8.clear();                                         // clear TLV records
@@ -558,7 +643,7 @@ int HAPClient::postPairSetupURL(){
         return(0);
       }
 
-      if(homeSpan.logLevel>1) tlv8.print();             // print decrypted TLV data
+      if(LOG_ON(2)) tlv8.print(*homeSpan.logOut);             // print decrypted TLV data
       LOG2("------- END DECRYPTED TLVS! -------\n");
        
       if(!tlv8.buf(kTLVType_Identifier) || !tlv8.buf(kTLVType_PublicKey) || !tlv8.buf(kTLVType_Signature)){            
@@ -607,8 +692,7 @@ int HAPClient::postPairSetupURL(){
 
       addController(iosDevicePairingID,iosDeviceLTPK,true);        // save Pairing ID and LTPK for this Controller with admin privileges
 
-      nvs_set_blob(hapNVS,"CONTROLLERS",controllers,sizeof(controllers));      // update data
-      nvs_commit(hapNVS);                                                      // commit to NVS
+      store.flush();           // Controller considers itself paired once it receives M6, so new pairing must be saved before responding
 
       // Now perform the above steps in reverse to securely transmit the AccessoryLTPK to the Controller (HAP Section 5.6.6.2)
 
@@ -638,7 +722,7 @@ int HAPClient::postPairSetupURL(){
 
       LOG2("------- ENCRYPTING SUB-TLVS -------\n");
 
-      if(homeSpan.logLevel>1) tlv8.print();
+      if(LOG_ON(2)) tlv8.print(*homeSpan.logOut);
 
       size_t subTLVLen=tlv8.pack(NULL);                 // get size of buffer needed to store sub-TLV 
       uint8_t subTLV[subTLVLen];
@@ -650,7 +734,7 @@ int HAPClient::postPairSetupURL(){
       
       unsigned long long edLen;
 
-      crypto_aead_chacha20poly1305_ietf_encrypt(tlv8.buf(kTLVType_EncryptedData),&edLen,subTLV,subTLVLen,NULL,0,NULL,(unsigned char *)"\x00\x00\x00\x00PS-Msg06",sessionKey);
+      crypto_aead_chacha20poly1305_ietf_encrypt(tlv8.buf(kTLVType_EncryptedData),&edLen,subTLV,subTLVLen,NULL,0,NULL,(unsigned char *)"\x00\x00\x00\x00PS-Msg06",keys->sessionKey);
                                               
       LOG2("---------- END SUB-TLVS! ----------\n");
 
@@ -659,7 +743,7 @@ int HAPClient::postPairSetupURL(){
       
       tlvRespond();                        // send response to client
 
-      mdns_service_txt_item_set("_hap","_tcp","sf","0");           // broadcast new status
+      homeSpan.setTXT("sf","0");           // broadcast new status
       
       LOG1("\n*** ACCESSORY PAIRED! ***\n");
       homeSpan.statusLED.on();
@@ -722,11 +806,12 @@ int HAPClient::postPairVerifyURL(){
 
         uint8_t secretCurveKey[32];     // Accessory's secret key for Curve25519 encryption (32 bytes).  Ephemeral usage - created below and used only in this block
 
-        crypto_box_keypair(publicCurveKey,secretCurveKey);         // generate Curve25519 public key pair (will persist until end of verification process)
+        allocKeys();
+        crypto_box_keypair(keys->publicCurveKey,secretCurveKey);         // generate Curve25519 public key pair (will persist until end of verification process)
 
-        memcpy(iosCurveKey,tlv8.buf(kTLVType_PublicKey),32);       // save iosCurveKey (will persist until end of verification process)
+        memcpy(keys->iosCurveKey,tlv8.buf(kTLVType_PublicKey),32);       // save iosCurveKey (will persist until end of verification process)
 
-        crypto_scalarmult_curve25519(sharedCurveKey,secretCurveKey,iosCurveKey);      // generate (and persist) Pair Verify SharedSecret CurveKey from Accessory's Curve25519 secret key and Controller's Curve25519 public key (32 bytes)
+        crypto_scalarmult_curve25519(keys->sharedCurveKey,secretCurveKey,keys->iosCurveKey);      // generate (and persist) Pair Verify SharedSecret CurveKey from Accessory's Curve25519 secret key and Controller's Curve25519 public key (32 bytes)
 
         uint8_t *accessoryPairingID = accessory.ID;                    // set accessoryPairingID
         size_t accessoryPairingIDLen = 17;
@@ -734,9 +819,9 @@ int HAPClient::postPairVerifyURL(){
         size_t accessoryInfoLen=32+accessoryPairingIDLen+32;           // total size of accessoryInfo
         uint8_t accessoryInfo[accessoryInfoLen];           
 
-        memcpy(accessoryInfo,publicCurveKey,32);                                        // accessoryInfo = Accessory's Curve25519 public key
+        memcpy(accessoryInfo,keys->publicCurveKey,32);                                        // accessoryInfo = Accessory's Curve25519 public key
         memcpy(accessoryInfo+32,accessoryPairingID,accessoryPairingIDLen);              // +accessoryPairingID
-        memcpy(accessoryInfo+32+accessoryPairingIDLen,iosCurveKey,32);                  // +Controller's Curve25519 public key
+        memcpy(accessoryInfo+32+accessoryPairingIDLen,keys->iosCurveKey,32);                  // +Controller's Curve25519 public key
 
         tlv8.clear();       // clear existing TLV records
 
@@ -746,7 +831,7 @@ int HAPClient::postPairVerifyURL(){
 
         LOG2("------- ENCRYPTING SUB-TLVS -------\n");
 
-        if(homeSpan.logLevel>1) tlv8.print();
+        if(LOG_ON(2)) tlv8.print(*homeSpan.logOut);
 
         size_t subTLVLen=tlv8.pack(NULL);                 // get size of buffer needed to store sub-TLV 
         uint8_t subTLV[subTLVLen];
@@ -758,15 +843,15 @@ int HAPClient::postPairVerifyURL(){
       
         unsigned long long edLen;
 
-        hkdf.create(sessionKey,sharedCurveKey,32,"Pair-Verify-Encrypt-Salt","Pair-Verify-Encrypt-Info");       // create SessionKey (32 bytes)
+        hkdf.create(keys->sessionKey,keys->sharedCurveKey,32,"Pair-Verify-Encrypt-Salt","Pair-Verify-Encrypt-Info");       // create SessionKey (32 bytes)
 
-        crypto_aead_chacha20poly1305_ietf_encrypt(tlv8.buf(kTLVType_EncryptedData),&edLen,subTLV,subTLVLen,NULL,0,NULL,(unsigned char *)"\x00\x00\x00\x00PV-Msg02",sessionKey);
+        crypto_aead_chacha20poly1305_ietf_encrypt(tlv8.buf(kTLVType_EncryptedData),&edLen,subTLV,subTLVLen,NULL,0,NULL,(unsigned char *)"\x00\x00\x00\x00PV-Msg02",keys->sessionKey);
                                               
         LOG2("---------- END SUB-TLVS! ----------\n");
         
         tlv8.buf(kTLVType_EncryptedData,edLen);                           // set length of EncryptedData TLV record, which should now include the Authentication Tag at the end as required by HAP
         tlv8.val(kTLVType_State,pairState_M2);                            // set State=<M2>
-        memcpy(tlv8.buf(kTLVType_PublicKey,32),publicCurveKey,32);        // set PublicKey to Accessory's Curve25519 public key
+        memcpy(tlv8.buf(kTLVType_PublicKey,32),keys->publicCurveKey,32);        // set PublicKey to Accessory's Curve25519 public key
       
         tlvRespond();                        // send response to client
         return(1);        
@@ -785,13 +870,15 @@ int HAPClient::postPairVerifyURL(){
         return(0);
       };
 
+      allocKeys();                                // normally already allocated in M1 (if not, authentication below will fail)
+
       uint8_t decrypted[1024];                    // temporary storage for decrypted data
       unsigned long long decryptedLen;            // length (in bytes) of decrypted data
       
       if(crypto_aead_chacha20poly1305_ietf_decrypt(                                            // use SessionKey to decrypt encrypytedData TLV with padded nonce="PV-Msg03"
         decrypted, &decryptedLen, NULL,
         tlv8.buf(kTLVType_EncryptedData), tlv8.len(kTLVType_EncryptedData), NULL, 0,
-        (unsigned char *)"\x00\x00\x00\x00PV-Msg03", sessionKey)==-1){
+        (unsigned char *)"\x00\x00\x00\x00PV-Msg03", keys->sessionKey)==-1){
           
         Serial.print("\n*** ERROR: Verify Authentication Failed\n\n");
         tlv8.clear();                                         // clear TLV records
@@ -810,7 +897,7 @@ int HAPClient::postPairVerifyURL(){
         return(0);
       }
 
-      if(homeSpan.logLevel>1) tlv8.print();             // print decrypted TLV data
+      if(LOG_ON(2)) tlv8.print(*homeSpan.logOut);             // print decrypted TLV data
       LOG2("------- END DECRYPTED TLVS! -------\n");
 
       if(!tlv8.buf(kTLVType_Identifier) || !tlv8.buf(kTLVType_Signature)){            
@@ -836,9 +923,9 @@ int HAPClient::postPairVerifyURL(){
       size_t iosDeviceInfoLen=32+36+32;
       uint8_t iosDeviceInfo[iosDeviceInfoLen];
 
-      memcpy(iosDeviceInfo,iosCurveKey,32);
+      memcpy(iosDeviceInfo,keys->iosCurveKey,32);
       memcpy(iosDeviceInfo+32,tPair->ID,36);
-      memcpy(iosDeviceInfo+32+36,publicCurveKey,32);
+      memcpy(iosDeviceInfo+32+36,keys->publicCurveKey,32);
       
       if(crypto_sign_verify_detached(tlv8.buf(kTLVType_Signature), iosDeviceInfo, iosDeviceInfoLen, tPair->LTPK) != 0){         // verify signature of iosDeviceInfo using iosDeviceLTPK   
         Serial.print("\n*** ERROR: LPTK Signature Verification Failed\n\n");
@@ -855,11 +942,11 @@ int HAPClient::postPairVerifyURL(){
 
       cPair=tPair;        // save Controller for this connection slot - connection is not verified and should be encrypted going forward
 
-      hkdf.create(a2cKey,sharedCurveKey,32,"Control-Salt","Control-Read-Encryption-Key");        // create AccessoryToControllerKey (HAP Section 6.5.2)
-      hkdf.create(c2aKey,sharedCurveKey,32,"Control-Salt","Control-Write-Encryption-Key");       // create ControllerToAccessoryKey (HAP Section 6.5.2)
+      hkdf.create(keys->a2cKey,keys->sharedCurveKey,32,"Control-Salt","Control-Read-Encryption-Key");        // create AccessoryToControllerKey (HAP Section 6.5.2)
+      hkdf.create(keys->c2aKey,keys->sharedCurveKey,32,"Control-Salt","Control-Write-Encryption-Key");       // create ControllerToAccessoryKey (HAP Section 6.5.2)
       
-      a2cNonce.zero();         // reset Nonces for this session to zero
-      c2aNonce.zero();
+      keys->a2cNonce.zero();         // reset Nonces for this session to zero
+      keys->c2aNonce.zero();
 
       LOG2("\n*** SESSION VERIFICATION COMPLETE *** \n");
       return(1);
@@ -887,11 +974,31 @@ int HAPClient::getAccessoriesURL(){
   LOG1(client.remoteIP());
   LOG1(")...\n");
 
-  int nBytes = homeSpan.sprintfAttributes(NULL);        // get size of HAP attributes JSON
-  TempBuffer <char> jBuf(nBytes+1);
-  homeSpan.sprintfAttributes(jBuf.buf);                  // create JSON database (will need to re-cast to uint8_t* below)
+  // The HAP Accessory Attributes Database is streamed one Accessory at a time, so that only the JSON for the 
+  // largest single Accessory needs to be held in memory, rather than the JSON for the entire database
+
+  const char prefix[]="{\"accessories\":[";
+  const char suffix[]="]}";
+  
+  int nAcc=homeSpan.nPublished;                           // only published Accessories are served
+  int nBytes=strlen(prefix)+strlen(suffix)+nAcc-1;        // size of HAP attributes JSON, starting with prefix, suffix, and commas between Accessories
+  int maxBytes=0;                                         // size of largest Accessory JSON
+
+  for(int i=0;i<nAcc;i++){
+    int n=homeSpan.Accessories[i]->sprintfAttributes(NULL);
+    nBytes+=n;
+    if(n>maxBytes)
+      maxBytes=n;
+  }
 
-  int nChars=snprintf(NULL,0,"HTTP/1.1 200 OK\r\nContent-Type: application/hap+json\r\nContent-Length: %d\r\n\r\n",nBytes);      // create '200 OK' Body with Content Length = size of JSON Buf
+  if(!Utils::heapAvailable(maxBytes+1)){
+    Serial.printf("\n*** ERROR:  Not enough memory to create %d-byte JSON for Accessory\n\n",maxBytes);
+    return(resourceError());
+  }
+  
+  TempBuffer <char> jBuf(maxBytes+1);
+
+  int nChars=snprintf(NULL,0,"HTTP/1.1 200 OK\r\nContent-Type: application/hap+json\r\nContent-Length: %d\r\n\r\n",nBytes);      // create '200 OK' Body with Content Length = size of JSON database
   char body[nChars+1];
   sprintf(body,"HTTP/1.1 200 OK\r\nContent-Type: application/hap+json\r\nContent-Length: %d\r\n\r\n",nBytes);
   
@@ -899,10 +1006,27 @@ int HAPClient::getAccessoriesURL(){
   LOG2(client.remoteIP());
   LOG2(" >>>>>>>>>>\n");
   LOG2(body);
-  LOG2(jBuf.buf);
+  LOG2(prefix);
+
+  streamEncrypted(body,nChars);
+  streamEncrypted(prefix,strlen(prefix));
+
+  for(int i=0;i<nAcc;i++){
+    int n=homeSpan.Accessories[i]->sprintfAttributes(jBuf.buf);
+    LOG2(jBuf.buf);
+    streamEncrypted(jBuf.buf,n);
+    if(i+1<nAcc){
+      LOG2(",");
+      streamEncrypted(",",1);
+    }
+  }
+
+  LOG2(suffix);
   LOG2("\n");
-  
-  sendEncrypted(body,(uint8_t *)jBuf.buf,nBytes);
+  streamEncrypted(suffix,strlen(suffix));
+  flushEncrypted();
+
+  LOG2("-------- SENT ENCRYPTED! --------\n");
        
   return(1);
   
@@ -957,6 +1081,8 @@ int HAPClient::postPairingsURL(){
         tlv8.val(kTLVType_State,pairState_M2);                // set State=<M2>
         if(!memcmp(cPair->LTPK,newCont->LTPK,32)){                       // requested Controller already exists and LTPK matches
           newCont->admin=tlv8.val(kTLVType_Permissions)==1?true:false;     // update permission of matching Controller
+          saveController(newCont);
+          store.flush();                                                   // save change before responding
         } else {
           tlv8.val(kTLVType_Error,tagError_Unknown);         // set Error=Unknown
         }
@@ -974,6 +1100,7 @@ int HAPClient::postPairingsURL(){
       }
 
       addController(tlv8.buf(kTLVType_Identifier),tlv8.buf(kTLVType_PublicKey),tlv8.val(kTLVType_Permissions)==1?true:false);
+      store.flush();                                        // admin Controller considers new Controller paired once it receives response, so new pairing must be saved before responding
       
       tlv8.clear();                                         // clear TLV records
       tlv8.val(kTLVType_State,pairState_M2);                // set State=<M2>
@@ -1020,10 +1147,7 @@ int HAPClient::postPairingsURL(){
       break;      
   }
 
-  nvs_set_blob(hapNVS,"CONTROLLERS",controllers,sizeof(controllers));      // update Controller data
-  nvs_commit(hapNVS);                                                      // commit to NVS
-
-  tlvRespond();
+  tlvRespond();                                              // changed Controller slots are saved by store (removals already saved)
 
   // re-check connections and close any (or all) clients as a result of controllers that were removed above
   // must be performed AFTER sending the TLV response, since that connection itself may be terminated below
@@ -1035,7 +1159,7 @@ int HAPClient::postPairingsURL(){
         LOG1("*** Terminating Client #");
         LOG1(i);
         LOG1("\n");
-        hap[i]->client.stop();
+        hap[i]->closeClient();
       }
       
     } // if client connected
@@ -1065,8 +1189,13 @@ int HAPClient::getCharacteristicsURL(char *urlBuf){
   for(int i=0;i<len;i++)
     if(urlBuf[i]==',')
       numIDs++;
+
+  if(numIDs>MAX_REQUEST_IDS){
+    Serial.printf("\n*** ERROR:  GET request for %d Characteristics exceeds maximum of %d\n\n",numIDs,MAX_REQUEST_IDS);
+    return(resourceError());
+  }
   
-  char *ids[numIDs];            // reserve space for number of IDs found
+  TempBuffer <char *> ids(numIDs);    // reserve space for number of IDs found
   int flags=GET_AID;            // flags indicating which characteristic fields to include in response (HAP Table 6-13)
   numIDs=0;                     // reset number of IDs found
 
@@ -1095,7 +1224,7 @@ int HAPClient::getCharacteristicsURL(char *urlBuf){
       char *p2;
       while(char *t2=strtok_r(t1,",",&p2)){      // parse IDs
         t1=NULL;
-        ids[numIDs++]=t2;
+        ids.buf[numIDs++]=t2;
       }
     }
   } // parse URL
@@ -1103,11 +1232,17 @@ int HAPClient::getCharacteristicsURL(char *urlBuf){
   if(!numIDs)           // could not find any IDs
     return(0);
 
-  int nBytes=homeSpan.sprintfAttributes(ids,numIDs,flags,NULL);          // get JSON response - includes terminating null (will be recast to uint8_t* below)
-  char jsonBuf[nBytes+1];
-  homeSpan.sprintfAttributes(ids,numIDs,flags,jsonBuf);
+  int nBytes=homeSpan.sprintfAttributes(ids.buf,numIDs,flags,NULL);          // get JSON response - includes terminating null (will be recast to uint8_t* below)
+
+  if(!Utils::heapAvailable(nBytes+1)){
+    Serial.printf("\n*** ERROR:  Not enough memory to create %d-byte response to GET request\n\n",nBytes);
+    return(resourceError());
+  }
+  
+  TempBuffer <char> jsonBuf(nBytes+1);
+  homeSpan.sprintfAttributes(ids.buf,numIDs,flags,jsonBuf.buf);
 
-  boolean sFlag=strstr(jsonBuf,"status");          // status attribute found?
+  boolean sFlag=strstr(jsonBuf.buf,"status");          // status attribute found?
 
   int nChars=snprintf(NULL,0,"HTTP/1.1 %s\r\nContent-Type: application/hap+json\r\nContent-Length: %d\r\n\r\n",!sFlag?"200 OK":"207 Multi-Status",nBytes);   
   char body[nChars+1];    
@@ -1117,10 +1252,10 @@ int HAPClient::getCharacteristicsURL(char *urlBuf){
   LOG2(client.remoteIP());
   LOG2(" >>>>>>>>>>\n");    
   LOG2(body);
-  LOG2(jsonBuf);
+  LOG2(jsonBuf.buf);
   LOG2("\n");
   
-  sendEncrypted(body,(uint8_t *)jsonBuf,nBytes);        // note recasting of jsonBuf into uint8_t*
+  sendEncrypted(body,(uint8_t *)jsonBuf.buf,nBytes);    // note recasting of jsonBuf into uint8_t*
       
   return(1);
 }
@@ -1143,16 +1278,48 @@ int HAPClient::putCharacteristicsURL(char *json){
   int n=homeSpan.countCharacteristics(json);    // count number of objects in JSON request
   if(n==0)                                      // if no objects found, return
     return(0);
+
+  if(n>MAX_REQUEST_IDS){
+    Serial.printf("\n*** ERROR:  PUT request for %d Characteristics exceeds maximum of %d\n\n",n,MAX_REQUEST_IDS);
+    return(resourceError());
+  }
  
-  SpanBuf pObj[n];                                        // reserve space for objects
+  TempBuffer <SpanBuf> pBuf(n);                           // reserve space for objects
+  SpanBuf *pObj=pBuf.buf;
+  for(int i=0;i<n;i++)
+    pObj[i]=SpanBuf();                                    // initialize objects (TempBuffer memory is not constructed)
+    
   if(!homeSpan.updateCharacteristics(json, pObj))         // perform update
     return(0);                                            // return if failed to update (error message will have been printed in update)
 
+  for(int i=0;i<n;i++){
+    if(pObj[i].status==StatusCode::TBD){                  // one or more Services deferred their update - response will be sent by checkPendingUpdates()
+      homeSpan.PendingUpdates.push_back({conNum,dispatchGen,vector<SpanBuf>(pObj,pObj+n)});
+      for(auto &obj : homeSpan.PendingUpdates.back().pObj){
+        if(obj.val)
+          obj.val=(char *)"";                             // JSON buffer will be overwritten by next request - val is only needed as a flag from here on
+        obj.ev=NULL;
+      }
+      deferred=true;
+      return(1);
+    }
+  }
+
+  putCharacteristicsResponse(pObj,n);
+  return(1);
+}
+
+//////////////////////////////////////
+
+void HAPClient::putCharacteristicsResponse(SpanBuf *pObj, int n){
+
   int multiCast=0;                                        // check if all status is OK, or if multicast response is request
   for(int i=0;i<n;i++)
     if(pObj[i].status!=StatusCode::OK)
       multiCast=1;    
 
+  int nBytes=multiCast?homeSpan.sprintfAttributes(pObj,n,NULL):0;      // size of multicast JSON response - includes terminating null (will be recast to uint8_t* below)
+
   if(!multiCast){                                         // JSON object has no content
     
     char body[]="HTTP/1.1 204 No Content\r\n\r\n";
@@ -1164,10 +1331,15 @@ int HAPClient::putCharacteristicsURL(char *json){
 
     sendEncrypted(body,NULL,0);  
         
+  } else if(!Utils::heapAvailable(nBytes+1)){                     // multicast response is required, but there is not enough memory to create it
+
+    Serial.printf("\n*** ERROR:  Not enough memory to create %d-byte response to PUT request\n\n",nBytes);
+    resourceError();
+    
   } else {                                                       // multicast respose is required
 
-    int nBytes=homeSpan.sprintfAttributes(pObj,n,NULL);          // get JSON response - includes terminating null (will be recast to uint8_t* below)
-    char jsonBuf[nBytes+1];
+    TempBuffer <char> jBuf(nBytes+1);
+    char *jsonBuf=jBuf.buf;
     homeSpan.sprintfAttributes(pObj,n,jsonBuf);
 
     int nChars=snprintf(NULL,0,"HTTP/1.1 207 Multi-Status\r\nContent-Type: application/hap+json\r\nContent-Length: %d\r\n\r\n",nBytes);      // create Body with Content Length = size of JSON Buf
@@ -1188,8 +1360,6 @@ int HAPClient::putCharacteristicsURL(char *json){
   // Create and send Event Notifications if needed
 
   eventNotify(pObj,n,HAPClient::conNum);                  // transmit EVENT Notification for "n" pObj objects, except DO NOT notify client making request
-    
-  return(1);
 }
 
 //////////////////////////////////////
@@ -1276,8 +1446,13 @@ void HAPClient::checkPushButtons(){
 void HAPClient::checkNotifications(){
 
   if(!homeSpan.Notifications.empty()){                                          // if there are Notifications to process    
+    if(homeSpan.reqStats)
+      homeSpan.reqStats->begin();
+    uint32_t tStart=micros();
     eventNotify(&homeSpan.Notifications[0],homeSpan.Notifications.size());      // transmit EVENT Notifications
     homeSpan.Notifications.clear();                                             // clear Notifications vector
+    if(homeSpan.reqStats)
+      homeSpan.reqStats->add(RequestStats::EVENT,tStart);
   }
 }
 
@@ -1300,16 +1475,70 @@ void  HAPClient::checkTimedWrites(){
 
 //////////////////////////////////////
 
+void HAPClient::checkPendingUpdates(){
+
+  for(auto pu=homeSpan.PendingUpdates.begin(); pu!=homeSpan.PendingUpdates.end();){       // loop over all pending PUT requests using an iterator
+
+    boolean waiting=false;
+    int n=pu->pObj.size();
+    
+    for(int i=0;i<n;i++){
+      if(pu->pObj[i].status!=StatusCode::TBD)
+        continue;
+        
+      SpanService *svc=pu->pObj[i].characteristic->service;
+      StatusCode status;
+
+      if(svc->updateState==SpanService::UPDATE_SUCCEEDED)
+        status=StatusCode::OK;
+      else if(svc->updateState==SpanService::UPDATE_FAILED)
+        status=StatusCode::Unable;
+      else if((int32_t)(millis()-svc->updateAlarm)>=0)
+        status=StatusCode::TimedOut;
+      else {
+        waiting=true;
+        continue;
+      }
+
+      svc->updateState=SpanService::UPDATE_IDLE;
+      homeSpan.snapTime=millis();
+      homeSpan.finishUpdate(&pu->pObj[i],n-i,status);
+    }
+
+    if(waiting){
+      pu++;
+      continue;
+    }
+
+    HAPClient *hc=hap[pu->conNum];
+    conNum=pu->conNum;
+    
+    if(hc->gen==pu->gen && hc->deferred){                 // connection that made request is still open (no new client has been accepted into its slot)
+      hc->putCharacteristicsResponse(&pu->pObj[0],n);
+      hc->deferred=false;
+      hc->queueOutbound(HAPMessage::DONE);                // multi-core mode: slot can be read again by HAP I/O task
+    } else {
+      eventNotify(&pu->pObj[0],n,conNum);                 // connection is gone, but other clients still need to be notified
+    }
+    
+    pu=homeSpan.PendingUpdates.erase(pu);
+  }
+}
+
+//////////////////////////////////////
 
 void HAPClient::eventNotify(SpanBuf *pObj, int nObj, int ignoreClient){
   
   for(int cNum=0;cNum<homeSpan.maxConnections;cNum++){        // loop over all connection slots
-    if(hap[cNum]->client && cNum!=ignoreClient){       // if there is a client connected to this slot and it is NOT flagged to be ignored (in cases where it is the client making a PUT request)
+    if((inQueue?hap[cNum]->cPair!=NULL:(boolean)hap[cNum]->client) && cNum!=ignoreClient){       // if there is a client connected to this slot (in multi-core mode, a verified client, since connections are owned by HAP I/O task) and it is NOT flagged to be ignored (in cases where it is the client making a PUT request)
 
       int nBytes=homeSpan.sprintfNotify(pObj,nObj,NULL,cNum);          // get JSON response for notifications to client cNum - includes terminating null (will be recast to uint8_t* below)
 
-      if(nBytes>0){                                                    // if there are notifications to send to client cNum
-        char jsonBuf[nBytes+1];
+      if(nBytes>0 && !Utils::heapAvailable(nBytes+1)){                 // if there is not enough memory to create notifications for client cNum, skip this client
+        Serial.printf("\n*** ERROR:  Not enough memory to create %d-byte Event Notification for connection #%d\n\n",nBytes,cNum);
+      } else if(nBytes>0){                                             // if there are notifications to send to client cNum
+        TempBuffer <char> jBuf(nBytes+1);
+        char *jsonBuf=jBuf.buf;
         homeSpan.sprintfNotify(pObj,nObj,jsonBuf,cNum);
 
         int nChars=snprintf(NULL,0,"EVENT/1.0 200 OK\r\nContent-Type: application/hap+json\r\nContent-Length: %d\r\n\r\n",nBytes);      // create Body with Content Length = size of JSON Buf
@@ -1336,9 +1565,7 @@ void HAPClient::eventNotify(SpanBuf *pObj, int nObj, int ignoreClient){
 
 void HAPClient::tlvRespond(){
 
-  int nBytes=tlv8.pack(NULL);      // return number of bytes needed to pack TLV records into a buffer
-  uint8_t tlvData[nBytes];         // create buffer
-  tlv8.pack(tlvData);              // pack TLV records into buffer
+  int nBytes=tlv8.pack(NULL);      // return number of bytes needed to pack TLV records (TLV records are streamed directly into frameBuf below)
 
   int nChars=snprintf(NULL,0,"HTTP/1.1 200 OK\r\nContent-Type: application/pairing+tlv8\r\nContent-Length: %d\r\n\r\n",nBytes);      // create Body with Content Length = size of TLV data
   char body[nChars+1];
@@ -1348,25 +1575,31 @@ void HAPClient::tlvRespond(){
   LOG2(client.remoteIP());
   LOG2(" >>>>>>>>>>\n");
   LOG2(body);
-  if(homeSpan.logLevel>1) tlv8.print();
+  if(LOG_ON(2)) tlv8.print(*homeSpan.logOut);
 
   if(!cPair){                       // unverified, unencrypted session
-    client.print(body);
-    client.write(tlvData,nBytes);      
+    writePlain(body,nChars);
+    for(int i=0;i<nBytes;i+=FRAME_SIZE)
+      writePlain(frameBuf,tlv8.pack(frameBuf,i,FRAME_SIZE));
     LOG2("------------ SENT! --------------\n");
   } else {
-    sendEncrypted(body,tlvData,nBytes);
+    writeEncrypted((uint8_t *)body,nChars);
+    for(int i=0;i<nBytes;i+=FRAME_SIZE)
+      sendFrame(tlv8.pack(frameBuf+2,i,FRAME_SIZE));   // pack next portion of TLV records directly into frame for encryption
+    LOG2("-------- SENT ENCRYPTED! --------\n");
   }
 
 } // tlvRespond
 
 //////////////////////////////////////
 
-int HAPClient::receiveEncrypted(){
+int HAPClient::receiveEncrypted(uint8_t *decryptBuf){
 
   uint8_t buf[1042];               // maximum size of encoded message = 2+1024+16 bytes (HAP Section 6.5.2)
   int nBytes=0;
 
+  uint32_t tRead=micros();
+
   while(client.read(buf,2)==2){    // read initial 2-byte AAD record
 
     int n=buf[0]+buf[1]*256;                // compute number of bytes expected in encoded message
@@ -1381,14 +1614,20 @@ int HAPClient::receiveEncrypted(){
       return(0);      
     }                
 
-    if(crypto_aead_chacha20poly1305_ietf_decrypt(httpBuf+nBytes, NULL, NULL, buf+2, n+16, buf, 2, c2aNonce.get(), c2aKey)==-1){
+    homeSpan.trace(Tracer::READ,slot,tRead);
+    uint32_t tDecrypt=micros();
+
+    if(crypto_aead_chacha20poly1305_ietf_decrypt(decryptBuf+nBytes, NULL, NULL, buf+2, n+16, buf, 2, keys->c2aNonce.get(), keys->c2aKey)==-1){
       Serial.print("\n\n*** ERROR: Can't Decrypt Message\n\n");
       return(0);        
     }
 
-    c2aNonce.inc();
+    homeSpan.trace(Tracer::DECRYPT,slot,tDecrypt);
+
+    keys->c2aNonce.inc();
 
     nBytes+=n;          // increment total number of bytes in plaintext message
+    tRead=micros();
     
   } // while
 
@@ -1400,52 +1639,271 @@ int HAPClient::receiveEncrypted(){
 
 void HAPClient::sendEncrypted(char *body, uint8_t *dataBuf, int dataLen){
 
-  const int FRAME_SIZE=1024;          // number of bytes to use in each ChaCha20-Poly1305 encrypted frame when sending encrypted JSON content to Client
-  
-  int bodyLen=strlen(body);
+  writeEncrypted((uint8_t *)body,strlen(body));     // Body is always sent in its own frame(s)
+  writeEncrypted(dataBuf,dataLen);
 
-  int count=0;
-  unsigned long long nBytes;
+  LOG2("-------- SENT ENCRYPTED! --------\n");
+      
+} // sendEncrypted
 
-  int totalBytes=2+bodyLen+16;                            // 2-byte AAD + bodyLen + 16-byte authentication tag
-  totalBytes+=(dataLen/FRAME_SIZE)*(2+FRAME_SIZE+16);     // number of full frames * size of full frame with 2-byte AAD + 16-byte authentication tag
+//////////////////////////////////////
 
-  if(dataLen%FRAME_SIZE)                                  // if there is a residual last partial frame
-    totalBytes+=2+dataLen%FRAME_SIZE+16;                  // 2-byte AAD + residual of last partial frame + 16-byte authentication tag
+void HAPClient::writeEncrypted(uint8_t *buf, int nBytes){
 
-  TempBuffer <uint8_t> tBuf(totalBytes);
+  for(int i=0;i<nBytes;i+=FRAME_SIZE){      // encrypt FRAME_SIZE number of bytes in buf in sequential frames
+    
+    int n=nBytes-i;            // number of bytes remaining
+    
+    if(n>FRAME_SIZE)           // maximum number of bytes to encrypt=FRAME_SIZE
+      n=FRAME_SIZE;                                     
+
+    memcpy(frameBuf+2,buf+i,n);
+    sendFrame(n);
+  }
+      
+} // writeEncrypted
+
+//////////////////////////////////////
+
+void HAPClient::streamEncrypted(const void *buf, int nBytes){
+
+  const uint8_t *p=(const uint8_t *)buf;
+
+  while(nBytes>0){
+    int n=FRAME_SIZE-frameLen;       // space remaining in frame
+    if(n>nBytes)
+      n=nBytes;
+
+    memcpy(frameBuf+2+frameLen,p,n);
+    frameLen+=n;
+    p+=n;
+    nBytes-=n;
+
+    if(frameLen==FRAME_SIZE)
+      flushEncrypted();
+  }
   
-  tBuf.buf[count]=bodyLen%256;         // store number of bytes in first frame that encrypts the Body (AAD bytes)
-  tBuf.buf[count+1]=bodyLen/256;
+} // streamEncrypted
+
+//////////////////////////////////////
+
+void HAPClient::flushEncrypted(){
+
+  if(frameLen>0)
+    sendFrame(frameLen);
+  frameLen=0;
   
-  crypto_aead_chacha20poly1305_ietf_encrypt(tBuf.buf+count+2,&nBytes,(uint8_t *)body,bodyLen,tBuf.buf+count,2,NULL,a2cNonce.get(),a2cKey);   // encrypt the Body with authentication tag appended
+} // flushEncrypted
 
-  a2cNonce.inc();                 // increment nonce
+//////////////////////////////////////
+
+void HAPClient::sendFrame(int nBytes){
+
+  if(queueOutbound(HAPMessage::ENCRYPT,frameBuf+2,nBytes))     // multi-core mode: HAP I/O task encrypts and sends frame
+    return;
+
+  transmitFrame(frameBuf,nBytes);
+      
+} // sendFrame
+
+//////////////////////////////////////
+
+void HAPClient::transmitFrame(uint8_t *frame, int nBytes){
+
+  unsigned long long n;
+  uint32_t tEncrypt=micros();
   
-  count+=2+bodyLen+16;            // increment count by 2-byte AAD record + length of Body + 16-byte authentication tag
+  frame[0]=nBytes%256;      // store number of bytes that encrypts this frame (AAD bytes)
+  frame[1]=nBytes/256;
 
-  for(int i=0;i<dataLen;i+=FRAME_SIZE){      // encrypt FRAME_SIZE number of bytes in dataBuf in sequential frames
-    
-    int n=dataLen-i;           // number of bytes remaining
-    
-    if(n>FRAME_SIZE)           // maximum number of bytes to encrypt=FRAME_SIZE
-      n=FRAME_SIZE;                                     
-    
-    tBuf.buf[count]=n%256;    // store number of bytes that encrypts this frame (AAD bytes)
-    tBuf.buf[count+1]=n/256;
+  crypto_aead_chacha20poly1305_ietf_encrypt(frame+2,&n,frame+2,nBytes,frame,2,NULL,keys->a2cNonce.get(),keys->a2cKey);   // encrypt frame in place with authentication tag appended
+
+  keys->a2cNonce.inc();              // increment nonce
 
-    crypto_aead_chacha20poly1305_ietf_encrypt(tBuf.buf+count+2,&nBytes,dataBuf+i,n,tBuf.buf+count,2,NULL,a2cNonce.get(),a2cKey);   // encrypt the next portion of dataBuf with authentication tag appended
+  homeSpan.trace(Tracer::ENCRYPT,slot,tEncrypt);
+  uint32_t tWrite=micros();
 
-    a2cNonce.inc();            // increment nonce
+  client.write(frame,2+nBytes+16);     // transmit encrypted frame to Client
+
+  homeSpan.trace(Tracer::WRITE,slot,tWrite);
+  bytesOut+=2+nBytes+16;
+  lastActivity=millis();
+      
+} // transmitFrame
+
+//////////////////////////////////////
+
+void HAPClient::writePlain(const void *buf, int nBytes){
+
+  if(queueOutbound(HAPMessage::PLAIN,buf,nBytes))      // multi-core mode: HAP I/O task sends data
+    return;
+
+  uint32_t tWrite=micros();
+  client.write((const uint8_t *)buf,nBytes);
+  homeSpan.trace(Tracer::WRITE,slot,tWrite);
+  bytesOut+=nBytes;
+  lastActivity=millis();
+  
+} // writePlain
+
+//////////////////////////////////////
+
+void HAPClient::closeClient(){
+
+  if(queueOutbound(HAPMessage::CLOSE))         // multi-core mode: HAP I/O task closes connection
+    return;
+
+  client.stop();
+}
 
-    count+=2+n+16;             // increment count by 2-byte AAD record + length of JSON + 16-byte authentication tag
+//////////////////////////////////////
+
+boolean HAPClient::queueOutbound(uint8_t type, const void *buf, int nBytes){
+
+  if(!outQueue || xTaskGetCurrentTaskHandle()==ioHandle)       // single-core mode, or already running in HAP I/O task
+    return(false);
+
+  HAPMessage msg={type,slot,dispatchGen,nBytes,NULL};
+
+  if(nBytes>0){
+    msg.data=(uint8_t *)malloc(nBytes);
+    if(!msg.data){
+      Serial.print("\n*** ERROR:  Can't allocate memory for HAP I/O message - closing connection\n\n");
+      msg.type=HAPMessage::CLOSE;
+      msg.len=0;
+    } else {
+      memcpy(msg.data,buf,nBytes);
+    }
   }
- 
-  client.write(tBuf.buf,count);   // transmit all encrypted frames to Client
 
-  LOG2("-------- SENT ENCRYPTED! --------\n");
+  while(!outQueue->push(msg))       // wait for HAP I/O task to make room
+    vTaskDelay(1);
+
+  return(true);
+}
+
+//////////////////////////////////////
+
+void HAPClient::queueInbound(uint8_t type, uint8_t slot, uint16_t gen, uint8_t *data, int len){
+
+  HAPMessage msg={type,slot,gen,len,data};
+
+  while(!inQueue->push(msg))        // cannot normally be full, since each slot has at most one outstanding message
+    vTaskDelay(1);
+}
+
+//////////////////////////////////////
+
+void HAPClient::startIO(int core, uint32_t stackSize){
+
+  inQueue=new SpanQueue<HAPMessage>(homeSpan.maxConnections+1);
+  outQueue=new SpanQueue<HAPMessage>(64);
+
+  xTaskCreatePinnedToCore(ioTask,"HAP I/O",stackSize,NULL,1,&ioHandle,core);
+}
+
+//////////////////////////////////////
+
+void HAPClient::ioTask(void *args){
+
+  uint8_t *ioBuf=(uint8_t *)malloc(MAX_HTTP+1);           // buffer for reading requests (httpBuf is owned by poll())
+  uint8_t *ioFrame=(uint8_t *)malloc(2+FRAME_SIZE+16);    // buffer for encrypting frames (frameBuf is owned by poll())
+  HAPMessage msg;
+
+  for(;;){
+
+    WiFiClient newClient;
+
+    if(newClient=homeSpan.hapServer->available())         // found a new HTTP client
+      homeSpan.acceptClient(newClient);
+
+    for(int i=0;i<homeSpan.maxConnections;i++){           // read complete requests from any slot not waiting on poll()
+      if(!hap[i]->busy && hap[i]->client && hap[i]->client.available()){
+        hap[i]->lastActivity=millis();
+        int nBytes=hap[i]->readRequest(ioBuf);
+        if(nBytes){
+          uint8_t *data=(uint8_t *)malloc(nBytes);
+          if(!data){
+            Serial.print("\n*** ERROR:  Can't allocate memory for HAP I/O message - closing connection\n\n");
+            hap[i]->client.stop();
+            continue;
+          }
+          memcpy(data,ioBuf,nBytes);
+          hap[i]->busy=true;
+          queueInbound(HAPMessage::REQUEST,i,hap[i]->gen,data,nBytes);
+        }
+      }
+    }
+
+    while(outQueue->pop(msg)){                            // transmit responses and notifications from poll()
+      HAPClient *hc=hap[msg.slot];
+
+      if(msg.gen==hc->gen){                               // ignore messages meant for a prior connection in this slot
+        switch(msg.type){
+          
+          case HAPMessage::PLAIN:
+            hc->writePlain(msg.data,msg.len);
+            break;
+
+          case HAPMessage::ENCRYPT:
+            memcpy(ioFrame+2,msg.data,msg.len);
+            hc->transmitFrame(ioFrame,msg.len);
+            break;
+
+          case HAPMessage::CLOSE:
+            hc->client.stop();
+            LOG1("** Disconnecting Client #");
+            LOG1(msg.slot);
+            LOG1("  (");
+            LOG1(millis()/1000);
+            LOG1(" sec)\n");
+            break;
+
+          case HAPMessage::DONE:
+            hc->busy=false;
+            break;
+        }
+      }
       
-} // sendEncrypted
+      free(msg.data);
+    }
+
+    homeSpan.checkIdleClients();
+    vTaskDelay(1);
+  }
+}
+
+//////////////////////////////////////
+
+void HAPClient::dispatchRequests(){
+
+  HAPMessage msg;
+
+  while(inQueue->pop(msg)){
+    HAPClient *hc=hap[msg.slot];
+
+    if(msg.type==HAPMessage::CONNECT){
+      hc->dispatchGen=msg.gen;
+      hc->reset();
+      
+    } else if(msg.gen==hc->dispatchGen){
+      memcpy(httpBuf,msg.data,msg.len);
+      conNum=msg.slot;                                    // set connection number
+      reqType=RequestStats::OTHER;                        // default request type (updated by parseRequest() when dispatching a valid request)
+      if(homeSpan.reqStats)
+        homeSpan.reqStats->begin();
+      uint32_t tStart=micros();
+      hc->parseRequest(msg.len);                          // process HAP request
+      if(homeSpan.reqStats)
+        homeSpan.reqStats->add(reqType,tStart);
+      LOG2("\n");
+    }
+
+    free(msg.data);
+    if(!hc->deferred)
+      hc->queueOutbound(HAPMessage::DONE);                // slot can be read again by HAP I/O task (once any deferred response has been sent)
+  }
+}
 
 /////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////
@@ -1463,26 +1921,26 @@ void HAPClient::hexPrintColumn(uint8_t *buf, int n){
 
 //////////////////////////////////////
 
-void HAPClient::hexPrintRow(uint8_t *buf, int n){
+void HAPClient::hexPrintRow(uint8_t *buf, int n, Print &out){
 
   char c[16];
   
   for(int i=0;i<n;i++){
     sprintf(c,"%02X",buf[i]);
-    Serial.print(c);
+    out.print(c);
   }
 
 }
 
 //////////////////////////////////////
 
-void HAPClient::charPrintRow(uint8_t *buf, int n){
+void HAPClient::charPrintRow(uint8_t *buf, int n, Print &out){
 
   char c[16];
   
   for(int i=0;i<n;i++){
     sprintf(c,"%c",buf[i]);
-    Serial.print(c);
+    out.print(c);
   }
 
 }
@@ -1495,8 +1953,8 @@ Controller *HAPClient::findController(uint8_t *id){
     
     if(controllers[i].allocated && !memcmp(controllers[i].ID,id,36)){     // found matching ID
       LOG2("Found Controller: ");
-      if(homeSpan.logLevel>1)
-        charPrintRow(id,36);
+      if(LOG_ON(2))
+        charPrintRow(id,36,*homeSpan.logOut);
       LOG2(controllers[i].admin?" (admin)\n":" (regular)\n");    
       return(controllers+i);                                              // return with pointer to matching controller
     }
@@ -1527,9 +1985,10 @@ Controller *HAPClient::addController(uint8_t *id, uint8_t *ltpk, boolean admin){
   if((slot=findController(id))){
     memcpy(slot->LTPK,ltpk,32);
     slot->admin=admin;
+    saveController(slot);
     LOG2("\n*** Updated Controller: ");
-    if(homeSpan.logLevel>1)
-      charPrintRow(id,36);
+    if(LOG_ON(2))
+      charPrintRow(id,36,*homeSpan.logOut);
     LOG2(slot->admin?" (admin)\n\n":" (regular)\n\n");
     return(slot);    
   }
@@ -1539,9 +1998,10 @@ Controller *HAPClient::addController(uint8_t *id, uint8_t *ltpk, boolean admin){
     memcpy(slot->ID,id,36);
     memcpy(slot->LTPK,ltpk,32);
     slot->admin=admin;
+    saveController(slot);
     LOG2("\n*** Added Controller: ");
-    if(homeSpan.logLevel>1)
-      charPrintRow(id,36);
+    if(LOG_ON(2))
+      charPrintRow(id,36,*homeSpan.logOut);
     LOG2(slot->admin?" (admin)\n\n":" (regular)\n\n");
     return(slot);       
   }
@@ -1569,8 +2029,19 @@ int HAPClient::nAdminControllers(){
 
 void HAPClient::removeControllers(){
   
-  for(int i=0;i<MAX_CONTROLLERS;i++)
-    controllers[i].allocated=false;
+  for(int i=0;i<MAX_CONTROLLERS;i++){
+    if(controllers[i].allocated){
+      controllers[i].allocated=false;
+      saveController(controllers+i);
+    }
+  }
+}    
+
+//////////////////////////////////////
+
+void HAPClient::saveController(Controller *slot){
+
+  store.mark(slot,!slot->allocated);      // removal of a Controller is security-related and is therefore saved at next poll without waiting for debounce
 }    
 
 //////////////////////////////////////
@@ -1581,15 +2052,16 @@ void HAPClient::removeController(uint8_t *id){
 
   if((slot=findController(id))){      // remove controller if found
     LOG2("\n***Removed Controller: ");
-    if(homeSpan.logLevel>1)
-      charPrintRow(id,36);
+    if(LOG_ON(2))
+      charPrintRow(id,36,*homeSpan.logOut);
     LOG2(slot->admin?" (admin)\n":" (regular)\n");
     slot->allocated=false;
+    saveController(slot);
 
     if(nAdminControllers()==0){       // if no more admins, remove all controllers
       removeControllers();
       LOG1("That was last Admin Controller!  Removing any remaining Regular Controllers and unpairing Accessory\n");  
-      mdns_service_txt_item_set("_hap","_tcp","sf","1");           // set Status Flag = 1 (Table 6-8)
+      homeSpan.setTXT("sf","1");           // set Status Flag = 1 (Table 6-8)
       homeSpan.statusLED.start(LED_PAIRING_NEEDED);
     }
 
@@ -1656,11 +2128,18 @@ nvs_handle HAPClient::hapNVS;
 nvs_handle HAPClient::wifiNVS;
 nvs_handle HAPClient::srpNVS;
 nvs_handle HAPClient::otaNVS;
+SpanStore HAPClient::store;
 uint8_t HAPClient::httpBuf[MAX_HTTP+1];                 
+uint8_t HAPClient::frameBuf[2+FRAME_SIZE+16];
+int HAPClient::frameLen=0;
 HKDF HAPClient::hkdf;                                   
 pairState HAPClient::pairStatus;                        
 Accessory HAPClient::accessory;                         
 Controller HAPClient::controllers[MAX_CONTROLLERS];    
 SRP6A HAPClient::srp;
 int HAPClient::conNum;
+uint8_t HAPClient::reqType;
+SpanQueue<HAPMessage> *HAPClient::inQueue=NULL;
+SpanQueue<HAPMessage> *HAPClient::outQueue=NULL;
+TaskHandle_t HAPClient::ioHandle=NULL;
  
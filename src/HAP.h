@@ -35,6 +35,7 @@
 #include "HAPConstants.h"
 #include "HKDF.h"
 #include "SRP.h"
+#include "Storage.h"
 
 /////////////////////////////////////////////////
 // NONCE Structure (HAP used last 64 of 96 bits)
@@ -47,6 +48,26 @@ struct Nonce {
   void inc();
 };
 
+/////////////////////////////////////////////////
+// Session Keys Structure (allocated only for connections that start pair-setup or pair-verify)
+
+struct SessionKeys {
+
+  // These keys are generated in the first call to pair-verify and used in the second call to pair-verify so must persist for a short period
+    
+  uint8_t publicCurveKey[32];     // public key for Curve25519 encryption
+  uint8_t sharedCurveKey[32];     // Pair-Verfied Shared Secret key derived from Accessory's epehmeral secretCurveKey and Controller's iosCurveKey
+  uint8_t sessionKey[32];         // shared Session Key (derived with various HKDF calls)
+  uint8_t iosCurveKey[32];        // Curve25519 public key for associated paired controller
+
+  // CurveKey and CurveKey Nonces are created once each new session is verified in /pair-verify.  Keys persist for as long as connection is open
+  
+  uint8_t a2cKey[32];             // AccessoryToControllerKey derived from HKDF-SHA-512 of sharedCurveKey (HAP Section 6.5.2)
+  uint8_t c2aKey[32];             // ControllerToAccessoryKey derived from HKDF-SHA-512 of sharedCurveKey (HAP Section 6.5.2)
+  Nonce a2cNonce;                 // encryption nonce (starts at zero at end of each Pair-Verify and increment every encryption - NOT DOCUMENTED)
+  Nonce c2aNonce;                 // decryption nonce (starts at zero at end of each Pair-Verify and increment every encryption - NOT DOCUMENTED)
+};
+
 /////////////////////////////////////////////////
 // Paired Controller Structure for Permanently-Stored Data
 
@@ -66,6 +87,27 @@ struct Accessory {
   uint8_t LTPK[32];        // public key for Ed25519 signatures
 };
 
+/////////////////////////////////////////////////
+// HAP Message Structure for passing requests and responses between HAP I/O task and poll() in multi-core mode
+
+struct HAPMessage {
+
+  enum {
+    CONNECT,            // I/O -> poll(): new client connected to slot (poll() resets slot and replies DONE)
+    REQUEST,            // I/O -> poll(): complete (decrypted) HTTP request of len bytes in data
+    PLAIN,              // poll() -> I/O: len bytes in data to be sent to client unencrypted
+    ENCRYPT,            // poll() -> I/O: len bytes in data to be encrypted into a single frame and sent to client
+    CLOSE,              // poll() -> I/O: close client connection
+    DONE                // poll() -> I/O: finished processing CONNECT or REQUEST - slot can be read again
+  };
+
+  uint8_t type;         // message type
+  uint8_t slot;         // HAPClient connection slot
+  uint16_t gen;         // connection generation of slot when message was created (messages for prior connections are discarded)
+  int len;              // number of bytes in data
+  uint8_t *data;        // malloc'd data (or NULL) - freed by recipient
+};
+
 /////////////////////////////////////////////////
 // HAPClient Structure
 // Reads and Writes from each HAP Client connection
@@ -76,43 +118,55 @@ struct HAPClient {
 
   static const int MAX_HTTP=8095;                     // max number of bytes in HTTP message buffer
   static const int MAX_CONTROLLERS=16;                // maximum number of paired controllers (HAP requires at least 16)
-  static const int MAX_ACCESSORIES=41;                // maximum number of allowed Acessories (HAP limit=150, but not enough memory in ESP32 to run that many)
+  static const int MAX_ACCESSORIES=150;               // maximum number of allowed Acessories (HAP limit=150) - in practice also limited by MIN_FREE_HEAP
+  static const int MIN_FREE_HEAP=40000;               // minimum free heap that must remain after creating each Accessory (reserved for WiFi, pair-verify, and HAP request processing)
+  static const int MAX_REQUEST_IDS=512;               // maximum number of Characteristics that can be read or written in a single request (larger requests are rejected with a 400 error)
+  static const int FRAME_SIZE=1024;                   // number of bytes to use in each ChaCha20-Poly1305 encrypted frame when sending encrypted content to Client (HAP Section 6.5.2)
   
   static TLV<kTLVType,10> tlv8;                       // TLV8 structure (HAP Section 14.1) with space for 10 TLV records of type kTLVType (HAP Table 5-6)
   static nvs_handle hapNVS;                           // handle for non-volatile-storage of HAP data
   static nvs_handle wifiNVS;                          // handle for non-volatile-storage of WiFi data
   static nvs_handle srpNVS;                           // handle for non-volatile-storage of SRP data
   static nvs_handle otaNVS;                           // handle for non-volatile-storage of OTA data
+  static SpanStore store;                             // write-coalescing storage for Controller and configuration data kept in HAP namespace of NVS
   static uint8_t httpBuf[MAX_HTTP+1];                 // buffer to store HTTP messages (+1 to leave room for storing an extra 'overflow' character)
+  static uint8_t frameBuf[2+FRAME_SIZE+16];           // buffer to store a single outgoing frame: 2-byte AAD + FRAME_SIZE bytes of content + 16-byte authentication tag
+  static int frameLen;                                // number of bytes of content accumulated in frameBuf by streamEncrypted() that have not yet been sent
   static HKDF hkdf;                                   // generates (and stores) HKDF-SHA-512 32-byte keys derived from an inputKey of arbitrary length, a salt string, and an info string
   static pairState pairStatus;                        // tracks pair-setup status
   static SRP6A srp;                                   // stores all SRP-6A keys used for Pair-Setup
   static Accessory accessory;                         // Accessory ID and Ed25519 public and secret keys- permanently stored
   static Controller controllers[MAX_CONTROLLERS];     // Paired Controller IDs and ED25519 long-term public keys - permanently stored
   static int conNum;                                  // connection number - used to keep track of per-connection EV notifications
+  static uint8_t reqType;                             // type of HAP request being processed - used for request statistics
+  static SpanQueue<HAPMessage> *inQueue;              // requests from HAP I/O task to poll() (NULL unless multi-core mode is enabled)
+  static SpanQueue<HAPMessage> *outQueue;             // responses from poll() to HAP I/O task (NULL unless multi-core mode is enabled)
+  static TaskHandle_t ioHandle;                       // handle to HAP I/O task
 
   // individual structures and data defined for each Hap Client connection
   
   WiFiClient client=0;            // handle to client
   Controller *cPair;              // pointer to info on current, session-verified Paired Controller (NULL=un-verified, and therefore un-encrypted, connection)
+  uint32_t connectTime;           // time (in millis) client connected
+  uint32_t lastActivity;          // time (in millis) data was last received from, or sent to, client
+  uint32_t bytesIn;               // total bytes received from client
+  uint32_t bytesOut;              // total bytes sent to client
+  uint8_t slot;                   // connection slot number of this HAPClient
+  std::atomic<uint16_t> gen{0};   // connection generation - incremented by acceptClient() for each new client (in both single-core and multi-core modes)
+  uint16_t dispatchGen=0;         // connection generation last seen by poll() (same as gen in single-core mode)
+  boolean deferred=false;         // true if response to a PUT request is waiting on a deferred Service update (no further requests are read until it is sent)
+  std::atomic<boolean> busy{false};   // true if request from this client is waiting to be, or is being, processed by poll() (multi-core mode only)
    
-  // These keys are generated in the first call to pair-verify and used in the second call to pair-verify so must persist for a short period
-    
-  uint8_t publicCurveKey[32];     // public key for Curve25519 encryption
-  uint8_t sharedCurveKey[32];     // Pair-Verfied Shared Secret key derived from Accessory's epehmeral secretCurveKey and Controller's iosCurveKey
-  uint8_t sessionKey[32];         // shared Session Key (derived with various HKDF calls)
-  uint8_t iosCurveKey[32];        // Curve25519 public key for associated paired controller
-
-  // CurveKey and CurveKey Nonces are created once each new session is verified in /pair-verify.  Keys persist for as long as connection is open
-  
-  uint8_t a2cKey[32];             // AccessoryToControllerKey derived from HKDF-SHA-512 of sharedCurveKey (HAP Section 6.5.2)
-  uint8_t c2aKey[32];             // ControllerToAccessoryKey derived from HKDF-SHA-512 of sharedCurveKey (HAP Section 6.5.2)
-  Nonce a2cNonce;                 // encryption nonce (starts at zero at end of each Pair-Verify and increment every encryption - NOT DOCUMENTED)
-  Nonce c2aNonce;                 // decryption nonce (starts at zero at end of each Pair-Verify and increment every encryption - NOT DOCUMENTED)
+  SessionKeys *keys=NULL;         // Curve25519 and ChaCha20-Poly1305 keys and nonces for this connection (NULL until needed by pair-setup or pair-verify)
 
   // define member methods
 
-  void processRequest();                       // process HAP request  
+  void processRequest();                       // read and process HAP request  
+  int readRequest(uint8_t *buf);               // read (and decrypt if needed) HTTP request into buf.  Returns number of bytes read, or 0 if request was rejected
+  void parseRequest(int nBytes);               // parse and process HTTP request of nBytes already stored in httpBuf
+  void reset();                                // resets verification, session keys, notifications, and pair-setup status for new connection
+  void allocKeys();                            // allocates (zeroed) session keys for this connection if not already allocated
+  void freeKeys();                             // frees session keys for this connection
   int postPairSetupURL();                      // POST /pair-setup (HAP Section 5.6)
   int postPairVerifyURL();                     // POST /pair-verify (HAP Section 5.7)
   int getAccessoriesURL();                     // GET /accessories (HAP Section 6.6)
@@ -120,22 +174,32 @@ struct HAPClient {
   int getCharacteristicsURL(char *urlBuf);     // GET /characteristics (HAP Section 6.7.4)  
   int putCharacteristicsURL(char *json);       // PUT /characteristics (HAP Section 6.7.2)
   int putPrepareURL(char *json);               // PUT /prepare (HAP Section 6.7.2.4)
+  void putCharacteristicsResponse(SpanBuf *pObj, int n);     // sends response to PUT /characteristics, and Event Notifications to other clients, once all updates are complete
 
   void tlvRespond();                                                // respond to client with HTTP OK header and all defined TLV data records (those with length>0)
   void sendEncrypted(char *body, uint8_t *dataBuf, int dataLen);    // send client complete ChaCha20-Poly1305 encrypted HTTP mesage comprising a null-terminated 'body' and 'dataBuf' with 'dataLen' bytes
-  int receiveEncrypted();                                           // decrypt HTTP request (HAP Section 6.5)
+  void writeEncrypted(uint8_t *buf, int nBytes);                    // encrypt and send client nBytes of buf, split into as many frames as needed
+  void sendFrame(int nBytes);                                       // encrypt (in place) and send client the nBytes of content already stored in frameBuf+2
+  void streamEncrypted(const void *buf, int nBytes);                // append nBytes of buf to frameBuf, encrypting and sending each frame to client as it fills
+  void flushEncrypted();                                            // encrypt and send any content remaining in frameBuf from streamEncrypted()
+  int receiveEncrypted(uint8_t *decryptBuf);                        // decrypt HTTP request into decryptBuf (HAP Section 6.5)
+  void transmitFrame(uint8_t *frame, int nBytes);                   // encrypt (in place) and send client the nBytes of content already stored in frame+2
+  void writePlain(const void *buf, int nBytes);                     // send client nBytes of unencrypted buf
+  void closeClient();                                               // close client connection
+  boolean queueOutbound(uint8_t type, const void *buf=NULL, int nBytes=0);    // queues output for HAP I/O task if called from any other task.  Returns false if output should be handled directly
 
   int notFoundError();           // return 404 error
   int badRequestError();         // return 400 error
   int unauthorizedError();       // return 470 error
+  int resourceError();           // return 400 error with OutOfResources status (HAP Table 6-11) - used when a request is too large to process
 
   // define static methods
     
   static void init();                                  // initialize HAP after start-up
     
   static void hexPrintColumn(uint8_t *buf, int n);     // prints 'n' bytes of *buf as HEX, one byte per row.  For diagnostics/debugging only
-  static void hexPrintRow(uint8_t *buf, int n);        // prints 'n' bytes of *buf as HEX, all on one row
-  static void charPrintRow(uint8_t *buf, int n);       // prints 'n' bytes of *buf as CHAR, all on one row
+  static void hexPrintRow(uint8_t *buf, int n, Print &out=Serial);     // prints 'n' bytes of *buf as HEX, all on one row
+  static void charPrintRow(uint8_t *buf, int n, Print &out=Serial);    // prints 'n' bytes of *buf as CHAR, all on one row
   
   static Controller *findController(uint8_t *id);                                      // returns pointer to controller with mathching ID (or NULL if no match)
   static Controller *getFreeController();                                              // return pointer to next free controller slot (or NULL if no free slots)
@@ -148,7 +212,13 @@ struct HAPClient {
   static void checkPushButtons();                                                      // checks for PushButton presses and calls button() method of attached Services when found
   static void checkNotifications();                                                    // checks for Event Notifications and reports to controllers as needed (HAP Section 6.8)
   static void checkTimedWrites();                                                      // checks for expired Timed Write PIDs, and clears any found (HAP Section 6.7.2.4)
+  static void checkPendingUpdates();                                                   // checks for completed or timed-out deferred Service updates, and sends PUT responses once all updates in a request are complete
+  static void saveController(Controller *slot);                                        // marks Controller slot as changed so it is saved to NVS (removals are saved without waiting for debounce)
   static void eventNotify(SpanBuf *pObj, int nObj, int ignoreClient=-1);               // transmits EVENT Notifications for nObj SpanBuf objects, pObj, with optional flag to ignore a specific client
+  static void startIO(int core, uint32_t stackSize);                                   // creates queues and starts HAP I/O task pinned to core
+  static void ioTask(void *args);                                                      // HAP I/O task: accepts clients, reads and decrypts requests, and encrypts and writes responses
+  static void queueInbound(uint8_t type, uint8_t slot, uint16_t gen, uint8_t *data=NULL, int len=0);   // pushes message onto inQueue, waiting for room if needed
+  static void dispatchRequests();                                                      // processes all CONNECT and REQUEST messages in inQueue (called from poll())
 };
 
 /////////////////////////////////////////////////
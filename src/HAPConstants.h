@@ -79,9 +79,12 @@ typedef enum {
 enum class StatusCode {  
   OK=0,
   Unable=-70402,
+  Busy=-70403,
   ReadOnly=-70404,
   WriteOnly=-70405,
   NotifyNotAllowed=-70406,
+  OutOfResources=-70407,
+  TimedOut=-70408,
   UnknownResource=-70409,
   InvalidValue=-70410,  
   TBD=-1                       // status To-Be-Determined (TBD) once service.update() called - internal use only
@@ -31,6 +31,8 @@
 #include <WiFi.h>
 #include <ArduinoOTA.h>
 #include <esp_ota_ops.h>
+#include <lwip/sockets.h>
+#include <algorithm>
 
 #include "HomeSpan.h"
 #include "HAP.h"
@@ -57,10 +59,14 @@ void Span::begin(Category catID, const char *displayName, const char *hostNameBa
   int maxLimit=CONFIG_LWIP_MAX_SOCKETS-2-otaEnabled;
   if(maxConnections>maxLimit)
     maxConnections=maxLimit;
+  if(maxConnections>32)                       // ev notification flags for each Characteristic are stored as a 32-bit mask
+    maxConnections=32;
 
   hap=(HAPClient **)calloc(maxConnections,sizeof(HAPClient *));
-  for(int i=0;i<maxConnections;i++)
+  for(int i=0;i<maxConnections;i++){
     hap[i]=new HAPClient;
+    hap[i]->slot=i;
+  }
 
   hapServer=new WiFiServer(tcpPortNum);
 
@@ -73,7 +79,14 @@ void Span::begin(Category catID, const char *displayName, const char *hostNameBa
                  "** Please ensure serial monitor is set to transmit <newlines>\n\n");
 
   Serial.print("Message Logs:     Level ");
-  Serial.print(logLevel);  
+  Serial.print(logLevel);
+  if(logLevel>MAX_LOG_LEVEL){
+    Serial.print(" (only Level ");
+    Serial.print(MAX_LOG_LEVEL);
+    Serial.print(" compiled)");
+  }
+  if(logBuffer)
+    Serial.print(" (buffered)");
   Serial.print("\nStatus LED:       Pin ");
   Serial.print(statusPin);  
   Serial.print("\nDevice Control:   Pin ");
@@ -151,6 +164,9 @@ void Span::poll() {
     
   } // isInitialized
 
+  if(network.apActive){
+    checkAP();                        // WiFi connection is not checked while Access Point is active, since Access Point may be testing new WiFi Credentials
+  } else
   if(strlen(network.wifiData.ssid)>0){
       checkConnect();
   }
@@ -162,73 +178,67 @@ void Span::poll() {
     processSerialCommand(cBuf);
   }
 
-  WiFiClient newClient;
-
-  if(newClient=hapServer->available()){                        // found a new HTTP client
-    int freeSlot=getFreeSlot();                                // get next free slot
-
-    if(freeSlot==-1){                                          // no available free slots
-      freeSlot=randombytes_uniform(maxConnections);
-      LOG2("=======================================\n");
-      LOG1("** Freeing Client #");
-      LOG1(freeSlot);
-      LOG1(" (");
-      LOG1(millis()/1000);
-      LOG1(" sec) ");
-      LOG1(hap[freeSlot]->client.remoteIP());
-      LOG1("\n");
-      hap[freeSlot]->client.stop();                     // disconnect client from first slot and re-use
-    }
-
-    hap[freeSlot]->client=newClient;             // copy new client handle into free slot
+  if(HAPClient::inQueue){                                 // multi-core mode: new connections, idle timeouts, and reading/writing are handled by HAP I/O task
+  
+    isPolling=true;                                       // HAP database cannot be modified while processing requests, loops, or buttons
+    HAPClient::dispatchRequests();                        // process HAP requests received by HAP I/O task
+    
+  } else {
 
-    LOG2("=======================================\n");
-    LOG1("** Client #");
-    LOG1(freeSlot);
-    LOG1(" Connected: (");
-    LOG1(millis()/1000);
-    LOG1(" sec) ");
-    LOG1(hap[freeSlot]->client.remoteIP());
-    LOG1(" on Socket ");
-    LOG1(hap[freeSlot]->client.fd()-LWIP_SOCKET_OFFSET+1);
-    LOG1("/");
-    LOG1(CONFIG_LWIP_MAX_SOCKETS);
-    LOG1("\n");
-    LOG2("\n");
+    WiFiClient newClient;
 
-    hap[freeSlot]->cPair=NULL;                   // reset pointer to verified ID
-    homeSpan.clearNotify(freeSlot);             // clear all notification requests for this connection
-    HAPClient::pairStatus=pairState_M1;         // reset starting PAIR STATE (which may be needed if Accessory failed in middle of pair-setup)
-  }
+    if(newClient=hapServer->available())                  // found a new HTTP client
+      acceptClient(newClient);
+      
+    checkIdleClients();
 
-  for(int i=0;i<maxConnections;i++){                     // loop over all HAP Connection slots
+    isPolling=true;                                         // HAP database cannot be modified while processing requests, loops, or buttons
+  
+    for(int i=0;i<maxConnections;i++){                     // loop over all HAP Connection slots
     
-    if(hap[i]->client && hap[i]->client.available()){       // if connection exists and data is available
-
-      HAPClient::conNum=i;                                // set connection number
-      hap[i]->processRequest();                           // process HAP request
+      if(hap[i]->client && !hap[i]->deferred && hap[i]->client.available()){       // if connection exists, is not waiting on a deferred update, and data is available
+
+        HAPClient::conNum=i;                                // set connection number
+        hap[i]->lastActivity=millis();
+        HAPClient::reqType=RequestStats::OTHER;             // default request type (updated by processRequest() when dispatching a valid request)
+        if(reqStats)
+          reqStats->begin();
+        uint32_t tStart=micros();
+        hap[i]->processRequest();                           // process HAP request
+        if(reqStats)
+          reqStats->add(HAPClient::reqType,tStart);
       
-      if(!hap[i]->client){                                 // client disconnected by server
-        LOG1("** Disconnecting Client #");
-        LOG1(i);
-        LOG1("  (");
-        LOG1(millis()/1000);
-        LOG1(" sec)\n");
-      }
+        if(!hap[i]->client){                                 // client disconnected by server
+          LOG1("** Disconnecting Client #");
+          LOG1(i);
+          LOG1("  (");
+          LOG1(millis()/1000);
+          LOG1(" sec)\n");
+        }
 
-      LOG2("\n");
+        LOG2("\n");
 
-    } // process HAP Client 
-  } // for-loop over connection slots
+      } // process HAP Client 
+    } // for-loop over connection slots
+  }
 
   HAPClient::callServiceLoops();
   HAPClient::checkPushButtons();
+  isPolling=false;
   HAPClient::checkNotifications();  
   HAPClient::checkTimedWrites();
+  HAPClient::checkPendingUpdates();
+  HAPClient::store.poll();
+
+  if(logBuffer)
+    logBuffer->drain(Serial);
 
   if(otaEnabled)
     ArduinoOTA.handle();
 
+  if(network.apActive)                  // control button is handled by checkAP() while Access Point is active
+    return;
+
   if(controlButton.primed()){
     statusLED.start(LED_ALERT);
   }
@@ -259,6 +269,122 @@ int Span::getFreeSlot(){
 
 //////////////////////////////////////
 
+int Span::getEvictSlot(){
+
+  int slot=0;
+  int bestGroup=4;
+  uint32_t bestIdle=0;
+
+  for(int i=0;i<maxConnections;i++){
+    int group=!hap[i]->cPair?0:(HAPClient::inQueue || countNotify(i)?2:1);      // 0=unverified, 1=verified without notifications, 2=verified with notifications (not checked in multi-core mode, since database is owned by poll())
+    if(hap[i]->busy)                                                            // 3=request still being processed by poll() (multi-core mode only)
+      group=3;
+    uint32_t idle=millis()-hap[i]->lastActivity;
+    
+    if(group<bestGroup || (group==bestGroup && idle>=bestIdle)){
+      slot=i;
+      bestGroup=group;
+      bestIdle=idle;
+    }
+  }
+
+  return(slot);
+}
+
+//////////////////////////////////////
+
+void Span::acceptClient(WiFiClient &newClient){
+
+  int freeSlot=getFreeSlot();                                // get next free slot
+
+  if(freeSlot==-1){                                          // no available free slots
+    freeSlot=getEvictSlot();
+    LOG2("=======================================\n");
+    LOG1("** Freeing Client #");
+    LOG1(freeSlot);
+    LOG1(" (");
+    LOG1(millis()/1000);
+    LOG1(" sec) ");
+    LOG1(hap[freeSlot]->client.remoteIP());
+    LOG1("\n");
+    hap[freeSlot]->client.stop();                     // disconnect client from selected slot and re-use
+  }
+
+  hap[freeSlot]->client=newClient;             // copy new client handle into free slot
+  hap[freeSlot]->connectTime=millis();
+  hap[freeSlot]->lastActivity=millis();
+  hap[freeSlot]->bytesIn=0;
+  hap[freeSlot]->bytesOut=0;
+
+  if(keepAlive){                               // enable TCP keepalive so that half-open connections are detected and closed by the TCP stack
+    int fd=newClient.fd();
+    int enable=1;
+    int idle=keepAlive;
+    int interval=10;
+    int count=3;
+    setsockopt(fd,SOL_SOCKET,SO_KEEPALIVE,&enable,sizeof(enable));
+    setsockopt(fd,IPPROTO_TCP,TCP_KEEPIDLE,&idle,sizeof(idle));
+    setsockopt(fd,IPPROTO_TCP,TCP_KEEPINTVL,&interval,sizeof(interval));
+    setsockopt(fd,IPPROTO_TCP,TCP_KEEPCNT,&count,sizeof(count));
+  }
+
+  LOG2("=======================================\n");
+  LOG1("** Client #");
+  LOG1(freeSlot);
+  LOG1(" Connected: (");
+  LOG1(millis()/1000);
+  LOG1(" sec) ");
+  LOG1(hap[freeSlot]->client.remoteIP());
+  LOG1(" on Socket ");
+  LOG1(hap[freeSlot]->client.fd()-LWIP_SOCKET_OFFSET+1);
+  LOG1("/");
+  LOG1(CONFIG_LWIP_MAX_SOCKETS);
+  LOG1("\n");
+  LOG2("\n");
+
+  hap[freeSlot]->gen++;
+
+  if(HAPClient::inQueue){                       // multi-core mode: reset slot in poll() before reading from new client
+    hap[freeSlot]->busy=true;
+    HAPClient::queueInbound(HAPMessage::CONNECT,freeSlot,hap[freeSlot]->gen);
+  } else {
+    hap[freeSlot]->dispatchGen=hap[freeSlot]->gen;
+    hap[freeSlot]->reset();
+  }
+}
+
+//////////////////////////////////////
+
+void Span::checkIdleClients(){
+
+  for(int i=0;i<maxConnections;i++){
+    if(!hap[i]->client){
+      if(hap[i]->keys && !HAPClient::inQueue)     // connection has closed - free its session keys (in multi-core mode this is done by reset() when slot is re-used)
+        hap[i]->freeKeys();
+      continue;
+    }
+
+    if(hap[i]->busy)                    // request is being processed
+      continue;
+
+    uint32_t timeout=hap[i]->cPair?idleTimeout:unverifiedTimeout;
+    
+    if(timeout && millis()-hap[i]->lastActivity>timeout*1000){
+      LOG2("=======================================\n");
+      LOG1("** Closing Idle Client #");
+      LOG1(i);
+      LOG1(" (");
+      LOG1(millis()/1000);
+      LOG1(" sec) ");
+      LOG1(hap[i]->client.remoteIP());
+      LOG1("\n");
+      hap[i]->client.stop();
+    }
+  }
+}
+
+//////////////////////////////////////
+
 void Span::commandMode(){
   
   Serial.print("*** ENTERING COMMAND MODE ***\n\n");
@@ -335,10 +461,10 @@ void Span::checkConnect(){
     if(WiFi.status()==WL_CONNECTED)
       return;
       
-    Serial.print("\n\n*** WiFi Connection Lost!\n");      // losing and re-establishing connection has not been tested
+    Serial.print("\n\n*** WiFi Connection Lost!\n");
     connected=false;
-    waitTime=60000;
-    alarmConnect=0;
+    wifiBackoff.reset();
+    alarmConnect=0;                   // try to reconnect immediately
     homeSpan.statusLED.start(LED_WIFI_CONNECTING);
   }
 
@@ -346,23 +472,38 @@ void Span::checkConnect(){
     if(millis()<alarmConnect)         // not yet time to try to try connecting
       return;
 
-    if(waitTime==60000)
-      waitTime=1000;
-    else
-      waitTime*=2;
-      
-    if(waitTime==32000){
+    if(wifiBackoff.attempts()==0 && !fastConnect && network.wifiCache.channel>0 && !strcmp(network.wifiCache.ssid,network.wifiData.ssid)){     // first try connecting directly to the last access point used, without scanning
+      fastConnect=true;
+      Serial.printf("Trying fast reconnect to %s (BSSID %02X:%02X:%02X:%02X:%02X:%02X, Channel %d)...\n",network.wifiData.ssid,
+                    network.wifiCache.bssid[0],network.wifiCache.bssid[1],network.wifiCache.bssid[2],network.wifiCache.bssid[3],network.wifiCache.bssid[4],network.wifiCache.bssid[5],network.wifiCache.channel);
+      if(reuseLease && network.wifiCache.ip)
+        WiFi.config(network.wifiCache.ip,network.wifiCache.gateway,network.wifiCache.subnet,network.wifiCache.dns);
+      WiFi.begin(network.wifiData.ssid,network.wifiData.pwd,network.wifiCache.channel,network.wifiCache.bssid);
+      alarmConnect=millis()+FAST_CONNECT_TIME;
+      return;
+    }
+
+    if(fastConnect){                  // fast reconnect failed
+      fastConnect=false;
+      if(reuseLease && network.wifiCache.ip)
+        WiFi.config((uint32_t)0,(uint32_t)0,(uint32_t)0);     // revert to DHCP
+      Serial.print("Fast reconnect failed.\n");
+    }
+
+    boolean wasMax=wifiBackoff.atMax();
+    uint32_t waitTime=wifiBackoff.next();
+
+    Serial.print("Trying to connect to ");
+    Serial.print(network.wifiData.ssid);
+    Serial.print(".  Waiting ");
+    Serial.print(waitTime/1000.0,1);
+    Serial.print(" second(s) for response...\n");
+    WiFi.begin(network.wifiData.ssid,network.wifiData.pwd);
+
+    if(!wasMax && wifiBackoff.atMax()){
       Serial.print("\n*** Can't connect to ");
       Serial.print(network.wifiData.ssid);
-      Serial.print(".  You may type 'W <return>' to re-configure WiFi, or 'X <return>' to erase WiFi credentials.  Will try connecting again in 60 seconds.\n\n");
-      waitTime=60000;
-    } else {    
-      Serial.print("Trying to connect to ");
-      Serial.print(network.wifiData.ssid);
-      Serial.print(".  Waiting ");
-      Serial.print(waitTime/1000);
-      Serial.print(" second(s) for response...\n");
-      WiFi.begin(network.wifiData.ssid,network.wifiData.pwd);
+      Serial.print(".  You may type 'W <return>' to re-configure WiFi, or 'X <return>' to erase WiFi credentials.  Will keep trying to connect.\n\n");
     }
 
     alarmConnect=millis()+waitTime;
@@ -371,6 +512,8 @@ void Span::checkConnect(){
   }
 
   connected=true;
+  fastConnect=false;
+  wifiBackoff.reset();
 
   Serial.print("Successfully connected to ");
   Serial.print(network.wifiData.ssid);
@@ -378,6 +521,8 @@ void Span::checkConnect(){
   Serial.print(WiFi.localIP());
   Serial.print("\n");
 
+  saveWifiCache();
+
   char id[18];                              // create string version of Accessory ID for MDNS broadcast
   memcpy(id,HAPClient::accessory.ID,17);    // copy ID bytes
   id[17]='\0';                              // add terminating null
@@ -408,6 +553,9 @@ void Span::checkConnect(){
     while(1);
   }
     
+  if(serverStarted)                             // re-connecting: MDNS is re-started so device is re-advertised at its (possibly new) address
+    MDNS.end();
+    
   Serial.print("\nStarting MDNS...\n\n");
   Serial.print("HostName:      ");
   Serial.print(hostName);
@@ -430,23 +578,23 @@ void Span::checkConnect(){
   char cNum[16];
   sprintf(cNum,"%d",hapConfig.configNumber);
   
-  mdns_service_txt_item_set("_hap","_tcp","c#",cNum);            // Accessory Current Configuration Number (updated whenever config of HAP Accessory Attribute Database is updated)
-  mdns_service_txt_item_set("_hap","_tcp","md",modelName);       // Accessory Model Name
-  mdns_service_txt_item_set("_hap","_tcp","ci",category);        // Accessory Category (HAP Section 13.1)
-  mdns_service_txt_item_set("_hap","_tcp","id",id);              // string version of Accessory ID in form XX:XX:XX:XX:XX:XX (HAP Section 5.4)
+  setTXT("c#",cNum);            // Accessory Current Configuration Number (updated whenever config of HAP Accessory Attribute Database is updated)
+  setTXT("md",modelName);       // Accessory Model Name
+  setTXT("ci",category);        // Accessory Category (HAP Section 13.1)
+  setTXT("id",id);              // string version of Accessory ID in form XX:XX:XX:XX:XX:XX (HAP Section 5.4)
 
-  mdns_service_txt_item_set("_hap","_tcp","ff","0");             // HAP Pairing Feature flags.  MUST be "0" to specify Pair Setup method (HAP Table 5-3) without MiFi Authentification
-  mdns_service_txt_item_set("_hap","_tcp","pv","1.1");           // HAP version - MUST be set to "1.1" (HAP Section 6.6.3)
-  mdns_service_txt_item_set("_hap","_tcp","s#","1");             // HAP current state - MUST be set to "1"
+  setTXT("ff","0");             // HAP Pairing Feature flags.  MUST be "0" to specify Pair Setup method (HAP Table 5-3) without MiFi Authentification
+  setTXT("pv","1.1");           // HAP version - MUST be set to "1.1" (HAP Section 6.6.3)
+  setTXT("s#","1");             // HAP current state - MUST be set to "1"
 
   if(!HAPClient::nAdminControllers())                            // Accessory is not yet paired
-    mdns_service_txt_item_set("_hap","_tcp","sf","1");           // set Status Flag = 1 (Table 6-8)
+    setTXT("sf","1");           // set Status Flag = 1 (Table 6-8)
   else
-    mdns_service_txt_item_set("_hap","_tcp","sf","0");           // set Status Flag = 0
+    setTXT("sf","0");           // set Status Flag = 0
 
-  mdns_service_txt_item_set("_hap","_tcp","hspn",HOMESPAN_VERSION);           // HomeSpan Version Number (info only - NOT used by HAP)
-  mdns_service_txt_item_set("_hap","_tcp","sketch",sketchVersion);            // Sketch Version (info only - NOT used by HAP)
-  mdns_service_txt_item_set("_hap","_tcp","ota",otaEnabled?"yes":"no");       // OTA Enabled (info only - NOT used by HAP)
+  setTXT("hspn",HOMESPAN_VERSION);           // HomeSpan Version Number (info only - NOT used by HAP)
+  setTXT("sketch",sketchVersion);            // Sketch Version (info only - NOT used by HAP)
+  setTXT("ota",otaEnabled?"yes":"no");       // OTA Enabled (info only - NOT used by HAP)
 
   uint8_t hashInput[22];
   uint8_t hashOutput[64];
@@ -457,7 +605,18 @@ void Span::checkConnect(){
   memcpy(hashInput+4,id,17);                                          // Step 1: Concatenate 4-character Setup ID and 17-character Accessory ID into hashInput
   mbedtls_sha512_ret(hashInput,21,hashOutput,0);                      // Step 2: Perform SHA-512 hash on combined 21-byte hashInput to create 64-byte hashOutput
   mbedtls_base64_encode((uint8_t *)setupHash,9,&len,hashOutput,4);    // Step 3: Encode the first 4 bytes of hashOutput in base64, which results in an 8-character, null-terminated, setupHash
-  mdns_service_txt_item_set("_hap","_tcp","sh",setupHash);            // Step 4: broadcast the resulting Setup Hash
+  setTXT("sh",setupHash);            // Step 4: broadcast the resulting Setup Hash
+
+  if(serverStarted){                            // re-connecting: HAP server, OTA server, and HAP I/O task are still running
+    Serial.print("\n");
+    if(!HAPClient::nAdminControllers())
+      statusLED.start(LED_PAIRING_NEEDED);
+    else
+      statusLED.on();
+    return;
+  }
+
+  serverStarted=true;
 
   if(otaEnabled){
     if(esp_ota_get_running_partition()!=esp_ota_get_next_update_partition(NULL)){
@@ -478,6 +637,7 @@ void Span::checkConnect(){
         })
         .onEnd([]() {
           Serial.println("\n*** OTA Completed.  Rebooting...");
+          HAPClient::store.flush();                 // save any pending changes before ArduinoOTA reboots device
           homeSpan.statusLED.off();
         })
         .onProgress([](unsigned int progress, unsigned int total) {
@@ -509,6 +669,13 @@ void Span::checkConnect(){
   Serial.print(" simultaneous connections...\n");
   hapServer->begin();
 
+  if(ioCore>=0 && !HAPClient::ioHandle){         // checkConnect() re-runs after WiFi is re-established, but HAP I/O task (and its queues) must only be created once
+    Serial.print("Starting HAP I/O Task on Core ");
+    Serial.print(ioCore);
+    Serial.print("...\n");
+    HAPClient::startIO(ioCore,ioStackSize);
+  }
+
   Serial.print("\n");
 
   if(!HAPClient::nAdminControllers()){
@@ -525,6 +692,86 @@ void Span::checkConnect(){
 
 ///////////////////////////////
 
+void Span::saveWifiCache(){
+
+  auto &cache=network.wifiCache;
+  uint8_t *bssid=WiFi.BSSID();
+  uint32_t ip=WiFi.localIP();
+  uint32_t gateway=WiFi.gatewayIP();
+  uint32_t subnet=WiFi.subnetMask();
+  uint32_t dns=WiFi.dnsIP();
+
+  if(!bssid)
+    return;
+
+  if(!strcmp(cache.ssid,network.wifiData.ssid) && !memcmp(cache.bssid,bssid,6) && cache.channel==WiFi.channel() &&
+     cache.ip==ip && cache.gateway==gateway && cache.subnet==subnet && cache.dns==dns)
+    return;                                     // unchanged - nothing to save
+
+  strcpy(cache.ssid,network.wifiData.ssid);
+  memcpy(cache.bssid,bssid,6);
+  cache.channel=WiFi.channel();
+  cache.ip=ip;
+  cache.gateway=gateway;
+  cache.subnet=subnet;
+  cache.dns=dns;
+  HAPClient::store.mark(&cache);
+}
+
+///////////////////////////////
+
+void Span::checkAP(){
+
+  if(controlButton.triggered(9999,3000)){       // long press terminates Access Point
+    Serial.print("\n*** Access Point Terminated.");
+    statusLED.start(LED_ALERT);
+    controlButton.wait();
+    network.apStatus=-1;
+    network.alarmTimeOut=0;
+  }
+
+  if(!network.apPoll())                         // Access Point still running
+    return;
+
+  if(network.apStatus==1){
+    nvs_set_blob(HAPClient::wifiNVS,"WIFIDATA",&network.wifiData,sizeof(network.wifiData));    // update data
+    nvs_commit(HAPClient::wifiNVS);                                                            // commit to NVS
+    Serial.print("*** Credentials saved!\n\n");
+    if(strlen(network.setupCode)){
+      char s[10];
+      sprintf(s,"S%s",network.setupCode);
+      processSerialCommand(s);
+    } else {
+      Serial.print("*** Setup Code Unchanged\n\n");
+    }
+  } else
+
+  if(network.staChanged){
+    WiFi.disconnect();                          // drop connection to network that was being tested so checkConnect() re-connects using prior WiFi Credentials
+  }
+
+  if(network.staChanged && connected){          // prior connection was lost, so re-advertise MDNS once connected
+    Serial.print("*** Applying WiFi Credentials...\n\n");
+    connected=false;
+    wifiBackoff.reset();
+    alarmConnect=0;
+  }
+
+  if(!strlen(network.wifiData.ssid))
+    statusLED.start(LED_WIFI_NEEDED);
+  else
+  if(!connected)
+    statusLED.start(LED_WIFI_CONNECTING);
+  else
+  if(!HAPClient::nAdminControllers())
+    statusLED.start(LED_PAIRING_NEEDED);
+  else
+    statusLED.on();
+  
+} // checkAP
+
+///////////////////////////////
+
 void Span::setQRID(const char *id){
   
   char tBuf[5];
@@ -577,6 +824,9 @@ void Span::processSerialCommand(const char *c){
           } else {
             Serial.print("  (unverified)");
           }
+
+          Serial.printf("\n                Connected: %u sec  Idle: %u sec  Received: %u bytes  Sent: %u bytes  Notifications: %d",
+            (unsigned)(millis()-hap[i]->connectTime)/1000,(unsigned)(millis()-hap[i]->lastActivity)/1000,hap[i]->bytesIn,hap[i]->bytesOut,countNotify(i));
       
         } else {
           Serial.print("(unconnected)");
@@ -695,9 +945,7 @@ void Span::processSerialCommand(const char *c){
 
     case 'U': {
 
-      HAPClient::removeControllers();                                                                           // clear all Controller data  
-      nvs_set_blob(HAPClient::hapNVS,"CONTROLLERS",HAPClient::controllers,sizeof(HAPClient::controllers));      // update data
-      nvs_commit(HAPClient::hapNVS);                                                                            // commit to NVS
+      HAPClient::removeControllers();                                                                           // clear all Controller data
       Serial.print("\n*** HomeSpan Pairing Data DELETED ***\n\n");
       
       for(int i=0;i<maxConnections;i++){     // loop over all connection slots
@@ -705,12 +953,12 @@ void Span::processSerialCommand(const char *c){
           LOG1("*** Terminating Client #");
           LOG1(i);
           LOG1("\n");
-          hap[i]->client.stop();
+          hap[i]->closeClient();
         }
       }
       
       Serial.print("\nDEVICE NOT YET PAIRED -- PLEASE PAIR WITH HOMEKIT APP\n\n");
-      mdns_service_txt_item_set("_hap","_tcp","sf","1");                                                        // set Status Flag = 1 (Table 6-8)
+      setTXT("sf","1");                                                        // set Status Flag = 1 (Table 6-8)
       
       if(strlen(network.wifiData.ssid)==0)
         statusLED.start(LED_WIFI_NEEDED);
@@ -725,6 +973,7 @@ void Span::processSerialCommand(const char *c){
       nvs_set_blob(HAPClient::wifiNVS,"WIFIDATA",&network.wifiData,sizeof(network.wifiData));    // update data
       nvs_commit(HAPClient::wifiNVS);                                                            // commit to NVS
       Serial.print("\n*** WiFi Credentials SAVED!  Re-starting ***\n\n");
+      HAPClient::store.flush();                                                                  // save any pending changes before re-starting
       statusLED.off();
       delay(1000);
       ESP.restart();  
@@ -733,29 +982,12 @@ void Span::processSerialCommand(const char *c){
 
     case 'A': {
 
-      if(strlen(network.wifiData.ssid)>0){
-        Serial.print("*** Stopping all current WiFi services...\n\n");
-        hapServer->end();
-        MDNS.end();
-        WiFi.disconnect();
-      }
-      
-      network.apConfigure();
-      nvs_set_blob(HAPClient::wifiNVS,"WIFIDATA",&network.wifiData,sizeof(network.wifiData));    // update data
-      nvs_commit(HAPClient::wifiNVS);                                                            // commit to NVS
-      Serial.print("\n*** Credentials saved!\n\n");
-      if(strlen(network.setupCode)){
-        char s[10];
-        sprintf(s,"S%s",network.setupCode);
-        processSerialCommand(s);
-      } else {
-        Serial.print("*** Setup Code Unchanged\n");
+      if(network.apActive){
+        Serial.print("\n*** Access Point is already running\n\n");
+        break;
       }
       
-      Serial.print("\n*** Re-starting ***\n\n");
-      statusLED.off();
-      delay(1000);
-      ESP.restart();                                                                             // re-start device   
+      network.apStart();                // Access Point runs alongside any current WiFi services, and is serviced by checkAP() in poll()
     }
     break;
     
@@ -764,6 +996,7 @@ void Span::processSerialCommand(const char *c){
       statusLED.off();
       nvs_erase_all(HAPClient::wifiNVS);
       nvs_commit(HAPClient::wifiNVS);      
+      HAPClient::store.flush();                                                                  // save any pending changes before re-starting
       Serial.print("\n*** WiFi Credentials ERASED!  Re-starting...\n\n");
       delay(1000);
       ESP.restart();                                                                             // re-start device   
@@ -784,6 +1017,7 @@ void Span::processSerialCommand(const char *c){
     case 'R': {
       
       statusLED.off();
+      HAPClient::store.flush();                                                                  // save any pending changes before re-starting
       Serial.print("\n*** Restarting...\n\n");
       delay(1000);
       ESP.restart();
@@ -825,12 +1059,84 @@ void Span::processSerialCommand(const char *c){
 
       Serial.print("\n*** Log Level set to ");
       Serial.print(level);
+      if(level>MAX_LOG_LEVEL){
+        Serial.print(" (only Level ");
+        Serial.print(MAX_LOG_LEVEL);
+        Serial.print(" compiled)");
+      }
       Serial.print("\n\n");
       delay(1000);
       setLogLevel(level);     
     }
     break;
 
+    case 'T': {
+
+      if(!tracer){
+        Serial.print("\n*** Request tracing not enabled.  Use homeSpan.enableTrace() to enable.\n\n");
+        break;
+      }
+
+      Serial.print("\n*** Request Trace (Chrome Trace Event JSON) ***\n\n");
+      tracer->print(Serial);
+      tracer->clear();
+      Serial.print("\n*** End Trace ***\n\n");
+    }
+    break;
+
+    case 'P': {
+
+      if(!reqStats){
+        Serial.print("\n*** Request statistics not enabled.  Use homeSpan.enableStats() to enable.\n\n");
+        break;
+      }
+
+      Serial.print("\n*** HAP Request Statistics ***\n\n");
+      reqStats->print(Serial);
+      reqStats->clear();
+      Serial.print("\n*** End Statistics ***\n\n");
+    }
+    break;
+
+    case 'M': {
+
+      Serial.print("\n*** HomeSpan Memory ***\n\n");
+
+      char d[]="------------------------------";
+      int accTotal=0;
+      
+      Serial.printf("%10s  %8s  %15s  %8s\n","AID","Services","Characteristics","Bytes");
+      Serial.printf("%.10s  %.8s  %.15s  %.8s\n",d,d,d,d);
+      for(int i=0;i<Accessories.size();i++){
+        int nChars=0;
+        for(int j=0;j<Accessories[i]->Services.size();j++)
+          nChars+=Accessories[i]->Services[j]->Characteristics.size();
+        int nBytes=Accessories[i]->memoryUsed();
+        accTotal+=nBytes;
+        Serial.printf("%10u  %8d  %15d  %8d\n",Accessories[i]->aid,(int)Accessories[i]->Services.size(),nChars,nBytes);
+      }
+      Serial.printf("\nAccessories: %d of %d (%d bytes total, %d bytes average)\n\n",(int)Accessories.size(),HAPClient::MAX_ACCESSORIES,accTotal,Accessories.size()?accTotal/(int)Accessories.size():0);
+
+      int conTotal=0;
+      Serial.printf("%10s  %10s  %12s  %8s\n","Connection","Status","Session Keys","Bytes");
+      Serial.printf("%.10s  %.10s  %.12s  %.8s\n",d,d,d,d);
+      for(int i=0;i<maxConnections;i++){
+        int nBytes=sizeof(HAPClient)+(hap[i]->keys?sizeof(SessionKeys):0);
+        conTotal+=nBytes;
+        Serial.printf("%10d  %10s  %12s  %8d\n",i,hap[i]->client?(hap[i]->cPair?"verified":"unverified"):"closed",hap[i]->keys?"YES":"NO",nBytes);
+      }
+      Serial.printf("\nConnections: %d (%d bytes total, plus %d bytes of session keys for each connection that starts pair-verify)\n\n",maxConnections,conTotal,(int)sizeof(SessionKeys));
+
+      Serial.printf("Shared HTTP and Frame Buffers:  %d bytes\n",(int)(sizeof(HAPClient::httpBuf)+sizeof(HAPClient::frameBuf)));
+      Serial.printf("Free Heap:                      %d bytes (largest block=%d, lowest since boot=%d)\n",(int)ESP.getFreeHeap(),(int)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),(int)ESP.getMinFreeHeap());
+      Serial.printf("Reserved Heap:                  %d bytes\n",HAPClient::MIN_FREE_HEAP);
+      if(Accessories.size() && ESP.getFreeHeap()>HAPClient::MIN_FREE_HEAP)
+        Serial.printf("Room for about %d more Accessories of average size\n",(int)(ESP.getFreeHeap()-HAPClient::MIN_FREE_HEAP)/(accTotal/(int)Accessories.size()));
+      
+      Serial.print("\n*** End Memory ***\n\n");
+    }
+    break;
+
     case 'i':{
 
       Serial.print("\n*** HomeSpan Info ***\n\n");
@@ -871,6 +1177,9 @@ void Span::processSerialCommand(const char *c){
       Serial.print("  s - print connection status\n");
       Serial.print("  i - print summary information about the HAP Database\n");
       Serial.print("  d - print the full HAP Accessory Attributes Database in JSON format\n");
+      Serial.print("  T - print and clear the timing trace of recent HAP requests in Chrome Trace Event JSON format\n");
+      Serial.print("  P - print and clear latency, throughput, and heap statistics for each type of HAP request\n");
+      Serial.print("  M - print memory used by each Accessory and each connection\n");
       Serial.print("\n");      
       Serial.print("  W - configure WiFi Credentials and restart\n");      
       Serial.print("  X - delete WiFi Credentials and restart\n");      
@@ -905,19 +1214,214 @@ void Span::processSerialCommand(const char *c){
 
 ///////////////////////////////
 
+void Span::hashAttributes(uint8_t *hash){
+
+  uint8_t aHash[48];
+
+  memset(hash,0,48);
+  
+  for(int i=0;i<Accessories.size();i++){        // hashes of each Accessory are combined with XOR so that any single Accessory can be added or removed without re-hashing the others
+    Accessories[i]->hashAttributes(aHash);
+    for(int j=0;j<48;j++)
+      hash[j]^=aHash[j];
+  }
+}
+
+///////////////////////////////
+
+void Span::enableLogBuffer(uint32_t nBytes){
+
+  if(logBuffer)
+    return;
+
+  logBuffer=new LogBuffer(nBytes);
+  logOut=logBuffer;
+}
+
+///////////////////////////////
+
+void Span::enableTrace(uint32_t nEvents){
+
+  if(!tracer)
+    tracer=new Tracer(nEvents);
+}
+
+///////////////////////////////
+
+void Span::trace(uint8_t phase, uint8_t conNum, uint32_t start, uint32_t aid){
+
+  if(tracer)
+    tracer->add(phase,conNum,start,aid);
+}
+
+///////////////////////////////
+
+void Span::updateConfigNumber(){
+
+  hapConfig.configNumber++;                        // increment configuration number
+  if(hapConfig.configNumber==65536)                // reached max value
+    hapConfig.configNumber=1;                      // reset to 1
+
+  Serial.print("Accessory configuration has changed.  Updating configuration number to ");
+  Serial.print(hapConfig.configNumber);
+  Serial.print("\n\n");
+
+  HAPClient::store.mark(&hapConfig);               // save data
+
+  if(connected){                                   // re-broadcast so Controllers know to re-read the Attribute Database
+    char cNum[16];
+    sprintf(cNum,"%d",hapConfig.configNumber);
+    setTXT("c#",cNum);
+  }
+}
+
+///////////////////////////////
+
+void Span::setTXT(const char *key, const char *val){
+
+  mdns_service_txt_item_set("_hap","_tcp",key,val);
+}
+
+///////////////////////////////
+
+void Span::addLoops(SpanAccessory *acc){
+
+  for(int i=0;i<acc->Services.size();i++){
+    SpanService *s=acc->Services[i];      
+    if((void(*)())(s->*(&SpanService::loop)) != (void(*)())(&SpanService::loop))    // save pointers to services in Loops vector
+      Loops.push_back(s);
+  }
+}
+
+///////////////////////////////
+
+boolean Span::updateDatabase(){
+
+  if(!isInitialized){
+    Serial.print("\n*** WARNING: Call to homeSpan.updateDatabase() ignored.  Accessories created before HomeSpan starts are published automatically.\n\n");
+    return(false);
+  }
+
+  if(isPolling){
+    Serial.print("\n*** ERROR: homeSpan.updateDatabase() cannot be called from within a Service's update(), loop(), or button() method.\n\n");
+    return(false);
+  }
+
+  if(nPublished==Accessories.size())             // nothing new to publish
+    return(true);
+
+  if(!Accessories.back()->Services.empty())
+    Accessories.back()->Services.back()->validate();    
+  Accessories.back()->validate();
+
+  Serial.print("\n*** Updating HAP Database ***\n\n");
+  Serial.print(configLog.substring(configLogMark));
+
+  if(nFatalErrors>0){
+    Serial.print("\n*** ERROR: Discarding ");
+    Serial.print(Accessories.size()-nPublished);
+    Serial.print(" new Accessories due to errors in configuration! ***\n\n");
+
+    while(Accessories.size()>nPublished){
+      delete Accessories.back();
+      Accessories.pop_back();
+    }
+    
+    configLog+="*** Accessories discarded due to errors ***\n";
+    configLogMark=configLog.length();
+    nFatalErrors=0;
+    return(false);
+  }
+
+  uint8_t aHash[48];
+
+  for(int i=nPublished;i<Accessories.size();i++){
+    Accessories[i]->hashAttributes(aHash);         // combine hash of new Accessory into hash of HAP database without re-hashing existing Accessories
+    for(int j=0;j<48;j++)
+      hapConfig.hashCode[j]^=aHash[j];
+    addLoops(Accessories[i]);
+  }
+
+  Serial.print("\n");
+  nPublished=Accessories.size();
+  configLogMark=configLog.length();
+  updateConfigNumber();
+  return(true);
+}
+
+///////////////////////////////
+
+boolean Span::deleteAccessory(uint32_t aid){
+
+  if(isPolling){
+    Serial.print("\n*** ERROR: homeSpan.deleteAccessory() cannot be called from within a Service's update(), loop(), or button() method.\n\n");
+    return(false);
+  }
+
+  if(aid==1){
+    Serial.print("\n*** ERROR: Can't delete Accessory with aid=1.\n\n");
+    return(false);
+  }
+
+  for(auto &pu : PendingUpdates){               // PUT responses waiting on deferred updates still refer to the Characteristics of the Accessory
+    for(auto &obj : pu.pObj){
+      if(obj.aid==aid){
+        Serial.print("\n*** ERROR: Can't delete Accessory with aid=");
+        Serial.print(aid);
+        Serial.print(" while a deferred update to one of its Services is pending.\n\n");
+        return(false);
+      }
+    }
+  }
+
+  for(int i=0;i<Accessories.size();i++){
+    if(Accessories[i]->aid==aid){
+
+      boolean published=(i<nPublished);
+      
+      if(published){
+        uint8_t aHash[48];
+        Accessories[i]->hashAttributes(aHash);     // remove hash of Accessory from hash of HAP database without re-hashing remaining Accessories
+        for(int j=0;j<48;j++)
+          hapConfig.hashCode[j]^=aHash[j];
+        nPublished--;
+      }
+
+      delete Accessories[i];
+      Accessories.erase(Accessories.begin()+i);
+      
+      configLog+="-Accessory-" + String(aid) + " (deleted)\n";
+      if(published){
+        configLogMark=configLog.length();
+        updateConfigNumber();
+      }
+      return(true);
+    }
+  }
+
+  Serial.print("\n*** ERROR: Can't delete Accessory with aid=");
+  Serial.print(aid);
+  Serial.print(".  Not found.\n\n");
+  return(false);
+}
+
+///////////////////////////////
+
 int Span::sprintfAttributes(char *cBuf){
 
+  uint32_t tStart=micros();
   int nBytes=0;
 
   nBytes+=snprintf(cBuf,cBuf?64:0,"{\"accessories\":[");
 
-  for(int i=0;i<Accessories.size();i++){
+  for(int i=0;i<nPublished;i++){                 // only published Accessories are included
     nBytes+=Accessories[i]->sprintfAttributes(cBuf?(cBuf+nBytes):NULL);    
-    if(i+1<Accessories.size())
+    if(i+1<nPublished)
       nBytes+=snprintf(cBuf?(cBuf+nBytes):NULL,cBuf?64:0,",");
     }
     
   nBytes+=snprintf(cBuf?(cBuf+nBytes):NULL,cBuf?64:0,"]}");
+  trace(Tracer::SERIALIZE,HAPClient::conNum,tStart);
   return(nBytes);
 }
 
@@ -969,7 +1473,7 @@ void Span::prettyPrint(char *buf, int nsp){
 SpanCharacteristic *Span::find(uint32_t aid, int iid){
 
   int index=-1;
-  for(int i=0;i<Accessories.size();i++){   // loop over all Accessories to find aid
+  for(int i=0;i<nPublished;i++){           // loop over all published Accessories to find aid
     if(Accessories[i]->aid==aid){          // if match, save index into Accessories array
       index=i;
       break;
@@ -982,8 +1486,9 @@ SpanCharacteristic *Span::find(uint32_t aid, int iid){
   for(int i=0;i<Accessories[index]->Services.size();i++){                           // loop over all Services in this Accessory
     for(int j=0;j<Accessories[index]->Services[i]->Characteristics.size();j++){     // loop over all Characteristics in this Service
       
-      if(iid == Accessories[index]->Services[i]->Characteristics[j]->iid)           // if matching iid
+      if(iid == Accessories[index]->Services[i]->Characteristics[j]->iid){          // if matching iid
         return(Accessories[index]->Services[i]->Characteristics[j]);                // return pointer to Characteristic
+      }
     }
   }
 
@@ -1009,6 +1514,7 @@ int Span::countCharacteristics(char *buf){
 
 int Span::updateCharacteristics(char *buf, SpanBuf *pObj){
 
+  uint32_t tStart=micros();
   int nObj=0;
   char *p1;
   int cFound=0;
@@ -1077,16 +1583,27 @@ int Span::updateCharacteristics(char *buf, SpanBuf *pObj){
       
   } // parse objects
 
+  trace(Tracer::PARSE,HAPClient::conNum,tStart);
+
   snapTime=millis();                                           // timestamp for this series of updates, assigned to each characteristic in loadUpdate()
 
-  for(int i=0;i<nObj;i++){                                     // PASS 1: loop over all objects, identify characteristics, and initialize update for those found
+  uint32_t tFind=micros();
+
+  for(int i=0;i<nObj;i++)                                      // identify characteristics (traced as a single FIND)
+    pObj[i].characteristic=twFail?NULL:find(pObj[i].aid,pObj[i].iid);     // find characteristic with matching aid/iid and store pointer
+
+  trace(Tracer::FIND,HAPClient::conNum,tFind);
+
+  for(int i=0;i<nObj;i++){                                     // PASS 1: loop over all objects and initialize update for characteristics found
 
     if(twFail){                                                // this is a timed-write request that has either expired or for which there was no PID
       pObj[i].status=StatusCode::InvalidValue;                 // set error for all characteristics      
       
     } else {
-      pObj[i].characteristic = find(pObj[i].aid,pObj[i].iid);  // find characteristic with matching aid/iid and store pointer          
 
+      if(pObj[i].characteristic && pObj[i].val && pObj[i].characteristic->service->updateState!=SpanService::UPDATE_IDLE)
+        pObj[i].status=StatusCode::Busy;                                              // Service is still processing, or waiting to complete, a prior update
+      else
       if(pObj[i].characteristic)                                                      // if found, initialize characterstic update with new val/ev
         pObj[i].status=pObj[i].characteristic->loadUpdate(pObj[i].val,pObj[i].ev);    // save status code, which is either an error, or TBD (in which case isUpdated for the characteristic has been set to true) 
       else
@@ -1095,46 +1612,152 @@ int Span::updateCharacteristics(char *buf, SpanBuf *pObj){
       
   } // first pass
       
-  for(int i=0;i<nObj;i++){                                     // PASS 2: loop again over all objects       
-    if(pObj[i].status==StatusCode::TBD){                       // if object status still TBD
+  if(nObj==0)
+    return(1);
 
-      StatusCode status=pObj[i].characteristic->service->update()?StatusCode::OK:StatusCode::Unable;                  // update service and save statusCode as OK or Unable depending on whether return is true or false
+  // PASS 2: group objects with TBD status by Service (chaining objects of the same Service through next[]), and Services by Accessory
 
-      for(int j=i;j<nObj;j++){                                                      // loop over this object plus any remaining objects to update values and save status for any other characteristics in this service
-        
-        if(pObj[j].characteristic->service==pObj[i].characteristic->service){       // if service of this characteristic matches service that was updated
-          pObj[j].status=status;                                                    // save statusCode for this object
-          LOG1("Updating aid=");
-          LOG1(pObj[j].characteristic->aid);
+  TempBuffer <int> nBuf(nObj);
+  int *next=nBuf.buf;
+  vector<int> heads;                                           // index of first object for each Service, in order of first appearance
+  unordered_map<SpanService *, int> tails;                     // index of last object found so far for each Service
+
+  for(int i=0;i<nObj;i++){
+    if(pObj[i].status==StatusCode::TBD){
+      next[i]=-1;
+      SpanService *svc=pObj[i].characteristic->service;
+      auto tail=tails.find(svc);
+      if(tail==tails.end()){
+        heads.push_back(i);
+        tails[svc]=i;
+      } else {
+        next[tail->second]=i;
+        tail->second=i;
+      }
+    }
+  }
+
+  if(heads.empty())                                            // no updates needed (e.g. only errors or notification requests)
+    return(1);
+
+  std::stable_sort(heads.begin(),heads.end(),[pObj](int a, int b){return(pObj[a].aid<pObj[b].aid);});      // group Services by Accessory, preserving order within each Accessory
+
+  TempBuffer <StatusCode> sBuf(heads.size());
+  StatusCode *status=sBuf.buf;
+      
+  for(int h=0;h<heads.size();){                                // PASS 3: call update() once for each Service, and updateBatch() once for each Accessory
+
+    int hEnd=h;
+    SpanAccessory *acc=pObj[heads[h]].characteristic->service->accessory;
+    
+    for(;hEnd<heads.size() && pObj[heads[hEnd]].characteristic->service->accessory==acc;hEnd++){
+      SpanService *svc=pObj[heads[hEnd]].characteristic->service;
+      uint32_t tUpdate=micros();
+      svc->updateState=SpanService::UPDATE_RUNNING;
+      boolean success=svc->update();                                              // update service with complete set of changes to its Characteristics
+      trace(Tracer::UPDATE,HAPClient::conNum,tUpdate,pObj[heads[hEnd]].aid);
+
+      if(svc->updateState==SpanService::UPDATE_DEFERRED){                         // update was deferred - leave status as TBD until Service calls updateComplete() or update times out
+        status[hEnd]=StatusCode::TBD;
+        continue;
+      }
+
+      if(svc->updateState!=SpanService::UPDATE_RUNNING)                           // updateComplete() was called from within update()
+        success=(svc->updateState==SpanService::UPDATE_SUCCEEDED);
+
+      svc->updateState=SpanService::UPDATE_IDLE;
+      status[hEnd]=success?StatusCode::OK:StatusCode::Unable;                     // save statusCode as OK or Unable depending on whether update succeeded
+    }
+
+    uint32_t tUpdate=micros();
+    boolean batchSuccess=acc->updateBatch();                                      // apply all Service updates for this Accessory at once
+    trace(Tracer::UPDATE,HAPClient::conNum,tUpdate,acc->aid);
+
+    if(!batchSuccess){
+      LOG1("Batch update failed for aid=");
+      LOG1(acc->aid);
+      LOG1("\n");
+    }
+
+    for(;h<hEnd;h++){
+      for(int i=heads[h];i>=0;i=next[i]){                                        // loop over all objects in this Service
+        if(status[h]==StatusCode::TBD){
+          LOG1("Deferring aid=");
+          LOG1(pObj[i].characteristic->aid);
           LOG1(" iid=");  
-          LOG1(pObj[j].characteristic->iid);
-          if(status==StatusCode::OK){                          // if status is okay
-            pObj[j].characteristic->value
-              =pObj[j].characteristic->newValue;               // update characteristic value with new value
-            LOG1(" (okay)\n");
-          } else {                                             // if status not okay
-            pObj[j].characteristic->newValue
-              =pObj[j].characteristic->value;                  // replace characteristic new value with original value
-            LOG1(" (failed)\n");
-          }
-          pObj[j].characteristic->isUpdated=false;             // reset isUpdated flag for characteristic
+          LOG1(pObj[i].characteristic->iid);
+          LOG1("\n");
+        } else {
+          commitUpdate(pObj+i,status[h]);                                         // commit (or revert) values according to outcome of the Service's own update()
+          if(!batchSuccess)
+            pObj[i].status=StatusCode::Unable;                                    // report failure of updateBatch() - values are not reverted since update() has already acted on them
         }
       }
-
-    } // object had TBD status
-  } // loop over all objects
+    }
+  } // loop over all Services
       
   return(1);
 }
 
 ///////////////////////////////
 
+void Span::finishUpdate(SpanBuf *pObj, int nObj, StatusCode status){
+
+  SpanService *svc=pObj[0].characteristic->service;
+
+  for(int j=0;j<nObj;j++){                                                      // loop over this object plus any remaining objects to update values and save status for any other characteristics in this service
+    if(pObj[j].status==StatusCode::TBD && pObj[j].characteristic->service==svc)   // if service of this characteristic matches service that was updated
+      commitUpdate(pObj+j,status);
+  }
+}
+
+///////////////////////////////
+
+void Span::commitUpdate(SpanBuf *obj, StatusCode status){
+
+  obj->status=status;                                  // save statusCode for this object
+  LOG1("Updating aid=");
+  LOG1(obj->characteristic->aid);
+  LOG1(" iid=");  
+  LOG1(obj->characteristic->iid);
+  if(status==StatusCode::OK){                          // if status is okay
+    obj->characteristic->value
+      =obj->characteristic->newValue;                  // update characteristic value with new value
+    LOG1(" (okay)\n");
+  } else {                                             // if status not okay
+    obj->characteristic->newValue
+      =obj->characteristic->value;                     // replace characteristic new value with original value
+    LOG1(status==StatusCode::TimedOut?" (timed out)\n":" (failed)\n");
+  }
+  obj->characteristic->isUpdated=false;                // reset isUpdated flag for characteristic
+}
+
+///////////////////////////////
+
+int Span::countNotify(int slotNum){
+
+  int n=0;
+  
+  for(int i=0;i<Accessories.size();i++){
+    for(int j=0;j<Accessories[i]->Services.size();j++){
+      for(int k=0;k<Accessories[i]->Services[j]->Characteristics.size();k++){
+        if(Accessories[i]->Services[j]->Characteristics[k]->ev&(1u<<slotNum))
+          n++;
+      }
+    }
+  }
+
+  return(n);
+}
+
+///////////////////////////////
+
 void Span::clearNotify(int slotNum){
   
   for(int i=0;i<Accessories.size();i++){
     for(int j=0;j<Accessories[i]->Services.size();j++){
       for(int k=0;k<Accessories[i]->Services[j]->Characteristics.size();k++){
-        Accessories[i]->Services[j]->Characteristics[k]->ev[slotNum]=false;
+        Accessories[i]->Services[j]->Characteristics[k]->ev&=~(1u<<slotNum);
       }
     }
   }
@@ -1144,6 +1767,7 @@ void Span::clearNotify(int slotNum){
 
 int Span::sprintfNotify(SpanBuf *pObj, int nObj, char *cBuf, int conNum){
 
+  uint32_t tStart=micros();
   int nChars=0;
   boolean notifyFlag=false;
   
@@ -1153,7 +1777,7 @@ int Span::sprintfNotify(SpanBuf *pObj, int nObj, char *cBuf, int conNum){
     
     if(pObj[i].status==StatusCode::OK && pObj[i].val){           // characteristic was successfully updated with a new value (i.e. not just an EV request)
       
-      if(pObj[i].characteristic->ev[conNum]){           // if notifications requested for this characteristic by specified connection number
+      if(pObj[i].characteristic->ev&(1u<<conNum)){       // if notifications requested for this characteristic by specified connection number
       
         if(notifyFlag)                                                           // already printed at least one other characteristic
           nChars+=snprintf(cBuf?(cBuf+nChars):NULL,cBuf?64:0,",");               // add preceeding comma before printing next characteristic
@@ -1167,6 +1791,7 @@ int Span::sprintfNotify(SpanBuf *pObj, int nObj, char *cBuf, int conNum){
 
   nChars+=snprintf(cBuf?(cBuf+nChars):NULL,cBuf?64:0,"]}");
 
+  trace(Tracer::SERIALIZE,HAPClient::conNum,tStart);
   return(notifyFlag?nChars:0);                          // if notifyFlag is not set, return 0, else return number of characters printed to cBuf
 }
 
@@ -1174,6 +1799,7 @@ int Span::sprintfNotify(SpanBuf *pObj, int nObj, char *cBuf, int conNum){
 
 int Span::sprintfAttributes(SpanBuf *pObj, int nObj, char *cBuf){
 
+  uint32_t tStart=micros();
   int nChars=0;
 
   nChars+=snprintf(cBuf,cBuf?64:0,"{\"characteristics\":[");
@@ -1186,6 +1812,7 @@ int Span::sprintfAttributes(SpanBuf *pObj, int nObj, char *cBuf){
 
   nChars+=snprintf(cBuf?(cBuf+nChars):NULL,cBuf?64:0,"]}");
 
+  trace(Tracer::SERIALIZE,HAPClient::conNum,tStart);
   return(nChars);    
 }
 
@@ -1193,17 +1820,27 @@ int Span::sprintfAttributes(SpanBuf *pObj, int nObj, char *cBuf){
 
 int Span::sprintfAttributes(char **ids, int numIDs, int flags, char *cBuf){
 
+  uint32_t tStart=micros();
   int nChars=0;
   uint32_t aid;
   int iid;
   
-  SpanCharacteristic *Characteristics[numIDs];
-  StatusCode status[numIDs];
+  TempBuffer <SpanCharacteristic *> cBuffer(numIDs);
+  TempBuffer <StatusCode> sBuffer(numIDs);
+  SpanCharacteristic **Characteristics=cBuffer.buf;
+  StatusCode *status=sBuffer.buf;
   boolean sFlag=false;
 
-  for(int i=0;i<numIDs;i++){              // PASS 1: loop over all ids requested to check status codes - only errors are if characteristic not found, or not readable
+  uint32_t tFind=micros();
+
+  for(int i=0;i<numIDs;i++){              // identify characteristics (traced as a single FIND)
     sscanf(ids[i],"%u.%d",&aid,&iid);     // parse aid and iid
     Characteristics[i]=find(aid,iid);      // find matching chararacteristic
+  }
+
+  trace(Tracer::FIND,HAPClient::conNum,tFind);
+
+  for(int i=0;i<numIDs;i++){              // PASS 1: loop over all ids requested to check status codes - only errors are if characteristic not found, or not readable
     
     if(Characteristics[i]){                                          // if found
       if(Characteristics[i]->perms&SpanCharacteristic::PR){          // if permissions allow reading
@@ -1242,6 +1879,7 @@ int Span::sprintfAttributes(char **ids, int numIDs, int flags, char *cBuf){
 
   nChars+=snprintf(cBuf?(cBuf+nChars):NULL,cBuf?64:0,"]}");
 
+  trace(Tracer::SERIALIZE,HAPClient::conNum,tStart);
   return(nChars);    
 }
 
@@ -1254,27 +1892,43 @@ SpanAccessory::SpanAccessory(uint32_t aid){
   if(!homeSpan.Accessories.empty()){
 
     if(homeSpan.Accessories.size()==HAPClient::MAX_ACCESSORIES){
-      Serial.print("\n\n*** FATAL ERROR: Can't create more than ");
-      Serial.print(HAPClient::MAX_ACCESSORIES);
-      Serial.print(" Accessories.  Program Halting.\n\n");
-      while(1);      
+      if(homeSpan.isInitialized){                             // Accessory is being added at runtime, so let updateDatabase() discard it rather than halting
+        homeSpan.configLog+="+Accessory *** ERROR!  Can't create more than " + String(HAPClient::MAX_ACCESSORIES) + " Accessories. ***\n";
+        homeSpan.nFatalErrors++;
+      } else {
+        Serial.print("\n\n*** FATAL ERROR: Can't create more than ");
+        Serial.print(HAPClient::MAX_ACCESSORIES);
+        Serial.print(" Accessories.  Program Halting.\n\n");
+        while(1);
+      }
+    }
+
+    if(ESP.getFreeHeap()<HAPClient::MIN_FREE_HEAP){
+      if(homeSpan.isInitialized){                             // Accessory is being added at runtime, so let updateDatabase() discard it rather than halting
+        homeSpan.configLog+="+Accessory *** ERROR!  Not enough free memory to create more Accessories. ***\n";
+        homeSpan.nFatalErrors++;
+      } else {
+        Serial.print("\n\n*** FATAL ERROR: Not enough free memory to create more than ");
+        Serial.print(homeSpan.Accessories.size());
+        Serial.print(" Accessories (free heap=");
+        Serial.print(ESP.getFreeHeap());
+        Serial.print(").  Program Halting.\n\n");
+        while(1);
+      }
     }
-    
-    this->aid=homeSpan.Accessories.back()->aid+1;
     
     if(!homeSpan.Accessories.back()->Services.empty())
       homeSpan.Accessories.back()->Services.back()->validate();    
       
     homeSpan.Accessories.back()->validate();    
-  } else {
-    this->aid=1;
   }
   
   homeSpan.Accessories.push_back(this);
 
-  if(aid>0){                 // override with user-specified aid
-    this->aid=aid;
-  }
+  this->aid=aid>0?aid:homeSpan.nextAid;      // use user-specified aid, else next unused aid
+
+  if(this->aid>=homeSpan.nextAid)            // aids of deleted Accessories are never handed out again
+    homeSpan.nextAid=this->aid+1;
 
   homeSpan.configLog+="+Accessory-" + String(this->aid);
 
@@ -1297,6 +1951,16 @@ SpanAccessory::SpanAccessory(uint32_t aid){
 
 ///////////////////////////////
 
+SpanAccessory::~SpanAccessory(){
+
+  while(!Services.empty()){               // Services are removed one at a time so that each one only unlinks itself from Services that still exist
+    delete Services.back();
+    Services.pop_back();
+  }
+}
+
+///////////////////////////////
+
 void SpanAccessory::validate(){
 
   boolean foundInfo=false;
@@ -1326,6 +1990,60 @@ void SpanAccessory::validate(){
 
 ///////////////////////////////
 
+int SpanAccessory::memoryUsed(){
+
+  int nBytes=sizeof(SpanAccessory)+Services.capacity()*sizeof(SpanService *);
+
+  for(int i=0;i<Services.size();i++){
+    SpanService *s=Services[i];
+    nBytes+=sizeof(SpanService)+s->Characteristics.capacity()*sizeof(SpanCharacteristic *)+s->linkedServices.capacity()*sizeof(SpanService *);
+    for(int j=0;j<s->Characteristics.size();j++)
+      nBytes+=sizeof(SpanCharacteristic)+(s->Characteristics[j]->range?sizeof(SpanRange):0);
+  }
+
+  return(nBytes);
+}
+
+///////////////////////////////
+
+void SpanAccessory::hashAttributes(uint8_t *hash){
+
+  mbedtls_sha512_context ctx;
+  
+  mbedtls_sha512_init(&ctx);
+  mbedtls_sha512_starts_ret(&ctx,1);                                                 // use SHA-384 variant
+
+  mbedtls_sha512_update_ret(&ctx,(uint8_t *)&aid,sizeof(aid));
+  
+  for(int i=0;i<Services.size();i++){
+    SpanService *svc=Services[i];
+    uint8_t flags=svc->hidden+2*svc->primary;
+    mbedtls_sha512_update_ret(&ctx,(uint8_t *)&svc->iid,sizeof(svc->iid));
+    mbedtls_sha512_update_ret(&ctx,(uint8_t *)svc->type,strlen(svc->type)+1);      // include null terminator to delimit variable-length fields
+    mbedtls_sha512_update_ret(&ctx,&flags,1);
+    
+    for(int j=0;j<svc->linkedServices.size();j++)
+      mbedtls_sha512_update_ret(&ctx,(uint8_t *)&svc->linkedServices[j]->iid,sizeof(int));
+      
+    for(int j=0;j<svc->Characteristics.size();j++){
+      SpanCharacteristic *chr=svc->Characteristics[j];
+      mbedtls_sha512_update_ret(&ctx,(uint8_t *)&chr->iid,sizeof(chr->iid));
+      mbedtls_sha512_update_ret(&ctx,(uint8_t *)chr->type,strlen(chr->type)+1);
+      mbedtls_sha512_update_ret(&ctx,&chr->perms,1);
+      mbedtls_sha512_update_ret(&ctx,(uint8_t *)&chr->format,sizeof(chr->format));
+      if(chr->range)
+        mbedtls_sha512_update_ret(&ctx,(uint8_t *)chr->range,sizeof(SpanRange));
+      if(chr->desc)
+        mbedtls_sha512_update_ret(&ctx,(uint8_t *)chr->desc,strlen(chr->desc)+1);
+    }
+  }
+
+  mbedtls_sha512_finish_ret(&ctx,hash);
+  mbedtls_sha512_free(&ctx);
+}
+
+///////////////////////////////
+
 int SpanAccessory::sprintfAttributes(char *cBuf){
   int nBytes=0;
 
@@ -1363,6 +2081,7 @@ SpanService::SpanService(const char *type, const char *hapName){
   }
 
   homeSpan.Accessories.back()->Services.push_back(this);  
+  accessory=homeSpan.Accessories.back();
   iid=++(homeSpan.Accessories.back()->iidCount);  
 
   homeSpan.configLog+="-" + String(iid) + String(" (") + String(type) + String(") ");
@@ -1378,6 +2097,36 @@ SpanService::SpanService(const char *type, const char *hapName){
 
 ///////////////////////////////
 
+SpanService::~SpanService(){
+
+  for(int i=0;i<Characteristics.size();i++)
+    delete Characteristics[i];
+
+  for(int i=0;i<homeSpan.Loops.size();i++){
+    if(homeSpan.Loops[i]==this)
+      homeSpan.Loops.erase(homeSpan.Loops.begin()+i--);
+  }
+
+  for(int i=0;i<homeSpan.PushButtons.size();i++){
+    if(homeSpan.PushButtons[i]->service==this){
+      delete homeSpan.PushButtons[i]->pushButton;
+      delete homeSpan.PushButtons[i];
+      homeSpan.PushButtons.erase(homeSpan.PushButtons.begin()+i--);
+    }
+  }
+
+  for(auto acc : homeSpan.Accessories){           // remove Service from the linked Services of any other Service
+    for(auto svc : acc->Services){
+      for(int i=0;i<svc->linkedServices.size();i++){
+        if(svc->linkedServices[i]==this)
+          svc->linkedServices.erase(svc->linkedServices.begin()+i--);
+      }
+    }
+  }
+}
+
+///////////////////////////////
+
 SpanService *SpanService::setPrimary(){
   primary=true;
   return(this);
@@ -1399,6 +2148,31 @@ SpanService *SpanService::addLink(SpanService *svc){
 
 ///////////////////////////////
 
+void SpanService::deferUpdate(uint32_t nMillis){
+
+  if(updateState!=UPDATE_RUNNING){
+    Serial.print("\n*** WARNING:  deferUpdate() ignored - may only be called from within update()\n\n");
+    return;
+  }
+
+  updateState=UPDATE_DEFERRED;
+  updateAlarm=millis()+nMillis;
+}
+
+///////////////////////////////
+
+void SpanService::updateComplete(boolean success){
+
+  if(updateState!=UPDATE_RUNNING && updateState!=UPDATE_DEFERRED){
+    Serial.print("\n*** WARNING:  updateComplete() ignored - Service has no deferred update (update may have timed out)\n\n");
+    return;
+  }
+
+  updateState=success?UPDATE_SUCCEEDED:UPDATE_FAILED;
+}
+
+///////////////////////////////
+
 int SpanService::sprintfAttributes(char *cBuf){
   int nBytes=0;
 
@@ -1471,8 +2245,6 @@ SpanCharacteristic::SpanCharacteristic(const char *type, uint8_t perms, const ch
   service=homeSpan.Accessories.back()->Services.back();
   aid=homeSpan.Accessories.back()->aid;
 
-  ev=(boolean *)calloc(homeSpan.maxConnections,sizeof(boolean));
-
   homeSpan.configLog+="-" + String(iid) + String(" (") + String(type) + String(") ");
 
   boolean valid=false;
@@ -1562,6 +2334,18 @@ SpanCharacteristic::SpanCharacteristic(const char *type, uint8_t perms, const ch
 
 ///////////////////////////////
 
+SpanCharacteristic::~SpanCharacteristic(){
+
+  delete range;
+
+  for(int i=0;i<homeSpan.Notifications.size();i++){
+    if(homeSpan.Notifications[i].characteristic==this)
+      homeSpan.Notifications.erase(homeSpan.Notifications.begin()+i--);
+  }
+}
+
+///////////////////////////////
+
 int SpanCharacteristic::sprintfAttributes(char *cBuf, int flags){
   int nBytes=0;
 
@@ -1644,7 +2428,7 @@ int SpanCharacteristic::sprintfAttributes(char *cBuf, int flags){
     nBytes+=snprintf(cBuf?(cBuf+nBytes):NULL,cBuf?64:0,",\"aid\":%u",aid);
   
   if(flags&GET_EV)
-    nBytes+=snprintf(cBuf?(cBuf+nBytes):NULL,cBuf?64:0,",\"ev\":%s",ev[HAPClient::conNum]?"true":"false");
+    nBytes+=snprintf(cBuf?(cBuf+nBytes):NULL,cBuf?64:0,",\"ev\":%s",(ev&(1u<<HAPClient::conNum))?"true":"false");
 
   nBytes+=snprintf(cBuf?(cBuf+nBytes):NULL,cBuf?64:0,"}");
 
@@ -1675,7 +2459,10 @@ StatusCode SpanCharacteristic::loadUpdate(char *val, char *ev){
     LOG1(": ");
     LOG1(evFlag?"true":"false");
     LOG1("\n");
-    this->ev[HAPClient::conNum]=evFlag;
+    if(evFlag)
+      this->ev|=(1u<<HAPClient::conNum);
+    else
+      this->ev&=~(1u<<HAPClient::conNum);
   }
 
   if(!val)                // no request to update value
@@ -27,7 +27,7 @@
  
 #pragma once
 
-#ifndef ARDUINO_ARCH_ESP32
+#if !defined(ARDUINO_ARCH_ESP32) && !defined(HOMESPAN_HOST)
 #error ERROR: HOMESPAN IS ONLY AVAILABLE FOR ESP32 MICROCONTROLLERS!
 #endif
 
@@ -62,6 +62,7 @@ struct SpanService;
 struct SpanCharacteristic;
 struct SpanRange;
 struct SpanBuf;
+struct SpanPending;
 struct SpanButton;
 
 ///////////////////////////////
@@ -85,21 +86,39 @@ struct Span{
   boolean isInitialized=false;                  // flag indicating HomeSpan has been initialized
   int nFatalErrors=0;                           // number of fatal errors in user-defined configuration
   String configLog;                             // log of configuration process, including any errors
+  unsigned int configLogMark=0;                 // length of configLog at time of last update to HAP database (new entries follow this mark)
+  int nPublished=0;                             // number of Accessories (at start of Accessories vector) that have been validated and published to HomeKit
+  uint32_t nextAid=1;                           // aid assigned to the next Accessory created without a user-specified aid (only ever increases, so aids are not reused)
+  boolean isPolling=false;                      // flag indicating poll() is in the middle of processing requests, loops, or buttons (HAP database cannot be updated)
   boolean isBridge=true;                        // flag indicating whether device is configured as a bridge (i.e. first Accessory contains nothing but AccessoryInformation and HAPProtocolInformation)
   HapQR qrCode;                                 // optional QR Code to use for pairing
   const char *sketchVersion="n/a";              // version of the sketch
 
   boolean connected=false;                      // WiFi connection status
-  unsigned long waitTime=60000;                 // time to wait (in milliseconds) between WiFi connection attempts
+  boolean serverStarted=false;                  // flag indicating HAP server (and OTA) have been started after first WiFi connection
+  Backoff wifiBackoff{DEFAULT_WIFI_MIN_BACKOFF,DEFAULT_WIFI_MAX_BACKOFF,DEFAULT_WIFI_JITTER};     // time to wait between WiFi connection attempts
   unsigned long alarmConnect=0;                 // time after which WiFi connection attempt should be tried again
+  boolean fastConnect=false;                    // flag indicating current WiFi connection attempt is a fast reconnect using wifiCache
+  boolean reuseLease=false;                     // flag indicating fast reconnect re-uses the cached IP lease instead of DHCP
+  const uint32_t FAST_CONNECT_TIME=3000;        // time (in milliseconds) to wait for fast reconnect before falling back to a full connection attempt
   
   const char *defaultSetupCode=DEFAULT_SETUP_CODE;            // Setup Code used for pairing
   uint8_t statusPin=DEFAULT_STATUS_PIN;                       // pin for status LED    
   uint8_t controlPin=DEFAULT_CONTROL_PIN;                     // pin for Control Pushbutton
   uint8_t logLevel=DEFAULT_LOG_LEVEL;                         // level for writing out log messages to serial monitor
+  Print *logOut=&Serial;                                      // destination for log messages (either Serial, or logBuffer if enabled)
+  LogBuffer *logBuffer=NULL;                                  // optional ring buffer for deferring log messages until poll() is idle
+  Tracer *tracer=NULL;                                        // optional ring buffer of timed HAP request phases
+  RequestStats *reqStats=NULL;                                // optional latency, throughput, and heap statistics for each type of HAP request
   uint8_t maxConnections=DEFAULT_MAX_CONNECTIONS;             // number of simultaneous HAP connections
+  uint32_t idleTimeout=DEFAULT_IDLE_TIMEOUT;                  // seconds of inactivity after which a verified HAP connection is closed (0=never)
+  uint32_t unverifiedTimeout=DEFAULT_UNVERIFIED_TIMEOUT;      // seconds of inactivity after which an unverified HAP connection is closed (0=never)
+  uint32_t keepAlive=DEFAULT_KEEPALIVE;                       // seconds of inactivity before TCP keepalive probes are sent on a HAP connection (0=disabled)
+  int ioCore=-1;                                              // core on which to run HAP network I/O and encryption in a separate task (-1=multi-core mode disabled)
+  uint32_t ioStackSize;                                       // stack size of HAP network I/O task
   unsigned long comModeLife=DEFAULT_COMMAND_TIMEOUT*1000;     // length of time (in milliseconds) to keep Command Mode alive before resuming normal operations
   uint16_t tcpPortNum=DEFAULT_TCP_PORT;                       // port for TCP communications between HomeKit and HomeSpan
+  uint32_t storageDelay=DEFAULT_STORAGE_DELAY;                // time (in milliseconds) to wait after last change to Controller or configuration data before saving to NVS
   char qrID[5]="";                                            // Setup ID used for pairing with QR Code
   boolean otaEnabled=false;                                   // enables Over-the-Air ("OTA") updates
   char otaPwd[33];                                            // MD5 Hash of OTA password, represented as a string of hexidecimal characters
@@ -117,6 +136,7 @@ struct Span{
   vector<SpanBuf> Notifications;                    // vector of SpanBuf objects that store info for Characteristics that are updated with setVal() and require a Notification Event
   vector<SpanButton *> PushButtons;                 // vector of pointer to all PushButtons
   unordered_map<uint64_t, uint32_t> TimedWrites;    // map of timed-write PIDs and Alarm Times (based on TTLs)
+  vector<SpanPending> PendingUpdates;               // vector of PUT requests whose response is waiting on one or more deferred Service updates
 
   HapCharList chr;                                  // list of all HAP Characteristics
 
@@ -127,20 +147,35 @@ struct Span{
              
   void poll();                                  // poll HAP Clients and process any new HAP requests
   int getFreeSlot();                            // returns free HAPClient slot number. HAPClients slot keep track of each active HAPClient connection
+  int getEvictSlot();                           // returns HAPClient slot to free when all slots are in use: unverified first, then verified without notifications, then verified with notifications, least-recently active within each group
+  void checkIdleClients();                      // closes HAP connections that have exceeded their idle timeout, and frees session keys of closed connections (in single-core mode)
+  void acceptClient(WiFiClient &newClient);     // assigns newClient to a free (or evicted) HAPClient slot
   void checkConnect();                          // check WiFi connection; connect if needed
+  void saveWifiCache();                         // saves details of current WiFi connection for fast reconnect, if changed
+  void checkAP();                               // service Access Point; save and apply settings (or restore prior settings) once it shuts down
   void commandMode();                           // allows user to control and reset HomeSpan settings with the control button
   void processSerialCommand(const char *c);     // process command 'c' (typically from readSerial, though can be called with any 'c')
 
   int sprintfAttributes(char *cBuf);            // prints Attributes JSON database into buf, unless buf=NULL; return number of characters printed, excluding null terminator, even if buf=NULL
+  void hashAttributes(uint8_t *hash);           // computes 48-byte hash of structure of Attributes database (excluding values) by combining hashes of each Accessory
+  void updateConfigNumber();                    // increments configuration number (c#), saves it, and re-broadcasts it via MDNS if connected
+  void addLoops(SpanAccessory *acc);            // adds any Services in Accessory that over-ride loop() to Loops vector
+  void setTXT(const char *key, const char *val);              // sets MDNS TXT record key=val for the HAP service (all TXT updates are routed through here)
+  void trace(uint8_t phase, uint8_t conNum, uint32_t start, uint32_t aid=0);    // if tracing is enabled, records phase of HAP request on connection conNum that started at time start (in micros) and ends now
+  boolean updateDatabase();                     // validates and publishes any Accessories added after HomeSpan has started.  Returns true on success, else discards the new Accessories and returns false
+  boolean deleteAccessory(uint32_t aid);        // deletes Accessory with matching aid, and all of its Services, Characteristics, and PushButtons.  Returns true on success, else false
   void prettyPrint(char *buf, int nsp=2);       // print arbitrary JSON from buf to serial monitor, formatted with indentions of 'nsp' spaces
   SpanCharacteristic *find(uint32_t aid, int iid);   // return Characteristic with matching aid and iid (else NULL if not found)
   
   int countCharacteristics(char *buf);                                    // return number of characteristic objects referenced in PUT /characteristics JSON request
   int updateCharacteristics(char *buf, SpanBuf *pObj);                    // parses PUT /characteristics JSON request 'buf into 'pObj' and updates referenced characteristics; returns 1 on success, 0 on fail
+  void finishUpdate(SpanBuf *pObj, int nObj, StatusCode status);          // saves status, and commits or reverts new values, for pObj[0] and any remaining objects in the same Service
+  void commitUpdate(SpanBuf *obj, StatusCode status);                     // saves status, and commits or reverts new value, for a single object
   int sprintfAttributes(SpanBuf *pObj, int nObj, char *cBuf);             // prints SpanBuf object into buf, unless buf=NULL; return number of characters printed, excluding null terminator, even if buf=NULL
   int sprintfAttributes(char **ids, int numIDs, int flags, char *cBuf);   // prints accessory.characteristic ids into buf, unless buf=NULL; return number of characters printed, excluding null terminator, even if buf=NULL
 
   void clearNotify(int slotNum);                                          // set ev notification flags for connection 'slotNum' to false across all characteristics 
+  int countNotify(int slotNum);                                           // returns number of characteristics with ev notification flags set for connection 'slotNum'
   int sprintfNotify(SpanBuf *pObj, int nObj, char *cBuf, int conNum);     // prints notification JSON into buf based on SpanBuf objects and specified connection number
 
   void setControlPin(uint8_t pin){controlPin=pin;}                        // sets Control Pin
@@ -151,14 +186,24 @@ struct Span{
   void setApTimeout(uint16_t nSec){network.lifetime=nSec*1000;}           // sets Access Point Timeout (seconds)
   void setCommandTimeout(uint16_t nSec){comModeLife=nSec*1000;}           // sets Command Mode Timeout (seconds)
   void setLogLevel(uint8_t level){logLevel=level;}                        // sets Log Level for log messages (0=baseline, 1=intermediate, 2=all)
+  void enableLogBuffer(uint32_t nBytes=DEFAULT_LOG_BUFFER_SIZE);          // buffers log messages in a ring buffer of nBytes that is sent to Serial only when poll() is otherwise idle
+  void enableTrace(uint32_t nEvents=DEFAULT_TRACE_SIZE);                  // records timing of each phase of HAP requests in a ring buffer of nEvents (print with 'T' command)
+  void enableStats(){if(!reqStats)reqStats=new RequestStats;}             // records latency, throughput, and heap statistics for each type of HAP request (print with 'P' command)
   void setMaxConnections(uint8_t nCon){maxConnections=nCon;}              // sets maximum number of simultaneous HAP connections (HAP requires devices support at least 8)
+  void setIdleTimeout(uint32_t nSeconds){idleTimeout=nSeconds;}           // sets seconds of inactivity after which a verified HAP connection is closed (0=never)
+  void setUnverifiedTimeout(uint32_t nSeconds){unverifiedTimeout=nSeconds;}   // sets seconds of inactivity after which an unverified HAP connection is closed (0=never)
+  void setKeepAlive(uint32_t nSeconds){keepAlive=nSeconds;}               // sets seconds of inactivity before TCP keepalive probes are sent (0=disabled)
+  void enableMultiCore(int core=DEFAULT_IO_CORE, uint32_t stackSize=DEFAULT_IO_STACK_SIZE){ioCore=core;ioStackSize=stackSize;}     // runs HAP network I/O and encryption in a separate task pinned to core, leaving request handling and user callbacks in poll()
   void setHostNameSuffix(const char *suffix){hostNameSuffix=suffix;}      // sets the hostName suffix to be used instead of the 6-byte AccessoryID
   void setPortNum(uint16_t port){tcpPortNum=port;}                        // sets the TCP port number to use for communications between HomeKit and HomeSpan
+  void setStorageDelay(uint32_t nMillis){storageDelay=nMillis;}           // sets the time to wait after last change to Controller or configuration data before saving changes to NVS
   void setQRID(const char *id);                                           // sets the Setup ID for optional pairing with a QR Code
   void enableOTA(boolean auth=true){otaEnabled=true;otaAuth=auth;}        // enables Over-the-Air updates, with (auth=true) or without (auth=false) authorization password
   void setSketchVersion(const char *sVer){sketchVersion=sVer;}            // set optional sketch version number
   const char *getSketchVersion(){return sketchVersion;}                   // get sketch version number
   void setWifiCallback(void (*f)()){wifiCallback=f;}                      // sets an optional user-defined function to call once WiFi connectivity is established
+  void setWifiBackoff(uint32_t minMillis, uint32_t maxMillis, uint8_t jitter=DEFAULT_WIFI_JITTER){wifiBackoff.config(minMillis,maxMillis,jitter);}    // sets the minimum and maximum time to wait between WiFi connection attempts, and the percentage by which each wait is randomly shortened
+  void enableLeaseReuse(){reuseLease=true;}                              // re-uses the IP address obtained from DHCP on the last connection when fast reconnecting, skipping DHCP
 };
 
 ///////////////////////////////
@@ -170,9 +215,14 @@ struct SpanAccessory{
   vector<SpanService *> Services;           // vector of pointers to all Services in this Accessory  
 
   SpanAccessory(uint32_t aid=0);
+  virtual ~SpanAccessory();                 // deletes all Services in this Accessory
 
   int sprintfAttributes(char *cBuf);        // prints Accessory JSON database into buf, unless buf=NULL; return number of characters printed, excluding null terminator, even if buf=NULL  
+  void hashAttributes(uint8_t *hash);       // computes 48-byte SHA-384 hash of structure of Accessory (aid, iids, types, permissions, formats, ranges, etc. but NOT values)
   void validate();                          // error-checks Accessory
+  int memoryUsed();                         // returns approximate bytes of heap used by Accessory and all of its Services and Characteristics (based on size of base classes)
+
+  virtual boolean updateBatch() {return(true);}     // placeholder for code that is called once after update() has been called for every Service in this Accessory updated by a single request.  Must return true/false depending on success of update
 };
 
 ///////////////////////////////
@@ -182,6 +232,7 @@ struct SpanService{
   int iid=0;                                              // Instance ID (HAP Table 6-2)
   const char *type;                                       // Service Type
   const char *hapName;                                    // HAP Name
+  SpanAccessory *accessory=NULL;                          // Accessory containing this Service
   boolean hidden=false;                                   // optional property indicating service is hidden
   boolean primary=false;                                  // optional property indicating service is primary
   vector<SpanCharacteristic *> Characteristics;           // vector of pointers to all Characteristics in this Service  
@@ -190,6 +241,7 @@ struct SpanService{
   vector<SpanService *> linkedServices;                   // vector of pointers to any optional linked Services
   
   SpanService(const char *type, const char *hapName);
+  virtual ~SpanService();                                 // deletes all Characteristics and SpanButtons in this Service, and removes Service from Loops and from the linked Services of other Services
 
   SpanService *setPrimary();                              // sets the Service Type to be primary and returns pointer to self
   SpanService *setHidden();                               // sets the Service Type to be hidden and returns pointer to self
@@ -198,7 +250,21 @@ struct SpanService{
   int sprintfAttributes(char *cBuf);                      // prints Service JSON records into buf; return number of characters printed, excluding null terminator
   void validate();                                        // error-checks Service
   
-  virtual boolean update() {return(true);}                // placeholder for code that is called when a Service is updated via a Controller.  Must return true/false depending on success of update
+  enum {                                                  // status of update() for this Service
+    UPDATE_IDLE=0,                                        // not being updated
+    UPDATE_RUNNING=1,                                     // update() is being called
+    UPDATE_DEFERRED=2,                                    // update() called deferUpdate() and is waiting on updateComplete()
+    UPDATE_SUCCEEDED=3,                                   // updateComplete(true) called
+    UPDATE_FAILED=4                                       // updateComplete(false) called
+  };
+  
+  uint8_t updateState=UPDATE_IDLE;                        // status of update() for this Service
+  uint32_t updateAlarm;                                   // time (in millis) at which a deferred update times out
+
+  void deferUpdate(uint32_t nMillis=DEFAULT_UPDATE_TIMEOUT);    // called from within update() to defer the response to the Controller until updateComplete() is called, or nMillis elapses
+  void updateComplete(boolean success);                   // completes a deferred update with success or failure
+  
+  virtual boolean update() {return(true);}                // placeholder for code that is called when a Service is updated via a Controller.  Must return true/false depending on success of update (ignored if update is deferred)
   virtual void loop(){}                                   // loops for each Service - called every cycle and can be over-ridden with user-defined code
   virtual void button(int pin, int pressType){}           // method called for a Service when a button attached to "pin" has a Single, Double, or Long Press, according to pressType
 };
@@ -248,7 +314,7 @@ struct SpanCharacteristic{
   FORMAT format;                           // Characteristic Format        
   char *desc=NULL;                         // Characteristic Description (optional)
   SpanRange *range=NULL;                   // Characteristic min/max/step; NULL = default values (optional)
-  boolean *ev;                             // Characteristic Event Notify Enable (per-connection)
+  uint32_t ev=0;                           // Characteristic Event Notify Enable (bit n set if enabled for connection n)
   
   uint32_t aid=0;                          // Accessory ID - passed through from Service containing this Characteristic
   boolean isUpdated=false;                 // set to true when new value has been requested by PUT /characteristic
@@ -265,6 +331,7 @@ struct SpanCharacteristic{
   SpanCharacteristic(const char *type, uint8_t perms, int32_t value, const char *hapName);
   SpanCharacteristic(const char *type, uint8_t perms, double value, const char *hapName);
   SpanCharacteristic(const char *type, uint8_t perms, const char* value, const char *hapName);
+  virtual ~SpanCharacteristic();                  // frees range, and removes any pending Notifications for this Characteristic
 
   int sprintfAttributes(char *cBuf, int flags);   // prints Characteristic JSON records into buf, according to flags mask; return number of characters printed, excluding null terminator  
   StatusCode loadUpdate(char *val, char *ev);     // load updated val/ev from PUT /characteristic JSON request.  Return intiial HAP status code (checks to see if characteristic is found, is writable, etc.)
@@ -327,6 +394,14 @@ struct SpanBuf{                               // temporary storage buffer for us
   StatusCode status;                          // return status (HAP Table 6-11)
   SpanCharacteristic *characteristic=NULL;    // Characteristic to update (NULL if not found)
 };
+
+///////////////////////////////
+
+struct SpanPending{                           // PUT request waiting on one or more deferred Service updates before a response can be sent
+  int conNum;                                 // connection slot of Controller that made request
+  uint16_t gen;                               // connection generation of slot when request was made (response is discarded if connection has since changed)
+  vector<SpanBuf> pObj;                       // copy of objects from request (status remains TBD for those waiting on deferred Services)
+};
   
 ///////////////////////////////
 
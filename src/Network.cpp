@@ -37,8 +37,18 @@ using namespace Utils;
 
 void Network::scan(){
 
-  int n=WiFi.scanNetworks();
+  saveNetworks(WiFi.scanNetworks());
+}
+
+///////////////////////////////
 
+void Network::saveNetworks(int n){
+
+  if(n<0)                   // scan failed
+    n=0;
+
+  for(int i=0;i<numSSID && ssidList;i++)
+    free(ssidList[i]);
   free(ssidList);
   ssidList=(char **)calloc(n,sizeof(char *));
   numSSID=0;
@@ -108,7 +118,7 @@ boolean Network::allowedCode(char *s){
 
 ///////////////////////////////
 
-void Network::apConfigure(){
+void Network::apStart(){
 
   Serial.print("*** Starting Access Point: ");
   Serial.print(apSSID);
@@ -118,133 +128,160 @@ void Network::apConfigure(){
 
   homeSpan.statusLED.start(LED_AP_STARTED);
 
-  Serial.print("\nScanning for Networks...\n\n");
-  
-  scan();                   // scan for networks    
-
-  for(int i=0;i<numSSID;i++){
-    Serial.print("  ");
-    Serial.print(i+1);
-    Serial.print(") ");
-    Serial.print(ssidList[i]);
-    Serial.print("\n");
-  }  
-
-  WiFiServer apServer(80);
+  strcpy(savedSSID,wifiData.ssid);
+  strcpy(savedPwd,wifiData.pwd);
+  setupCode[0]='\0';
+  staChanged=false;
   client=0;
-  
-  TempBuffer <uint8_t> tempBuffer(MAX_HTTP+1);
-  uint8_t *httpBuf=tempBuffer.buf;
-  
+
   const byte DNS_PORT = 53;
-  DNSServer dnsServer;
   IPAddress apIP(192, 168, 4, 1);
 
-  WiFi.mode(WIFI_AP);
+  apServer=new WiFiServer(80);
+  dnsServer=new DNSServer;
+  
+  WiFi.mode(WIFI_AP_STA);                     // run access point alongside station, so any existing connection (and HAP server) remains up
   WiFi.softAP(apSSID,apPassword);             // start access point
-  dnsServer.start(DNS_PORT, "*", apIP);       // start DNS server that resolves every request to the address of this device
-  apServer.begin();
+  dnsServer->start(DNS_PORT, "*", apIP);      // start DNS server that resolves every request to the address of this device
+  apServer->begin();
+
+  Serial.print("\nScanning for Networks...\n\n");
+  WiFi.scanNetworks(true);                   // start scan without waiting - results are saved by apPoll() once complete
+  scanning=true;
 
   alarmTimeOut=millis()+lifetime;            // Access Point will shut down when alarmTimeOut is reached
   apStatus=0;                                // status will be "timed out" unless changed
+  apActive=true;
+}
 
-  Serial.print("\nReady.\n");
-
-  while(1){                                  // loop until we get timed out (which will be accelerated if save/cancel selected)
+///////////////////////////////
 
-    if(homeSpan.controlButton.triggered(9999,3000)){
-      Serial.print("\n*** Access Point Terminated.");
-      homeSpan.statusLED.start(LED_ALERT);
-      homeSpan.controlButton.wait();
-      Serial.print("  Restarting... \n\n");
-      homeSpan.statusLED.off();        
-      ESP.restart();      
+boolean Network::apPoll(){
+
+  if(!apActive)
+    return(false);
+
+  if(millis()>alarmTimeOut){
+    WiFi.softAPdisconnect(true);           // terminate connections and shut down captive access point
+    WiFi.mode(WIFI_STA);
+    dnsServer->stop();
+    apServer->end();
+    delete dnsServer;
+    delete apServer;
+    dnsServer=NULL;
+    apServer=NULL;
+    client=0;
+    
+    if(scanning){
+      WiFi.scanDelete();
+      scanning=false;
     }
+    
+    apActive=false;
 
-    if(millis()>alarmTimeOut){
-      WiFi.softAPdisconnect(true);           // terminate connections and shut down captive access point
-      delay(100);
-      if(apStatus==1){
-        Serial.print("\n*** Access Point: Exiting and Saving Settings\n\n");
-        return;
+    if(apStatus==1){
+      Serial.print("\n*** Access Point: Exiting and Saving Settings\n\n");
+    } else {
+      if(apStatus==0){
+        Serial.print("\n*** Access Point: Timed Out (");
+        Serial.print(lifetime/1000);
+        Serial.print(" seconds).");
       } else {
-        if(apStatus==0){
-          Serial.print("\n*** Access Point: Timed Out (");
-          Serial.print(lifetime/1000);
-          Serial.print(" seconds).");
-        } else {
-          Serial.print("\n*** Access Point: Configuration Canceled.");
-        }
-        Serial.print("  Restarting...\n\n");
-        homeSpan.statusLED.start(LED_ALERT);
-        delay(1000);
-        homeSpan.statusLED.off();        
-        ESP.restart();
+        Serial.print("\n*** Access Point: Configuration Canceled.");
       }
+      Serial.print("  Restoring prior settings...\n\n");
+      strcpy(wifiData.ssid,savedSSID);
+      strcpy(wifiData.pwd,savedPwd);
     }
+    
+    return(true);
+  }
 
-    dnsServer.processNextRequest();
-
-    if(client=apServer.available()){                    // found a new HTTP client
-      LOG2("=======================================\n");
-      LOG1("** Access Point Client Connected: (");
-      LOG1(millis()/1000);
-      LOG1(" sec) ");
-      LOG1(client.remoteIP());
-      LOG1("\n");
-      LOG2("\n");
-      delay(50);                                        // pause to allow data buffer to begin to populate
+  if(scanning){
+    int n=WiFi.scanComplete();
+    if(n!=WIFI_SCAN_RUNNING){
+      scanning=false;
+      saveNetworks(n);
+      WiFi.scanDelete();
+      
+      for(int i=0;i<numSSID;i++){
+        Serial.print("  ");
+        Serial.print(i+1);
+        Serial.print(") ");
+        Serial.print(ssidList[i]);
+        Serial.print("\n");
+      }
+      Serial.print("\nReady.\n");
     }
-    
-    if(client && client.available()){                   // if connection exists and data is available
+  }
 
-      LOG2("<<<<<<<<< ");
-      LOG2(client.remoteIP());
-      LOG2(" <<<<<<<<<\n");
+  dnsServer->processNextRequest();
+
+  WiFiClient newClient;
+
+  if(newClient=apServer->available()){              // found a new HTTP client
+    client=newClient;
+    LOG2("=======================================\n");
+    LOG1("** Access Point Client Connected: (");
+    LOG1(millis()/1000);
+    LOG1(" sec) ");
+    LOG1(client.remoteIP());
+    LOG1("\n");
+    LOG2("\n");
+    return(false);                                  // check for data on next poll, to allow data buffer to begin to populate
+  }
     
-      int nBytes=client.read(httpBuf,MAX_HTTP+1);       // read all available bytes up to maximum allowed+1
-       
-      if(nBytes>MAX_HTTP){                              // exceeded maximum number of bytes allowed
-        badRequestError();
-        Serial.print("\n*** ERROR:  Exceeded maximum HTTP message length\n\n");
-        continue;
-      }
+  if(client && client.available()){                 // if connection exists and data is available
 
-      httpBuf[nBytes]='\0';                             // add null character to enable string functions    
-      char *body=(char *)httpBuf;                       // char pointer to start of HTTP Body
-      char *p;                                          // char pointer used for searches
-      
-      if(!(p=strstr((char *)httpBuf,"\r\n\r\n"))){
-        badRequestError();
-        Serial.print("\n*** ERROR:  Malformed HTTP request (can't find blank line indicating end of BODY)\n\n");
-        continue;      
-      }
+    LOG2("<<<<<<<<< ");
+    LOG2(client.remoteIP());
+    LOG2(" <<<<<<<<<\n");
 
-      *p='\0';                                          // null-terminate end of HTTP Body to faciliate additional string processing
-      uint8_t *content=(uint8_t *)p+4;                  // byte pointer to start of optional HTTP Content
-      int cLen=0;                                       // length of optional HTTP Content
+    TempBuffer <uint8_t> tempBuffer(MAX_HTTP+1);
+    uint8_t *httpBuf=tempBuffer.buf;
+  
+    int nBytes=client.read(httpBuf,MAX_HTTP+1);     // read all available bytes up to maximum allowed+1
+     
+    if(nBytes>MAX_HTTP){                            // exceeded maximum number of bytes allowed
+      badRequestError();
+      Serial.print("\n*** ERROR:  Exceeded maximum HTTP message length\n\n");
+      return(false);
+    }
 
-      if((p=strstr(body,"Content-Length: ")))           // Content-Length is specified
-        cLen=atoi(p+16);
-      if(nBytes!=strlen(body)+4+cLen){
-        badRequestError();
-        Serial.print("\n*** ERROR:  Malformed HTTP request (Content-Length plus Body Length does not equal total number of bytes read)\n\n");
-        continue;        
-      }
+    httpBuf[nBytes]='\0';                           // add null character to enable string functions    
+    char *body=(char *)httpBuf;                     // char pointer to start of HTTP Body
+    char *p;                                        // char pointer used for searches
+    
+    if(!(p=strstr((char *)httpBuf,"\r\n\r\n"))){
+      badRequestError();
+      Serial.print("\n*** ERROR:  Malformed HTTP request (can't find blank line indicating end of BODY)\n\n");
+      return(false);
+    }
+
+    *p='\0';                                        // null-terminate end of HTTP Body to faciliate additional string processing
+    uint8_t *content=(uint8_t *)p+4;                // byte pointer to start of optional HTTP Content
+    int cLen=0;                                     // length of optional HTTP Content
 
-      LOG2(body);
-      LOG2("\n------------ END BODY! ------------\n");
+    if((p=strstr(body,"Content-Length: ")))         // Content-Length is specified
+      cLen=atoi(p+16);
+    if(nBytes!=strlen(body)+4+cLen){
+      badRequestError();
+      Serial.print("\n*** ERROR:  Malformed HTTP request (Content-Length plus Body Length does not equal total number of bytes read)\n\n");
+      return(false);
+    }
 
-      content[cLen]='\0';                               // add a trailing null on end of any contents, which should always be text-based
+    LOG2(body);
+    LOG2("\n------------ END BODY! ------------\n");
 
-      processRequest(body, (char *)content);            // process request
-      
-      LOG2("\n");
+    content[cLen]='\0';                             // add a trailing null on end of any contents, which should always be text-based
 
-    } // process Client
+    processRequest(body, (char *)content);          // process request
+    
+    LOG2("\n");
 
-  } // while 1
+  } // process Client
 
+  return(false);
 }
 
 ///////////////////////////////
@@ -279,6 +316,7 @@ void Network::processRequest(char *body, char *formData){
                   "<p>Initiating WiFi connection to:</p><p><b>" + String(wifiData.ssid) + "</p>";
 
     WiFi.begin(wifiData.ssid,wifiData.pwd);              
+    staChanged=true;
   
   } else
 
@@ -286,7 +324,7 @@ void Network::processRequest(char *body, char *formData){
     getFormValue(formData,"code",setupCode,8);
 
     if(allowedCode(setupCode)){
-      responseBody+="<p><b>Settings saved!</b></p><p>Restarting HomeSpan.</p><p>Closing window...</p>";
+      responseBody+="<p><b>Settings saved!</b></p><p>Starting HomeSpan.</p><p>Closing window...</p>";
       alarmTimeOut=millis()+2000;
       apStatus=1;
       
@@ -298,7 +336,7 @@ void Network::processRequest(char *body, char *formData){
   } else
 
   if(!strncmp(body,"GET /cancel ",12)){                                   // GET CANCEL
-    responseBody+="<p><b>Configuration Canceled!</b></p><p>Restarting HomeSpan.</p><p>Closing window...</p>";
+    responseBody+="<p><b>Configuration Canceled!</b></p><p>Restoring prior settings.</p><p>Closing window...</p>";
     alarmTimeOut=millis()+2000;
     apStatus=-1;
   } else
@@ -33,6 +33,8 @@
 
 using std::unordered_set;
 
+class DNSServer;
+
 const int MAX_SSID=32;                              // max number of characters in WiFi SSID
 const int MAX_PWD=64;                               // max number of characters in WiFi Password
 
@@ -50,21 +52,41 @@ struct Network {
   int numSSID;
 
   WiFiClient client;                      // client used for HTTP calls
+  WiFiServer *apServer=NULL;              // HTTP server for captive access point
+  DNSServer *dnsServer=NULL;              // DNS server for captive access point
   int waitTime;                           // time to wait between HTTP refreshed when checking for WiFi connection
-  unsigned long alarmTimeOut;             // alarm time after which access point is shut down and HomeSpan is re-started
+  unsigned long alarmTimeOut;             // alarm time after which access point is shut down
   int apStatus;                           // tracks access point status (0=timed-out, -1=cancel, 1=save)
+  boolean apActive=false;                 // true if access point is running
+  boolean scanning=false;                 // true if a scan for networks started by access point has not yet completed
+  boolean staChanged;                     // true if access point has started connecting to a new network (which disconnects any existing connection)
 
   struct {
     char ssid[MAX_SSID+1]="";
     char pwd[MAX_PWD+1]="";
   } wifiData;
+
+  struct {                                // details of last successful connection, used to reconnect without scanning
+    char ssid[MAX_SSID+1]="";             // network to which details apply
+    uint8_t bssid[6];                     // BSSID of access point
+    int32_t channel=0;                    // channel of access point (0=no details saved)
+    uint32_t ip;                          // IP address, gateway, subnet mask, and DNS server obtained from DHCP
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+  } wifiCache;
+
+  char savedSSID[MAX_SSID+1];             // WiFi credentials in effect when access point was started, restored if configuration is canceled or times out
+  char savedPwd[MAX_PWD+1];
   
   char setupCode[8+1];  
 
   void scan();                                                              // scan for WiFi networks and save only those with unique SSIDs
+  void saveNetworks(int n);                                                 // save unique SSIDs from the n networks found in last scan
   void serialConfigure();                                                   // configure homeSpan WiFi from serial monitor
   boolean allowedCode(char *s);                                             // checks if Setup Code is allowed (HAP defines a list of disallowed codes)
-  void apConfigure();                                                       // configure homeSpan WiFi and Setup Code using temporary Captive Access Point; only returns if sucessful, else ESP restarts
+  void apStart();                                                           // starts temporary Captive Access Point for configuring homeSpan WiFi and Setup Code, alongside any existing WiFi connection, and returns immediately
+  boolean apPoll();                                                         // services Captive Access Point; returns true once access point has shut down, with result in apStatus
   void processRequest(char *body, char *formData);                          // process the HTTP request
   int getFormValue(char *formData, const char *tag, char *value, int maxSize);    // search for 'tag' in 'formData' and copy result into 'value' up to 'maxSize' characters; returns number of characters, else -1 if 'tag' not found
   int badRequestError();                                                    // return 400 error
@@ -74,9 +74,24 @@
 #define     DEFAULT_COMMAND_TIMEOUT   120                 // change with homeSpan.setCommandTimeout(nSeconds)
 
 #define     DEFAULT_LOG_LEVEL         0                   // change with homeSpan.setLogLevel(level)
+#define     DEFAULT_LOG_BUFFER_SIZE   4096                // change with homeSpan.enableLogBuffer(nBytes)
+#define     DEFAULT_TRACE_SIZE        256                 // change with homeSpan.enableTrace(nEvents)
 
 #define     DEFAULT_MAX_CONNECTIONS   8                   // change with homeSpan.setMaxConnections(num);
 #define     DEFAULT_TCP_PORT          80                  // change with homeSpan.setPort(port);
+#define     DEFAULT_IDLE_TIMEOUT      0                   // change with homeSpan.setIdleTimeout(nSeconds);  0=verified connections never time out
+#define     DEFAULT_UNVERIFIED_TIMEOUT  120               // change with homeSpan.setUnverifiedTimeout(nSeconds);
+#define     DEFAULT_KEEPALIVE         60                  // change with homeSpan.setKeepAlive(nSeconds);  0=TCP keepalive disabled
+#define     DEFAULT_IO_CORE           0                   // change with homeSpan.enableMultiCore(core, stackSize)
+#define     DEFAULT_IO_STACK_SIZE     8192                // change with homeSpan.enableMultiCore(core, stackSize)
+
+#define     DEFAULT_UPDATE_TIMEOUT    5000                // change with optional argument in SpanService::deferUpdate(nMillis)
+
+#define     DEFAULT_STORAGE_DELAY     2000                // change with homeSpan.setStorageDelay(nMillis);
+
+#define     DEFAULT_WIFI_MIN_BACKOFF  1000                // change with homeSpan.setWifiBackoff(minMillis, maxMillis, jitter);
+#define     DEFAULT_WIFI_MAX_BACKOFF  32000               // change with homeSpan.setWifiBackoff(minMillis, maxMillis, jitter);
+#define     DEFAULT_WIFI_JITTER       25                  // change with homeSpan.setWifiBackoff(minMillis, maxMillis, jitter);
 
 
 /////////////////////////////////////////////////////
@@ -94,8 +109,14 @@
 //      Message Log Level Control Macros           //
 //       0=Minimal, 1=Informative, 2=All           //
 
-#define LOG1(x) if(homeSpan.logLevel>0)Serial.print(x)
-#define LOG2(x) if(homeSpan.logLevel>1)Serial.print(x)
+#ifndef MAX_LOG_LEVEL
+  #define MAX_LOG_LEVEL 2       // maximum Log Level compiled into HomeSpan.  Messages above this level are removed entirely at compile time (override with compiler flag -DMAX_LOG_LEVEL=n)
+#endif
+
+#define LOG_ON(n) (MAX_LOG_LEVEL>=(n) && homeSpan.logLevel>=(n))
+
+#define LOG1(x) if(LOG_ON(1))homeSpan.logOut->print(x)
+#define LOG2(x) if(LOG_ON(2))homeSpan.logOut->print(x)
    
 
 //////////////////////////////////////////////////////
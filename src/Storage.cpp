@@ -0,0 +1,182 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+ 
+ 
+#include "Storage.h"
+#include "HomeSpan.h"
+
+///////////////////////////////
+
+int NVSBackend::get(const char *key, void *data, size_t len){
+
+  size_t n;
+  
+  if(nvs_get_blob(handle,key,NULL,&n) || n!=len)      // not found, or size does not match
+    return(0);
+    
+  return(nvs_get_blob(handle,key,data,&n)==ESP_OK);  
+}
+
+///////////////////////////////
+
+int NVSBackend::set(const char *key, const void *data, size_t len){
+  return(nvs_set_blob(handle,key,data,len)==ESP_OK);
+}
+
+///////////////////////////////
+
+int NVSBackend::erase(const char *key){
+
+  esp_err_t err=nvs_erase_key(handle,key);
+  return(err==ESP_OK || err==ESP_ERR_NVS_NOT_FOUND);
+}
+
+///////////////////////////////
+
+int NVSBackend::commit(){
+  return(nvs_commit(handle)==ESP_OK);
+}
+
+///////////////////////////////
+
+void SpanStore::begin(StorageBackend *backend, uint32_t debounce){
+  this->backend=backend;
+  this->debounce=debounce;
+}
+
+///////////////////////////////
+
+int SpanStore::add(const char *key, void *data, size_t len){
+
+  record_t rec;
+  
+  strncpy(rec.key,key,sizeof(rec.key)-1);
+  rec.key[sizeof(rec.key)-1]='\0';
+  rec.data=data;
+  rec.len=len;
+  rec.dirty=false;
+  rec.urgent=false;
+  records.push_back(rec);
+
+  return(backend->get(key,data,len));
+}
+
+///////////////////////////////
+
+SpanStore::record_t *SpanStore::find(void *data){
+
+  for(int i=0;i<records.size();i++){
+    if(records[i].data==data)
+      return(&records[i]);
+  }
+
+  return(NULL);
+}
+
+///////////////////////////////
+
+void SpanStore::mark(void *data, boolean urgent){
+
+  record_t *rec=find(data);
+
+  if(!rec){
+    Serial.print("\n*** WARNING: Attempt to mark unregistered storage record as changed.  Ignored.\n\n");
+    return;
+  }
+
+  rec->dirty=true;
+  rec->urgent|=urgent;
+  this->urgent|=urgent;
+  
+  pending=true;
+  alarmTime=millis()+debounce;          // each new change restarts the debounce window
+}
+
+///////////////////////////////
+
+void SpanStore::flush(){
+
+  write(true);                          // write and commit urgent records ahead of all others
+  write(false);
+  urgent=false;
+  pending=false;
+
+  for(int i=0;i<records.size();i++)     // records that could not be saved remain dirty...
+    pending|=records[i].dirty;
+
+  if(pending)                           // ...and are retried once another debounce period has elapsed
+    alarmTime=millis()+debounce;
+}
+
+///////////////////////////////
+
+void SpanStore::poll(){
+
+  if(urgent){
+    write(true);
+    urgent=false;
+  }
+  
+  if(pending && (int32_t)(millis()-alarmTime)>=0)
+    flush();
+}
+
+///////////////////////////////
+
+void SpanStore::write(boolean urgentOnly){
+
+  vector<record_t *> written;
+
+  for(int i=0;i<records.size();i++){
+    if(records[i].dirty && (records[i].urgent || !urgentOnly)){
+      if(!backend->set(records[i].key,records[i].data,records[i].len)){
+        Serial.print("\n*** ERROR: Can't save record '");
+        Serial.print(records[i].key);
+        Serial.print("' to storage\n\n");
+        continue;                                                 // leave record dirty so it is retried at next flush
+      }
+      written.push_back(&records[i]);
+    }
+  }
+
+  if(written.empty())
+    return;
+
+  if(!backend->commit()){
+    Serial.print("\n*** ERROR: Can't commit changes to storage\n\n");
+    return;                                                       // leave all records dirty so they are retried at next flush
+  }
+
+  for(auto rec : written){
+    rec->dirty=false;
+    rec->urgent=false;
+  }
+
+  LOG2("Storage: wrote ");
+  LOG2(written.size());
+  LOG2(" record(s)\n");
+}
@@ -0,0 +1,106 @@
+/*********************************************************************************
+ *  MIT License
+ *  
+ *  Copyright (c) 2020-2021 Gregg E. Berman
+ *  
+ *  https://github.com/HomeSpan/HomeSpan
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *  
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *  
+ ********************************************************************************/
+ 
+ 
+#pragma once
+
+#include <Arduino.h>
+#include <nvs.h>
+#include <vector>
+
+using std::vector;
+
+/////////////////////////////////////////////////
+// Abstract interface to a key/value store used to
+// persist HomeSpan data.  The NVS implementation
+// below is used on the ESP32, but any store that
+// can get, set, and atomically commit blobs by key
+// can be substituted
+
+struct StorageBackend {
+  virtual int get(const char *key, void *data, size_t len)=0;          // reads stored blob 'key' into data, if found and exactly 'len' bytes.  Returns 1 on success, else 0
+  virtual int set(const char *key, const void *data, size_t len)=0;    // stages blob 'key' with 'len' bytes from data.  Returns 1 on success, else 0
+  virtual int erase(const char *key)=0;                                // stages erasure of blob 'key'.  Returns 1 on success (or if not found), else 0
+  virtual int commit()=0;                                              // commits all staged changes.  Returns 1 on success, else 0
+  virtual ~StorageBackend(){}
+};
+
+/////////////////////////////////////////////////
+// StorageBackend implemented on an open NVS namespace
+
+struct NVSBackend : StorageBackend {
+  nvs_handle handle;
+
+  NVSBackend(nvs_handle handle) : handle{handle} {}
+
+  int get(const char *key, void *data, size_t len) override;
+  int set(const char *key, const void *data, size_t len) override;
+  int erase(const char *key) override;
+  int commit() override;
+};
+
+/////////////////////////////////////////////////
+// Tracks a set of fixed-size records that mirror data
+// held in RAM, and writes only those records marked
+// as changed.  Changes are coalesced and flushed
+// together once no further changes have been marked
+// for 'debounce' milliseconds.  Urgent changes (such as
+// removal of a paired Controller) skip the debounce and
+// are flushed at the very next poll(), and are always
+// written and committed ahead of any other pending changes
+// so that a reset mid-flush can never leave an urgent
+// change unsaved while a later one is saved.
+
+class SpanStore {
+
+  struct record_t {
+    char key[16];            // key used to store record in backend
+    void *data;              // pointer to RAM copy of record
+    size_t len;              // size of record
+    boolean dirty;           // record has changed since last flush
+    boolean urgent;          // record must be written at next (immediate) flush, ahead of other dirty records
+  };
+
+  StorageBackend *backend=NULL;     // backend used to store records
+  vector<record_t> records;         // all records registered with add()
+  uint32_t debounce;                // time (in milliseconds) to wait after last change before flushing
+  uint32_t alarmTime;               // time (in millis) after which pending changes are flushed
+  boolean pending=false;            // flag indicating there are pending changes
+  boolean urgent=false;             // flag indicating there are pending urgent changes
+
+  record_t *find(void *data);                                   // returns record whose RAM copy is 'data' (or NULL if not found)
+  void write(boolean urgentOnly);                               // writes dirty records (or only urgent ones) to backend and commits
+
+public:
+
+  void begin(StorageBackend *backend, uint32_t debounce);       // sets backend and debounce time
+  int add(const char *key, void *data, size_t len);             // registers record 'key' with 'len' bytes held in RAM at 'data' and loads its stored value, if any.  Returns 1 if stored value was found, else 0
+  void mark(void *data, boolean urgent=false);                  // marks record held in RAM at 'data' as changed.  Urgent changes are flushed at next poll() without waiting for debounce time
+  void flush();                                                 // immediately writes all pending changes (any that cannot be written remain pending and are retried after the debounce time)
+  void poll();                                                  // flushes urgent changes, and all other pending changes once debounce time has elapsed since last change
+};
+
@@ -30,23 +30,34 @@
 template <class tagType, int maxTags>
 class TLV {
 
-  int cLen;              // total number of bytes in all defined TLV records, including TAG andf LEN (suitable for use as Content-Length in HTTP Body)
   int numTags;           // actual number of tags defined
   
   struct tlv_t {
     tagType tag;         // TAG
-    int len;             // LENGTH
-    uint8_t *val;        // VALUE buffer
+    int len;             // LENGTH (-1 if TAG is not present)
+    uint8_t *val;        // VALUE buffer if it is a view into an unpacked byte buffer (NULL if VALUE is stored in arena)
     int maxLen;          // maximum length of VALUE buffer
-    const char *name;          // abbreviated name of this TAG
+    int offset;          // offset of this record's VALUE storage within arena
+    const char *name;    // abbreviated name of this TAG
   };
 
-  tlv_t tlv[maxTags];           // pointer to array of TLV record structures
-  tlv_t *find(tagType tag);     // returns pointer to TLV record with matching TAG (or NULL if no match)
+  tlv_t tlv[maxTags];           // array of TLV record structures
+  int8_t index[256];            // maps each possible TAG to its slot in tlv[] (or -1 if TAG has not been created), so lookups do not require a search
+  uint8_t *arena=NULL;          // single storage block holding the VALUE buffers of all TLV records (allocated upon first use)
+  int arenaSize=0;              // size of arena, equal to the sum of maxLen over all TLV records
+
+  tlv_t *find(tagType tag){return(index[(uint8_t)tag]<0?NULL:tlv+index[(uint8_t)tag]);}     // returns pointer to TLV record with matching TAG (or NULL if no match)
+  uint8_t *own(tlv_t *tlv);                                                                 // returns pointer to VALUE storage for TLV record within arena (NULL if arena could not be allocated)
+  uint8_t *data(tlv_t *tlv){return(tlv->val?tlv->val:own(tlv));}                           // returns pointer to current VALUE of TLV record, whether a view or stored in arena
+  int unpackFail(){clear();return(0);}                                                      // clears all TLV records and returns 0
+  void packSegment(uint8_t *tlvBuf, int &pos, const uint8_t *src, int len, int offset, int nBytes);   // copies whatever part of 'len' bytes of 'src', located at 'pos' in packed stream, falls into range [offset,offset+nBytes)
 
 public:
 
   TLV();
+  ~TLV(){free(arena);}
+  TLV(const TLV &)=delete;                  // TLV records may point into arena, so TLVs are not copyable
+  TLV &operator=(const TLV &)=delete;
   
   int create(tagType tag, int maxLen, const char *name);   // creates a new TLV record of type 'tag' with 'maxLen' bytes and display 'name'
   
@@ -56,10 +67,11 @@ public:
   uint8_t *buf(tagType tag);                // returns VAL Buffer for TLV with matching TAG (or NULL if no match)
   uint8_t *buf(tagType tag, int len);       // set length and returns VAL Buffer for TLV with matching TAG (or NULL if no match or if LEN>MAX)
   int len(tagType tag);                     // returns LEN for TLV matching TAG (or 0 if TAG is found but LEN not yet set; -1 if no match at all)
-  void print();                             // prints all defined TLVs (those with length>0). For diagnostics/debugging only
-  int unpack(uint8_t *tlvBuf, int nBytes);  // unpacks nBytes of TLV content from single byte buffer into individual TLV records (return 1 on success, 0 if fail) 
+  void print(Print &out=Serial);            // prints all defined TLVs (those with length>0) to out. For diagnostics/debugging only
+  int unpack(uint8_t *tlvBuf, int nBytes);  // unpacks nBytes of TLV content from single byte buffer into individual TLV records (return 1 on success, 0 if fail).  Non-fragmented VALUES are NOT copied; they point into tlvBuf, which must persist until clear() is called
   int pack(uint8_t *tlvBuf);                // if tlvBuf!=NULL, packs all defined TLV records (LEN>0) into a single byte buffer, spitting large TLVs into separate 255-byte chunks.  Returns number of bytes (that would be) stored in buffer
-  int pack_old(uint8_t *buf);               // packs all defined TLV records (LEN>0) into a single byte buffer, spitting large TLVs into separate 255-byte records.  Returns number of bytes stored in buffer
+
+  int pack(uint8_t *tlvBuf, int offset, int nBytes);            // streaming writer: packs only bytes [offset,offset+nBytes) of what pack() would produce into tlvBuf.  Returns number of bytes stored
   
 }; // TLV
 
@@ -69,6 +81,7 @@ public:
 template<class tagType, int maxTags>
 TLV<tagType, maxTags>::TLV(){
   numTags=0;
+  memset(index,-1,sizeof(index));
 }
 
 //////////////////////////////////////
@@ -88,24 +101,32 @@ int TLV<tagType, maxTags>::create(tagType tag, int maxLen, const char *name){
   tlv[numTags].maxLen=maxLen;
   tlv[numTags].name=name;
   tlv[numTags].len=-1;
-  tlv[numTags].val=(uint8_t *)malloc(maxLen);
+  tlv[numTags].val=NULL;
+  tlv[numTags].offset=arenaSize;
+  index[(uint8_t)tag]=numTags;
+  arenaSize+=maxLen;
   numTags++;
 
+  free(arena);            // arena is re-sized upon next use to include the storage needed for this new record
+  arena=NULL;
+
   return(1);
 }
 
 //////////////////////////////////////
-// TLV find(tag)
+// TLV own(tlv)
 
 template<class tagType, int maxTags>
-typename TLV<tagType, maxTags>::tlv_t *TLV<tagType, maxTags>::find(tagType tag){
+uint8_t *TLV<tagType, maxTags>::own(tlv_t *tlv){
 
-  for(int i=0;i<numTags;i++){
-    if(tlv[i].tag==tag)
-      return(tlv+i);
+  if(!arena && !(arena=(uint8_t *)calloc(arenaSize,1))){
+    Serial.print("\n*** ERROR:  Can't allocate ");
+    Serial.print(arenaSize);
+    Serial.print(" bytes for TLV records\n\n");
+    return(NULL);
   }
-  
-  return(NULL);
+
+  return(arena+tlv->offset);
 }
 
 //////////////////////////////////////
@@ -114,10 +135,10 @@ typename TLV<tagType, maxTags>::tlv_t *TLV<tagType, maxTags>::find(tagType tag){
 template<class tagType, int maxTags>
 void TLV<tagType, maxTags>::clear(){
 
-  cLen=0;
-
-  for(int i=0;i<numTags;i++)
+  for(int i=0;i<numTags;i++){
     tlv[i].len=-1;
+    tlv[i].val=NULL;
+  }
 
 }
 
@@ -130,7 +151,7 @@ int TLV<tagType, maxTags>::val(tagType tag){
   tlv_t *tlv=find(tag);
 
   if(tlv && tlv->len>0)
-    return(tlv->val[0]);
+    return(data(tlv)[0]);
 
   return(-1);
 }
@@ -143,10 +164,10 @@ int TLV<tagType, maxTags>::val(tagType tag, uint8_t val){
 
   tlv_t *tlv=find(tag);
   
-  if(tlv){
-    tlv->val[0]=val;
+  if(tlv && own(tlv)){
+    tlv->val=NULL;
+    own(tlv)[0]=val;
     tlv->len=1;
-    cLen+=tlv->len+2;
     return(val);
   }
   
@@ -162,7 +183,7 @@ uint8_t *TLV<tagType, maxTags>::buf(tagType tag){
   tlv_t *tlv=find(tag);
 
   if(tlv)
-    return(tlv->val);
+    return(data(tlv));
     
   return(NULL);
 }
@@ -175,14 +196,10 @@ uint8_t *TLV<tagType, maxTags>::buf(tagType tag, int len){
 
   tlv_t *tlv=find(tag);
   
-  if(tlv && len<=tlv->maxLen){
+  if(tlv && len<=tlv->maxLen && own(tlv)){
+    tlv->val=NULL;
     tlv->len=len;
-    cLen+=tlv->len;
-
-    for(int i=0;i<tlv->len;i+=255)
-      cLen+=2;
-    
-    return(tlv->val);
+    return(own(tlv));
   }
   
   return(NULL);
@@ -192,24 +209,25 @@ uint8_t *TLV<tagType, maxTags>::buf(tagType tag, int len){
 // TLV print()
 
 template<class tagType, int maxTags>
-void TLV<tagType, maxTags>::print(){
+void TLV<tagType, maxTags>::print(Print &out){
 
   char buf[3];
 
   for(int i=0;i<numTags;i++){
     
     if(tlv[i].len>0){
-      Serial.print(tlv[i].name);
-      Serial.print("(");
-      Serial.print(tlv[i].len);
-      Serial.print(") ");
+      uint8_t *val=data(tlv+i);
+      out.print(tlv[i].name);
+      out.print("(");
+      out.print(tlv[i].len);
+      out.print(") ");
       
       for(int j=0;j<tlv[i].len;j++){
-        sprintf(buf,"%02X",tlv[i].val[j]);
-        Serial.print(buf);
+        sprintf(buf,"%02X",val[j]);
+        out.print(buf);
        }
 
-      Serial.print("\n");
+      out.print("\n");
 
     } // len>0
   } // loop over all TLVs
@@ -227,11 +245,12 @@ int TLV<tagType, maxTags>::pack(uint8_t *tlvBuf){
   for(int i=0;i<numTags;i++){    
     
     if((nBytes=tlv[i].len)>0){
+      uint8_t *val=tlvBuf?data(tlv+i):NULL;
       for(int j=0;j<tlv[i].len;j+=255,nBytes-=255){
         if(tlvBuf!=NULL){
           *tlvBuf++=tlv[i].tag;
           *tlvBuf++=nBytes>255?255:nBytes;
-          memcpy(tlvBuf,tlv[i].val+j,nBytes>255?255:nBytes);
+          memcpy(tlvBuf,val+j,nBytes>255?255:nBytes);
           tlvBuf+=nBytes>255?255:nBytes;
         }
         n+=(nBytes>255?255:nBytes)+2;      
@@ -258,61 +277,81 @@ int TLV<tagType, maxTags>::len(tagType tag){
 }
 
 //////////////////////////////////////
-// TLV unpack(tlvBuf, nBytes)
+// TLV pack(tlvBuf, offset, nBytes)
 
 template<class tagType, int maxTags>
-int TLV<tagType, maxTags>::unpack(uint8_t *tlvBuf, int nBytes){
-
-  clear();
+int TLV<tagType, maxTags>::pack(uint8_t *tlvBuf, int offset, int nBytes){
 
-  tagType tag;
-  int tagLen;
-  uint8_t *val;
-  int currentLen;
-  int state=0;
+  int pos=0;                                    // position in full packed stream
 
-  for(int i=0;i<nBytes;i++){
+  for(int i=0;i<numTags && pos<offset+nBytes;i++){
     
-    switch(state){
-      
-      case 0:                                     // ready to read next tag
-        if((tag=(tagType)tlvBuf[i])==-1){         // read TAG; return with error if not found
-          clear();
-          return(0);
-        }
-        state=1;
-      break;
-
-      case 1:                                     // ready to read tag length
-        tagLen=tlvBuf[i];                         // read LEN
-        currentLen=len(tag);                      // get current length of existing tag
-        if(!(val=buf(tag,tagLen+currentLen))){    // get VAL Buffer for TAG and set LEN (returns NULL if LEN > maxLen)
-          clear();
-          return(0);
-        }
+    if(tlv[i].len>0){
+      uint8_t *val=data(tlv+i);
+      for(int j=0;j<tlv[i].len && pos<offset+nBytes;j+=255){
+        int n=tlv[i].len-j>255?255:tlv[i].len-j;
+        uint8_t hdr[2]={(uint8_t)tlv[i].tag,(uint8_t)n};
+        packSegment(tlvBuf,pos,hdr,2,offset,nBytes);
+        packSegment(tlvBuf,pos,val+j,n,offset,nBytes);
+      } // j-loop
+    } // len>0
+    
+  } // loop over all TLVs
+
+  pos-=offset;
+  return(pos<0?0:(pos>nBytes?nBytes:pos));
+}
+
+//////////////////////////////////////
+// TLV packSegment(tlvBuf, pos, src, len, offset, nBytes)
+
+template<class tagType, int maxTags>
+void TLV<tagType, maxTags>::packSegment(uint8_t *tlvBuf, int &pos, const uint8_t *src, int len, int offset, int nBytes){
 
-        val+=currentLen;                          // move val to end of current length (tag repeats to load more than 255 bytes)
-          
-        if(tagLen==0)                             // no bytes to read
-          state=0;
-        else                                      // move to next state
-          state=2;
-      break;
+  int start=pos>offset?pos:offset;
+  int end=pos+len<offset+nBytes?pos+len:offset+nBytes;
 
-      case 2:                                     // ready to read another byte into VAL
-        *val=tlvBuf[i];                           // copy byte into VAL buffer
-        val++;                                    // increment VAL buffer (already checked for sufficient length above)
-        tagLen--;                                 // decrement number of bytes to continue copying
-        if(tagLen==0)                             // no more bytes to copy
-          state=0;
-      break;
+  if(start<end)
+    memcpy(tlvBuf+start-offset,src+start-pos,end-start);
 
-    } // switch
-  } // for-loop
+  pos+=len;
+}
 
-  if(state==0)            // should always end back in state=0
-    return(1);            // return success
+//////////////////////////////////////
+// TLV unpack(tlvBuf, nBytes)
+
+template<class tagType, int maxTags>
+int TLV<tagType, maxTags>::unpack(uint8_t *tlvBuf, int nBytes){
 
   clear();
-  return(0);              // return fail
+
+  for(int i=0;i<nBytes;){
+
+    tlv_t *t=find((tagType)tlvBuf[i++]);
+    if(!t || i==nBytes)                             // return with error if TAG not found or LEN is missing
+      return(unpackFail());
+
+    int n=tlvBuf[i++];
+    if((t->len<0?0:t->len)+n>t->maxLen || i+n>nBytes)     // return with error if VALUE will not fit or is truncated
+      return(unpackFail());
+
+    if(t->len<0){                                   // first (and typically only) fragment for this TAG...
+      t->val=tlvBuf+i;                              // ...so just point to VALUE in tlvBuf without copying
+      t->len=n;
+    } else {                                        // TAG repeats to load more than 255 bytes...
+      uint8_t *v=own(t);
+      if(!v)                                        // return with error if arena cannot be allocated
+        return(unpackFail());
+      if(t->val){                                   // ...and prior fragment is a view into tlvBuf, so move it into arena first
+        memcpy(v,t->val,t->len);
+        t->val=NULL;
+      }
+      memcpy(v+t->len,tlvBuf+i,n);
+      t->len+=n;
+    }
+
+    i+=n;
+  }
+
+  return(1);
 }
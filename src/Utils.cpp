@@ -25,6 +25,9 @@
  *  
  ********************************************************************************/
  
+#include <climits>
+#include <esp_timer.h>
+
 #include "Utils.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -36,6 +39,9 @@
 //
 //  class PushButton        - tracks Single, Double, and Long Presses of a pushbutton that connects a specified pin to ground
 //  class Blinker           - creates customized blinking patterns on an LED connected to a specified pin
+//  class LogBuffer         - lock-free ring buffer that defers log output to Serial until idle time
+//  class Tracer            - ring buffer of timed HAP request phases, exportable as Chrome Trace Event JSON
+//  class RequestStats      - latency histograms, throughput, and free heap for each type of HAP request
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -81,6 +87,63 @@ String Utils::mask(char *c, int n){
   return(s);  
 } // mask
 
+//////////////////////////////////////
+
+boolean Utils::heapAvailable(size_t nBytes){
+
+  const size_t reserve=8192;          // free heap that must remain after allocation (for WiFi, TLS, and other system tasks)
+
+  return(nBytes<heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) && nBytes+reserve<heap_caps_get_free_size(MALLOC_CAP_8BIT));
+}
+
+//////////////////////////////////////
+
+uint32_t Utils::heapLowWater=UINT32_MAX;
+
+void Utils::markHeap(){
+
+  uint32_t heap=ESP.getFreeHeap();
+  if(heap<heapLowWater)
+    heapLowWater=heap;
+}
+
+////////////////////////////////
+//          Backoff           //
+////////////////////////////////
+
+void Backoff::config(uint32_t minDelay, uint32_t maxDelay, uint8_t jitter){
+
+  this->minDelay=minDelay>0?minDelay:1;
+  this->maxDelay=maxDelay>this->minDelay?maxDelay:this->minDelay;
+  this->jitter=jitter<100?jitter:100;
+  reset();
+}
+
+//////////////////////////////////////
+
+uint32_t Backoff::next(uint32_t r){
+
+  uint32_t d=delay;
+  uint32_t span=(uint64_t)d*jitter/100;     // maximum amount by which delay is shortened
+
+  if(span)
+    d-=r%(span+1);
+
+  if(d<minDelay)                            // jitter never shortens delay below minDelay
+    d=minDelay;
+
+  delay=(delay>maxDelay/2)?maxDelay:delay*2;
+  count++;
+  
+  return(d);
+}
+
+//////////////////////////////////////
+
+uint32_t Backoff::next(){
+  return(next(esp_random()));
+}
+
 ////////////////////////////////
 //         PushButton         //
 ////////////////////////////////
@@ -95,18 +158,138 @@ PushButton::PushButton(uint8_t pin){
 
 //////////////////////////////////////
 
+PushButton::~PushButton(){
+  if(edgeSem){
+    detachInterrupt(pin);
+    vSemaphoreDelete(edgeSem);
+  }
+}
+
+//////////////////////////////////////
+
 void PushButton::init(uint8_t pin){
   status=0;
   doubleCheck=false;
   this->pin=pin;
   pinMode(pin, INPUT_PULLUP);
+
+  if(!edgeSem)
+    edgeSem=xSemaphoreCreateBinary();
+
+  flush();
+  attachInterruptArg(pin,isr,this,CHANGE);
+}
+
+//////////////////////////////////////
+
+void IRAM_ATTR PushButton::isr(void *arg){
+
+  // Runs with ESP_INTR_FLAG_IRAM, so it may be called while the flash cache is disabled.  The push is therefore
+  // done inline (the ring and its std::atomic indices need no function calls), and the timestamp and level are
+  // read with esp_timer_get_time() and gpio_get_level(), which are IRAM-resident, rather than millis() and digitalRead().
+
+  PushButton *b=(PushButton *)arg;
+  BaseType_t woken=pdFALSE;
+
+  uint32_t t=b->edgeTail.load(std::memory_order_relaxed);
+  if(t-b->edgeHead.load(std::memory_order_acquire)<(uint32_t)EDGE_QUEUE_SIZE){
+    b->edges[t%EDGE_QUEUE_SIZE]={(uint32_t)(esp_timer_get_time()/1000),!gpio_get_level((gpio_num_t)b->pin)};
+    b->edgeTail.store(t+1,std::memory_order_release);
+  } else {
+    b->overflow=true;
+  }
+    
+  xSemaphoreGiveFromISR(b->edgeSem,&woken);
+  if(woken)
+    portYIELD_FROM_ISR();
+}
+
+//////////////////////////////////////
+
+boolean PushButton::popEdge(edge_t &e){
+
+  uint32_t h=edgeHead.load(std::memory_order_relaxed);
+  if(h==edgeTail.load(std::memory_order_acquire))
+    return(false);
+
+  e=edges[h%EDGE_QUEUE_SIZE];
+  edgeHead.store(h+1,std::memory_order_release);
+  return(true);
+}
+
+//////////////////////////////////////
+
+void PushButton::flush(){
+
+  edge_t e;
+  while(popEdge(e));
+  
+  overflow=false;
+  rawPending=false;
+  havePeek=false;
+  haveEdge=false;
+  pressed=!digitalRead(pin);
+}
+
+//////////////////////////////////////
+
+boolean PushButton::nextEdge(){
+
+  // A raw edge is accepted only once the level it sets has been stable for DEBOUNCE_TIME,
+  // as determined by the timestamp of the following raw edge (if any) or the current time.
+  // Accepted edges that do not change the debounced state are discarded.
+
+  while(1){
+    if(!havePeek){
+      havePeek=popEdge(peek);
+      if(!havePeek && overflow){            // an edge was lost; re-synchronize with the current state of the button
+        overflow=false;
+        peek={(uint32_t)millis(),!digitalRead(pin)};
+        havePeek=true;
+      }
+    }
+
+    if(rawPending && (havePeek?peek.time:millis())-raw.time>=DEBOUNCE_TIME){
+      rawPending=false;
+      if(raw.pressed!=pressed){
+        edge=raw;
+        haveEdge=true;
+        return(true);
+      }
+    }
+
+    if(!havePeek)
+      return(false);
+
+    raw=peek;                               // any raw edge still pending was a bounce and is superseded
+    rawPending=true;
+    havePeek=false;
+  }
 }
 
 //////////////////////////////////////
 
 boolean PushButton::triggered(uint16_t singleTime, uint16_t longTime, uint16_t doubleTime){
 
-  unsigned long cTime=millis();
+  // Each debounced edge is classified at the time it occurred, first with the prior state of the button
+  // (so that any alarms expiring before the edge are processed in order) and then with the new state.
+  // If a trigger occurs before the edge is applied, the edge is retained for the next call.
+
+  while(haveEdge || nextEdge()){
+    if(step(edge.time,singleTime,longTime,doubleTime))
+      return(true);
+    pressed=edge.pressed;
+    haveEdge=false;
+    if(step(edge.time,singleTime,longTime,doubleTime))
+      return(true);
+  }
+
+  return(step(millis(),singleTime,longTime,doubleTime));
+}
+
+//////////////////////////////////////
+
+boolean PushButton::step(uint32_t cTime, uint16_t singleTime, uint16_t longTime, uint16_t doubleTime){
 
   switch(status){
     
@@ -117,7 +300,7 @@ boolean PushButton::triggered(uint16_t singleTime, uint16_t longTime, uint16_t d
         return(true);
       }
       
-      if(!digitalRead(pin)){         // button is pressed
+      if(pressed){                  // button is pressed
         singleAlarm=cTime+singleTime;
         if(!doubleCheck){
           status=1;
@@ -131,7 +314,7 @@ boolean PushButton::triggered(uint16_t singleTime, uint16_t longTime, uint16_t d
   
     case 1:
     case 2:
-      if(digitalRead(pin)){         // button is released          
+      if(!pressed){                 // button is released          
         status=0;
         if(cTime>singleAlarm){
           doubleCheck=true;
@@ -147,7 +330,7 @@ boolean PushButton::triggered(uint16_t singleTime, uint16_t longTime, uint16_t d
     break;
 
     case 3:
-      if(digitalRead(pin))          // button has been released after a long press
+      if(!pressed)                  // button has been released after a long press
         status=0;
       else if(cTime>longAlarm){
         longAlarm=cTime+longTime;
@@ -157,7 +340,7 @@ boolean PushButton::triggered(uint16_t singleTime, uint16_t longTime, uint16_t d
     break;
 
     case 4:    
-      if(digitalRead(pin)){         // button is released          
+      if(!pressed){                 // button is released          
         status=0;
       } else
       
@@ -170,7 +353,7 @@ boolean PushButton::triggered(uint16_t singleTime, uint16_t longTime, uint16_t d
     break;
 
     case 5:
-      if(digitalRead(pin))          // button has been released after double-click
+      if(!pressed)                  // button has been released after double-click
         status=0;
      break;
 
@@ -200,13 +383,174 @@ int PushButton::type(){
 //////////////////////////////////////
 
 void PushButton::wait(){
-  while(!digitalRead(pin));
+  while(!digitalRead(pin))
+    xSemaphoreTake(edgeSem,portMAX_DELAY);        // interrupt handler gives semaphore on every edge
+  delay(DEBOUNCE_TIME);
+  flush();
 }
 
 //////////////////////////////////////
 
 void PushButton::reset(){
   status=0;
+  flush();
+}
+
+////////////////////////////////
+//         SpanTimer          //
+////////////////////////////////
+
+SpanTimer::spanTimer_t SpanTimer::timers[SpanTimer::MAX_TIMERS];
+boolean SpanTimer::configured=false;
+uint64_t SpanTimer::alarm=UINT64_MAX;
+portMUX_TYPE SpanTimer::mux=portMUX_INITIALIZER_UNLOCKED;
+
+//////////////////////////////////////
+
+int SpanTimer::add(callback_t callback, void *arg){
+
+  int id=-1;
+
+  portENTER_CRITICAL(&mux);
+  for(int i=0;i<MAX_TIMERS && id<0;i++){
+    if(!timers[i].callback){
+      timers[i].callback=callback;
+      timers[i].arg=arg;
+      timers[i].active=false;
+      id=i;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+
+  if(id<0){
+    Serial.print("\n*** ERROR: Can't add SpanTimer - all ");
+    Serial.print(MAX_TIMERS);
+    Serial.print(" timers are in use\n\n");
+  }
+
+  return(id);
+}
+
+//////////////////////////////////////
+
+void SpanTimer::remove(int id){
+
+  if(id<0 || id>=MAX_TIMERS)
+    return;
+
+  portENTER_CRITICAL(&mux);
+  timers[id].active=false;
+  timers[id].callback=NULL;
+  portEXIT_CRITICAL(&mux);
+}
+
+//////////////////////////////////////
+
+void SpanTimer::start(int id, uint32_t delay){
+
+  if(id<0 || id>=MAX_TIMERS || !timers[id].callback)
+    return;
+
+  if(!configured){                          // configure Alarm Timer on first use
+    timer_config_t conf;
+    conf.alarm_en=TIMER_ALARM_EN;
+    conf.counter_en=TIMER_PAUSE;
+    conf.intr_type=TIMER_INTR_LEVEL;
+    conf.counter_dir=TIMER_COUNT_UP;
+    conf.auto_reload=TIMER_AUTORELOAD_DIS;  // counter runs freely; each alarm is set to the absolute time of the next expiration
+    conf.divider=80;                        // 80 MHz clock / 80 = 1 MHz clock (1 us pulses)
+
+    timer_init(TIMER_GROUP_0,TIMER_0,&conf);
+    timer_set_counter_value(TIMER_GROUP_0,TIMER_0,0);
+    timer_isr_register(TIMER_GROUP_0,TIMER_0,SpanTimer::isr,NULL,0,NULL);
+    timer_enable_intr(TIMER_GROUP_0,TIMER_0);
+    timer_start(TIMER_GROUP_0,TIMER_0);
+    configured=true;
+  }
+
+  portENTER_CRITICAL(&mux);
+  timers[id].due=now()+delay;
+  timers[id].active=true;
+  if(timers[id].due<alarm)
+    arm(timers[id].due);
+  portEXIT_CRITICAL(&mux);
+}
+
+//////////////////////////////////////
+
+void SpanTimer::stop(int id){
+
+  if(id<0 || id>=MAX_TIMERS)
+    return;
+
+  portENTER_CRITICAL(&mux);
+  timers[id].active=false;                  // alarm is left as is - if it fires, isr() simply finds nothing to do
+  portEXIT_CRITICAL(&mux);
+}
+
+//////////////////////////////////////
+
+uint64_t SpanTimer::service(uint64_t t){
+
+  uint64_t next=UINT64_MAX;
+
+  for(int i=0;i<MAX_TIMERS;i++){
+    spanTimer_t *st=timers+i;
+    if(!st->callback || !st->active)
+      continue;
+      
+    if(st->due<=t){
+      uint32_t delay=st->callback(st->arg);
+      if(delay==0){
+        st->active=false;
+        continue;
+      }
+      st->due+=delay;                       // schedule from when timer was due, not when it was serviced, to avoid drift
+      if(st->due<=t)                        // timer has fallen behind by more than one period - skip missed expirations
+        st->due=t+delay;
+    }
+
+    if(st->due<next)
+      next=st->due;
+  }
+
+  return(next);
+}
+
+//////////////////////////////////////
+
+uint64_t SpanTimer::now(){
+
+  uint64_t t;
+  timer_get_counter_value(TIMER_GROUP_0,TIMER_0,&t);
+  return(t);
+}
+
+//////////////////////////////////////
+
+void SpanTimer::arm(uint64_t due){
+
+  uint64_t t=now()+MIN_DELAY;               // alarm only fires when counter reaches alarm value, so never program a time that may have already passed
+  if(due<t)
+    due=t;
+
+  alarm=due;
+  timer_set_alarm_value(TIMER_GROUP_0,TIMER_0,due);
+  timer_set_alarm(TIMER_GROUP_0,TIMER_0,TIMER_ALARM_EN);
+}
+
+//////////////////////////////////////
+
+void SpanTimer::isr(void *arg){
+
+  TIMERG0.int_clr_timers.t0=1;
+
+  portENTER_CRITICAL_ISR(&mux);
+  alarm=UINT64_MAX;
+  uint64_t next=service(now());
+  if(next!=UINT64_MAX)
+    arm(next);
+  portEXIT_CRITICAL_ISR(&mux);
 }
 
 ////////////////////////////////
@@ -229,56 +573,32 @@ void Blinker::init(int pin, int timerNum){
   pinMode(pin,OUTPUT);
   digitalWrite(pin,0);
 
-  group=((timerNum/2)%2==0)?TIMER_GROUP_0:TIMER_GROUP_1;
-  idx=(timerNum%2==0)?TIMER_0:TIMER_1;  
-
-  timer_config_t conf;
-  conf.alarm_en=TIMER_ALARM_EN;
-  conf.counter_en=TIMER_PAUSE;
-  conf.intr_type=TIMER_INTR_LEVEL;
-  conf.counter_dir=TIMER_COUNT_UP;
-  conf.auto_reload=TIMER_AUTORELOAD_EN;
-  conf.divider=8000;                      // 80 MHz clock / 8,000 = 10 kHz clock (0.1 ms pulses)
-
-  timer_init(group,idx,&conf);
-  timer_isr_register(group,idx,Blinker::isrTimer,(void *)this,0,NULL);
-  timer_enable_intr(group,idx);
-
+  if(timerId<0)
+    timerId=SpanTimer::add(Blinker::isrTimer,(void *)this);
 }
 
 //////////////////////////////////////
 
-void Blinker::isrTimer(void *arg){
+uint32_t Blinker::isrTimer(void *arg){
 
   Blinker *b=(Blinker *)arg;
+  int next;
   
-  if(b->group){
-    if(b->idx)
-      TIMERG1.int_clr_timers.t1=1;
-    else
-      TIMERG1.int_clr_timers.t0=1;
-  } else {
-    if(b->idx)
-      TIMERG0.int_clr_timers.t1=1;
-    else
-      TIMERG0.int_clr_timers.t0=1;    
-  }
-
   if(!digitalRead(b->pin)){
     digitalWrite(b->pin,1);
-    timer_set_alarm_value(b->group,b->idx,b->onTime);
+    next=b->onTime;
     b->count--;
   } else {
     digitalWrite(b->pin,0);    
     if(b->count){
-      timer_set_alarm_value(b->group,b->idx,b->offTime);
+      next=b->offTime;
     } else {
-      timer_set_alarm_value(b->group,b->idx,b->delayTime);
+      next=b->delayTime;
       b->count=b->nBlinks;      
     }
   }
   
-  timer_set_alarm(b->group,b->idx,TIMER_ALARM_EN);
+  return(next>0?next:1);                  // a delay of 0 would stop the timer
 }
 
 //////////////////////////////////////
@@ -292,21 +612,19 @@ void Blinker::start(int period, float dutyCycle){
 
 void Blinker::start(int period, float dutyCycle, int nBlinks, int delayTime){
 
-  period*=10;
+  period*=1000;
   onTime=dutyCycle*period;
   offTime=period-onTime;
-  this->delayTime=delayTime*10+offTime;
+  this->delayTime=delayTime*1000+offTime;
   this->nBlinks=nBlinks;
   count=nBlinks;
-  timer_set_counter_value(group,idx,0);
-  timer_set_alarm_value(group,idx,0);  
-  timer_start(group,idx);
+  SpanTimer::start(timerId,0);
 }
 
 //////////////////////////////////////
 
 void Blinker::stop(){
-  timer_pause(group,idx);  
+  SpanTimer::stop(timerId);
 }
 
 //////////////////////////////////////
@@ -322,3 +640,240 @@ void Blinker::off(){
   stop();
   digitalWrite(pin,0);
 }
+
+////////////////////////////////
+//         LogBuffer          //
+////////////////////////////////
+
+LogBuffer::LogBuffer(uint32_t nBytes){
+
+  for(size=2;size*SLOT_DATA<nBytes;size*=2);      // round up to power of 2 so running counts can wrap freely
+  
+  slots=new slot_t[size];
+  for(uint32_t i=0;i<size;i++)
+    slots[i].seq=i;
+  reserved=0;
+  consumed=0;
+  dropped=0;
+}
+
+//////////////////////////////////////
+
+size_t LogBuffer::write(uint8_t c){
+  return(write(&c,1));
+}
+
+//////////////////////////////////////
+
+size_t LogBuffer::write(const uint8_t *data, size_t n){
+
+  if(n==0)
+    return(0);
+
+  uint32_t nSlots=(n+SLOT_DATA-1)/SLOT_DATA;
+  uint32_t start=reserved.load();
+
+  do {
+    uint32_t last=start+nSlots-1;           // slots are freed by drain() in order, so if last slot needed is free, all prior ones are as well
+    if(nSlots>size || (int32_t)(slots[last&(size-1)].seq.load()-last)<0){      // not enough room - drop output rather than wait
+      dropped+=n;
+      return(n);
+    }
+  } while(!reserved.compare_exchange_weak(start,start+nSlots));     // reserve nSlots starting at start (start is reloaded if another writer got there first)
+
+  for(uint32_t i=0;i<nSlots;i++){
+    slot_t *slot=slots+((start+i)&(size-1));
+    int len=n-i*SLOT_DATA;
+    slot->len=len>SLOT_DATA?SLOT_DATA:len;
+    memcpy(slot->data,data+i*SLOT_DATA,slot->len);
+    slot->seq.store(start+i+1);             // publish slot
+  }
+
+  return(n);
+}
+
+//////////////////////////////////////
+
+void LogBuffer::drain(HardwareSerial &out, boolean block){
+
+  int room=block?INT_MAX:out.availableForWrite();       // number of bytes that can be sent without waiting
+
+  for(;;){
+    slot_t *slot=slots+(consumed&(size-1));
+
+    if(slot->seq.load()!=consumed+1 || slot->len>room)  // slot not yet written, or no room to send it without waiting
+      break;
+
+    out.write((uint8_t *)slot->data,slot->len);
+    room-=slot->len;
+    slot->seq.store(consumed+size);                     // free slot for next pass around ring
+    consumed++;
+  }
+
+  if(dropped.load() && slots[consumed&(size-1)].seq.load()!=consumed+1){   // buffer is empty
+    out.printf("\n*** WARNING: %u bytes of log output dropped (log buffer full)\n",dropped.exchange(0));
+  }
+}
+
+////////////////////////////////
+//          Tracer            //
+////////////////////////////////
+
+Tracer::Tracer(uint32_t nEvents){
+
+  size=nEvents;
+  events=(event_t *)calloc(size,sizeof(event_t));
+  count=0;
+}
+
+//////////////////////////////////////
+
+void Tracer::add(uint8_t phase, uint8_t conNum, uint32_t start, uint32_t aid){
+
+  event_t *e=events+(count++)%size;         // claim next slot (overwriting oldest event if buffer is full)
+
+  e->start=start;
+  e->duration=micros()-start;
+  e->aid=aid;
+  e->phase=phase;
+  e->conNum=conNum;
+}
+
+//////////////////////////////////////
+
+void Tracer::print(Print &out){
+
+  const char *names[]={"read","decrypt","parse","find","update","serialize","encrypt","write"};
+
+  uint32_t n=count.load();
+  uint32_t first=n>size?n-size:0;
+
+  out.print("{\"traceEvents\":[\n");
+  
+  for(uint32_t i=first;i<n;i++){
+    event_t *e=events+i%size;
+    out.printf("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%u,\"dur\":%u",names[e->phase],e->conNum,e->start,e->duration);
+    if(e->phase==UPDATE)
+      out.printf(",\"args\":{\"aid\":%u}",e->aid);
+    out.print(i+1<n?"},\n":"}\n");
+  }
+
+  out.print("],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+//////////////////////////////////////
+
+void Tracer::clear(){
+  count=0;
+}
+
+////////////////////////////////
+//        RequestStats        //
+////////////////////////////////
+
+int RequestStats::bin(uint32_t t){
+
+  if(t<4)
+    return(t);
+
+  int n=31-__builtin_clz(t);              // position of highest bit set (n>=2)
+  int b=4*(n-1)+((t>>(n-2))&3);           // 4 bins per power of 2, selected by the next two highest bits
+
+  return(b<N_BINS?b:N_BINS-1);
+}
+
+//////////////////////////////////////
+
+uint32_t RequestStats::binLimit(int b){
+
+  if(b<4)
+    return(b+1);
+
+  return((5+b%4)<<(b/4-1));
+}
+
+//////////////////////////////////////
+
+uint32_t RequestStats::percentile(stat_t *s, int p){
+
+  uint32_t target=(s->count*p+99)/100;    // number of requests at or below percentile p (rounded up)
+  uint32_t n=0;
+
+  for(int b=0;b<N_BINS;b++){
+    n+=s->bins[b];
+    if(n>=target)
+      return(binLimit(b)<s->max?binLimit(b):s->max);
+  }
+
+  return(s->max);
+}
+
+//////////////////////////////////////
+
+void RequestStats::begin(){
+
+  startHeap=ESP.getFreeHeap();
+  startStack=uxTaskGetStackHighWaterMark(NULL);
+  Utils::heapLowWater=startHeap;
+}
+
+//////////////////////////////////////
+
+void RequestStats::add(uint8_t type, uint32_t start){
+
+  uint32_t t=micros()-start;
+  Utils::markHeap();
+  uint32_t heap=ESP.getFreeHeap();
+  uint32_t stack=uxTaskGetStackHighWaterMark(NULL);
+  stat_t *s=stats+type;
+
+  s->count++;
+  s->total+=t;
+  s->bins[bin(t)]++;
+  if(t>s->max)
+    s->max=t;
+  if(heap<s->minHeap)
+    s->minHeap=heap;
+  if(startHeap>Utils::heapLowWater && startHeap-Utils::heapLowWater>s->peakHeap)
+    s->peakHeap=startHeap-Utils::heapLowWater;
+  if(stack<startStack && stack<s->minStack)        // this request lowered the high-water mark
+    s->minStack=stack;
+}
+
+//////////////////////////////////////
+
+void RequestStats::print(Print &out){
+
+  const char *names[]={"POST /pair-setup","POST /pair-verify","POST /pairings","GET /accessories","GET /characteristics","PUT /characteristics","PUT /prepare","EVENT","Other/Error"};
+  char d[]="------------------------------";
+
+  float elapsed=(millis()-startTime)/1000.0;
+
+  out.printf("Elapsed Time: %.1f sec   Free Heap: %u   Min Free Heap Since Boot: %u   Unused Stack: %u\n\n",elapsed,ESP.getFreeHeap(),ESP.getMinFreeHeap(),uxTaskGetStackHighWaterMark(NULL));
+  out.printf("%-20s  %8s  %10s  %10s  %10s  %10s  %8s  %8s  %8s  %9s  %9s\n","Request","Count","Mean (us)","p50 (us)","p99 (us)","Max (us)","Req/sec","Max/sec","Min Heap","Peak Heap","Min Stack");
+  out.printf("%.20s  %.8s  %.10s  %.10s  %.10s  %.10s  %.8s  %.8s  %.8s  %.9s  %.9s\n",d,d,d,d,d,d,d,d,d,d,d);
+
+  for(int i=0;i<N_TYPES;i++){
+    stat_t *s=stats+i;
+    if(!s->count)
+      continue;
+    out.printf("%-20s  %8u  %10u  %10u  %10u  %10u  %8.1f  %8.1f  %8u  %9u  ",names[i],s->count,(uint32_t)(s->total/s->count),
+               percentile(s,50),percentile(s,99),s->max,elapsed>0?s->count/elapsed:0,s->total?s->count*1.0e6/s->total:0,s->minHeap,s->peakHeap);
+    if(s->minStack==UINT32_MAX)
+      out.printf("%9s\n","-");
+    else
+      out.printf("%9u\n",s->minStack);
+  }
+}
+
+//////////////////////////////////////
+
+void RequestStats::clear(){
+
+  memset(stats,0,sizeof(stats));
+  for(int i=0;i<N_TYPES;i++){
+    stats[i].minHeap=UINT32_MAX;
+    stats[i].minStack=UINT32_MAX;
+  }
+  startTime=millis();
+}
@@ -29,11 +29,17 @@
 
 #include <Arduino.h>
 #include <driver/timer.h>
+#include <driver/gpio.h>
+#include <atomic>
 
 namespace Utils {
 
 char *readSerial(char *c, int max);   // read serial port into 'c' until <newline>, but storing only first 'max' characters (the rest are discarded)
 String mask(char *c, int n);          // simply utility that creates a String from 'c' with all except the first and last 'n' characters replaced by '*'
+boolean heapAvailable(size_t nBytes); // returns true if a single block of 'nBytes' can be allocated while still leaving a minimum reserve of free heap
+void markHeap();                      // records current free heap if lower than heapLowWater
+
+extern uint32_t heapLowWater;         // lowest free heap recorded by markHeap() since last reset (used by RequestStats)
   
 }
 
@@ -55,6 +61,7 @@ struct TempBuffer {
       Serial.print(" bytes failed.  Program Halting.\n\n");
       while(1);
     }
+    Utils::markHeap();
    }
 
   ~TempBuffer(){
@@ -67,11 +74,106 @@ struct TempBuffer {
   
 };
 
+/////////////////////////////////////////////////
+// Lock-free, fixed-size, single-producer/single-
+// consumer queue for passing items between tasks
+
+template <class itemType>
+class SpanQueue {
+  itemType *items;
+  uint32_t size;
+  std::atomic<uint32_t> head;       // running count of items popped (written only by consumer)
+  std::atomic<uint32_t> tail;       // running count of items pushed (written only by producer)
+
+  public:
+
+  SpanQueue(uint32_t n) : size{n}, head{0}, tail{0} {
+    items=new itemType[n];
+  }
+
+  ~SpanQueue(){
+    delete [] items;
+  }
+
+  boolean push(const itemType &item){     // adds item to queue; returns false if queue is full.  Call only from producer task
+    uint32_t t=tail.load(std::memory_order_relaxed);
+    if(t-head.load(std::memory_order_acquire)==size)
+      return(false);
+    items[t%size]=item;
+    tail.store(t+1,std::memory_order_release);
+    return(true);
+  }
+
+  boolean pop(itemType &item){            // removes oldest item from queue into item; returns false if queue is empty.  Call only from consumer task
+    uint32_t h=head.load(std::memory_order_relaxed);
+    if(h==tail.load(std::memory_order_acquire))
+      return(false);
+    item=items[h%size];
+    head.store(h+1,std::memory_order_release);
+    return(true);
+  }
+  
+};
+
+////////////////////////////////
+//          Backoff           //
+////////////////////////////////
+
+class Backoff {
+
+  uint32_t minDelay;        // first delay after reset (in ms)
+  uint32_t maxDelay;        // maximum delay (in ms)
+  uint8_t jitter;           // percentage (0-100) by which each delay is randomly shortened
+  uint32_t delay;           // delay (before jitter) to return on next call to next()
+  uint32_t count;           // number of delays returned since last reset
+
+  public:
+
+  Backoff(uint32_t minDelay, uint32_t maxDelay, uint8_t jitter){config(minDelay,maxDelay,jitter);}
+
+//  Creates an exponential backoff policy that starts at minDelay milliseconds and doubles on each
+//  call to next(), up to maxDelay milliseconds.  Each delay is shortened by a random amount of up to
+//  jitter percent (but never below minDelay), so that many devices losing the same network do not all
+//  retry in lock-step.
+
+  void config(uint32_t minDelay, uint32_t maxDelay, uint8_t jitter);
+
+//  Re-configures policy (see above) and resets it
+
+  void reset(){delay=minDelay;count=0;}
+
+//  Resets policy so that next delay is minDelay
+
+  uint32_t next(uint32_t r);
+  uint32_t next();
+
+//  Returns next delay (in ms), and doubles the delay for the following call.  In the first form, jitter
+//  is determined by r, which should be a uniformly-distributed random number.  In the second form, r is
+//  generated by the ESP32 hardware random number generator.
+
+  uint32_t attempts(){return(count);}
+
+//  Returns the number of delays returned since last reset
+
+  boolean atMax(){return(delay>=maxDelay);}
+
+//  Returns true if policy has reached maxDelay
+
+};
+
 ////////////////////////////////
 //         PushButton         //
 ////////////////////////////////
 
 class PushButton{
+
+  struct edge_t {
+    uint32_t time;                  // time (in ms) of edge
+    boolean pressed;                // true if button was pressed, false if released
+  };
+
+  static const int EDGE_QUEUE_SIZE=16;        // maximum number of edges that can be waiting to be processed
+  static const uint32_t DEBOUNCE_TIME=5;      // minimum time (in ms) a new level must be stable before it is accepted
   
   int status;
   uint8_t pin;
@@ -81,6 +183,25 @@ class PushButton{
   uint32_t longAlarm;
   int pressType;
 
+  edge_t edges[EDGE_QUEUE_SIZE];              // ring of raw edges timestamped by interrupt handler
+  std::atomic<uint32_t> edgeHead{0};          // index of next edge to pop (advanced only by nextEdge/flush)
+  std::atomic<uint32_t> edgeTail{0};          // index of next edge to push (advanced only by interrupt handler)
+  SemaphoreHandle_t edgeSem=NULL;             // given by interrupt handler on every edge
+  volatile boolean overflow=false;            // true if an edge was lost because queue was full
+  boolean pressed;                            // debounced state of button
+  boolean rawPending;                         // true if raw edge is waiting to be debounced
+  edge_t raw;                                 // raw edge waiting to be debounced
+  boolean havePeek;                           // true if peek holds next raw edge
+  edge_t peek;                                // next raw edge, popped from queue to check if raw edge was a bounce
+  boolean haveEdge;                           // true if debounced edge is waiting to be classified
+  edge_t edge;                                // debounced edge waiting to be classified
+
+  static void isr(void *arg);                 // timestamps edges and adds them to ring (IRAM-safe: no flash-resident calls)
+  boolean popEdge(edge_t &e);                 // pops oldest raw edge from ring; returns false if ring is empty
+  boolean nextEdge();                         // debounces raw edges into edge; returns false if no debounced edge is available
+  boolean step(uint32_t cTime, uint16_t singleTime, uint16_t longTime, uint16_t doubleTime);     // advances press classifier to cTime; returns true if triggered
+  void flush();                               // discards queued edges and re-reads state of button
+
   public:
 
   enum {
@@ -91,6 +212,7 @@ class PushButton{
   
   PushButton();
   PushButton(uint8_t pin);
+  ~PushButton();
 
 //  Creates generic pushbutton functionality on specified pin
 //  that is wired to connect to ground when the button is pressed.
@@ -146,7 +268,73 @@ class PushButton{
 
   void wait();
 
-//  Waits for button to be released.  Use after Long Press if button release confirmation is desired
+//  Waits (without polling) for button to be released.  Use after Long Press if button release confirmation is desired
+
+};
+
+////////////////////////////////
+//         SpanTimer          //
+////////////////////////////////
+
+// A pool of software timers multiplexed onto a single ESP32 Alarm Timer (Group0/Timer0), so that
+// any number of Blinkers and other periodic tasks can run in the background without each
+// requiring one of the ESP32's four hardware Alarm Timers.
+
+class SpanTimer {
+
+  public:
+  
+  typedef uint32_t (*callback_t)(void *arg);      // called from interrupt context when timer expires; returns delay (in microseconds) until next call, or 0 to stop timer
+
+  private:
+
+  static const int MAX_TIMERS=16;                 // number of software timers in pool
+  static const uint32_t MIN_DELAY=20;             // minimum time (in microseconds) between programming alarm and alarm firing
+  
+  struct spanTimer_t {
+    callback_t callback;                          // function called when timer expires (NULL if timer is free)
+    void *arg;                                    // argument passed to callback
+    uint64_t due;                                 // time (in microseconds since pool started) when timer expires
+    boolean active;                               // true if timer is running
+  };
+
+  static spanTimer_t timers[MAX_TIMERS];
+  static boolean configured;
+  static uint64_t alarm;                          // time currently programmed into Alarm Timer (UINT64_MAX if none)
+  static portMUX_TYPE mux;                        // protects pool, which is shared with interrupt
+
+  static void isr(void *arg);
+  static void arm(uint64_t due);                  // programs Alarm Timer to fire at due (call with mux held)
+  static uint64_t now();                          // returns current time (in microseconds since pool started)
+
+  public:
+
+  static int add(callback_t callback, void *arg);
+
+//  Reserves a timer in the pool that calls callback(arg) when it expires.  Returns timer id,
+//  or -1 if all timers are in use.  Timer is initially stopped.  Callbacks run in interrupt context,
+//  must be short, and must not call other SpanTimer functions (instead, return the delay until the
+//  next call, or 0 to stop the timer).
+
+  static void remove(int id);
+
+//  Stops timer id and returns it to the pool
+
+  static void start(int id, uint32_t delay);
+
+//  Starts (or re-starts) timer id so that it expires delay microseconds from now.  The timer then
+//  repeats as determined by the return value of its callback, without drifting.
+
+  static void stop(int id);
+
+//  Stops timer id
+
+  static uint64_t service(uint64_t t);
+
+//  Calls the callback of every running timer that has expired by time t, reschedules or stops
+//  each according to the callback's return value, and returns the time of the next expiration
+//  (UINT64_MAX if no timers are running).  This is the scheduling core used by the interrupt handler,
+//  and only depends on the time it is given.
 
 };
 
@@ -156,8 +344,7 @@ class PushButton{
 
 class Blinker {
   
-  timer_group_t group;
-  timer_idx_t idx;
+  int timerId=-1;
   int pin;
 
   int nBlinks;
@@ -166,7 +353,7 @@ class Blinker {
   int delayTime;
   int count;
 
-  static void isrTimer(void *arg); 
+  static uint32_t isrTimer(void *arg); 
 
   public:
 
@@ -174,7 +361,7 @@ class Blinker {
   Blinker(int pin, int timerNum=0);
 
 //  Creates a generic blinking LED on specified pin controlled
-//  in background via interrupts generated by an ESP32 Alarm Timer.
+//  in background via interrupts generated by a SpanTimer.
 //
 //  In the first form, a Blinker is instantiated without specifying
 //  the pin.  In this case the pin must be specified in a subsequent call 
@@ -184,14 +371,14 @@ class Blinker {
 //  the specified pin, obviating the need for a separate call to init().
 //
 //  pin:         Pin mumber to control.  Blinker will set pinMode to OUTPUT automatically 
-//  timerNum:    ESP32 Alarm Timer to use. 0=Group0/Timer0, 1=Group0/Timer1, 2=Group1/Timer0, 3=Group1/Timer1
+//  timerNum:    Ignored.  Retained for compatibility (all Blinkers now share a single ESP32 Alarm Timer through SpanTimer)
     
   void init(int pin, int timerNum=0);
 
 //  Initializes Blinker, if not configured during instantiation.
 //
 //  pin:         Pin mumber to control.  Blinker will set pinMode to OUTPUT automatically 
-//  timerNum:    ESP32 Alarm Timer to use. 0=Group0/Timer0, 1=Group0/Timer1, 2=Group1/Timer0, 3=Group1/Timer1
+//  timerNum:    Ignored.  Retained for compatibility (all Blinkers now share a single ESP32 Alarm Timer through SpanTimer)
 
   void start(int period, float dutyCycle=0.5);
     
@@ -222,3 +409,170 @@ class Blinker {
 //  Stops current blinking pattern and turns off LED
 
 };
+
+////////////////////////////////
+//         LogBuffer          //
+////////////////////////////////
+
+class LogBuffer : public Print {
+
+  static const int SLOT_DATA=27;      // number of bytes of output stored in each slot
+
+  struct slot_t {
+    std::atomic<uint32_t> seq;        // equals running slot number once slot is free to be written, and running slot number+1 once written (and therefore readable)
+    uint8_t len;                      // number of bytes of output in slot
+    char data[SLOT_DATA];             // output
+  };
+
+  slot_t *slots;                      // ring buffer storage
+  uint32_t size;                      // number of slots in ring buffer (always a power of 2)
+  std::atomic<uint32_t> reserved;     // running count of slots reserved by writers
+  uint32_t consumed;                  // running count of slots drained (only accessed by drain())
+  std::atomic<uint32_t> dropped;      // number of bytes dropped since last drain because buffer was full
+
+  public:
+
+  LogBuffer(uint32_t nBytes);
+
+//  Creates a lock-free ring buffer of at least nBytes (rounded up to a power of 2) that can
+//  be used as the target of any print() or printf() call in place of Serial.  Writers never block
+//  on the UART: formatting happens immediately, but output is only copied into the buffer, and
+//  is later sent to Serial by drain().  Any number of tasks, as well as interrupts, may write concurrently
+//  without ever waiting on each other: each write reserves its own run of slots, and each slot is
+//  published separately once filled.  If the buffer is full, new output is dropped (and counted) rather
+//  than waiting for space.
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *data, size_t n) override;
+
+  void drain(HardwareSerial &out, boolean block=false);
+
+//  Sends buffered output to out (typically Serial).  If block=false, sends only as many bytes as can be written to
+//  Serial without waiting (i.e. out.availableForWrite()), so it is safe to call every poll.  If
+//  block=true, sends everything in buffer.  Output is sent in the order it was reserved, so sending stops at
+//  any slot a writer has not yet finished filling, and resumes at next drain().  Must be called from only one task.
+  
+};
+
+////////////////////////////////
+//          Tracer            //
+////////////////////////////////
+
+class Tracer {
+
+  public:
+
+  enum {                  // phases of a HAP request that are traced
+    READ=0,
+    DECRYPT=1,
+    PARSE=2,
+    FIND=3,
+    UPDATE=4,
+    SERIALIZE=5,
+    ENCRYPT=6,
+    WRITE=7
+  };
+
+  private:
+  
+  struct event_t {
+    uint32_t start;         // start time of phase (in micros)
+    uint32_t duration;      // duration of phase (in micros)
+    uint32_t aid;           // aid of Accessory (for UPDATE phases only)
+    uint8_t phase;          // phase
+    uint8_t conNum;         // HAP connection number
+  };
+
+  event_t *events;                  // ring buffer of events
+  uint32_t size;                    // number of events in ring buffer
+  std::atomic<uint32_t> count;      // running count of events added
+
+  public:
+
+  Tracer(uint32_t nEvents);
+
+//  Creates a fixed-size ring buffer that stores the most recent nEvents timed phases of HAP requests.
+
+  void add(uint8_t phase, uint8_t conNum, uint32_t start, uint32_t aid=0);
+
+//  Adds an event for phase of request on connection conNum that started at time start (in micros) and 
+//  ended now.  For UPDATE phases, aid is the Accessory whose Service was updated.
+
+  void print(Print &out);
+
+//  Prints all events in ring buffer, oldest first, to out in Chrome Trace Event JSON format,
+//  suitable for loading directly into chrome://tracing or https://ui.perfetto.dev 
+
+  void clear();
+
+//  Clears all events
+
+};
+
+////////////////////////////////
+//        RequestStats        //
+////////////////////////////////
+
+class RequestStats {
+
+  public:
+
+  enum {                  // types of HAP requests that are tracked
+    PAIR_SETUP=0,
+    PAIR_VERIFY=1,
+    PAIRINGS=2,
+    ACCESSORIES=3,
+    GET_CHARACTERISTICS=4,
+    PUT_CHARACTERISTICS=5,
+    PUT_PREPARE=6,
+    EVENT=7,
+    OTHER=8,
+    N_TYPES=9
+  };
+
+  private:
+
+  static const int N_BINS=96;       // latency histogram uses 4 bins per power of 2, covering 0 to ~16 seconds
+
+  struct stat_t {
+    uint32_t count;                 // number of requests
+    uint64_t total;                 // total time spent processing requests (in micros)
+    uint32_t max;                   // longest request (in micros)
+    uint32_t minHeap;               // lowest free heap seen at the end of a request
+    uint32_t peakHeap;              // largest drop in free heap seen during a request
+    uint32_t minStack;              // lowest stack high-water mark (i.e. least unused stack) reached during a request
+    uint32_t bins[N_BINS];          // latency histogram
+  };
+
+  stat_t stats[N_TYPES];
+  uint32_t startTime;               // time (in millis) stats were last cleared
+  uint32_t startHeap;               // free heap at start of current request
+  uint32_t startStack;              // stack high-water mark at start of current request
+
+  static int bin(uint32_t t);       // returns histogram bin for time t (in micros)
+  static uint32_t binLimit(int b);  // returns upper limit (in micros) of histogram bin b
+  uint32_t percentile(stat_t *s, int p);
+
+  public:
+
+  RequestStats(){clear();}
+
+  void begin();
+
+//  Records free heap and stack high-water mark at the start of a request
+
+  void add(uint8_t type, uint32_t start);
+
+//  Adds a request of type that started at time start (in micros) and ended now.  Peak heap usage is measured
+//  from the free heap recorded in begin() to the lowest free heap recorded by any TempBuffer allocation made
+//  during the request.  Stack usage is only attributed to a request if it lowered the task's high-water mark.
+
+  void print(Print &out);
+
+//  Prints a table of count, mean, p50, p99 and max latency, throughput, and heap and stack usage for each type of request
+
+  void clear();
+
+//  Clears all stats
+
+};
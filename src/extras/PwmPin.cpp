@@ -1,34 +1,270 @@
 
-#include "PwmPin.h"
 #include <Arduino.h>
 
-PwmPin::PwmPin(uint8_t channel, uint8_t pin){
+#include "PwmPin.h"
+
+PwmPin::pwmTimer_t PwmPin::timers[2][PwmPin::NUM_TIMERS];
+
+///////////////////
+
+PwmPin::PwmPin(uint8_t channel, uint8_t pin, uint32_t freq, uint8_t resolution){
   this->channel=channel & 0x0F;
   this->pin=pin;
 
-  ledc_timer_config_t ledTimer;
-  ledTimer.timer_num=LEDC_TIMER_0;
-  ledTimer.speed_mode=(this->channel)<8?LEDC_HIGH_SPEED_MODE:LEDC_LOW_SPEED_MODE;
-  ledTimer.duty_resolution=LEDC_TIMER_10_BIT;
-  ledTimer.freq_hz=5000;
-  ledc_timer_config(&ledTimer);
-
   ledChannel.gpio_num=pin;
   ledChannel.speed_mode=(this->channel)<8?LEDC_HIGH_SPEED_MODE:LEDC_LOW_SPEED_MODE;
   ledChannel.channel=(ledc_channel_t)(this->channel&0x07);
   ledChannel.intr_type=LEDC_INTR_DISABLE;
-  ledChannel.timer_sel=LEDC_TIMER_0;
   ledChannel.duty=0;
   ledChannel.hpoint=0;
+
+  uint8_t res=solveResolution(freq,resolution);
+
+  if(res==0){
+    Serial.print("\n*** ERROR: Can't create PWM Pin on pin ");
+    Serial.print(pin);
+    Serial.print(" - frequency of ");
+    Serial.print(freq);
+    Serial.print(" Hz is out of range\n\n");
+    return;
+  }
+
+  if(resolution && res!=resolution){
+    Serial.print("\n*** WARNING: PWM Pin on pin ");
+    Serial.print(pin);
+    Serial.print(" - resolution of ");
+    Serial.print(resolution);
+    Serial.print(" bits not supported at ");
+    Serial.print(freq);
+    Serial.print(" Hz.  Using ");
+    Serial.print(res);
+    Serial.print(" bits instead\n\n");
+  }
+
+  pwmTimer_t *t=timers[ledChannel.speed_mode];
+  int n=allocTimer(ledChannel.speed_mode,freq,res);
+
+  if(n<0){
+    Serial.print("\n*** ERROR: Can't create PWM Pin on pin ");
+    Serial.print(pin);
+    Serial.print(" - all ");
+    Serial.print(NUM_TIMERS);
+    Serial.print(ledChannel.speed_mode==LEDC_HIGH_SPEED_MODE?" High-Speed":" Low-Speed");
+    Serial.print(" timers are in use with other frequencies or resolutions\n\n");
+    return;
+  }
+
+  if(t[n].nUsers==0){                                 // configure timer if not already in use
+    ledc_timer_config_t ledTimer;
+    ledTimer.timer_num=(ledc_timer_t)n;
+    ledTimer.speed_mode=ledChannel.speed_mode;
+    ledTimer.duty_resolution=(ledc_timer_bit_t)res;
+    ledTimer.freq_hz=freq;
+    ledc_timer_config(&ledTimer);
+    t[n].freq=freq;
+    t[n].resolution=res;
+  }
+
+  t[n].nUsers++;
+  timer=n;
+  this->freq=freq;
+  this->resolution=res;
+  setGamma(1.0);
+
+  ledChannel.timer_sel=(ledc_timer_t)n;
+  ledc_channel_config(&ledChannel);                   // configure channel once; duty is updated directly thereafter
   
 }
 
+///////////////////
+
+PwmPin::~PwmPin(){
+
+  if(fadeTimer){
+    portENTER_CRITICAL(&fadeMux);
+    fading=false;                                     // fadeStep() does not re-arm timer once fading is cleared
+    portEXIT_CRITICAL(&fadeMux);
+    esp_timer_stop(fadeTimer);
+    esp_timer_delete(fadeTimer);
+  }
+
+  if(timer>=0){
+    setDuty(0);
+    timers[ledChannel.speed_mode][timer].nUsers--;
+  }
+}
+
+///////////////////
+
+uint8_t PwmPin::solveResolution(uint32_t freq, uint8_t resolution){
+
+  // The timer divides LEDC_CLK by a divider with a 10-bit integer part (and an 8-bit fractional part)
+  // to produce a counter clock of freq*2^resolution, so a resolution is only possible if 1 <= divider < 1024
+
+  if(freq==0 || resolution>16)
+    return(0);
+
+  int maxRes=0;
+  while(maxRes<16 && ((uint64_t)freq<<(maxRes+1))<=LEDC_CLK)      // highest resolution for which divider >= 1
+    maxRes++;
+
+  if(maxRes==0)
+    return(0);
+
+  int res=(resolution==0 || resolution>maxRes)?maxRes:resolution;
+
+  while(res<maxRes && ((uint64_t)freq<<res)*1024<=LEDC_CLK)       // increase resolution until divider < 1024
+    res++;
+
+  if(((uint64_t)freq<<res)*1024<=LEDC_CLK)
+    return(0);
+
+  return(res);
+}
+
+///////////////////
+
+int PwmPin::allocTimer(ledc_mode_t mode, uint32_t freq, uint8_t resolution){
+
+  int freeTimer=-1;
+
+  for(int i=0;i<NUM_TIMERS;i++){
+    pwmTimer_t *t=timers[mode]+i;
+    if(t->nUsers==0){
+      if(freeTimer<0)
+        freeTimer=i;
+    } else if(t->freq==freq && t->resolution==resolution){
+      return(i);
+    }
+  }
+
+  return(freeTimer);
+}
+
+///////////////////
+
+void PwmPin::gammaTable(uint16_t *lut, float gamma, uint32_t maxDuty){
+
+  for(int i=0;i<=100;i++)
+    lut[i]=lroundf(powf(i/100.0,gamma)*maxDuty);
+}
+
+///////////////////
+
+void PwmPin::setGamma(float gamma){
+
+  if(timer<0)
+    return;
+
+  if(gamma<=0)
+    gamma=1.0;
+
+  gammaTable(dutyLUT,gamma,(1<<resolution)-1);
+}
+
+///////////////////
+
 void PwmPin::set(uint8_t channel, uint8_t level){
-  ledChannel.duty=level*1023;
-  ledChannel.duty/=100;
-  ledChannel.duty&=0x03FF;
-  ledc_channel_config(&ledChannel);
-  
+
+  if(timer<0)
+    return;
+
+  if(level>100)
+    level=100;
+
+  portENTER_CRITICAL(&fadeMux);
+  fading=false;                                       // stop any fade in progress
+  setDuty(dutyLUT[level]);
+  portEXIT_CRITICAL(&fadeMux);
+
+  if(fadeTimer)
+    esp_timer_stop(fadeTimer);
+}
+
+///////////////////
+
+void PwmPin::setDuty(uint32_t duty){
+  ledChannel.duty=duty;
+  ledc_set_duty(ledChannel.speed_mode,ledChannel.channel,duty);
+  ledc_update_duty(ledChannel.speed_mode,ledChannel.channel);
+}
+
+///////////////////
+
+void PwmPin::fade(uint8_t level, uint32_t duration, uint8_t curve){
+
+  if(timer<0)
+    return;
+
+  if(!fadeTimer){
+    esp_timer_create_args_t args={fadeStep,this,ESP_TIMER_TASK,"PwmFade"};
+    esp_timer_create(&args,&fadeTimer);
+  }
+
+  if(level>100)
+    level=100;
+
+  portENTER_CRITICAL(&fadeMux);
+  fadeFrom=ledChannel.duty;                           // fade starts from current duty, even if in the middle of a prior fade
+  fadeTo=dutyLUT[level];
+  fadeStart=esp_timer_get_time();
+  fadeDuration=(int64_t)duration*1000;
+  fadeCurve=curve;
+  fading=(duration>0 && fadeFrom!=fadeTo);
+
+  if(fading)
+    esp_timer_start_once(fadeTimer,FADE_INTERVAL*1000);     // has no effect if timer is still armed from a prior fade
+  else
+    setDuty(fadeTo);
+  portEXIT_CRITICAL(&fadeMux);
+}
+
+///////////////////
+
+void PwmPin::fadeStep(void *arg){
+
+  PwmPin *pwm=(PwmPin *)arg;
+
+  // fading is checked, and the duty written, inside the critical section so that a set() or fade() made
+  // while this step was pending is never overwritten by a stale step
+
+  portENTER_CRITICAL(&pwm->fadeMux);
+
+  if(pwm->fading){
+    int64_t elapsed=esp_timer_get_time()-pwm->fadeStart;
+
+    if(elapsed>=pwm->fadeDuration){                   // fade complete - timer is not re-armed
+      pwm->fading=false;
+      pwm->setDuty(pwm->fadeTo);
+    } else {
+      float f=ease((float)elapsed/pwm->fadeDuration,pwm->fadeCurve);
+      pwm->setDuty(pwm->fadeFrom+lroundf(((int32_t)pwm->fadeTo-(int32_t)pwm->fadeFrom)*f));
+      esp_timer_start_once(pwm->fadeTimer,FADE_INTERVAL*1000);
+    }
+  }
+
+  portEXIT_CRITICAL(&pwm->fadeMux);
+}
+
+///////////////////
+
+float PwmPin::ease(float t, uint8_t curve){
+
+  if(t<=0)
+    return(0);
+  if(t>=1)
+    return(1);
+
+  switch(curve){
+    case EASE_IN:
+      return(t*t);
+    case EASE_OUT:
+      return(t*(2-t));
+    case EASE_IN_OUT:
+      return(t<0.5?4*t*t*t:1-4*(1-t)*(1-t)*(1-t));
+    default:
+      return(t);
+  }
 }
 
 ///////////////////
@@ -87,3 +323,45 @@ void PwmPin::HSVtoRGB(float h, float s, float v, float *r, float *g, float *b ){
       break;
   }
 }
+
+///////////////////
+
+void PwmPin::HSVtoRGB(uint16_t h, uint8_t s, uint8_t v, uint8_t *r, uint8_t *g, uint8_t *b){
+
+  // Fixed-point version of the algorithm above, suitable for converting many pixels per frame.
+  // S and V are scaled to 0-255 and the fractional part of h/60 is kept as a numerator over 60,
+  // so each of p, q, and t is computed with a single rounded integer division by a constant.
+
+  if(s>100)
+    s=100;
+  if(v>100)
+    v=100;
+
+  uint32_t V=(v*255+50)/100;
+  uint32_t S=(s*255+50)/100;
+
+  h%=360;
+  uint32_t i=h/60;
+  uint32_t f=h-i*60;
+
+  uint8_t p=(V*(255-S)+127)/255;
+  uint8_t q=(V*(15300-S*f)+7650)/15300;              // 15300 = 255*60
+  uint8_t t=(V*(15300-S*(60-f))+7650)/15300;
+
+  switch(i){
+    case 0: *r=V; *g=t; *b=p; break;
+    case 1: *r=q; *g=V; *b=p; break;
+    case 2: *r=p; *g=V; *b=t; break;
+    case 3: *r=p; *g=q; *b=V; break;
+    case 4: *r=t; *g=p; *b=V; break;
+    default: *r=V; *g=p; *b=q; break;
+  }
+}
+
+///////////////////
+
+void PwmPin::HSVtoRGB(const uint16_t *hsv, uint8_t *rgb, int n){
+
+  for(int i=0;i<n;i++,hsv+=3,rgb+=3)
+    HSVtoRGB(hsv[0],hsv[1],hsv[2],rgb,rgb+1,rgb+2);
+}
@@ -4,22 +4,82 @@
 /////////////////////////////////////
 
 // A wrapper around the ESP-IDF ledc library to easily set the brightness of an LED from 0-100%.
-// Can be used for any device requiring a PWM output (not just an LED).  Frequency of PWM
-// is hardcoded to 5000 Hz and either High-Speed Timer-0 (for channels 0-7) or Low-Speed Timer-0
-// for channels (8-15) is configured and selected automatically.
+// Can be used for any device requiring a PWM output (not just an LED).  Frequency (default 5000 Hz)
+// and duty resolution (default 10 bits, up to 16 bits) can be specified for each pin.  High-Speed
+// timers (for channels 0-7) or Low-Speed timers (for channels 8-15) are allocated automatically,
+// with pins requesting the same frequency and resolution sharing a timer.
+//
+// Levels are mapped to duty through a lookup table that can be gamma-corrected so that equal steps
+// in HomeKit Brightness appear as equal steps in perceived brightness.
+//
+// Levels can also be faded smoothly over a specified duration using one of several easing
+// curves.  Fades are driven by a timer in the background, so no calls from loop() are needed.
 
 #include <driver/ledc.h>
+#include <esp_timer.h>
 
 class PwmPin {
+
+  static const int NUM_TIMERS=4;                        // number of timers in each speed mode
+  static const uint32_t LEDC_CLK=80000000;              // frequency (in Hz) of clock driving timers (APB clock)
+  
+  struct pwmTimer_t {
+    uint32_t freq;                                      // frequency (in Hz) of timer
+    uint8_t resolution;                                 // duty resolution (in bits) of timer
+    uint8_t nUsers;                                     // number of channels using timer (0 if timer is free)
+  };
+
+  static pwmTimer_t timers[2][NUM_TIMERS];              // timers in High-Speed and Low-Speed modes
+
   uint8_t channel;
   uint8_t pin;
   ledc_channel_config_t ledChannel;
+  int timer=-1;                                         // timer used by channel (-1 if no timer could be allocated)
+  uint8_t resolution=0;                                 // duty resolution (in bits)
+  uint32_t freq=0;                                      // PWM frequency (in Hz)
+  uint16_t dutyLUT[101];                                // duty for each level (0-100)
+
+  esp_timer_handle_t fadeTimer=NULL;                    // one-shot timer that drives fades, re-armed by fadeStep() while fading (created on first call to fade())
+  portMUX_TYPE fadeMux=portMUX_INITIALIZER_UNLOCKED;    // protects fade state and duty, which are shared with fadeStep() in the esp_timer task
+  volatile boolean fading=false;                        // true if a fade is in progress
+  uint32_t fadeFrom;                                    // duty at start of fade
+  uint32_t fadeTo;                                      // duty at end of fade
+  int64_t fadeStart;                                    // time (in microseconds) fade started
+  int64_t fadeDuration;                                 // duration (in microseconds) of fade
+  uint8_t fadeCurve;                                    // easing curve of fade
+
+  static const int FADE_INTERVAL=10;                    // time (in milliseconds) between duty updates during a fade
+  
+  static void fadeStep(void *arg);                      // timer callback that updates duty during a fade
+  void setDuty(uint32_t duty);                          // sets duty without reconfiguring channel
 
   public:
-    PwmPin(uint8_t channel, uint8_t pin);               // assigns pin to be output of one of 16 PWM channels (0-15)
-    void set(uint8_t channel, uint8_t level);           // sets the PWM duty of channel to level (0-100)
+    enum {                                              // easing curves for fade()
+      LINEAR=0,
+      EASE_IN=1,                                        // starts slowly and ends quickly (quadratic)
+      EASE_OUT=2,                                       // starts quickly and ends slowly (quadratic)
+      EASE_IN_OUT=3                                     // starts and ends slowly (cubic)
+    };
+    
+    PwmPin(uint8_t channel, uint8_t pin, uint32_t freq=5000, uint8_t resolution=10);     // assigns pin to be output of one of 16 PWM channels (0-15), with PWM frequency freq (Hz) and duty resolution of 1-16 bits (0=highest possible for freq)
+    ~PwmPin();                                          // stops any fade and frees timer
+    PwmPin(const PwmPin &)=delete;                      // PwmPin owns its fade timer and holds a reference on its LEDC timer, so PwmPins are not copyable
+    PwmPin &operator=(const PwmPin &)=delete;
+    void set(uint8_t channel, uint8_t level);           // sets the PWM duty of channel to level (0-100), stopping any fade in progress
+    void fade(uint8_t level, uint32_t duration, uint8_t curve=LINEAR);     // fades the PWM duty from its current value to level (0-100) over duration milliseconds, following curve, and returns immediately
+    boolean isFading(){return(fading);}                 // returns true if a fade is in progress
+    void setGamma(float gamma);                         // maps levels to duty using gamma correction (1.0=linear, the default; 2.2 is typical for LEDs)
     int getPin(){return pin;}                           // returns the pin number
+    uint32_t getFreq(){return(freq);}                   // returns the PWM frequency (0 if pin could not be configured)
+    uint8_t getResolution(){return(resolution);}        // returns the duty resolution in bits (0 if pin could not be configured)
+
+    static float ease(float t, uint8_t curve);          // returns fraction (0-1) of a fade completed at fraction t (0-1) of its duration, following curve
+    static uint8_t solveResolution(uint32_t freq, uint8_t resolution);          // returns resolution (1-16 bits) that timers can support at freq, closest to requested resolution (0=highest possible), or 0 if freq cannot be generated
+    static int allocTimer(ledc_mode_t mode, uint32_t freq, uint8_t resolution);  // returns timer in mode already configured with freq and resolution, else first free timer, else -1 (does not reserve timer)
+    static void gammaTable(uint16_t *lut, float gamma, uint32_t maxDuty);       // fills lut[0-100] with duty for each level, where duty=maxDuty*(level/100)^gamma
     
     static void HSVtoRGB(float h, float s, float v, float *r, float *g, float *b );       // converts Hue/Saturation/Brightness to R/G/B
+    static void HSVtoRGB(uint16_t h, uint8_t s, uint8_t v, uint8_t *r, uint8_t *g, uint8_t *b);     // converts Hue (0-360)/Saturation (0-100)/Brightness (0-100) to R/G/B (0-255) using integer arithmetic only
+    static void HSVtoRGB(const uint16_t *hsv, uint8_t *rgb, int n);                         // converts n H/S/V triplets in hsv to n packed R/G/B triplets in rgb, using integer arithmetic only
 
 };
@@ -7,43 +7,272 @@
 
 ///////////////////
 
-RFControl::RFControl(int pin){
+RFControl::RFControl(int pin, int nBlocks){
   if(!configured){            // configure RMT peripheral
 
     DPORT_REG_SET_BIT(DPORT_PERIP_CLK_EN_REG,1<<9);           // enable RMT clock by setting bit 9
-    DPORT_REG_CLR_BIT(DPORT_PERIP_RST_EN_REG,1<<9);           // set RMT to normal ("un-reset") mode by clearing bit 9        
-    REG_SET_BIT(RMT_APB_CONF_REG,3);                          // enables access to RMT memory and enables wraparound mode (though the latter does not seem to be needed to set continuous TX)
-    REG_WRITE(RMT_INT_ENA_REG,1<<RMT_CH0_TX_END_INT_ENA_S);   // enable end-transmission interrupt so that interrupt vector is called
-    REG_WRITE(RMT_CH0CONF0_REG,0x08000000);                   // disable carrier wave; set channel 0 to use all 8 blocks of RMT memory       
-    esp_intr_alloc(ETS_RMT_INTR_SOURCE,0,eot_int,NULL,NULL);  // set RMT general interrupt vector
+    DPORT_REG_CLR_BIT(DPORT_PERIP_RST_EN_REG,1<<9);           // set RMT to normal ("un-reset") mode by clearing bit 9
+    REG_SET_BIT(RMT_APB_CONF_REG,3);                          // enables access to RMT memory and enables wraparound mode (needed so that pulse trains longer than RMT memory can be refilled on the fly)
+    esp_intr_alloc(ETS_RMT_INTR_SOURCE,0,eot_int,NULL,NULL);  // set RMT general interrupt vector (shared by all channels)
 
     configured=true;
   }
 
   this->pin=pin;
 
+  if(nBlocks<1 || nBlocks>NUM_CHANNELS){
+    Serial.print("\n*** ERROR: Request to create RF Control Module with nBlocks=");
+    Serial.print(nBlocks);
+    Serial.print(" is out of allowable range: 1-8\n\n");
+    return;
+  }
+
+  portENTER_CRITICAL(&mux);
+  channel=allocChannel(nBlocks);
+  if(channel>=0){
+    channels[channel]=this;
+    blocksUsed|=((1<<nBlocks)-1)<<channel;
+  }
+  portEXIT_CRITICAL(&mux);
+
+  if(channel<0){
+    Serial.print("\n*** ERROR: Can't create RF Control Module on pin ");
+    Serial.print(pin);
+    Serial.print(" - no RMT channel with ");
+    Serial.print(nBlocks);
+    Serial.print(" free block(s) of memory\n\n");
+    return;
+  }
+
+  this->nBlocks=nBlocks;
+  pRMT=(uint32_t *)RMT_CHANNEL_MEM(channel);
+  memWords=nBlocks*BLOCK_WORDS;
+
+  REG_WRITE(RMT_CHnCONF0_REG(channel),nBlocks<<24);                                          // disable carrier wave; set channel to use nBlocks blocks of RMT memory
+  REG_SET_FIELD(RMT_CH0_TX_LIM_REG+4*channel,RMT_TX_LIM_CH0,memWords/2);                     // raise threshold interrupt each time half of RMT memory has been transmitted
+  REG_SET_BIT(RMT_INT_ENA_REG,(1<<(RMT_CH0_TX_END_INT_ENA_S+3*channel))|(1<<(RMT_CH0_TX_THR_EVENT_INT_ENA_S+channel)));   // enable end-transmission and threshold interrupts for channel
+
   pinMode(pin,OUTPUT);
-  REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG+4*pin,87);                         // set GPIO OUTPUT of pin in GPIO_MATRIX to use RMT Channel-0 Output (=signal 87)
+  REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG+4*pin,87+channel);                 // set GPIO OUTPUT of pin in GPIO_MATRIX to use RMT Channel Output (=signal 87 for Channel-0 through 94 for Channel-7)
   REG_SET_FIELD(GPIO_FUNC0_OUT_SEL_CFG_REG+4*pin,GPIO_FUNC0_OEN_SEL,1);   // use GPIO_ENABLE_REG of pin (not RMT) to enable this channel
   REG_WRITE(GPIO_ENABLE_W1TC_REG,1<<pin);                                 // disable output on pin - enable only when started
-      
+
 }
- 
+
+///////////////////
+
+RFControl::~RFControl(){
+
+  if(channel<0)
+    return;
+
+  wait();
+
+  portENTER_CRITICAL(&mux);
+  REG_CLR_BIT(RMT_INT_ENA_REG,(1<<(RMT_CH0_TX_END_INT_ENA_S+3*channel))|(1<<(RMT_CH0_TX_THR_EVENT_INT_ENA_S+channel)));
+  channels[channel]=NULL;
+  blocksUsed&=~(((1<<nBlocks)-1)<<channel);
+  portEXIT_CRITICAL(&mux);
+}
+
+///////////////////
+
+int RFControl::allocChannel(int nBlocks){
+
+  uint8_t mask=(1<<nBlocks)-1;
+
+  for(int ch=0;ch+nBlocks<=NUM_CHANNELS;ch++){              // channel n can only use blocks n and above
+    if(!channels[ch] && !(blocksUsed&(mask<<ch)))
+      return(ch);
+  }
+
+  return(-1);
+}
+
 ///////////////////
 
 void RFControl::start(uint8_t _numCycles, uint8_t tickTime){
 
+  if(channel<0)
+    return;
+
+  int result;
+  while((result=queue(_numCycles,tickTime,NULL,NULL))==QUEUE_FULL)     // wait for room in queue
+    delay(1);
+
+  if(result==QUEUED)                                          // give up if pulse train could not be allocated (error message already printed)
+    wait();
+}
+
+///////////////////
+
+void RFControl::start(const RFCode &code){
+
+  if(channel<0)
+    return;
+
+  int result;
+  while((result=queue(code,NULL,NULL))==QUEUE_FULL)          // wait for room in queue
+    delay(1);
+
+  if(result==QUEUED)                                          // give up if pulse train could not be allocated (error message already printed)
+    wait();
+}
+
+///////////////////
+
+void RFControl::wait(){
+
+  uint32_t ticket=nQueued;
+  while((int32_t)(nSent-ticket)<0)                            // wait while transmission in progress, yielding so other tasks (and the idle task's watchdog) can run
+    delay(1);
+  reap();
+}
+
+///////////////////
+
+boolean RFControl::startAsync(uint8_t _numCycles, uint8_t tickTime, callback_t callback, void *arg){
+
+  return(queue(_numCycles,tickTime,callback,arg)==QUEUED);
+}
+
+///////////////////
+
+boolean RFControl::startAsync(const RFCode &code, callback_t callback, void *arg){
+
+  return(queue(code,callback,arg)==QUEUED);
+}
+
+///////////////////
+
+int RFControl::queue(uint8_t _numCycles, uint8_t tickTime, callback_t callback, void *arg){
+
+  if(_numCycles==0)                                           // nothing to transmit
+    return(QUEUED);
+
+  job_t *job;
+  int result=newJob(pCount/2+1,job);                          // number of words needed, including end-marker
+  if(result!=QUEUED)
+    return(result);
+
+  memcpy(job->data,train,(pCount/2)*sizeof(uint32_t));
   if(pCount%2==0)                                             // if next entry is lower 16 bits of 32-bit memory
-    pRMT[pCount/2]=0;                                         // set memory to zero (end-marker)
+    job->data[pCount/2]=0;                                    // set memory to zero (end-marker)
   else
-    pRMT[pCount/2]&=0xFFFF;                                   // else preserve lower 16 bits and zero our upper 16 bits
-  
+    job->data[pCount/2]=train[pCount/2]&0xFFFF;               // else preserve lower 16 bits and zero out upper 16 bits
+
+  queueJob(job,_numCycles,tickTime,callback,arg);
+  return(QUEUED);
+}
+
+///////////////////
+
+int RFControl::queue(const RFCode &code, callback_t callback, void *arg){
+
+  if(code.numCycles==0 || code.nRuns==0)                      // nothing to transmit
+    return(QUEUED);
+
+  job_t *job;
+  int result=newJob(code.nWords+1,job);                       // number of words needed, including end-marker
+  if(result!=QUEUED)
+    return(result);
+
+  code.expand(job->data);
+  queueJob(job,code.numCycles,code.tickTime,callback,arg);
+  return(QUEUED);
+}
+
+///////////////////
+
+int RFControl::newJob(int nWords, job_t *&job){
+
+  if(channel<0)                                               // no RMT channel
+    return(NO_CHANNEL);
+
+  reap();
+
+  if(nQueued-nFreed==QUEUE_SIZE)                              // no room in queue
+    return(QUEUE_FULL);
+
+  job=jobs+nQueued%QUEUE_SIZE;
+  job->nWords=nWords;
+  job->data=(uint32_t *)malloc(nWords*sizeof(uint32_t));
+  if(!job->data){
+    Serial.print("\n*** ERROR: Can't allocate memory for RF Control pulse train\n\n");
+    return(NO_MEMORY);
+  }
+
+  return(QUEUED);
+}
+
+///////////////////
+
+void RFControl::queueJob(job_t *job, uint8_t _numCycles, uint8_t tickTime, callback_t callback, void *arg){
+
+  job->numCycles=_numCycles;
+  job->tickTime=tickTime;
+  job->callback=callback;
+  job->arg=arg;
+
+  portENTER_CRITICAL(&mux);
+  nQueued++;
+  if(!active)
+    startNext();
+  portEXIT_CRITICAL(&mux);
+}
+
+///////////////////
+
+boolean RFControl::busy(){
+  return(nSent!=nQueued);
+}
+
+///////////////////
+
+void RFControl::startNext(){
+
+  if(nSent==nQueued){                                         // nothing left to transmit
+    active=false;
+    return;
+  }
+
+  job_t *job=jobs+nSent%QUEUE_SIZE;
+
+  active=true;
+  numCycles=job->numCycles;                                   // set number of cycles to repeat transmission
+  pos=0;
+  refillHalf=0;
+  fill(pRMT,memWords);                                        // load as much of pulse train as fits into RMT memory
+
   REG_WRITE(GPIO_ENABLE_W1TS_REG,1<<pin);                     // enable output on pin
-  numCycles=_numCycles;                                       // set number of cycles to repeat transmission
-  REG_SET_FIELD(RMT_CH0CONF0_REG,RMT_DIV_CNT_CH0,tickTime);   // set one tick = 1 microsecond * tickTime (RMT will be set to use 1 MHz REF_TICK, not 80 MHz APB_CLK)    
-  REG_WRITE(RMT_CH0CONF1_REG,0x0000000D);                     // use REF_TICK clock; reset xmit and receive memory address to start of channel; START TRANSMITTING!
-  while(numCycles);                                           // wait while transmission in progress
-  REG_WRITE(GPIO_ENABLE_W1TC_REG,1<<pin);                     // disable output on pin
+  REG_SET_FIELD(RMT_CHnCONF0_REG(channel),RMT_DIV_CNT_CH0,job->tickTime);   // set one tick = 1 microsecond * tickTime (RMT will be set to use 1 MHz REF_TICK, not 80 MHz APB_CLK)
+  REG_WRITE(RMT_CHnCONF1_REG(channel),0x0000000D);            // use REF_TICK clock; reset xmit and receive memory address to start of channel; START TRANSMITTING!
+}
+
+///////////////////
+
+void RFControl::fill(uint32_t *mem, int nWords){
+
+  job_t *job=jobs+nSent%QUEUE_SIZE;
+
+  int n=job->nWords-pos;                                      // number of words remaining in pulse train
+  if(n>nWords)
+    n=nWords;
+
+  for(int i=0;i<n;i++)
+    mem[i]=job->data[pos++];
+  for(int i=n;i<nWords;i++)                                   // pad with end-markers
+    mem[i]=0;
+}
+
+///////////////////
+
+void RFControl::reap(){
+
+  while(nFreed!=nSent){
+    free(jobs[nFreed%QUEUE_SIZE].data);
+    nFreed++;
+  }
 }
 
 ///////////////////
@@ -57,47 +286,227 @@ void RFControl::clear(){
 void RFControl::add(uint16_t onTime, uint16_t offTime){
 
   phase(onTime,HIGH);
-  phase(offTime,LOW);  
+  phase(offTime,LOW);
 }
 
 ///////////////////
 
 void RFControl::phase(uint16_t numTicks, uint8_t phase){
 
-  if(pCount==1023){                                            // maximum number of entries reached (saving one space for end-marker)
-    Serial.print("\n*** ERROR: Can't add more than 1023 entries to RF Control Module\n\n");
-  } else
-  
   if(numTicks>32767 || numTicks<1){
     Serial.print("\n*** ERROR: Request to add RF Control entry with numTicks=");
     Serial.print(numTicks);
     Serial.print(" is out of allowable range: 1-32767\n\n");
-  } else {
+    return;
+  }
 
-    int index=pCount/2;
-    
-    if(pCount%2==0)                                             
-      pRMT[index]=numTicks | (phase?(1<<15):0);                                // load entry into lower 16 bits of 32-bit memory           
-    else
-      pRMT[index]=pRMT[index] & 0xFFFF | (numTicks<<16) | (phase?(1<<31):0);   // load entry into upper 16 bits of 32-bit memory, preserving lower 16 bits
+  int index=pCount/2;
 
-    pCount++;
+  if(index==trainWords){                                      // pulse train buffer is full - double its size
+    uint32_t *p=(uint32_t *)realloc(train,(trainWords?trainWords*2:64)*sizeof(uint32_t));
+    if(!p){
+      Serial.print("\n*** ERROR: Can't allocate memory to add more entries to RF Control Module\n\n");
+      return;
+    }
+    train=p;
+    trainWords=trainWords?trainWords*2:64;
   }
 
+  if(pCount%2==0)
+    train[index]=numTicks | (phase?(1<<15):0);                                 // load entry into lower 16 bits of 32-bit memory
+  else
+    train[index]=train[index] & 0xFFFF | (numTicks<<16) | (phase?(1<<31):0);   // load entry into upper 16 bits of 32-bit memory, preserving lower 16 bits
+
+  pCount++;
 }
 
 ///////////////////
 
 void RFControl::eot_int(void *arg){
-  numCycles--;
-  REG_WRITE(RMT_INT_CLR_REG,~0);                      // interrupt MUST be cleared first; transmission re-started after (clearing after restart crestes havoc)
-  if(numCycles)
-    REG_WRITE(RMT_CH0CONF1_REG,0x0000000D);           // use REF_TICK clock; reset xmit and receive memory address to start of channel; re-start transmission
-}    
+
+  uint32_t status=REG_READ(RMT_INT_ST_REG);
+  REG_WRITE(RMT_INT_CLR_REG,status);                  // interrupt MUST be cleared first; transmission re-started after (clearing after restart crestes havoc)
+
+  callback_t callbacks[NUM_CHANNELS];
+  void *cbArgs[NUM_CHANNELS];
+  int nCallbacks=0;
+
+  portENTER_CRITICAL_ISR(&mux);
+
+  for(int ch=0;ch<NUM_CHANNELS;ch++){
+    RFControl *rf=channels[ch];
+    if(!rf || !rf->active)
+      continue;
+
+    if(status&(1<<(RMT_CH0_TX_THR_EVENT_INT_ST_S+ch))){       // half of RMT memory has been transmitted - refill it with next portion of pulse train
+      rf->fill(rf->pRMT+rf->refillHalf*rf->memWords/2,rf->memWords/2);
+      rf->refillHalf^=1;
+    }
+
+    if(status&(1<<(RMT_CH0_TX_END_INT_ST_S+3*ch))){           // end of pulse train
+      if(--rf->numCycles){
+        rf->pos=0;
+        rf->refillHalf=0;
+        rf->fill(rf->pRMT,rf->memWords);                      // reload start of pulse train (only needed if it does not fit into RMT memory, but harmless otherwise)
+        REG_WRITE(RMT_CHnCONF1_REG(ch),0x0000000D);           // use REF_TICK clock; reset xmit and receive memory address to start of channel; re-start transmission
+      } else {
+        job_t *job=rf->jobs+rf->nSent%QUEUE_SIZE;
+        REG_WRITE(GPIO_ENABLE_W1TC_REG,1<<rf->pin);           // disable output on pin
+        if(job->callback){
+          callbacks[nCallbacks]=job->callback;
+          cbArgs[nCallbacks++]=job->arg;
+        }
+        rf->nSent++;
+        rf->startNext();
+      }
+    }
+  }
+
+  portEXIT_CRITICAL_ISR(&mux);
+
+  for(int i=0;i<nCallbacks;i++)
+    callbacks[i](cbArgs[i]);
+}
+
+///////////////////
+
+RFCode::~RFCode(){
+  free(runs);
+}
+
+///////////////////
+
+void RFCode::clear(){
+  free(runs);
+  runs=NULL;
+  nRuns=0;
+  nWords=0;
+}
 
 ///////////////////
-    
+
+boolean RFCode::append(uint32_t pulse){
+
+  if(nRuns>0 && runs[nRuns-1].pulse==pulse && runs[nRuns-1].count<65535){     // extend last run
+    runs[nRuns-1].count++;
+    nWords++;
+    return(true);
+  }
+
+  run_t *p=(run_t *)realloc(runs,(nRuns+1)*sizeof(run_t));
+  if(!p){
+    Serial.print("\n*** ERROR: Can't allocate memory for RF Code\n\n");
+    return(false);
+  }
+
+  runs=p;
+  runs[nRuns].pulse=pulse;
+  runs[nRuns].count=1;
+  nRuns++;
+  nWords++;
+  return(true);
+}
+
+///////////////////
+
+boolean RFCode::appendPulse(uint32_t first, uint32_t second, boolean inverted){
+
+  if(first>32767 || first<1 || second>32767 || second<1){
+    Serial.print("\n*** ERROR: RF Code pulse duration is out of allowable range: 1-32767 ticks\n\n");
+    return(false);
+  }
+
+  if(inverted)
+    return(append(first | (second<<16) | (1<<31)));           // LOW phase in lower 16 bits, followed by HIGH phase in upper 16 bits
+
+  return(append(first | (1<<15) | (second<<16)));            // HIGH phase in lower 16 bits, followed by LOW phase in upper 16 bits
+}
+
+///////////////////
+
+void RFCode::expand(uint32_t *data) const {
+
+  for(int i=0;i<nRuns;i++)
+    for(int j=0;j<runs[i].count;j++)
+      *data++=runs[i].pulse;
+
+  *data=0;                                                    // end-marker
+}
+
+///////////////////
+
+boolean RFCode::capture(uint8_t _numCycles, uint8_t _tickTime){
+
+  clear();
+  numCycles=_numCycles;
+  tickTime=_tickTime;
+
+  int n=RFControl::pCount/2;
+  for(int i=0;i<n;i++)
+    if(!append(RFControl::train[i]))
+      return(false);
+
+  if(RFControl::pCount%2)                                     // odd number of phases - final word holds one phase and an end-marker
+    return(append(RFControl::train[n]&0xFFFF));
+
+  return(true);
+}
+
+///////////////////
+
+boolean RFCode::encode(const RFProtocol &protocol, uint64_t code, int nBits, uint8_t _numCycles){
+
+  clear();
+  numCycles=_numCycles;
+  tickTime=1;
+
+  uint32_t t=protocol.pulseLength;
+
+  for(int i=nBits-1;i>=0;i--){
+    const uint8_t *bit=(code>>i)&1?protocol.one:protocol.zero;
+    if(!appendPulse(bit[0]*t,bit[1]*t,protocol.inverted))
+      return(false);
+  }
+
+  return(appendPulse(protocol.sync[0]*t,protocol.sync[1]*t,protocol.inverted));
+}
+
+///////////////////
+
+boolean RFCode::encode(int protocolNum, uint64_t code, int nBits, uint8_t _numCycles){
+
+  if(protocolNum<1 || protocolNum>RFProtocolCount){
+    Serial.print("\n*** ERROR: RF Protocol number ");
+    Serial.print(protocolNum);
+    Serial.print(" is out of allowable range: 1-");
+    Serial.print(RFProtocolCount);
+    Serial.print("\n\n");
+    return(false);
+  }
+
+  return(encode(RFProtocols[protocolNum-1],code,nBits,_numCycles));
+}
+
+///////////////////
+
+const RFProtocol RFProtocols[]={
+//  pulse   sync      zero     one     inverted
+  { 350,  {  1, 31 }, { 1, 3 }, { 3, 1 }, false },     // 1: PT2262, EV1527, and most generic 433 MHz remotes
+  { 650,  {  1, 10 }, { 1, 2 }, { 2, 1 }, false },     // 2
+  { 100,  { 30, 71 }, { 4,11 }, { 9, 6 }, false },     // 3
+  { 380,  {  1,  6 }, { 1, 3 }, { 3, 1 }, false },     // 4
+  { 500,  {  6, 14 }, { 1, 2 }, { 2, 1 }, false },     // 5
+  { 450,  { 23,  1 }, { 1, 2 }, { 2, 1 }, true  }      // 6: HT6P20B
+};
+
+const int RFProtocolCount=sizeof(RFProtocols)/sizeof(RFProtocol);
+
+///////////////////
+
 boolean RFControl::configured=false;
-volatile int RFControl::numCycles;
-uint32_t *RFControl::pRMT=(uint32_t *)RMT_CHANNEL_MEM(0);
+RFControl *RFControl::channels[NUM_CHANNELS]={NULL};
+uint8_t RFControl::blocksUsed=0;
+uint32_t *RFControl::train=NULL;
+int RFControl::trainWords=0;
 int RFControl::pCount=0;
+portMUX_TYPE RFControl::mux=portMUX_INITIALIZER_UNLOCKED;
@@ -3,21 +3,143 @@
 //       RF Control Module        //
 ////////////////////////////////////
 
+#include <atomic>
+
+class RFCode;
+
 class RFControl {
+  public:
+    typedef void (*callback_t)(void *arg);                  // function called (from interrupt context) when a transmission completes
+
+  friend class RFCode;
+
   private:
+    static const int NUM_CHANNELS=8;                        // number of RMT channels
+    static const int BLOCK_WORDS=64;                        // number of 32-bit words in each of the 8 blocks of RMT memory
+    static const int QUEUE_SIZE=8;                          // maximum number of pulse trains that can be waiting to be transmitted on each channel
+
+    struct job_t {
+      uint32_t *data;                                       // pulse train, two 16-bit RMT entries per word, terminated by an end-marker
+      int nWords;                                           // number of words in data, including end-marker
+      uint8_t numCycles;                                    // number of times to transmit pulse train
+      uint8_t tickTime;                                     // duration of each tick, in microseconds
+      callback_t callback;                                  // optional function called when transmission completes
+      void *arg;                                            // argument passed to callback
+    };
+
     int pin;
-    static volatile int numCycles;
+    int channel=-1;                                         // RMT channel (-1 if no channel could be allocated)
+    int nBlocks;                                            // number of blocks of RMT memory used by channel
+    uint32_t *pRMT;                                         // RMT channel memory
+    int memWords;                                           // number of 32-bit words in RMT channel memory (refilled in two halves, ping-pong, for pulse trains that do not fit)
+
+    job_t jobs[QUEUE_SIZE];                                 // ring of pulse trains waiting to be, or being, transmitted
+    volatile uint32_t nQueued=0;                            // running count of pulse trains added to ring
+    std::atomic<uint32_t> nSent{0};                         // running count of pulse trains that have completed transmission (incremented by interrupt, after which the data of the pulse train may be freed)
+    uint32_t nFreed=0;                                      // running count of completed pulse trains whose data has been freed
+    volatile boolean active=false;                          // true if a pulse train is being transmitted
+    volatile int numCycles;                                 // number of cycles remaining for pulse train being transmitted
+    int pos;                                                // index of next word of pulse train to load into RMT memory
+    int refillHalf;                                         // half of RMT memory (0 or 1) to refill on next threshold interrupt
+
     static boolean configured;
-    static uint32_t *pRMT;
-    static int pCount;
-    static void eot_int(void *arg);                         
+    static RFControl *channels[NUM_CHANNELS];               // RFControl using each channel, or NULL if channel is free
+    static uint8_t blocksUsed;                              // bitmask of RMT memory blocks in use
+    static uint32_t *train;                                 // pulse train being built with add() and phase()
+    static int trainWords;                                  // number of words allocated for train
+    static int pCount;                                      // number of 16-bit entries in train
+    static portMUX_TYPE mux;                                // protects channel allocation, rings, and transmission state shared with interrupt
+
+    static void eot_int(void *arg);
+    static int allocChannel(int nBlocks);                   // returns lowest channel for which nBlocks of contiguous RMT memory starting at that channel's own block are free, or -1 if none
+    void startNext();                                       // starts transmission of next pulse train in ring, if any (call with mux held)
+    void fill(uint32_t *mem, int nWords);                   // copies next nWords of current pulse train into mem, padding with end-markers once pulse train is exhausted
+    void reap();                                            // frees data of pulse trains that have completed transmission
+    void wait();                                            // waits for all queued transmissions to complete
+    enum {                                                  // result of trying to queue a pulse train
+      QUEUED=0,                                             // pulse train was queued (or there was nothing to transmit)
+      QUEUE_FULL=1,                                         // no room in queue - may succeed once a queued pulse train completes
+      NO_MEMORY=2,                                          // pulse train data could not be allocated
+      NO_CHANNEL=3                                          // transmitter has no RMT channel
+    };
 
-  public:    
-    RFControl(int pin);                                     // creates transmitter on pin
+    int newJob(int nWords, job_t *&job);                    // reserves next job in ring with room for nWords of pulse train data; returns QUEUED (job is set), QUEUE_FULL, NO_MEMORY, or NO_CHANNEL
+    void queueJob(job_t *job, uint8_t _numCycles, uint8_t tickTime, callback_t callback, void *arg);     // completes job and adds it to the ring for transmission
+    int queue(uint8_t _numCycles, uint8_t tickTime, callback_t callback, void *arg);       // queues copy of pulse train memory buffer; returns result as above
+    int queue(const RFCode &code, callback_t callback, void *arg);                          // queues pre-compiled pulse train; returns result as above
+
+  public:
+    RFControl(int pin, int nBlocks=1);                      // creates transmitter on pin, using the next free RMT channel with nBlocks (1-8) of RMT memory
+    ~RFControl();                                           // waits for any queued transmissions to complete and frees RMT channel
+    RFControl(const RFControl &)=delete;                    // transmitter owns an RMT channel and a ring of queued pulse trains, and cannot be copied
+    RFControl &operator=(const RFControl &)=delete;
     static void clear();                                    // clears transmitter memory
     static void add(uint16_t onTime, uint16_t offTime);     // adds pulse of onTime ticks HIGH followed by offTime ticks LOW
     static void phase(uint16_t numTicks, uint8_t phase);    // adds either a HIGH phase or LOW phase lasting numTicks ticks
-    void start(uint8_t _numCycles, uint8_t tickTime=1);     // starts transmission of pulses, repeated for numCycles, where each tick in pulse is tickTime microseconds long
+    void start(uint8_t _numCycles, uint8_t tickTime=1);     // starts transmission of pulses, repeated for numCycles, where each tick in pulse is tickTime microseconds long, and waits for transmission to complete (gives up if memory cannot be allocated)
+    boolean startAsync(uint8_t _numCycles, uint8_t tickTime=1, callback_t callback=NULL, void *arg=NULL);    // queues transmission of pulses and returns immediately; returns false if queue is full or memory cannot be allocated
+    void start(const RFCode &code);                         // starts transmission of a pre-compiled pulse train and waits for transmission to complete (gives up if memory cannot be allocated)
+    boolean startAsync(const RFCode &code, callback_t callback=NULL, void *arg=NULL);      // queues transmission of a pre-compiled pulse train and returns immediately; returns false if queue is full or memory cannot be allocated
+    boolean busy();                                         // returns true if any transmission is in progress or queued on this transmitter
+    int getChannel(){return(channel);}                      // returns RMT channel used by this transmitter (-1 if none could be allocated)
+};
+
+////////////////////////////////////
+//      RF Protocol Timings       //
+////////////////////////////////////
+
+// Timings of a fixed-code protocol in which each bit is a single HIGH/LOW pulse, followed by a sync pulse.
+// Durations are in multiples of pulseLength microseconds.  If inverted, each pulse is LOW then HIGH (for the same
+// durations), as in the rc-switch library these timings come from.
+
+struct RFProtocol {
+  uint16_t pulseLength;           // base pulse length, in microseconds
+  uint8_t sync[2];                // durations of first and second phases of sync pulse
+  uint8_t zero[2];                // durations of first and second phases of a 0 bit
+  uint8_t one[2];                 // durations of first and second phases of a 1 bit
+  boolean inverted;               // true if each pulse starts with LOW
+};
+
+extern const RFProtocol RFProtocols[];      // common 433 MHz fixed-code protocols (PT2262, EV1527, HT6P20B, etc.), numbered 1-6
+extern const int RFProtocolCount;
+
+////////////////////////////////////
+//       Pre-Compiled RF Code     //
+////////////////////////////////////
+
+// Stores a pulse train as runs of identical HIGH/LOW pulses, together with the number of cycles
+// and tick duration to use when transmitting.  Codes are compiled once and can be transmitted
+// any number of times with RFControl::start(code) or RFControl::startAsync(code).
+
+class RFCode {
+  friend class RFControl;
+
+  struct run_t {
+    uint32_t pulse;               // pair of 16-bit RMT entries
+    uint16_t count;               // number of times pulse is repeated
+  };
+
+  run_t *runs=NULL;               // run-length encoded pulse train
+  int nRuns=0;                    // number of runs
+  int nWords=0;                   // number of 32-bit words in expanded pulse train (excluding end-marker)
+  uint8_t numCycles=1;            // number of times to transmit pulse train
+  uint8_t tickTime=1;             // duration of each tick, in microseconds
+
+  boolean append(uint32_t pulse);               // appends pulse, extending last run if identical
+  boolean appendPulse(uint32_t first, uint32_t second, boolean inverted);  // appends a pulse that is HIGH for 'first' ticks then LOW for 'second' ticks (LOW then HIGH if inverted), after checking range
+  void expand(uint32_t *data) const;            // writes expanded pulse train, followed by an end-marker, into data
+
+  public:
+    RFCode(){}
+    ~RFCode();
+    RFCode(const RFCode &)=delete;
+    RFCode &operator=(const RFCode &)=delete;
+    
+    void clear();                                                                               // clears code
+    boolean capture(uint8_t _numCycles, uint8_t _tickTime=1);                                   // compiles pulse train currently built with RFControl::add() and RFControl::phase()
+    boolean encode(const RFProtocol &protocol, uint64_t code, int nBits, uint8_t _numCycles=10);   // compiles nBits of code, MSB first, using protocol timings (tick=1 microsecond)
+    boolean encode(int protocolNum, uint64_t code, int nBits, uint8_t _numCycles=10);             // compiles nBits of code using protocol number protocolNum (1-6) from RFProtocols[]
+    int size(){return(nRuns*sizeof(run_t));}                                                    // returns number of bytes used to store code
 };
 
-   
+